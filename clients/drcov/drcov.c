@@ -42,6 +42,9 @@
  * The runtime options for this client include:
  * -dump_text         Dumps the log file in text format
  * -dump_binary       Dumps the log file in binary format
+ * -bitmap            Records coverage in a bitmap per module, without duplicates
+ * -hit_counts        Implies -bitmap and also counts executions of each bb
+ * -max_hit_counts <n> Sets the maximum number of distinct bbs counted.
  * -[no_]nudge_kills  On by default.
  *                    Uses nudge to notify a child process being terminated
  *                    by its parent, so that the exit event will be called.
@@ -132,6 +135,18 @@ options_init(client_id_t id, int argc, const char *argv[], drcovlib_options_t *o
             ops->flags |= DRCOVLIB_DUMP_AS_TEXT;
         else if (strcmp(token, "-dump_binary") == 0)
             ops->flags &= ~DRCOVLIB_DUMP_AS_TEXT;
+        else if (strcmp(token, "-bitmap") == 0)
+            ops->flags |= DRCOVLIB_DEDUP_BITMAP;
+        else if (strcmp(token, "-hit_counts") == 0)
+            ops->flags |= DRCOVLIB_HIT_COUNTS;
+        else if (strcmp(token, "-max_hit_counts") == 0) {
+            USAGE_CHECK((i + 1) < argc, "missing -max_hit_counts number");
+            token = argv[++i];
+            if (dr_sscanf(token, "%u", &ops->max_hit_counts) != 1) {
+                ops->max_hit_counts = 0;
+                USAGE_CHECK(false, "invalid -max_hit_counts number");
+            }
+        }
         else if (strcmp(token, "-no_nudge_kills") == 0)
             nudge_kills = false;
         else if (strcmp(token, "-nudge_kills") == 0)
@@ -162,7 +177,9 @@ options_init(client_id_t id, int argc, const char *argv[], drcovlib_options_t *o
             USAGE_CHECK(false, "invalid option");
         }
     }
-    if (dr_using_all_private_caches())
+    /* The bitmap is shared by all threads so it is always dumped per process */
+    if (dr_using_all_private_caches() &&
+        !TESTANY(DRCOVLIB_DEDUP_BITMAP|DRCOVLIB_HIT_COUNTS, ops->flags))
         ops->flags |= DRCOVLIB_THREAD_PRIVATE;
 }
 
@@ -58,9 +58,11 @@
 #ifdef UNIX
 # include <dirent.h> /* opendir, readdir */
 # include <unistd.h> /* getcwd */
+# include <pthread.h>
 #else
 # include <windows.h>
 # include <direct.h> /* _getcwd */
+# include <process.h> /* _beginthreadex */
 # pragma comment(lib, "User32.lib")
 #endif
 
@@ -160,7 +162,25 @@ static droption_t<std::string> op_reduce_set
 (DROPTION_SCOPE_FRONTEND, "reduce_set", "", "Output minimal inputs with same coverage",
  "Results in drcov2lcov identifying a smaller set of log files from the inputs that "
  "have the same code coverage as the full set.  The smaller set's file paths are "
- "written to the given output file path.");
+ "written to the given output file path.  The set is chosen by a greedy set cover "
+ "that repeatedly picks the file adding the most new coverage, and does not depend "
+ "on -jobs.  With -test_pattern, which must process the files in order, a file is "
+ "instead selected if it adds coverage to the files before it.");
+
+static droption_t<unsigned int> op_jobs
+(DROPTION_SCOPE_FRONTEND, "jobs", 1, 1, 256, "Number of worker threads",
+ "Specifies the number of threads used to read the input log files.  Each thread "
+ "accumulates coverage into its own per-module bitmaps, which are merged once all "
+ "files have been read.  With -reduce_set, the set cover is also computed in "
+ "parallel.  This option is ignored with -test_pattern, which must process the "
+ "files in order.");
+
+static droption_t<std::string> op_cache_dir
+(DROPTION_SCOPE_FRONTEND, "cache_dir", "", "Directory for persistent line tables",
+ "Specifies a directory in which to keep each module's sorted symbol and line "
+ "tables, named by the module's build id.  Later runs on the same modules read "
+ "the tables from there instead of parsing the debug information.  Currently "
+ "only supported for ELF modules.");
 
 static droption_t<twostring_t> op_pathmap
 (DROPTION_SCOPE_FRONTEND, "pathmap", 0, twostring_t("",""), "Map library to local path",
@@ -532,6 +552,7 @@ enum {
 
 typedef struct _module_table_t {
     size_t size;
+    uint id;                 /* dense index used by the -jobs worker bitmaps */
     union {
         byte *bitmap;        /* store exec info (bit) for each app byte */
         const char **array;  /* store test info (char *) for each app byte */
@@ -539,6 +560,167 @@ typedef struct _module_table_t {
     hashtable_t test_htable; /* hashtable for test functions found in the module */
 } module_table_t;
 
+/* Parallel ingestion (-jobs):
+ * - Module tables are still created in the shared module_htable, under
+ *   module_lock, but each worker sets bits in its own copy of every module
+ *   bitmap, so the hot bb loop needs no synchronization.
+ * - Once all files are read the worker copies are or-ed into the shared
+ *   bitmaps a word at a time.
+ * - For -reduce_set, each file's coverage is additionally kept as a sorted
+ *   list of non-zero bitmap words, which is the input to the set cover.
+ */
+typedef struct _cov_word_t {
+    uint mod_id;
+    uint index;              /* word index within the module bitmap */
+    ptr_uint_t bits;
+} cov_word_t;
+
+typedef struct _cov_file_t {
+    char *path;
+    cov_word_t *words;
+    uint num_words;
+    uint gain;               /* number of not-yet-covered bits */
+    uint order;              /* rank by path, to break ties */
+} cov_file_t;
+
+typedef struct _worker_data_t worker_data_t;
+struct _worker_data_t {
+    void (*func)(worker_data_t *);
+#ifdef UNIX
+    pthread_t thread;
+#else
+    HANDLE thread;
+#endif
+    byte **bitmaps;          /* indexed by module_table_t.id */
+    uint num_bitmaps;
+    cov_word_t *words;       /* bits of the current file, for -reduce_set */
+    uint num_words;
+    uint words_capacity;
+    cov_file_t *files;       /* per-file coverage, for -reduce_set */
+    uint num_files;
+    uint files_capacity;
+};
+
+static void *module_lock;    /* guards module_htable while workers run */
+static uint num_module_ids;
+
+static byte *
+worker_bitmap(worker_data_t *worker, module_table_t *table)
+{
+    if (worker == NULL)
+        return table->bb_table.bitmap;
+    if (table->id >= worker->num_bitmaps) {
+        uint old = worker->num_bitmaps;
+        /* ids are only handed out under module_lock, so read it under it too */
+        dr_mutex_lock(module_lock);
+        worker->num_bitmaps = num_module_ids;
+        dr_mutex_unlock(module_lock);
+        ASSERT(table->id < worker->num_bitmaps, "Invalid module id");
+        worker->bitmaps = (byte **)
+            realloc(worker->bitmaps, worker->num_bitmaps * sizeof(worker->bitmaps[0]));
+        ASSERT(worker->bitmaps != NULL, "Failed to grow worker bitmaps");
+        memset(worker->bitmaps + old, 0,
+               (worker->num_bitmaps - old) * sizeof(worker->bitmaps[0]));
+    }
+    if (worker->bitmaps[table->id] == NULL) {
+        worker->bitmaps[table->id] = (byte *) calloc(1, table->size/BITS_PER_BYTE);
+        ASSERT(worker->bitmaps[table->id] != NULL, "Failed to create worker bitmap");
+    }
+    return worker->bitmaps[table->id];
+}
+
+/* records one byte of the current file's bitmap for -reduce_set */
+static void
+worker_record_bits(worker_data_t *worker, uint mod_id, uint byte_idx, byte bits)
+{
+    uint index = byte_idx / sizeof(ptr_uint_t);
+    ptr_uint_t word_bits = (ptr_uint_t)bits << (BITS_PER_BYTE *
+                                                (byte_idx % sizeof(ptr_uint_t)));
+    cov_word_t *last;
+    if (bits == 0)
+        return;
+    last = worker->num_words == 0 ? NULL : &worker->words[worker->num_words - 1];
+    if (last != NULL && last->mod_id == mod_id && last->index == index) {
+        last->bits |= word_bits;
+        return;
+    }
+    if (worker->num_words == worker->words_capacity) {
+        worker->words_capacity = worker->words_capacity == 0 ? 1024 :
+            worker->words_capacity * 2;
+        worker->words = (cov_word_t *)
+            realloc(worker->words, worker->words_capacity * sizeof(worker->words[0]));
+        ASSERT(worker->words != NULL, "Failed to grow file coverage");
+    }
+    worker->words[worker->num_words].mod_id = mod_id;
+    worker->words[worker->num_words].index = index;
+    worker->words[worker->num_words].bits = word_bits;
+    worker->num_words++;
+}
+
+static void
+worker_record_bb(worker_data_t *worker, module_table_t *table, bb_entry_t *entry)
+{
+    uint idx, offs, addr_end, idx_end, offs_end, i;
+    if (worker == NULL || set_log == INVALID_FILE)
+        return;
+    idx = BITMAP_INDEX(entry->start);
+    offs = BITMAP_OFFSET(entry->start);
+    addr_end = entry->start + entry->size - 1;
+    idx_end  = BITMAP_INDEX(addr_end);
+    offs_end = (idx_end > idx) ? BITS_PER_BYTE-1 : BITMAP_OFFSET(addr_end);
+    worker_record_bits(worker, table->id, idx, bitmap_set[offs][offs_end]);
+    for (i = idx + 1; i < idx_end; i++)
+        worker_record_bits(worker, table->id, i, BB_TABLE_RANGE_SET);
+    offs_end = BITMAP_OFFSET(addr_end);
+    if (idx_end > idx)
+        worker_record_bits(worker, table->id, idx_end, bitmap_set[0][offs_end]);
+}
+
+static int
+compare_cov_word(const void *a_in, const void *b_in)
+{
+    const cov_word_t *w1 = (const cov_word_t *)a_in;
+    const cov_word_t *w2 = (const cov_word_t *)b_in;
+    if (w1->mod_id != w2->mod_id)
+        return w1->mod_id < w2->mod_id ? -1 : 1;
+    if (w1->index != w2->index)
+        return w1->index < w2->index ? -1 : 1;
+    return 0;
+}
+
+/* moves the words recorded for the file just read into its cov_file_t */
+static void
+worker_file_done(worker_data_t *worker, const char *path)
+{
+    cov_file_t *file;
+    uint i, num_words = 0;
+    qsort(worker->words, worker->num_words, sizeof(worker->words[0]), compare_cov_word);
+    for (i = 0; i < worker->num_words; i++) {
+        if (num_words > 0 &&
+            compare_cov_word(&worker->words[num_words - 1], &worker->words[i]) == 0)
+            worker->words[num_words - 1].bits |= worker->words[i].bits;
+        else
+            worker->words[num_words++] = worker->words[i];
+    }
+    worker->num_words = 0;
+    if (worker->num_files == worker->files_capacity) {
+        worker->files_capacity = worker->files_capacity == 0 ? 64 :
+            worker->files_capacity * 2;
+        worker->files = (cov_file_t *)
+            realloc(worker->files, worker->files_capacity * sizeof(worker->files[0]));
+        ASSERT(worker->files != NULL, "Failed to grow file list");
+    }
+    file = &worker->files[worker->num_files++];
+    file->path = (char *) malloc(strlen(path) + 1);
+    ASSERT(file->path != NULL, "Failed to alloc path");
+    strncpy(file->path, path, strlen(path) + 1);
+    file->words = (cov_word_t *) malloc(num_words * sizeof(file->words[0]));
+    ASSERT(num_words == 0 || file->words != NULL, "Failed to alloc file coverage");
+    memcpy(file->words, worker->words, num_words * sizeof(file->words[0]));
+    file->num_words = num_words;
+    file->gain = 0;
+}
+
 static void
 module_table_delete(void *p)
 {
@@ -564,10 +746,9 @@ bb_bitmap_lookup(module_table_t *table, uint addr)
 
 /* add an entry into a bitmap bb_table */
 static inline bool
-bb_bitmap_add(module_table_t *table, bb_entry_t *entry)
+bb_bitmap_add(byte *bm, bb_entry_t *entry)
 {
     uint idx, offs, addr_end, idx_end, offs_end, i;
-    byte *bm = table->bb_table.bitmap;
     idx = BITMAP_INDEX(entry->start);
     /* we assume that the whole bb is seen if its start addr is seen */
     if (bm[idx] == BB_TABLE_RANGE_SET)
@@ -576,10 +757,10 @@ bb_bitmap_add(module_table_t *table, bb_entry_t *entry)
     if (TEST(BITMAP_MASK(offs), bm[idx]))
         return false;
     /* now we add a new bb */
-    PRINT(6, "Add " PFX"-" PFX" in table " PFX"\n",
+    PRINT(6, "Add " PFX"-" PFX" in bitmap " PFX"\n",
           (ptr_uint_t)entry->start,
           (ptr_uint_t)entry->start + entry->size,
-          (ptr_uint_t)table);
+          (ptr_uint_t)bm);
     addr_end = entry->start + entry->size - 1;
     idx_end  = BITMAP_INDEX(addr_end);
     offs_end = (idx_end > idx) ? BITS_PER_BYTE-1 : BITMAP_OFFSET(addr_end);
@@ -653,7 +834,7 @@ module_table_bb_lookup(module_table_t *table, uint addr, const char **info)
 }
 
 static inline bool
-module_table_bb_add(module_table_t *table, bb_entry_t *entry)
+module_table_bb_add(module_table_t *table, bb_entry_t *entry, worker_data_t *worker)
 {
     if (table == MODULE_TABLE_IGNORE)
         return false;
@@ -665,8 +846,8 @@ module_table_bb_add(module_table_t *table, bb_entry_t *entry)
     }
     if (op_test_pattern.specified())
         return bb_array_add(table, entry);
-    else
-        return bb_bitmap_add(table, entry);
+    worker_record_bb(worker, table, entry);
+    return bb_bitmap_add(worker_bitmap(worker, table), entry);
 }
 
 static bool
@@ -719,6 +900,7 @@ module_table_create(const char *module, size_t size)
     table = (module_table_t *) calloc(1, sizeof(*table));
     ASSERT(table != NULL, "Failed to allocate module table");
     table->size = (size_t)size;
+    table->id = num_module_ids++;
     PRINT(3, "module table %p, %u\n", table, (uint)size);
     if (op_test_pattern.specified()) {
         /* i#1465: add unittest case coverage information in drcov.
@@ -826,7 +1008,8 @@ read_module_list(char *buf, module_table_t ***tables, uint *num_mods)
 }
 
 static bool
-read_bb_list(char *buf, module_table_t **tables, uint num_mods, uint num_bbs)
+read_bb_list(char *buf, module_table_t **tables, uint num_mods, uint num_bbs,
+             worker_data_t *worker)
 {
     uint i;
     bb_entry_t *entry;
@@ -844,7 +1027,61 @@ read_bb_list(char *buf, module_table_t **tables, uint num_mods, uint num_bbs)
               (ptr_uint_t)entry->start, entry->size, entry->mod_id);
         /* we could have mod id USHRT_MAX for unknown module e.g., [vdso] */
         if (entry->mod_id < num_mods)
-            add_new_bb = module_table_bb_add(tables[entry->mod_id], entry) || add_new_bb;
+            add_new_bb = module_table_bb_add(tables[entry->mod_id], entry, worker) ||
+                add_new_bb;
+    }
+    free(tables);
+    return add_new_bb;
+}
+
+/* Merges the per-module bitmaps written with DRCOVLIB_DEDUP_BITMAP, which use the
+ * same layout as our own bitmaps and so can simply be or-ed in.
+ */
+static bool
+read_bb_bitmaps(char *buf, char *buf_end, module_table_t **tables, uint num_mods,
+                uint num_bitmaps, worker_data_t *worker)
+{
+    uint i, j;
+    byte *bm;
+    bool add_new_bb = false;
+
+    PRINT(4, "Reading %u module bitmaps\n", num_bitmaps);
+    for (i = 0; i < num_bitmaps; i++) {
+        bb_bitmap_header_t header;
+        module_table_t *table;
+        if (buf + sizeof(header) > buf_end)
+            break;
+        memcpy(&header, buf, sizeof(header));
+        buf += sizeof(header);
+        if (header.size > (size_t)(buf_end - buf)) {
+            WARN(1, "Truncated bitmap for module %u\n", header.mod_id);
+            break;
+        }
+        table = header.mod_id < num_mods ? tables[header.mod_id] :
+            (module_table_t *)MODULE_TABLE_IGNORE;
+        if (table == MODULE_TABLE_IGNORE) {
+            buf += header.size;
+            continue;
+        }
+        if (op_test_pattern.specified()) {
+            /* XXX: the bitmap does not record bb boundaries, which we need to
+             * find the starts of test functions.
+             */
+            WARN(1, "-test_pattern is not supported for bitmap logs\n");
+            buf += header.size;
+            continue;
+        }
+        bm = worker_bitmap(worker, table);
+        for (j = 0; j < header.size && j < BITMAP_INDEX(table->size - 1) + 1; j++) {
+            byte bits = (byte)buf[j];
+            if (worker != NULL && set_log != INVALID_FILE)
+                worker_record_bits(worker, table->id, j, bits);
+            if ((bm[j] | bits) != bm[j]) {
+                bm[j] |= bits;
+                add_new_bb = true;
+            }
+        }
+        buf += header.size;
     }
     free(tables);
     return add_new_bb;
@@ -935,14 +1172,26 @@ close_input_file(file_t f, char *map, size_t map_size)
     dr_close_file(f);
 }
 
+static void
+read_drcov_file_done(const char *input, bool add_new_bb, worker_data_t *worker)
+{
+    if (set_log == INVALID_FILE)
+        return;
+    if (worker != NULL)
+        worker_file_done(worker, input);
+    else if (add_new_bb)
+        dr_fprintf(set_log, "%s\n", input);
+}
+
+/* worker is NULL when reading serially into the shared module tables */
 static bool
-read_drcov_file(char *input)
+read_drcov_file(const char *input, worker_data_t *worker)
 {
     file_t log;
     char  *map, *ptr;
     size_t map_size;
     module_table_t **tables;
-    uint   num_mods, num_bbs;
+    uint   num_mods, num_bbs, num_bitmaps;
     bool   res;
 
     PRINT(2, "Reading drcov log file: %s\n", input);
@@ -957,10 +1206,22 @@ read_drcov_file(char *input)
         return false;
     }
 
+    if (worker != NULL)
+        dr_mutex_lock(module_lock);
     ptr = read_module_list(ptr, &tables, &num_mods);
+    if (worker != NULL)
+        dr_mutex_unlock(module_lock);
     if (ptr == NULL)
         return false;
 
+    if (dr_sscanf(ptr, "BB Bitmap: %u modules\n", &num_bitmaps) == 1) {
+        ptr = move_to_next_line(ptr);
+        res = read_bb_bitmaps(ptr, map + map_size, tables, num_mods, num_bitmaps,
+                              worker);
+        read_drcov_file_done(input, res, worker);
+        close_input_file(log, map, map_size);
+        return true;
+    }
     if (dr_sscanf(ptr, "BB Table: %u bbs\n", &num_bbs) != 1) {
         WARN(1, "Failed to read bb list from %s\n", input);
         return false;
@@ -971,13 +1232,45 @@ read_drcov_file(char *input)
         close_input_file(log, map, map_size);
         return false;
     }
-    res = read_bb_list(ptr, tables, num_mods, num_bbs);
-    if (res && set_log != INVALID_FILE)
-        dr_fprintf(set_log, "%s\n", input);
+    res = read_bb_list(ptr, tables, num_mods, num_bbs, worker);
+    read_drcov_file_done(input, res, worker);
     close_input_file(log, map, map_size);
     return true;
 }
 
+/* with -jobs, paths are collected here and read by the workers afterward */
+static char **input_paths;
+static uint num_input_paths;
+static uint input_paths_capacity;
+
+/* -reduce_set needs each file's coverage for its set cover, which only the
+ * queued reader records, so it is queued even for a single job.
+ */
+static inline bool
+queue_input_files(void)
+{
+    return !op_test_pattern.specified() &&
+        (op_jobs.get_value() > 1 || set_log != INVALID_FILE);
+}
+
+static bool
+read_or_queue_drcov_file(const char *path)
+{
+    if (!queue_input_files())
+        return read_drcov_file(path, NULL);
+    if (num_input_paths == input_paths_capacity) {
+        input_paths_capacity = input_paths_capacity == 0 ? 256 : input_paths_capacity * 2;
+        input_paths = (char **)
+            realloc(input_paths, input_paths_capacity * sizeof(input_paths[0]));
+        ASSERT(input_paths != NULL, "Failed to grow input list");
+    }
+    input_paths[num_input_paths] = (char *) malloc(strlen(path) + 1);
+    ASSERT(input_paths[num_input_paths] != NULL, "Failed to alloc path");
+    strncpy(input_paths[num_input_paths], path, strlen(path) + 1);
+    num_input_paths++;
+    return true;
+}
+
 static inline bool
 is_drcov_log_file(const char *fname)
 {
@@ -1012,7 +1305,7 @@ read_drcov_dir(void)
                     WARN(1, "Fail to get full path of log file %s\n", ent->d_name);
                 } else {
                     NULL_TERMINATE_BUFFER(path);
-                    read_drcov_file(path);
+                    read_or_queue_drcov_file(path);
                     found_logs = true;
                 }
             }
@@ -1059,7 +1352,7 @@ read_drcov_dir(void)
             if (!has_sep)
                 strcat(path, "\\");
             strcat(path, ffd.cFileName);
-            found_logs = read_drcov_file(path) || found_logs;
+            found_logs = read_or_queue_drcov_file(path) || found_logs;
         }
     } while (FindNextFile(hFind, &ffd) != 0);
     FindClose(hFind);
@@ -1092,7 +1385,7 @@ read_drcov_list(void)
         NULL_TERMINATE_BUFFER(path);
         ptr = move_to_next_line(ptr);
         null_terminate_path(path);
-        found_logs = read_drcov_file(path) || found_logs;
+        found_logs = read_or_queue_drcov_file(path) || found_logs;
     }
     close_input_file(list, map, map_size);
     if (!found_logs)
@@ -1100,67 +1393,499 @@ read_drcov_list(void)
     return found_logs;
 }
 
+/****************************************************************************
+ * Parallel Input Processing
+ */
+
+#define GAIN_CHUNK_SIZE 64 /* set cover candidates per worker task */
+
+static worker_data_t *workers;
+static uint num_workers;
+/* tasks are handed out by atomically incrementing next_task */
+static volatile int next_task;
+static int num_tasks;
+static volatile int num_files_read;
+
+static module_table_t **merge_tables;
+static ptr_uint_t **covered;         /* indexed by module_table_t.id */
+static cov_file_t **candidates;
+static uint num_candidates;
+static cov_file_t **gain_batch;      /* files whose gain is being recomputed */
+static uint num_gain_batch;
+
+#ifdef UNIX
+static void *
+worker_thread(void *arg)
+#else
+static unsigned int __stdcall
+worker_thread(void *arg)
+#endif
+{
+    worker_data_t *worker = (worker_data_t *)arg;
+    worker->func(worker);
+    return 0;
+}
+
+/* runs func on every worker and waits for all of them to finish */
+static void
+run_workers(void (*func)(worker_data_t *), int tasks)
+{
+    uint i;
+    next_task = 0;
+    num_tasks = tasks;
+    if (tasks <= 1 || num_workers == 1) {
+        /* not worth the thread creation */
+        func(&workers[0]);
+        return;
+    }
+    for (i = 0; i < num_workers; i++) {
+        workers[i].func = func;
+#ifdef UNIX
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0)
+            ASSERT(false, "Failed to create worker thread\n");
+#else
+        workers[i].thread = (HANDLE)
+            _beginthreadex(NULL, 0, worker_thread, &workers[i], 0, NULL);
+        ASSERT(workers[i].thread != NULL, "Failed to create worker thread\n");
+#endif
+    }
+    for (i = 0; i < num_workers; i++) {
+#ifdef UNIX
+        pthread_join(workers[i].thread, NULL);
+#else
+        WaitForSingleObject(workers[i].thread, INFINITE);
+        CloseHandle(workers[i].thread);
+#endif
+    }
+}
+
+static inline int
+worker_next_task(void)
+{
+    return dr_atomic_add32_return_sum(&next_task, 1) - 1;
+}
+
+static void
+worker_read_files(worker_data_t *worker)
+{
+    int i;
+    while ((i = worker_next_task()) < num_tasks) {
+        if (read_drcov_file(input_paths[i], worker))
+            dr_atomic_add32_return_sum(&num_files_read, 1);
+    }
+}
+
+/* Each task ors all the worker copies of one module bitmap into the shared one.
+ * The loop is kept simple enough for the compiler to vectorize it.
+ */
+static void
+worker_merge_bitmaps(worker_data_t *worker)
+{
+    int i;
+    uint j, k;
+    while ((i = worker_next_task()) < num_tasks) {
+        module_table_t *table = merge_tables[i];
+        ptr_uint_t *dst = (ptr_uint_t *)table->bb_table.bitmap;
+        size_t num_words = table->size/BITS_PER_BYTE/sizeof(ptr_uint_t);
+        for (j = 0; j < num_workers; j++) {
+            ptr_uint_t *src;
+            if (table->id >= workers[j].num_bitmaps ||
+                workers[j].bitmaps[table->id] == NULL)
+                continue;
+            src = (ptr_uint_t *)workers[j].bitmaps[table->id];
+            for (k = 0; k < num_words; k++)
+                dst[k] |= src[k];
+        }
+    }
+}
+
+static inline uint
+count_bits(ptr_uint_t x)
+{
+    /* parallel bit count, as we have no portable popcount intrinsic */
+    x = x - ((x >> 1) & (ptr_uint_t)0x5555555555555555ULL);
+    x = (x & (ptr_uint_t)0x3333333333333333ULL) +
+        ((x >> 2) & (ptr_uint_t)0x3333333333333333ULL);
+    x = (x + (x >> 4)) & (ptr_uint_t)0x0f0f0f0f0f0f0f0fULL;
+    return (uint)((x * (ptr_uint_t)0x0101010101010101ULL) >>
+                  ((sizeof(ptr_uint_t) - 1) * BITS_PER_BYTE));
+}
+
+static void
+worker_compute_gains(worker_data_t *worker)
+{
+    int chunk;
+    uint i, j;
+    while ((chunk = worker_next_task()) < num_tasks) {
+        for (i = chunk * GAIN_CHUNK_SIZE;
+             i < num_gain_batch && i < (uint)(chunk + 1) * GAIN_CHUNK_SIZE; i++) {
+            cov_file_t *file = gain_batch[i];
+            file->gain = 0;
+            for (j = 0; j < file->num_words; j++) {
+                cov_word_t *word = &file->words[j];
+                file->gain +=
+                    count_bits(word->bits & ~covered[word->mod_id][word->index]);
+            }
+        }
+    }
+}
+
+static void
+compute_gains(void)
+{
+    run_workers(worker_compute_gains,
+                (num_gain_batch + GAIN_CHUNK_SIZE - 1) / GAIN_CHUNK_SIZE);
+}
+
+static int
+compare_cov_file(const void *a_in, const void *b_in)
+{
+    cov_file_t *f1 = *(cov_file_t **)a_in;
+    cov_file_t *f2 = *(cov_file_t **)b_in;
+    return strcmp(f1->path, f2->path);
+}
+
+/* a larger gain wins, with ties going to the earlier path */
+static inline bool
+cov_file_better(cov_file_t *f1, cov_file_t *f2)
+{
+    return f1->gain > f2->gain || (f1->gain == f2->gain && f1->order < f2->order);
+}
+
+/* candidates is a max-heap ordered by cov_file_better() */
+static void
+candidate_push(cov_file_t *file)
+{
+    uint i = num_candidates++;
+    while (i > 0 && cov_file_better(file, candidates[(i - 1) / 2])) {
+        candidates[i] = candidates[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    candidates[i] = file;
+}
+
+static cov_file_t *
+candidate_pop(void)
+{
+    cov_file_t *top = candidates[0];
+    cov_file_t *last = candidates[--num_candidates];
+    uint i = 0;
+    while (2 * i + 1 < num_candidates) {
+        uint child = 2 * i + 1;
+        if (child + 1 < num_candidates &&
+            cov_file_better(candidates[child + 1], candidates[child]))
+            child++;
+        if (!cov_file_better(candidates[child], last))
+            break;
+        candidates[i] = candidates[child];
+        i = child;
+    }
+    candidates[i] = last;
+    return top;
+}
+
+/* Greedy set cover: repeatedly picks the file that adds the most not-yet-covered
+ * bits.  As a file's gain can only shrink, the gains kept in the heap are upper
+ * bounds and only the files at the top need re-evaluating each round ("lazy"
+ * greedy).  We re-evaluate a batch of them in parallel and select the best one
+ * once it beats the bound of everything left in the heap.
+ */
+static void
+reduce_set_greedy(void)
+{
+    uint i, j, num_files = 0, num_selected = 0;
+    hash_entry_t *e;
+
+    for (i = 0; i < num_workers; i++)
+        num_files += workers[i].num_files;
+    candidates = (cov_file_t **) malloc(num_files * sizeof(candidates[0]) + 1);
+    gain_batch = (cov_file_t **) malloc(num_files * sizeof(gain_batch[0]) + 1);
+    ASSERT(candidates != NULL && gain_batch != NULL,
+           "Failed to alloc set cover candidates\n");
+    num_gain_batch = 0;
+    for (i = 0; i < num_workers; i++) {
+        for (j = 0; j < workers[i].num_files; j++)
+            gain_batch[num_gain_batch++] = &workers[i].files[j];
+    }
+    /* the read order is not deterministic, so sort for a stable selection */
+    qsort(gain_batch, num_gain_batch, sizeof(gain_batch[0]), compare_cov_file);
+    for (i = 0; i < num_gain_batch; i++)
+        gain_batch[i]->order = i;
+
+    covered = (ptr_uint_t **) calloc(num_module_ids + 1, sizeof(covered[0]));
+    ASSERT(covered != NULL, "Failed to alloc covered bitmaps\n");
+    for (i = 0; i < HASHTABLE_SIZE(module_htable.table_bits); i++) {
+        for (e = module_htable.table[i]; e != NULL; e = e->next) {
+            module_table_t *table = (module_table_t *)e->payload;
+            if (table == MODULE_TABLE_IGNORE)
+                continue;
+            covered[table->id] = (ptr_uint_t *) calloc(1, table->size/BITS_PER_BYTE);
+            ASSERT(covered[table->id] != NULL, "Failed to alloc covered bitmap\n");
+        }
+    }
+
+    /* the first evaluation covers every file */
+    compute_gains();
+    num_candidates = 0;
+    for (i = 0; i < num_gain_batch; i++) {
+        if (gain_batch[i]->gain > 0)
+            candidate_push(gain_batch[i]);
+    }
+    while (num_candidates > 0) {
+        cov_file_t *best = NULL;
+        num_gain_batch = 0;
+        while (num_candidates > 0 && num_gain_batch < num_workers * GAIN_CHUNK_SIZE)
+            gain_batch[num_gain_batch++] = candidate_pop();
+        compute_gains();
+        for (i = 0; i < num_gain_batch; i++) {
+            if (best == NULL || cov_file_better(gain_batch[i], best))
+                best = gain_batch[i];
+        }
+        if (best->gain > 0 &&
+            (num_candidates == 0 || !cov_file_better(candidates[0], best))) {
+            PRINT(4, "Selecting %s, adding %u bits\n", best->path, best->gain);
+            dr_fprintf(set_log, "%s\n", best->path);
+            num_selected++;
+            for (j = 0; j < best->num_words; j++) {
+                cov_word_t *word = &best->words[j];
+                covered[word->mod_id][word->index] |= word->bits;
+            }
+        } else
+            best = NULL;
+        for (i = 0; i < num_gain_batch; i++) {
+            if (gain_batch[i] != best && gain_batch[i]->gain > 0)
+                candidate_push(gain_batch[i]);
+        }
+    }
+    PRINT(2, "Selected %u files for the reduced set\n", num_selected);
+
+    for (i = 0; i < num_module_ids; i++)
+        free(covered[i]);
+    free(covered);
+    free(candidates);
+    free(gain_batch);
+}
+
+static bool
+read_drcov_queued(void)
+{
+    uint i, j, num_tables = 0;
+    hash_entry_t *e;
+
+    num_workers = op_jobs.get_value();
+    PRINT(2, "Reading %u files with %u threads\n", num_input_paths, num_workers);
+    workers = (worker_data_t *) calloc(num_workers, sizeof(workers[0]));
+    ASSERT(workers != NULL, "Failed to alloc workers\n");
+    module_lock = dr_mutex_create();
+
+    run_workers(worker_read_files, num_input_paths);
+
+    merge_tables = (module_table_t **)
+        malloc(num_module_htable_entries * sizeof(merge_tables[0]) + 1);
+    ASSERT(merge_tables != NULL, "Failed to alloc merge list\n");
+    for (i = 0; i < HASHTABLE_SIZE(module_htable.table_bits); i++) {
+        for (e = module_htable.table[i]; e != NULL; e = e->next) {
+            if (e->payload != MODULE_TABLE_IGNORE)
+                merge_tables[num_tables++] = (module_table_t *)e->payload;
+        }
+    }
+    run_workers(worker_merge_bitmaps, num_tables);
+    free(merge_tables);
+
+    if (set_log != INVALID_FILE)
+        reduce_set_greedy();
+
+    for (i = 0; i < num_workers; i++) {
+        for (j = 0; j < workers[i].num_bitmaps; j++)
+            free(workers[i].bitmaps[j]);
+        for (j = 0; j < workers[i].num_files; j++) {
+            free(workers[i].files[j].path);
+            free(workers[i].files[j].words);
+        }
+        free(workers[i].bitmaps);
+        free(workers[i].words);
+        free(workers[i].files);
+    }
+    free(workers);
+    dr_mutex_destroy(module_lock);
+    for (i = 0; i < num_input_paths; i++)
+        free(input_paths[i]);
+    free(input_paths);
+    return num_files_read > 0;
+}
+
 static bool
 read_drcov_input(void)
 {
     bool res = true;
     if (op_input.specified())
-        res = read_drcov_file(input_file_buf) && res;
+        res = read_or_queue_drcov_file(input_file_buf) && res;
     if (op_list.specified())
         res = read_drcov_list() && res;
     if (op_dir.specified())
         res = read_drcov_dir() && res;
+    if (num_input_paths > 0)
+        res = read_drcov_queued() && res;
     return res;
 }
 
-static bool
-enum_line_cb(drsym_line_info_t *info, void *data)
+/* Line mapping:
+ * - The lines of each module are first collected into an array of
+ *   (address, file, line) entries, with each source file resolved to its
+ *   line table once rather than per line.
+ * - The array is sorted by address and then joined against the module's
+ *   bb table in a single ascending sweep.
+ * - With -cache_dir, drsyms keeps each module's sorted line table on disk,
+ *   keyed by build id, so later runs do not parse DWARF at all.
+ */
+typedef struct _line_entry_t {
+    uint addr;
+    uint file;   /* index into module_lines_t.files */
+    uint line;
+    uint seq;    /* enumeration order, to keep the sort stable */
+} line_entry_t;
+
+typedef struct _module_lines_t {
+    line_entry_t *entries;
+    uint num_entries;
+    uint capacity;
+    bool sorted;
+    /* line table of each source file, or NULL if it is filtered out */
+    line_table_t **files;
+    uint num_files;
+    uint files_capacity;
+    /* maps a file name to 1 + its index in files */
+    hashtable_t file_htable;
+    char last_file[MAXIMUM_PATH];
+    uint last_file_idx;
+} module_lines_t;
+
+static line_table_t *
+source_file_line_table(const char *file)
 {
-    int   status;
-    module_table_t *table = (module_table_t *)data;
     line_table_t *line_table;
-    const char *test_info = NULL;
     /* FIXME i#1445: we have seen the pdb convert paths to all-lowercase,
      * so these should be case-insensitive on Windows.
      */
-    if (info->file == NULL ||
-        (op_src_filter.specified() &&
-         strstr(info->file, op_src_filter.get_value().c_str()) == NULL) ||
+    if ((op_src_filter.specified() &&
+         strstr(file, op_src_filter.get_value().c_str()) == NULL) ||
         (op_src_skip_filter.specified() &&
-         strstr(info->file, op_src_skip_filter.get_value().c_str()) != NULL))
-        return true;
-    line_table = (line_table_t *) hashtable_lookup(&line_htable, (void *)info->file);
+         strstr(file, op_src_skip_filter.get_value().c_str()) != NULL))
+        return NULL;
+    line_table = (line_table_t *) hashtable_lookup(&line_htable, (void *)file);
     if (line_table == NULL) {
         num_line_htable_entries++;
-        line_table = line_table_create(info->file);
-        if (!hashtable_add(&line_htable, (void *)info->file, line_table))
+        line_table = line_table_create(file);
+        if (!hashtable_add(&line_htable, (void *)file, line_table))
             ASSERT(false, "Failed to add new source line table");
     }
-    status = module_table_bb_lookup(table, (uint)info->line_addr, &test_info);
+    return line_table;
+}
+
+static uint
+module_lines_file_idx(module_lines_t *lines, const char *file)
+{
+    ptr_uint_t idx;
+    /* consecutive lines nearly always share a file */
+    if (lines->num_files > 0 && strcmp(file, lines->last_file) == 0)
+        return lines->last_file_idx;
+    idx = (ptr_uint_t) hashtable_lookup(&lines->file_htable, (void *)file);
+    if (idx == 0) {
+        if (lines->num_files == lines->files_capacity) {
+            lines->files_capacity = lines->files_capacity == 0 ? 64 :
+                lines->files_capacity * 2;
+            lines->files = (line_table_t **)
+                realloc(lines->files, lines->files_capacity * sizeof(lines->files[0]));
+            ASSERT(lines->files != NULL, "Failed to grow file list");
+        }
+        lines->files[lines->num_files] = source_file_line_table(file);
+        idx = ++lines->num_files;
+        hashtable_add(&lines->file_htable, (void *)file, (void *)idx);
+    }
+    strncpy(lines->last_file, file, BUFFER_SIZE_ELEMENTS(lines->last_file));
+    NULL_TERMINATE_BUFFER(lines->last_file);
+    lines->last_file_idx = (uint)(idx - 1);
+    return lines->last_file_idx;
+}
+
+static bool
+enum_line_cb(drsym_line_info_t *info, void *data)
+{
+    module_lines_t *lines = (module_lines_t *)data;
+    line_entry_t *entry;
+    if (info->file == NULL)
+        return true;
     /* info->line is uint64 */
     ASSERT((uint)info->line == info->line, "info->line is too large");
-    if (status == BB_TABLE_ENTRY_SET) {
-        PRINT(5, "exec: ");
-        line_table_add(line_table, (uint)info->line,
-                       (byte)SOURCE_LINE_STATUS_EXEC, test_info);
-    } else if (status == BB_TABLE_ENTRY_CLEAR) {
-        PRINT(5, "skip: ");
-        line_table_add(line_table, (uint)info->line,
-                       (byte)SOURCE_LINE_STATUS_SKIP, test_info);
-    } else {
-        WARN(2, "Invalid bb lookup, Table: " PFX", Addr: " PFX"\n",
-             (ptr_uint_t)table, (ptr_uint_t)info->line);
+    if (lines->num_entries == lines->capacity) {
+        lines->capacity = lines->capacity == 0 ? 4096 : lines->capacity * 2;
+        lines->entries = (line_entry_t *)
+            realloc(lines->entries, lines->capacity * sizeof(lines->entries[0]));
+        ASSERT(lines->entries != NULL, "Failed to grow line list");
     }
-    PRINT(5, "%s, %s, %llu, " PFX"\n",
-          info->cu_name, info->file, (unsigned long long)info->line,
-          (ptr_uint_t)info->line_addr);
+    entry = &lines->entries[lines->num_entries];
+    entry->addr = (uint)info->line_addr;
+    entry->file = module_lines_file_idx(lines, info->file);
+    entry->line = (uint)info->line;
+    entry->seq = lines->num_entries;
+    if (lines->num_entries > 0 && entry->addr < entry[-1].addr)
+        lines->sorted = false;
+    lines->num_entries++;
+    PRINT(6, "%s, %llu, " PFX"\n",
+          info->file, (unsigned long long)info->line, (ptr_uint_t)info->line_addr);
     return true;
 }
 
+static int
+compare_line_entry(const void *a_in, const void *b_in)
+{
+    const line_entry_t *a = (const line_entry_t *)a_in;
+    const line_entry_t *b = (const line_entry_t *)b_in;
+    if (a->addr != b->addr)
+        return a->addr < b->addr ? -1 : 1;
+    if (a->seq != b->seq)
+        return a->seq < b->seq ? -1 : 1;
+    return 0;
+}
+
+static void
+module_lines_join(module_table_t *table, module_lines_t *lines)
+{
+    uint i;
+    if (!lines->sorted) {
+        qsort(lines->entries, lines->num_entries, sizeof(lines->entries[0]),
+              compare_line_entry);
+    }
+    for (i = 0; i < lines->num_entries; i++) {
+        line_entry_t *entry = &lines->entries[i];
+        line_table_t *line_table = lines->files[entry->file];
+        const char *test_info = NULL;
+        int status;
+        if (line_table == NULL)
+            continue;
+        status = module_table_bb_lookup(table, entry->addr, &test_info);
+        if (status == BB_TABLE_ENTRY_SET) {
+            PRINT(5, "exec: %s, %u, " PFX"\n",
+                  line_table->file, entry->line, (ptr_uint_t)entry->addr);
+            line_table_add(line_table, entry->line,
+                           (byte)SOURCE_LINE_STATUS_EXEC, test_info);
+        } else if (status == BB_TABLE_ENTRY_CLEAR) {
+            PRINT(5, "skip: %s, %u, " PFX"\n",
+                  line_table->file, entry->line, (ptr_uint_t)entry->addr);
+            line_table_add(line_table, entry->line,
+                           (byte)SOURCE_LINE_STATUS_SKIP, test_info);
+        } else {
+            WARN(2, "Invalid bb lookup, Table: " PFX", Addr: " PFX"\n",
+                 (ptr_uint_t)table, (ptr_uint_t)entry->addr);
+        }
+    }
+}
+
 static bool
 enumerate_line_info(void)
 {
     uint i, num_entries = 0;
+    module_lines_t lines;
     /* iterate module table */
     for (i = 0; i < HASHTABLE_SIZE(module_htable.table_bits); i++) {
         hash_entry_t *e;
@@ -1172,9 +1897,20 @@ enumerate_line_info(void)
                 continue;
             if (e->payload == MODULE_TABLE_IGNORE)
                 continue;
-            res = drsym_enumerate_lines((const char *)e->key, enum_line_cb, e->payload);
+            memset(&lines, 0, sizeof(lines));
+            lines.sorted = true;
+            hashtable_init_ex(&lines.file_htable, LINE_HASH_TABLE_BITS, HASH_STRING,
+                              true /* strdup */, false /* !synch */, NULL /* free */,
+                              NULL /* hash */, NULL /* cmp */);
+            res = drsym_enumerate_lines((const char *)e->key, enum_line_cb, &lines);
             if (res != DRSYM_SUCCESS)
                 WARN(1, "Failed to enumerate lines for %s\n", (char *)e->key);
+            PRINT(4, "Joining %u lines%s\n", lines.num_entries,
+                  lines.sorted ? "" : " after sorting");
+            module_lines_join((module_table_t *)e->payload, &lines);
+            hashtable_delete(&lines.file_htable);
+            free(lines.entries);
+            free(lines.files);
             res = drsym_free_resources((char *)e->key);
             if (res != DRSYM_SUCCESS)
                 WARN(1, "Failed to free resource for %s\n", (char *)e->key);
@@ -1380,6 +2116,9 @@ main(int argc, const char *argv[])
         ASSERT(false, "Unable to initialize symbol translation");
         return 1;
     }
+    if (op_cache_dir.specified() &&
+        drsym_set_index_cache_dir(op_cache_dir.get_value().c_str()) != DRSYM_SUCCESS)
+        WARN(1, "Failed to use cache directory %s\n", op_cache_dir.get_value().c_str());
     hashtable_init_ex(&module_htable, MODULE_HASH_TABLE_BITS, HASH_STRING,
                       true /* strdup */, false /* !synch */,
                       module_table_delete /* free */,
@@ -36,6 +36,7 @@
 #     should have intra-arg space=@@ and inter-arg space=@ and ;=!
 # * cmp = file containing output to compare app output to, to ensure app ran correctly
 # * postcmd = post processing command to run
+# * postargs = optional extra post processing args, with inter-arg space=@
 
 # Intra-arg space=@@ and inter-arg space=@.
 # XXX i#1327: now that we have -c and other option passing improvements we
@@ -43,6 +44,21 @@
 string(REGEX REPLACE "@@" " " cmd "${cmd}")
 string(REGEX REPLACE "@" ";" cmd "${cmd}")
 string(REGEX REPLACE "!" "\\\;" cmd "${cmd}")
+string(REGEX REPLACE "@" ";" postargs "${postargs}")
+
+# A test passing drcov -logdir gets its own log directory, so that it does not
+# pick up the logs of other runs of the same app.
+if ("${cmd}" MATCHES ";-logdir;([^;]+)")
+  set(logdir "${CMAKE_MATCH_1}")
+  file(REMOVE_RECURSE ${logdir})
+  file(MAKE_DIRECTORY ${logdir})
+else ()
+  set(logdir "./")
+endif ()
+if ("${postargs}" MATCHES "-cache_dir;([^;]+)")
+  set(cache_dir "${CMAKE_MATCH_1}")
+  file(REMOVE_RECURSE ${cache_dir})
+endif ()
 
 # run the cmd
 execute_process(COMMAND ${cmd}
@@ -62,8 +78,8 @@ string(REGEX REPLACE "\\.[^.]+$" "" test_name ${test_name})
 # tool.drcov.fib => fib
 string(REGEX REPLACE "^.+\\.([^.]+)$" "\\1" test_name ${test_name})
 
-FILE(GLOB drcov_logs "drcov.*${test_name}*.log")
-set(cov_file "coverage.${test_name}")
+FILE(GLOB drcov_logs "${logdir}/drcov.*${test_name}*.log")
+set(cov_file "${logdir}/coverage.${test_name}")
 
 file(READ ${cmp} expect)
 if (WIN32)
@@ -71,25 +87,47 @@ if (WIN32)
   string(REGEX REPLACE "\r\\?" "" expect "${expect}")
 endif (WIN32)
 
-execute_process(COMMAND ${postcmd}
-  -dir        ./
-  -mod_filter ${test_name}
-  -src_filter ${test_name}
-  -output     ${cov_file}
-  RESULT_VARIABLE cmd_result
-  ERROR_VARIABLE cmd_err
-  OUTPUT_VARIABLE cmd_out)
-if (cmd_result)
-  message(FATAL_ERROR "*** ${postcmd} failed (${cmd_result}): ${cmd_err} ${cmd_out}***\n")
-endif (cmd_result)
+macro(run_postcmd)
+  execute_process(COMMAND ${postcmd}
+    -dir        ${logdir}
+    -mod_filter ${test_name}
+    -src_filter ${test_name}
+    -output     ${cov_file}
+    ${postargs}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR "*** ${postcmd} failed (${cmd_result}): ${cmd_err} ${cmd_out}***\n")
+  endif (cmd_result)
+endmacro(run_postcmd)
 
+run_postcmd()
 file(READ ${cov_file} cov_out)
 
+if (DEFINED cache_dir)
+  # The first run wrote the line cache: a second run must be served from it
+  # and produce the same output.
+  file(GLOB cache_files "${cache_dir}/*")
+  if (NOT cache_files)
+    message(FATAL_ERROR "no line cache was written to ${cache_dir}")
+  endif ()
+  run_postcmd()
+  file(READ ${cov_file} cov_cached)
+  if (NOT "${cov_cached}" STREQUAL "${cov_out}")
+    message(FATAL_ERROR "cached output ${cov_cached} differs from ${cov_out}")
+  endif ()
+  file(REMOVE_RECURSE ${cache_dir})
+endif ()
+
 # cleanup
 foreach(logfile ${drcov_logs})
   file(REMOVE ${logfile})
 endforeach(logfile)
 file(REMOVE ${cov_file})
+if (NOT "${logdir}" STREQUAL "./")
+  file(REMOVE_RECURSE ${logdir})
+endif ()
 
 if (NOT "${cov_out}" MATCHES "${expect}")
   message(FATAL_ERROR "tool output ${cov_out} failed to match expected ${expect}")
@@ -1,5 +1,5 @@
 /* ***************************************************************************
- * Copyright (c) 2013-2015 Google, Inc.  All rights reserved.
+ * Copyright (c) 2013-2016 Google, Inc.  All rights reserved.
  * ***************************************************************************/
 
 /*
@@ -43,6 +43,19 @@
  * -ignore_underscore  Ignores library routine names starting with "_".
  * -all_args <N>       Prints N arg values for every library call.
  *                     Set to 2 by default.
+ * -binary             Writes a compact binary log to -logdir instead of
+ *                     text, to be rendered offline by drltrace2text.
+ * -first <N>          Logs the first N calls to each routine, plus those
+ *                     picked by -sample.  Set to 0 by default.
+ * -sample <N>         Logs every Nth call to each routine, or none past
+ *                     -first if 0.  Set to 1 by default.
+ * -max_rate <N>       Stops wrapping a routine once it is called more than
+ *                     N times per second.  Set to 0 (no limit) by default.
+ * -summary            Counts all calls to each routine with inline counters
+ *                     and writes the counts, with the top callers of each
+ *                     routine, to a summary file at exit.
+ * -summary_max <N>    Counts at most N routines inline for -summary.
+ *                     Set to 16384 by default.
  * -verbose <N>        For debugging the tool itself.
  */
 
@@ -50,7 +63,11 @@
 #include "drmgr.h"
 #include "drwrap.h"
 #include "drx.h"
+#include "drreg.h"
+#include "drvector.h"
+#include "hashtable.h"
 #include "../common/utils.h"
+#include "drltrace_log.h"
 #include <string.h>
 
 /* XXX i#1349: features to add:
@@ -64,12 +81,10 @@
  *   file, or from querying debug information.
  *   Today we have simple type-blind printing via -all_args.
  *
- * + Add 2 more modes, both gathering statistics rather than a full
- *   trace: one mode that counts total calls, and one that just
- *   records whether each library routine was ever called.  For these,
- *   we'll probably want to insert custom instrumentation rather than
- *   a clean call via drwrap, and so we'll want our own hashtable of
- *   the library entries.
+ * + Add a mode that just records whether each library routine was ever
+ *   called.  -summary counts calls with inline counters, but it still
+ *   keeps the drwrap clean call (for callers and sampling) until
+ *   -max_rate disables it.
  */
 
 static uint verbose;
@@ -87,6 +102,12 @@ typedef struct _drltrace_options_t {
     bool ignore_underscore;
     char only_to_lib[MAXIMUM_PATH];
     uint all_args;
+    bool binary;
+    uint first;
+    uint sample;
+    uint max_rate;
+    bool summary;
+    uint summary_max;
 } drltrace_options_t;
 
 static drltrace_options_t options;
@@ -96,10 +117,445 @@ static file_t outf;
 
 /* Avoid exe exports, as on Linux many apps have a ton of global symbols. */
 static app_pc exe_start;
+static module_data_t *exe;
+
+/* Each wrapped export gets one of these, passed to lib_entry() as its drwrap
+ * user_data so that the per-call path needs no module lookup.  The index in
+ * the exports vector is the export's id in the binary log.  We keep them all
+ * until exit, as ids are never reused and a wrapped call may still be in
+ * flight while its library is being unloaded.
+ */
+typedef struct _export_t {
+    uint id;
+    /* Calls seen by lib_entry(), for -first, -sample, and -max_rate */
+    volatile int wrapped_calls;
+    /* -max_rate: start of the current window of RATE_WINDOW_CALLS calls */
+    uint64 window_start;
+    /* -max_rate: non-zero once we have stopped wrapping this routine */
+    volatile int disabled;
+    uint disabled_at;
+    /* -summary: the value of our call_counts entry at the last fork */
+    uint64 calls_at_fork;
+    /* -summary: all calls, computed by write_summary() */
+    uint64 calls;
+    uint name_length;
+    char name[1]; /* "module!function", variable-sized */
+} export_t;
+
+static drvector_t exports;
+
+/* -summary: calls to each export, indexed by id, incremented inline at the
+ * routine's entry in a per-thread copy.  Exports with ids past -summary_max
+ * are not counted inline.
+ */
+static drx_counter_array_t *call_counts;
+
+/* Maps each wrapped routine's entry to its most recent export_t */
+static hashtable_t export_table;
+
+/* -max_rate is checked once per this many calls to a routine */
+#define RATE_WINDOW_CALLS 1024
+
+/* -summary: how many calls to one routine came from one return address.
+ * Callers of the same retaddr are chained, as an indirect call can reach
+ * several routines.
+ */
+typedef struct _caller_t {
+    app_pc retaddr;
+    export_t *exp;
+    uint64 count;
+    struct _caller_t *next;
+} caller_t;
+
+/* Process-wide callers, keyed by retaddr, merged in from exiting threads */
+static hashtable_t callers;
+
+/* How many callers of each routine the summary lists */
+#define SUMMARY_MAX_CALLERS 10
+
+/* Protects exports, export_buf, and callers, and serializes writes to a
+ * binary outf.
+ */
+static void *log_lock;
+
+/* Binary export entries not yet written to outf */
+#define LOG_BUFFER_SIZE (64 * 1024)
+static byte export_buf[LOG_BUFFER_SIZE];
+static size_t export_buf_used;
+
+typedef struct _per_thread_t {
+    uint thread_id;
+    /* -binary: buffer of LOG_BUFFER_SIZE bytes of call entries */
+    byte *buf;
+    byte *cur;
+    /* -summary: this thread's callers, keyed by retaddr */
+    hashtable_t callers;
+} per_thread_t;
+
+static int tls_idx;
+
+/* Size of each binary call entry, including its return address and args */
+static size_t call_entry_size;
+
+/* Keep a call entry well within a thread buffer */
+#define MAX_BINARY_ARGS 256
 
 /* runtest.cmake assumes this is the prefix, so update both when changing it */
 #define STDERR_PREFIX "~~~~ "
 
+/****************************************************************************
+ * Binary log
+ */
+
+static void
+write_log(const void *buf, size_t size)
+{
+    IF_DEBUG(ssize_t written =)
+        dr_write_file(outf, buf, size);
+    ASSERT(written == (ssize_t) size, "failed to write log file");
+}
+
+/* Caller must hold log_lock */
+static void
+flush_export_buf(void)
+{
+    if (export_buf_used > 0) {
+        write_log(export_buf, export_buf_used);
+        export_buf_used = 0;
+    }
+}
+
+/* Caller must hold log_lock */
+static void
+log_export(export_t *exp)
+{
+    drltrace_export_entry_t entry;
+    if (export_buf_used + sizeof(entry) + exp->name_length > sizeof(export_buf))
+        flush_export_buf();
+    entry.type = DRLTRACE_ENTRY_EXPORT;
+    entry.id = exp->id;
+    entry.name_length = exp->name_length;
+    entry.padding = 0;
+    memcpy(export_buf + export_buf_used, &entry, sizeof(entry));
+    memcpy(export_buf + export_buf_used + sizeof(entry), exp->name, exp->name_length);
+    export_buf_used += sizeof(entry) + exp->name_length;
+}
+
+/* Writes the file header plus all exports seen so far to a new outf */
+static void
+log_header(void)
+{
+    drltrace_log_header_t header;
+    uint i;
+    memcpy(header.magic, DRLTRACE_LOG_MAGIC, sizeof(header.magic));
+    header.version = DRLTRACE_LOG_VERSION;
+    header.pointer_size = sizeof(void *);
+    header.num_args = options.all_args;
+    header.padding = 0;
+    dr_mutex_lock(log_lock);
+    write_log(&header, sizeof(header));
+    export_buf_used = 0;
+    for (i = 0; i < exports.entries; i++)
+        log_export((export_t *) drvector_get_entry(&exports, i));
+    flush_export_buf();
+    dr_mutex_unlock(log_lock);
+}
+
+static void
+flush_thread_buf(per_thread_t *data)
+{
+    if (data->cur == data->buf)
+        return;
+    dr_mutex_lock(log_lock);
+    /* Export entries must reach the file before any call entry using them */
+    flush_export_buf();
+    write_log(data->buf, data->cur - data->buf);
+    dr_mutex_unlock(log_lock);
+    data->cur = data->buf;
+}
+
+static void
+log_call(void *wrapcxt, void *drcontext, export_t *exp, app_pc retaddr)
+{
+    per_thread_t *data = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    drltrace_call_entry_t *entry;
+    app_pc *slots;
+    if (data->cur + call_entry_size > data->buf + LOG_BUFFER_SIZE)
+        flush_thread_buf(data);
+    entry = (drltrace_call_entry_t *) data->cur;
+    slots = (app_pc *) (entry + 1);
+    entry->type = DRLTRACE_ENTRY_CALL;
+    entry->id = exp->id;
+    entry->thread_id = data->thread_id;
+    entry->valid_args = 0;
+    slots[0] = retaddr;
+    DR_TRY_EXCEPT(drcontext, {
+        for (; entry->valid_args < options.all_args; entry->valid_args++)
+            slots[1 + entry->valid_args] = drwrap_get_arg(wrapcxt, entry->valid_args);
+    }, { /* EXCEPT */
+        /* Just keep going: the formatter prints <invalid memory> */
+    });
+    if (entry->valid_args < options.all_args) {
+        memset(&slots[1 + entry->valid_args], 0,
+               (options.all_args - entry->valid_args) * sizeof(slots[0]));
+    }
+    data->cur += call_entry_size;
+}
+
+/****************************************************************************
+ * Call counting and sampling
+ */
+
+static void
+lib_entry(void *wrapcxt, INOUT void **user_data);
+
+static bool
+call_is_sampled(uint count)
+{
+    return (count <= options.first ||
+            (options.sample > 0 && count % options.sample == 0));
+}
+
+/* Called on every RATE_WINDOW_CALLS-th call to exp.  If those calls came in
+ * faster than -max_rate allows, we stop wrapping the routine, leaving only
+ * -summary's inline counter.
+ */
+static void
+check_rate(void *wrapcxt, export_t *exp, uint count)
+{
+    uint64 now = dr_get_milliseconds();
+    uint64 start = exp->window_start;
+    exp->window_start = now;
+    if (now - start >= (uint64) RATE_WINDOW_CALLS * 1000 / options.max_rate)
+        return;
+    if (dr_atomic_add32_return_sum(&exp->disabled, 1) != 1)
+        return; /* another thread beat us to it */
+    exp->disabled_at = count;
+    /* drwrap supports unwrapping from a pre-callback */
+    drwrap_unwrap(drwrap_get_func(wrapcxt), lib_entry, NULL);
+    NOTIFY(1, "disabling %s after %u calls\n", exp->name, count);
+}
+
+static void
+record_caller(per_thread_t *data, export_t *exp, app_pc retaddr)
+{
+    caller_t *head = (caller_t *) hashtable_lookup(&data->callers, retaddr);
+    caller_t *caller;
+    for (caller = head; caller != NULL; caller = caller->next) {
+        if (caller->exp == exp) {
+            caller->count++;
+            return;
+        }
+    }
+    caller = (caller_t *) dr_global_alloc(sizeof(*caller));
+    caller->retaddr = retaddr;
+    caller->exp = exp;
+    caller->count = 1;
+    caller->next = head;
+    hashtable_add_replace(&data->callers, retaddr, caller);
+}
+
+static void
+caller_chain_free(void *ptr)
+{
+    caller_t *caller, *next;
+    for (caller = (caller_t *) ptr; caller != NULL; caller = next) {
+        next = caller->next;
+        dr_global_free(caller, sizeof(*caller));
+    }
+}
+
+/* Moves a thread's callers into the process-wide table and empties it.
+ * Caller must hold log_lock.
+ */
+static void
+callers_merge(hashtable_t *from)
+{
+    uint i;
+    for (i = 0; i < HASHTABLE_SIZE(from->table_bits); i++) {
+        hash_entry_t *he;
+        for (he = from->table[i]; he != NULL; he = he->next) {
+            caller_t *caller, *next;
+            for (caller = (caller_t *) he->payload; caller != NULL; caller = next) {
+                caller_t *head = (caller_t *) hashtable_lookup(&callers, he->key);
+                caller_t *match;
+                next = caller->next;
+                for (match = head; match != NULL; match = match->next) {
+                    if (match->exp == caller->exp)
+                        break;
+                }
+                if (match != NULL) {
+                    match->count += caller->count;
+                    dr_global_free(caller, sizeof(*caller));
+                } else {
+                    caller->next = head;
+                    hashtable_add_replace(&callers, he->key, caller);
+                }
+            }
+        }
+    }
+    /* The per-thread table has no free function: its callers were moved above */
+    hashtable_clear(from);
+}
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
+                      bool for_trace, bool translating, void *user_data)
+{
+    export_t *exp;
+    app_pc pc = instr_get_app_pc(instr);
+    if (pc == NULL || !instr_is_app(instr))
+        return DR_EMIT_DEFAULT;
+    exp = (export_t *) hashtable_lookup(&export_table, pc);
+    if (exp != NULL && exp->id < options.summary_max) {
+        IF_DEBUG(bool ok =)
+            drx_counter_array_insert_update(drcontext, call_counts, bb, instr,
+                                            exp->id, 1);
+        ASSERT(ok, "failed to insert call counter");
+    }
+    return DR_EMIT_DEFAULT;
+}
+
+/* Routines past -summary_max fall back to the calls seen while wrapped */
+static uint64
+export_calls(export_t *exp)
+{
+    if (exp->id < options.summary_max)
+        return drx_counter_array_get_value(call_counts, exp->id) - exp->calls_at_fork;
+    return (uint64) exp->wrapped_calls;
+}
+
+/* A shell sort, as we have no libc qsort */
+static void
+sort_pointers(void **array, uint num, int (*cmp)(void *a, void *b))
+{
+    uint gap = 1, i, j;
+    while (gap < num / 3)
+        gap = gap * 3 + 1;
+    for (; gap > 0; gap /= 3) {
+        for (i = gap; i < num; i++) {
+            void *cur = array[i];
+            for (j = i; j >= gap && cmp(array[j - gap], cur) > 0; j -= gap)
+                array[j] = array[j - gap];
+            array[j] = cur;
+        }
+    }
+}
+
+static int
+compare_export_calls(void *a, void *b)
+{
+    export_t *exp_a = (export_t *) a, *exp_b = (export_t *) b;
+    if (exp_a->calls != exp_b->calls)
+        return exp_a->calls > exp_b->calls ? -1 : 1;
+    return exp_a->id < exp_b->id ? -1 : 1;
+}
+
+static int
+compare_caller(void *a, void *b)
+{
+    caller_t *caller_a = (caller_t *) a, *caller_b = (caller_t *) b;
+    if (caller_a->exp->id != caller_b->exp->id)
+        return caller_a->exp->id < caller_b->exp->id ? -1 : 1;
+    if (caller_a->count != caller_b->count)
+        return caller_a->count > caller_b->count ? -1 : 1;
+    if (caller_a->retaddr != caller_b->retaddr)
+        return caller_a->retaddr < caller_b->retaddr ? -1 : 1;
+    return 0;
+}
+
+/* Writes each called routine's count, most called first, followed by its
+ * top callers.  Threads have exited, so all callers are in the global table.
+ */
+static void
+write_summary(void)
+{
+    char buf[MAXIMUM_PATH];
+    const char *prefix = "";
+    file_t f = STDERR;
+    export_t **sorted;
+    caller_t **all_callers;
+    uint *first_caller;
+    uint num_exports = exports.entries, num_sorted = 0, num_callers = 0, i, j;
+
+    if (strcmp(options.logdir, "-") == 0)
+        prefix = STDERR_PREFIX;
+    else {
+        f = drx_open_unique_appid_file(options.logdir, dr_get_process_id(),
+                                       "drltrace", "summary", DR_FILE_ALLOW_LARGE,
+                                       buf, BUFFER_SIZE_ELEMENTS(buf));
+        ASSERT(f != INVALID_FILE, "failed to open summary file");
+        if (f == INVALID_FILE)
+            return;
+        NOTIFY(1, "summary file is %s\n", buf);
+    }
+
+    for (i = 0; i < HASHTABLE_SIZE(callers.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = callers.table[i]; he != NULL; he = he->next) {
+            caller_t *caller;
+            for (caller = (caller_t *) he->payload; caller != NULL; caller = caller->next)
+                num_callers++;
+        }
+    }
+    /* dr_global_alloc() does not accept a size of 0 */
+    all_callers = (caller_t **) dr_global_alloc((num_callers + 1) * sizeof(*all_callers));
+    num_callers = 0;
+    for (i = 0; i < HASHTABLE_SIZE(callers.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = callers.table[i]; he != NULL; he = he->next) {
+            caller_t *caller;
+            for (caller = (caller_t *) he->payload; caller != NULL; caller = caller->next)
+                all_callers[num_callers++] = caller;
+        }
+    }
+    sort_pointers((void **) all_callers, num_callers, compare_caller);
+
+    sorted = (export_t **) dr_global_alloc((num_exports + 1) * sizeof(*sorted));
+    first_caller = (uint *) dr_global_alloc((num_exports + 1) * sizeof(*first_caller));
+    for (i = 0; i < num_exports; i++) {
+        export_t *exp = (export_t *) drvector_get_entry(&exports, i);
+        first_caller[i] = num_callers; /* none */
+        exp->calls = export_calls(exp);
+        if (exp->calls > 0)
+            sorted[num_sorted++] = exp;
+    }
+    sort_pointers((void **) sorted, num_sorted, compare_export_calls);
+    for (i = num_callers; i > 0; i--)
+        first_caller[all_callers[i - 1]->exp->id] = i - 1;
+
+    dr_fprintf(f, "%sCalls to each library routine, with its top callers:\n", prefix);
+    for (i = 0; i < num_sorted; i++) {
+        export_t *exp = sorted[i];
+        dr_fprintf(f, "%s%12"UINT64_FORMAT_CODE" %s", prefix, exp->calls, exp->name);
+        if (exp->disabled != 0) {
+            dr_fprintf(f, " (stopped wrapping after %u calls)", exp->disabled_at);
+        }
+        dr_fprintf(f, "\n");
+        for (j = first_caller[exp->id];
+             j < num_callers && all_callers[j]->exp == exp &&
+                 j - first_caller[exp->id] < SUMMARY_MAX_CALLERS;
+             j++) {
+            module_data_t *mod = dr_lookup_module(all_callers[j]->retaddr);
+            dr_fprintf(f, "%s%12s %12"UINT64_FORMAT_CODE" from ", prefix, "",
+                       all_callers[j]->count);
+            if (mod != NULL) {
+                const char *modname = dr_module_preferred_name(mod);
+                dr_fprintf(f, "%s+"PIFX"\n", modname == NULL ? "<unknown>" : modname,
+                           all_callers[j]->retaddr - mod->start);
+                dr_free_module_data(mod);
+            } else
+                dr_fprintf(f, PFX"\n", all_callers[j]->retaddr);
+        }
+    }
+
+    dr_global_free(all_callers, (num_callers + 1) * sizeof(*all_callers));
+    dr_global_free(first_caller, (num_exports + 1) * sizeof(*first_caller));
+    dr_global_free(sorted, (num_exports + 1) * sizeof(*sorted));
+    if (f != STDERR)
+        dr_close_file(f);
+}
+
 /****************************************************************************
  * Library entry wrapping
  */
@@ -107,28 +563,28 @@ static app_pc exe_start;
 static void
 lib_entry(void *wrapcxt, INOUT void **user_data)
 {
-    const char *name = (const char *) *user_data;
-    const char *modname = NULL;
-    app_pc func = drwrap_get_func(wrapcxt);
-    module_data_t *mod;
-    if (options.only_from_app) {
-        /* For just this option, the modxfer approach might be better */
-        app_pc retaddr =  NULL;
-        void *drcontext = drwrap_get_drcontext(wrapcxt);
+    export_t *exp = (export_t *) *user_data;
+    void *drcontext = drwrap_get_drcontext(wrapcxt);
+    app_pc retaddr = NULL;
+    uint count = (uint) dr_atomic_add32_return_sum(&exp->wrapped_calls, 1);
+    if (options.max_rate > 0 && count % RATE_WINDOW_CALLS == 0)
+        check_rate(wrapcxt, exp, count);
+    if (options.only_from_app || options.binary || options.summary) {
         DR_TRY_EXCEPT(drcontext, {
             retaddr = drwrap_get_retaddr(wrapcxt);
         }, { /* EXCEPT */
             retaddr = NULL;
         });
-        if (retaddr != NULL) {
-            mod = dr_lookup_module(retaddr);
-            if (mod != NULL) {
-                bool from_exe = (mod->start == exe_start);
-                dr_free_module_data(mod);
-                if (!from_exe)
-                    return;
-            }
-        } else {
+    }
+    if (options.summary && retaddr != NULL) {
+        record_caller((per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx),
+                      exp, retaddr);
+    }
+    if (!call_is_sampled(count))
+        return;
+    if (options.only_from_app) {
+        /* For just this option, the modxfer approach might be better */
+        if (retaddr == NULL) {
             /* Nearly all of these cases should be things like KiUserCallbackDispatcher
              * or other abnormal transitions.
              * If the user really wants to see everything they can not pass
@@ -136,19 +592,24 @@ lib_entry(void *wrapcxt, INOUT void **user_data)
              */
             return;
         }
+        /* Avoid a module lookup for the common case of a call from the exe */
+        if (exe == NULL || !dr_module_contains_addr(exe, retaddr)) {
+            module_data_t *mod = dr_lookup_module(retaddr);
+            if (mod != NULL) {
+                bool from_exe = (mod->start == exe_start);
+                dr_free_module_data(mod);
+                if (!from_exe)
+                    return;
+            }
+        }
     }
-    /* XXX: it may be better to heap-allocate the "module!func" string and
-     * pass in, to avoid this lookup.
-     */
-    mod = dr_lookup_module(func);
-    if (mod != NULL)
-        modname = dr_module_preferred_name(mod);
-    dr_fprintf(outf, "%s%s%s%s", (outf == STDERR ? STDERR_PREFIX : ""),
-               modname == NULL ? "" : modname,
-               modname == NULL ? "" : "!", name);
+    if (options.binary) {
+        log_call(wrapcxt, drcontext, exp, retaddr);
+        return;
+    }
+    dr_fprintf(outf, "%s%s", (outf == STDERR ? STDERR_PREFIX : ""), exp->name);
     if (options.all_args > 0) {
         uint i;
-        void *drcontext = drwrap_get_drcontext(wrapcxt);
         dr_fprintf(outf, "(");
         DR_TRY_EXCEPT(drcontext, {
             for (i = 0; i < options.all_args; i++) {
@@ -162,8 +623,49 @@ lib_entry(void *wrapcxt, INOUT void **user_data)
         dr_fprintf(outf, ")");
     }
     dr_fprintf(outf, "\n");
+}
+
+static export_t *
+export_create(app_pc func, const char *name)
+{
+    char buf[MAXIMUM_PATH * 2];
+    const char *modname = NULL;
+    export_t *exp;
+    size_t len;
+    module_data_t *mod = dr_lookup_module(func);
+    if (mod != NULL)
+        modname = dr_module_preferred_name(mod);
+    dr_snprintf(buf, BUFFER_SIZE_ELEMENTS(buf), "%s%s%s",
+                modname == NULL ? "" : modname,
+                modname == NULL ? "" : "!", name);
+    NULL_TERMINATE_BUFFER(buf);
     if (mod != NULL)
         dr_free_module_data(mod);
+    len = strlen(buf);
+    exp = (export_t *) dr_global_alloc(sizeof(*exp) + len);
+    exp->wrapped_calls = 0;
+    exp->window_start = dr_get_milliseconds();
+    exp->disabled = 0;
+    exp->disabled_at = 0;
+    exp->calls_at_fork = 0;
+    exp->calls = 0;
+    exp->name_length = (uint) len;
+    memcpy(exp->name, buf, len + 1);
+    dr_mutex_lock(log_lock);
+    exp->id = exports.entries;
+    drvector_append(&exports, exp);
+    if (options.binary)
+        log_export(exp);
+    dr_mutex_unlock(log_lock);
+    hashtable_add_replace(&export_table, func, exp);
+    return exp;
+}
+
+static void
+export_free(void *ptr)
+{
+    export_t *exp = (export_t *) ptr;
+    dr_global_free(exp, sizeof(*exp) + exp->name_length);
 }
 
 static void
@@ -195,14 +697,20 @@ iterate_exports(const module_data_t *info, bool add)
         if (func != NULL) {
             if (add) {
                 IF_DEBUG(bool ok =)
-                    drwrap_wrap_ex(func, lib_entry, NULL, (void *) sym->name, 0);
+                    drwrap_wrap_ex(func, lib_entry, NULL,
+                                   (void *) export_create(func, sym->name), 0);
                 ASSERT(ok, "wrap request failed");
                 NOTIFY(2, "wrapping export %s!%s @"PFX"\n",
                        dr_module_preferred_name(info), sym->name, func);
             } else {
-                IF_DEBUG(bool ok =)
-                    drwrap_unwrap(func, lib_entry, NULL);
-                ASSERT(ok, "unwrap request failed");
+                export_t *exp = (export_t *) hashtable_lookup(&export_table, func);
+                /* -max_rate may have already unwrapped it */
+                if (exp == NULL || exp->disabled == 0) {
+                    IF_DEBUG(bool ok =)
+                        drwrap_unwrap(func, lib_entry, NULL);
+                    ASSERT(ok, "unwrap request failed");
+                }
+                hashtable_remove(&export_table, func);
             }
         }
     }
@@ -253,13 +761,77 @@ open_log_file(void)
                                           buf, BUFFER_SIZE_ELEMENTS(buf));
         ASSERT(outf != INVALID_FILE, "failed to open log file");
         NOTIFY(1, "log file is %s\n", buf);
+        if (options.binary)
+            log_header();
     }
 }
 
+static void
+event_thread_init(void *drcontext)
+{
+    per_thread_t *data = (per_thread_t *) dr_thread_alloc(drcontext, sizeof(*data));
+    data->thread_id = (uint) dr_get_thread_id(drcontext);
+    data->buf = NULL;
+    if (options.binary)
+        data->buf = (byte *) dr_thread_alloc(drcontext, LOG_BUFFER_SIZE);
+    data->cur = data->buf;
+    if (options.summary) {
+        hashtable_init_ex(&data->callers, 8, HASH_INTPTR, false/*!str_dup*/,
+                          false/*!synch*/, NULL, NULL, NULL);
+    }
+    drmgr_set_tls_field(drcontext, tls_idx, data);
+}
+
+static void
+event_thread_exit(void *drcontext)
+{
+    per_thread_t *data = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (options.binary) {
+        flush_thread_buf(data);
+        dr_thread_free(drcontext, data->buf, LOG_BUFFER_SIZE);
+    }
+    if (options.summary) {
+        dr_mutex_lock(log_lock);
+        callers_merge(&data->callers);
+        dr_mutex_unlock(log_lock);
+        hashtable_delete(&data->callers);
+    }
+    dr_thread_free(drcontext, data, sizeof(*data));
+}
+
 #ifndef WINDOWS
 static void
 event_fork(void *drcontext)
 {
+    per_thread_t *data = NULL;
+    if (options.binary || options.summary)
+        data = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (options.binary) {
+        /* The parent writes out its own copy of these calls */
+        data->thread_id = (uint) dr_get_thread_id(drcontext);
+        data->cur = data->buf;
+    }
+    if (options.summary) {
+        /* Likewise, the parent reports the counts so far.  Merging frees this
+         * thread's callers into the global table, which we then empty.
+         */
+        uint i;
+        dr_mutex_lock(log_lock);
+        callers_merge(&data->callers);
+        hashtable_clear(&callers);
+        for (i = 0; i < exports.entries; i++) {
+            export_t *exp = (export_t *) drvector_get_entry(&exports, i);
+            exp->wrapped_calls = 0;
+            /* This thread's copy and the exited totals carry the parent's
+             * counts, which we cannot reset from here.
+             */
+            if (exp->id < options.summary_max) {
+                exp->calls_at_fork =
+                    drx_counter_array_get_value(call_counts, exp->id);
+            }
+        }
+        dr_mutex_unlock(log_lock);
+    }
     /* The old file was closed by DR b/c we passed DR_FILE_CLOSE_ON_FORK */
     open_log_file();
 }
@@ -268,8 +840,28 @@ event_fork(void *drcontext)
 static void
 event_exit(void)
 {
+    if (options.summary) {
+        write_summary();
+        if (call_counts != NULL)
+            drx_counter_array_free(call_counts);
+    }
+    if (options.binary) {
+        dr_mutex_lock(log_lock);
+        flush_export_buf();
+        dr_mutex_unlock(log_lock);
+    }
+    if (options.binary || options.summary)
+        drmgr_unregister_tls_field(tls_idx);
+    if (options.summary)
+        drreg_exit();
     if (outf != STDERR)
         dr_close_file(outf);
+    hashtable_delete(&callers);
+    hashtable_delete(&export_table);
+    drvector_delete(&exports);
+    dr_mutex_destroy(log_lock);
+    if (exe != NULL)
+        dr_free_module_data(exe);
     drx_exit();
     drwrap_exit();
     drmgr_exit();
@@ -285,6 +877,8 @@ options_init(client_id_t id)
     /* default values */
     dr_snprintf(options.logdir, BUFFER_SIZE_ELEMENTS(options.logdir), "-");
     options.all_args = 2;
+    options.sample = 1;
+    options.summary_max = 16384;
 
     for (s = dr_get_token(opstr, token, BUFFER_SIZE_ELEMENTS(token));
          s != NULL;
@@ -308,6 +902,38 @@ options_init(client_id_t id)
                 int res = dr_sscanf(token, "%u", &options.all_args);
                 USAGE_CHECK(res == 1, "invalid -all_args number");
             }
+        } else if (strcmp(token, "-binary") == 0) {
+            options.binary = true;
+        } else if (strcmp(token, "-first") == 0) {
+            s = dr_get_token(s, token, BUFFER_SIZE_ELEMENTS(token));
+            USAGE_CHECK(s != NULL, "missing -first number");
+            if (s != NULL) {
+                int res = dr_sscanf(token, "%u", &options.first);
+                USAGE_CHECK(res == 1, "invalid -first number");
+            }
+        } else if (strcmp(token, "-sample") == 0) {
+            s = dr_get_token(s, token, BUFFER_SIZE_ELEMENTS(token));
+            USAGE_CHECK(s != NULL, "missing -sample number");
+            if (s != NULL) {
+                int res = dr_sscanf(token, "%u", &options.sample);
+                USAGE_CHECK(res == 1, "invalid -sample number");
+            }
+        } else if (strcmp(token, "-max_rate") == 0) {
+            s = dr_get_token(s, token, BUFFER_SIZE_ELEMENTS(token));
+            USAGE_CHECK(s != NULL, "missing -max_rate number");
+            if (s != NULL) {
+                int res = dr_sscanf(token, "%u", &options.max_rate);
+                USAGE_CHECK(res == 1, "invalid -max_rate number");
+            }
+        } else if (strcmp(token, "-summary") == 0) {
+            options.summary = true;
+        } else if (strcmp(token, "-summary_max") == 0) {
+            s = dr_get_token(s, token, BUFFER_SIZE_ELEMENTS(token));
+            USAGE_CHECK(s != NULL, "missing -summary_max number");
+            if (s != NULL) {
+                int res = dr_sscanf(token, "%u", &options.summary_max);
+                USAGE_CHECK(res == 1, "invalid -summary_max number");
+            }
         } else if (strcmp(token, "-verbose") == 0) {
             s = dr_get_token(s, token, BUFFER_SIZE_ELEMENTS(token));
             USAGE_CHECK(s != NULL, "missing -verbose number");
@@ -320,12 +946,15 @@ options_init(client_id_t id)
             USAGE_CHECK(false, "invalid option");
         }
     }
+    if (options.binary) {
+        USAGE_CHECK(strcmp(options.logdir, "-") != 0, "-binary requires -logdir");
+        USAGE_CHECK(options.all_args <= MAX_BINARY_ARGS, "-all_args too large");
+    }
 }
 
 DR_EXPORT void
 dr_init(client_id_t id)
 {
-    module_data_t *exe;
     IF_DEBUG(bool ok;)
 
     dr_set_client_name("DrLTrace", "http://dynamorio.org/issues");
@@ -342,10 +971,43 @@ dr_init(client_id_t id)
         drx_init();
     ASSERT(ok, "drx failed to initialize");
 
+    /* We keep exe for -only_from_app's retaddr checks */
     exe = dr_get_main_module();
     if (exe != NULL)
         exe_start = exe->start;
-    dr_free_module_data(exe);
+
+    log_lock = dr_mutex_create();
+    drvector_init(&exports, 1024, false/*!synch: we use log_lock*/, export_free);
+    hashtable_init(&export_table, 12, HASH_INTPTR, false/*!str_dup*/);
+    hashtable_init_ex(&callers, 12, HASH_INTPTR, false/*!str_dup*/,
+                      false/*!synch: we use log_lock*/, caller_chain_free, NULL, NULL);
+    if (options.binary) {
+        call_entry_size = sizeof(drltrace_call_entry_t) +
+            (1 + options.all_args) * sizeof(app_pc);
+    }
+    if (options.summary) {
+        drreg_options_t ops = {sizeof(ops), 2 /*max slots needed*/, false};
+        IF_DEBUG(ok = )
+            (drreg_init(&ops) == DRREG_SUCCESS);
+        ASSERT(ok, "drreg failed to initialize");
+        /* Created before any thread so that every thread gets its own copy.
+         * Per-thread arrays are not yet supported on 32-bit ARM.
+         */
+        if (options.summary_max > 0) {
+            call_counts = drx_counter_array_create
+                (IF_ARM_ELSE(DRX_COUNTER_ARRAY_GLOBAL_PADDED,
+                             DRX_COUNTER_ARRAY_PER_THREAD),
+                 options.summary_max, IF_ARM_ELSE(DRX_COUNTER_LOCK, 0));
+            ASSERT(call_counts != NULL, "failed to create call counters");
+        }
+        drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL);
+    }
+    if (options.binary || options.summary) {
+        tls_idx = drmgr_register_tls_field();
+        ASSERT(tls_idx != -1, "failed to reserve TLS slot");
+        drmgr_register_thread_init_event(event_thread_init);
+        drmgr_register_thread_exit_event(event_thread_exit);
+    }
 
     /* No-frills is safe b/c we're the only module doing wrapping, and
      * we're only wrapping at module load and unwrapping at unload.
@@ -0,0 +1,86 @@
+/* ***************************************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * ***************************************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* drltrace binary log format (-binary), shared by the client and drltrace2text.
+ *
+ * The file starts with a drltrace_log_header_t.  The rest of the file is a
+ * sequence of entries, each starting with a 16-byte entry header whose first
+ * field is its drltrace_entry_type_t:
+ *
+ * + An export entry assigns an id to a "module!function" name.  It is
+ *   followed by name_length bytes of the name (no terminating NUL).
+ *   An export entry always precedes the first call entry that refers to it.
+ *
+ * + A call entry records one call to a wrapped export.  It is followed by
+ *   the return address and then by num_args argument slots, each
+ *   pointer_size bytes.  Only the first valid_args slots hold values; if
+ *   valid_args < num_args, reading the next argument faulted.
+ *
+ * Call entries are buffered per thread, so the entries of different threads
+ * are interleaved in large chunks rather than in global call order.
+ * We use only plain C types here so the post-processor needs no DR headers.
+ */
+
+#ifndef _DRLTRACE_LOG_H_
+#define _DRLTRACE_LOG_H_ 1
+
+#define DRLTRACE_LOG_MAGIC "DRLTRACE"
+#define DRLTRACE_LOG_VERSION 1
+
+typedef struct _drltrace_log_header_t {
+    char magic[8];                  /* DRLTRACE_LOG_MAGIC, no terminating NUL */
+    unsigned int version;           /* DRLTRACE_LOG_VERSION */
+    unsigned int pointer_size;      /* size of each address and argument slot */
+    unsigned int num_args;          /* argument slots in each call entry */
+    unsigned int padding;
+} drltrace_log_header_t;
+
+typedef enum {
+    DRLTRACE_ENTRY_EXPORT = 1,
+    DRLTRACE_ENTRY_CALL   = 2
+} drltrace_entry_type_t;
+
+typedef struct _drltrace_export_entry_t {
+    unsigned int type;              /* DRLTRACE_ENTRY_EXPORT */
+    unsigned int id;
+    unsigned int name_length;
+    unsigned int padding;
+} drltrace_export_entry_t;
+
+typedef struct _drltrace_call_entry_t {
+    unsigned int type;              /* DRLTRACE_ENTRY_CALL */
+    unsigned int id;
+    unsigned int thread_id;
+    unsigned int valid_args;
+} drltrace_call_entry_t;
+
+#endif /* _DRLTRACE_LOG_H_ */
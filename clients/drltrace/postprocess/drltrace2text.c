@@ -0,0 +1,209 @@
+/* ***************************************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * ***************************************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* drltrace2text: renders the binary logs written by drltrace -binary as the
+ * same text that drltrace prints without -binary.
+ *
+ * Usage: drltrace2text [-show_thread] [-show_retaddr] <log file>...
+ *
+ * -show_thread   Prefixes each call with the id of the calling thread.
+ * -show_retaddr  Appends the return address of each call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../drltrace_log.h"
+
+static int show_thread;
+static int show_retaddr;
+
+/* Export names indexed by id */
+static char **names;
+static unsigned int names_capacity;
+
+static void
+usage(const char *msg)
+{
+    fprintf(stderr, "ERROR: %s\n", msg);
+    fprintf(stderr, "Usage: drltrace2text [-show_thread] [-show_retaddr] "
+            "<log file>...\n");
+    exit(1);
+}
+
+static void
+fatal(const char *msg, const char *path)
+{
+    fprintf(stderr, "ERROR: %s: %s\n", msg, path);
+    exit(1);
+}
+
+static void
+free_names(void)
+{
+    unsigned int i;
+    for (i = 0; i < names_capacity; i++)
+        free(names[i]);
+    free(names);
+    names = NULL;
+    names_capacity = 0;
+}
+
+static void
+set_name(unsigned int id, char *name)
+{
+    if (id >= names_capacity) {
+        unsigned int capacity = names_capacity == 0 ? 1024 : names_capacity;
+        while (capacity <= id)
+            capacity *= 2;
+        names = (char **) realloc(names, capacity * sizeof(*names));
+        if (names == NULL) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            exit(1);
+        }
+        memset(names + names_capacity, 0,
+               (capacity - names_capacity) * sizeof(*names));
+        names_capacity = capacity;
+    }
+    free(names[id]);
+    names[id] = name;
+}
+
+/* Reads one pointer_size-byte little-endian slot */
+static unsigned long long
+read_slot(const unsigned char *slot, unsigned int pointer_size)
+{
+    unsigned long long val = 0;
+    unsigned int i;
+    for (i = pointer_size; i > 0; i--)
+        val = (val << 8) | slot[i - 1];
+    return val;
+}
+
+static void
+print_slot(unsigned long long val, unsigned int pointer_size)
+{
+    /* Match drltrace's PFX */
+    printf("0x%0*llx", (int) pointer_size * 2, val);
+}
+
+static void
+process_file(const char *path)
+{
+    drltrace_log_header_t header;
+    unsigned char *slots;
+    size_t slots_size;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        fatal("failed to open", path);
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, DRLTRACE_LOG_MAGIC, sizeof(header.magic)) != 0)
+        fatal("not a drltrace binary log", path);
+    if (header.version != DRLTRACE_LOG_VERSION)
+        fatal("unsupported drltrace log version", path);
+    if (header.pointer_size != 4 && header.pointer_size != 8)
+        fatal("invalid pointer size", path);
+    slots_size = (size_t) (1 + header.num_args) * header.pointer_size;
+    slots = (unsigned char *) malloc(slots_size);
+    if (slots == NULL)
+        fatal("out of memory", path);
+    /* Ids are per process, and each log file is one process. */
+    free_names();
+    for (;;) {
+        union {
+            unsigned int type;
+            drltrace_export_entry_t exp;
+            drltrace_call_entry_t call;
+        } entry;
+        if (fread(&entry, sizeof(entry), 1, f) != 1)
+            break;
+        if (entry.type == DRLTRACE_ENTRY_EXPORT) {
+            char *name = (char *) malloc(entry.exp.name_length + 1);
+            if (name == NULL)
+                fatal("out of memory", path);
+            if (entry.exp.name_length > 0 &&
+                fread(name, entry.exp.name_length, 1, f) != 1)
+                fatal("truncated export entry", path);
+            name[entry.exp.name_length] = '\0';
+            set_name(entry.exp.id, name);
+        } else if (entry.type == DRLTRACE_ENTRY_CALL) {
+            unsigned int i;
+            if (fread(slots, slots_size, 1, f) != 1)
+                fatal("truncated call entry", path);
+            if (show_thread)
+                printf("%u ", entry.call.thread_id);
+            if (entry.call.id < names_capacity && names[entry.call.id] != NULL)
+                printf("%s", names[entry.call.id]);
+            else
+                printf("<unknown export %u>", entry.call.id);
+            if (header.num_args > 0) {
+                printf("(");
+                for (i = 0; i < entry.call.valid_args && i < header.num_args; i++) {
+                    printf("%s", i != 0 ? ", " : "");
+                    print_slot(read_slot(slots + (1 + i) * header.pointer_size,
+                                         header.pointer_size), header.pointer_size);
+                }
+                if (entry.call.valid_args < header.num_args)
+                    printf("<invalid memory>");
+                printf(")");
+            }
+            if (show_retaddr) {
+                printf(" from ");
+                print_slot(read_slot(slots, header.pointer_size), header.pointer_size);
+            }
+            printf("\n");
+        } else
+            fatal("corrupt log entry", path);
+    }
+    free(slots);
+    fclose(f);
+}
+
+int
+main(int argc, const char *argv[])
+{
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-show_thread") == 0)
+            show_thread = 1;
+        else if (strcmp(argv[i], "-show_retaddr") == 0)
+            show_retaddr = 1;
+        else
+            usage("invalid option");
+    }
+    if (i == argc)
+        usage("no log file specified");
+    for (; i < argc; i++)
+        process_file(argv[i]);
+    free_names();
+    return 0;
+}
@@ -1,5 +1,5 @@
 # **********************************************************
-# Copyright (c) 2013 Google, Inc.    All rights reserved.
+# Copyright (c) 2013-2016 Google, Inc.    All rights reserved.
 # Copyright (c) 2010 VMware, Inc.    All rights reserved.
 # **********************************************************
 
@@ -58,6 +58,23 @@ set(app_out "${cmd_out}${cmd_err}")
 string(REGEX MATCHALL "~~~~[^\n]*\n" tool_out "${app_out}")
 string(REGEX REPLACE "~~~~[^\n]*\n" "" app_out "${app_out}")
 
+# With -binary, postcmd is drltrace2text, which renders the log files without
+# the prefix, so we add it back.
+if (NOT "${postcmd}" STREQUAL "")
+  file(GLOB drltrace_logs "drltrace.*.log")
+  execute_process(COMMAND ${postcmd} ${drltrace_logs}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR "*** ${postcmd} failed (${cmd_result}): ${cmd_err}***\n")
+  endif (cmd_result)
+  foreach (logfile ${drltrace_logs})
+    file(REMOVE ${logfile})
+  endforeach (logfile)
+  string(REGEX REPLACE "([^\n]*\n)" "~~~~ \\1" tool_out "${cmd_out}")
+endif ()
+
 # get expected app output
 # we assume it has already been processed w/ regex => literal, etc.
 file(READ "${cmp}" str)
@@ -73,11 +90,52 @@ if (NOT "${app_out}" STREQUAL "${str}")
 endif ()
 
 # Now check tool output
-if (UNIX)
-  set(tomatch "~~~~ libc.so.*!.*printf")
-else (UNIX)
-  set(tomatch "~~~~ KERNEL32.dll!WriteFile")
-endif (UNIX)
-if (NOT "${tool_out}" MATCHES "${tomatch}" )
-  message(FATAL_ERROR "tool output ${tool_out} failed to match expected ${tomatch}")
+if ("${cmd}" MATCHES "common.libcalls")
+  # libcalls.c calls getenv() this many times.  The loader and libc may add a
+  # few calls of their own.
+  set(app_calls 100000)
+  string(REGEX MATCHALL "~~~~ [^\n]*!getenv\\(" logged "${tool_out}")
+  list(LENGTH logged num_logged)
+  if ("${cmd}" MATCHES "[; ]-first[; ]")
+    # -first 2 -sample 0
+    if (NOT num_logged EQUAL 2)
+      message(FATAL_ERROR "-first logged ${num_logged} getenv calls, expected 2")
+    endif ()
+  elseif ("${cmd}" MATCHES "[; ]-sample[; ]1000")
+    if (num_logged LESS 100 OR num_logged GREATER 110)
+      message(FATAL_ERROR "-sample logged ${num_logged} getenv calls, expected ~100")
+    endif ()
+  elseif (NOT num_logged EQUAL 0)
+    message(FATAL_ERROR "-sample 0 logged ${num_logged} getenv calls")
+  endif ()
+  if ("${cmd}" MATCHES "[; ]-summary")
+    # The inline counter keeps counting after -max_rate stops wrapping, and the
+    # callers are recorded whether or not a call is logged.
+    if (NOT "${tool_out}" MATCHES
+        "~~~~ +([0-9]+) [^\n]*!getenv([^\n]*)\n~~~~ +([0-9]+) from [^\n]*libcalls")
+      message(FATAL_ERROR "summary ${tool_out} is missing getenv or its caller")
+    endif ()
+    set(count ${CMAKE_MATCH_1})
+    set(suffix "${CMAKE_MATCH_2}")
+    if (count LESS app_calls)
+      message(FATAL_ERROR "summary counted ${count} getenv calls, expected ${app_calls}")
+    endif ()
+    if ("${cmd}" MATCHES "[; ]-max_rate[; ]")
+      set(tomatch " \\(stopped wrapping after 1024 calls\\)")
+    else ()
+      set(tomatch "^$")
+    endif ()
+    if (NOT "${suffix}" MATCHES "${tomatch}")
+      message(FATAL_ERROR "summary entry for getenv has \"${suffix}\"")
+    endif ()
+  endif ()
+else ()
+  if (UNIX)
+    set(tomatch "~~~~ libc.so.*!.*printf")
+  else (UNIX)
+    set(tomatch "~~~~ KERNEL32.dll!WriteFile")
+  endif (UNIX)
+  if (NOT "${tool_out}" MATCHES "${tomatch}" )
+    message(FATAL_ERROR "tool output ${tool_out} failed to match expected ${tomatch}")
+  endif ()
 endif ()
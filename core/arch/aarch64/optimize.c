@@ -32,12 +32,8 @@
 
 #include "../globals.h"
 
-#ifdef INTERNAL
-
 void
 optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 {
     ASSERT_NOT_IMPLEMENTED(false); /* FIXME i#1569 */
 }
-
-#endif
@@ -165,6 +165,8 @@ typedef struct _local_state_t {
 typedef struct _local_state_extended_t {
     spill_state_t spill_space;
     table_stat_state_t table_space;
+    /* -ret_shadow_stack: top entry of this thread's return shadow stack */
+    byte *ret_shadow_sp;
 } local_state_extended_t;
 
 /* local_state_[extended_]t is allocated in os-specific thread-local storage (TLS),
@@ -210,6 +212,15 @@ typedef struct _local_state_extended_t {
                                   + offsetof(table_stat_state_t, table[btype])  \
                                   + offsetof(lookup_table_access_t, lookuptable)))
 
+#define TLS_RET_SHADOW_SP_SLOT   ((ushort)offsetof(local_state_extended_t, ret_shadow_sp))
+
+/* -ret_shadow_stack: each thread's return shadow stack is a ring of
+ * {app return address, cache pc to return to} entries that the mangled code
+ * walks with 16-bit lea, so it is 64KB in size and in alignment.
+ */
+#define RET_SHADOW_STACK_SIZE    (64*1024)
+#define RET_SHADOW_ENTRY_SIZE    (2*sizeof(app_pc))
+
 #ifdef HASHTABLE_STATISTICS
 # define TLS_HTABLE_STATS_SLOT   ((ushort)(offsetof(local_state_extended_t,     \
                                                     table_space)                \
@@ -1808,16 +1819,30 @@ is_jmp_rel8(byte *code_buf, app_pc app_loc, app_pc *jmp_target /* OUT */);
  */
 #define TRACE_CTI_MANGLE_SIZE_UPPER_BOUND 72
 
+/* Upper bound for -ib_inline_targets: keeps each inlined check's jecxz within
+ * short-jump range of its landing pad past the indirect branch exit.
+ */
+#define MAX_IB_INLINE_TARGETS 4
+
 fragment_t *
 build_basic_block_fragment(dcontext_t *dcontext, app_pc start_pc,
                            uint initial_flags, bool linked, bool visible
                            _IF_CLIENT(bool for_trace)
                            _IF_CLIENT(instrlist_t **unmangled_ilist));
 
+fragment_t *
+build_basic_block_fragment_parallel(dcontext_t *dcontext, app_pc start_pc,
+                                    fragment_t *wrapper);
+
 void interp(dcontext_t *dcontext);
 uint extend_trace(dcontext_t *dcontext, fragment_t *f, linkstub_t *prev_l);
 int append_trace_speculate_last_ibl(dcontext_t *dcontext, instrlist_t *trace,
                                     app_pc speculate_next_tag, bool record_translation);
+int append_ib_inline_targets(dcontext_t *dcontext, instrlist_t *ilist,
+                             /*IN/OUT*/uint *flags, app_pc site,
+                             bool record_translation);
+linkstub_t *get_ib_inline_targets(dcontext_t *dcontext, fragment_t *f,
+                                  /*OUT*/app_pc *targets, /*OUT*/uint *num_targets);
 
 uint
 forward_eflags_analysis(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr);
@@ -1874,12 +1899,15 @@ expand_should_set_translation(dcontext_t *dcontext);
  *   check selfmod and native_exec for elision, but otherwise will
  *   follow ubrs to the limit.  Currently used for
  *   record_translation_info() (case 3559).
+ * If ret_shadow_stack is true, adds the -ret_shadow_stack code that building
+ * the bb for the code cache would.
  */
 instrlist_t * recreate_bb_ilist(dcontext_t *dcontext, byte *pc, byte *pretend_pc,
                                 app_pc stop_pc/*optional, only for full_decode*/,
                                 uint flags,
                                 uint *res_flags, uint *res_exit_type,
-                                bool check_vm_area, bool mangle, void **vmlist
+                                bool check_vm_area, bool mangle,
+                                bool ret_shadow_stack, void **vmlist
                                 _IF_CLIENT(bool call_client)
                                 _IF_CLIENT(bool for_trace));
 
@@ -2021,6 +2049,13 @@ bool is_observed_call_site(dcontext_t *dcontext, app_pc retaddr);
 
 /* in optimize.c */
 void optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
+#define OPT_TRACE_LEVEL_MAX 3
+/* -opt_trace_level only takes effect under -opt_speed */
+#define OPT_TRACE_LEVEL() \
+    (DYNAMO_OPTION(opt_speed) ? DYNAMO_OPTION(opt_trace_level) : 0)
+/* whether new traces are passed through optimize_trace() */
+#define TRACE_OPTIMIZE_ENABLED() \
+    (IF_INTERNAL(dynamo_options.optimize ||) OPT_TRACE_LEVEL() > 0)
 #ifdef DEBUG
 void print_optimization_stats(void);
 #endif
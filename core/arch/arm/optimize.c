@@ -35,9 +35,7 @@
  * routines to support optimization of traces
  */
 
-#include "../globals.h"   /* just to disable warning C4206 about an empty file */
-
-#ifdef INTERNAL /* around whole file */
+#include "../globals.h"
 
 void
 optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
@@ -45,5 +43,3 @@ optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     /* FIXME i#1551: NYI on ARM */
     ASSERT_NOT_IMPLEMENTED(false);
 }
-
-#endif /* INTERNAL around whole file */
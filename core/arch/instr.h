@@ -188,10 +188,22 @@ enum {
     INSTR_HAS_CUSTOM_STUB       = 0x00400000,
     /* used to indicate that an indirect call can be treated as a direct call */
     INSTR_IND_CALL_DIRECT       = 0x00800000,
+    /* Marks one of our spills whose restore the trace optimizer removed as
+     * dead (remove_dead_spills()), so the app value stays in its slot past
+     * the end of the mangling region.  Spills are never calls, so it can
+     * share a bit with INSTR_IND_CALL_DIRECT.
+     */
+    INSTR_SPILL_CARRIED         = 0x00800000,
 #ifdef WINDOWS
     /* used to indicate that a syscall should be executed via shared syscall */
     INSTR_SHARED_SYSCALL        = 0x01000000,
 #endif
+    /* Case 9581: marks our push of a call's return address, whose immediate
+     * must be rebased if a persisted coarse unit is loaded at a new base.
+     * It is only set on our own mangling and never on a syscall, so it can
+     * share a bit with INSTR_SHARED_SYSCALL.
+     */
+    INSTR_RETADDR_PUSH          = 0x01000000,
 
 #ifdef CLIENT_INTERFACE
     INSTR_CLOBBER_RETADDR       = 0x02000000,
@@ -87,7 +87,8 @@
 instr_t*
 instr_create(dcontext_t *dcontext)
 {
-    instr_t *instr = (instr_t*) heap_alloc(dcontext, sizeof(instr_t) HEAPACCT(ACCT_IR));
+    instr_t *instr = (instr_t*)
+        heap_ir_alloc(dcontext, sizeof(instr_t) HEAPACCT(ACCT_IR));
     /* everything initializes to 0, even flags, to indicate
      * an uninitialized instruction */
     memset((void *)instr, 0, sizeof(instr_t));
@@ -106,14 +107,15 @@ instr_destroy(dcontext_t *dcontext, instr_t *instr)
     instr_free(dcontext, instr);
 
     /* CAUTION: assumes that instr is not part of any instrlist */
-    heap_free(dcontext, instr, sizeof(instr_t) HEAPACCT(ACCT_IR));
+    heap_ir_free(dcontext, instr, sizeof(instr_t) HEAPACCT(ACCT_IR));
 }
 
 /* returns a clone of orig, but with next and prev fields set to NULL */
 instr_t *
 instr_clone(dcontext_t *dcontext, instr_t *orig)
 {
-    instr_t *instr = (instr_t*) heap_alloc(dcontext, sizeof(instr_t) HEAPACCT(ACCT_IR));
+    instr_t *instr = (instr_t*)
+        heap_ir_alloc(dcontext, sizeof(instr_t) HEAPACCT(ACCT_IR));
     memcpy((void *)instr, (void *)orig, sizeof(instr_t));
     instr->next = NULL;
     instr->prev = NULL;
@@ -126,8 +128,8 @@ instr_clone(dcontext_t *dcontext, instr_t *orig)
 
     if ((orig->flags & INSTR_RAW_BITS_ALLOCATED) != 0) {
         /* instr length already set from memcpy */
-        instr->bytes = (byte *) heap_alloc(dcontext, instr->length
-                                           HEAPACCT(ACCT_IR));
+        instr->bytes = (byte *) heap_ir_alloc(dcontext, instr->length
+                                              HEAPACCT(ACCT_IR));
         memcpy((void *)instr->bytes, (void *)orig->bytes, instr->length);
     }
 #ifdef CUSTOM_EXIT_STUBS
@@ -140,13 +142,13 @@ instr_clone(dcontext_t *dcontext, instr_t *orig)
     else /* disable normal dst cloning */
 #endif
     if (orig->num_dsts > 0) { /* checking num_dsts, not dsts, b/c of label data */
-        instr->dsts = (opnd_t *) heap_alloc(dcontext, instr->num_dsts*sizeof(opnd_t)
+        instr->dsts = (opnd_t *) heap_ir_alloc(dcontext, instr->num_dsts*sizeof(opnd_t)
                                           HEAPACCT(ACCT_IR));
         memcpy((void *)instr->dsts, (void *)orig->dsts,
                instr->num_dsts*sizeof(opnd_t));
     }
     if (orig->num_srcs > 1) { /* checking num_src, not srcs, b/c of label data */
-        instr->srcs = (opnd_t *) heap_alloc(dcontext,
+        instr->srcs = (opnd_t *) heap_ir_alloc(dcontext,
                                           (instr->num_srcs-1)*sizeof(opnd_t)
                                           HEAPACCT(ACCT_IR));
         memcpy((void *)instr->srcs, (void *)orig->srcs,
@@ -174,7 +176,7 @@ void
 instr_free(dcontext_t *dcontext, instr_t *instr)
 {
     if ((instr->flags & INSTR_RAW_BITS_ALLOCATED) != 0) {
-        heap_free(dcontext, instr->bytes, instr->length HEAPACCT(ACCT_IR));
+        heap_ir_free(dcontext, instr->bytes, instr->length HEAPACCT(ACCT_IR));
         instr->bytes = NULL;
         instr->flags &= ~INSTR_RAW_BITS_ALLOCATED;
     }
@@ -188,15 +190,15 @@ instr_free(dcontext_t *dcontext, instr_t *instr)
     }
 #endif
     if (instr->num_dsts > 0) { /* checking num_dsts, not dsts, b/c of label data */
-        heap_free(dcontext, instr->dsts, instr->num_dsts*sizeof(opnd_t)
-                  HEAPACCT(ACCT_IR));
+        heap_ir_free(dcontext, instr->dsts, instr->num_dsts*sizeof(opnd_t)
+                     HEAPACCT(ACCT_IR));
         instr->dsts = NULL;
         instr->num_dsts = 0;
     }
     if (instr->num_srcs > 1) { /* checking num_src, not src, b/c of label data */
         /* remember one src is static, rest are dynamic */
-        heap_free(dcontext, instr->srcs, (instr->num_srcs-1)*sizeof(opnd_t)
-                  HEAPACCT(ACCT_IR));
+        heap_ir_free(dcontext, instr->srcs, (instr->num_srcs-1)*sizeof(opnd_t)
+                     HEAPACCT(ACCT_IR));
         instr->srcs = NULL;
         instr->num_srcs = 0;
     }
@@ -327,8 +329,8 @@ private_instr_encode(dcontext_t *dcontext, instr_t *instr, bool always_cache)
     /* we cannot use a stack buffer for encoding since our stack on x64 linux
      * can be too far to reach from our heap
      */
-    byte *buf = heap_alloc(dcontext, 32 /* max instr length is 17 bytes */
-                           HEAPACCT(ACCT_IR));
+    byte *buf = heap_ir_alloc(dcontext, 32 /* max instr length is 17 bytes */
+                              HEAPACCT(ACCT_IR));
     uint len;
     /* Do not cache instr opnds as they are pc-relative to final encoding location.
      * Rather than us walking all of the operands separately here, we have
@@ -344,7 +346,7 @@ private_instr_encode(dcontext_t *dcontext, instr_t *instr, bool always_cache)
             SYSLOG_INTERNAL_WARNING("cannot encode %s", opcode_to_encoding_info
                                     (instr->opcode, instr_get_isa_mode(instr)
                                      _IF_ARM(false))->name);
-            heap_free(dcontext, buf, 32 HEAPACCT(ACCT_IR));
+            heap_ir_free(dcontext, buf, 32 HEAPACCT(ACCT_IR));
             return 0;
         }
         /* if unreachable, we can't cache, since re-relativization won't work */
@@ -392,7 +394,7 @@ private_instr_encode(dcontext_t *dcontext, instr_t *instr, bool always_cache)
         instr->bytes = tmp;
         instr_set_operands_valid(instr, valid);
     }
-    heap_free(dcontext, buf, 32 HEAPACCT(ACCT_IR));
+    heap_ir_free(dcontext, buf, 32 HEAPACCT(ACCT_IR));
     return len;
 }
 
@@ -533,7 +535,7 @@ instr_set_num_opnds(dcontext_t *dcontext,
         CLIENT_ASSERT_TRUNCATE(instr->num_dsts, byte, instr_num_dsts,
                                "instr_set_num_opnds: too many dsts");
         instr->num_dsts = (byte) instr_num_dsts;
-        instr->dsts = (opnd_t *) heap_alloc(dcontext, instr_num_dsts*sizeof(opnd_t)
+        instr->dsts = (opnd_t *) heap_ir_alloc(dcontext, instr_num_dsts*sizeof(opnd_t)
                                           HEAPACCT(ACCT_IR));
     }
     if (instr_num_srcs > 0) {
@@ -541,8 +543,9 @@ instr_set_num_opnds(dcontext_t *dcontext,
         if (instr_num_srcs > 1) {
             CLIENT_ASSERT(instr->num_srcs <= 1 && instr->srcs == NULL,
                           "instr_set_num_opnds: srcs are already set");
-            instr->srcs = (opnd_t *) heap_alloc(dcontext, (instr_num_srcs-1)*sizeof(opnd_t)
-                                              HEAPACCT(ACCT_IR));
+            instr->srcs = (opnd_t *)
+                heap_ir_alloc(dcontext, (instr_num_srcs-1)*sizeof(opnd_t)
+                              HEAPACCT(ACCT_IR));
         }
         CLIENT_ASSERT_TRUNCATE(instr->num_srcs, byte, instr_num_srcs,
                                "instr_set_num_opnds: too many srcs");
@@ -602,8 +605,8 @@ instr_remove_srcs(dcontext_t *dcontext, instr_t *instr, uint start, uint end)
         new_srcs = NULL;
     if (start == 0 && end < instr->num_srcs)
         instr->src0 = instr->srcs[end - 1];
-    heap_free(dcontext, instr->srcs, (instr->num_srcs-1)*sizeof(opnd_t)
-              HEAPACCT(ACCT_IR));
+    heap_ir_free(dcontext, instr->srcs, (instr->num_srcs-1)*sizeof(opnd_t)
+                 HEAPACCT(ACCT_IR));
     instr->num_srcs -= (byte)(end - start);
     instr->srcs = new_srcs;
     instr_being_modified(instr, false/*raw bits invalid*/);
@@ -628,7 +631,7 @@ instr_remove_dsts(dcontext_t *dcontext, instr_t *instr, uint start, uint end)
         }
     } else
         new_dsts = NULL;
-    heap_free(dcontext, instr->dsts, instr->num_dsts*sizeof(opnd_t) HEAPACCT(ACCT_IR));
+    heap_ir_free(dcontext, instr->dsts, instr->num_dsts*sizeof(opnd_t) HEAPACCT(ACCT_IR));
     instr->num_dsts -= (byte)(end - start);
     instr->dsts = new_dsts;
     instr_being_modified(instr, false/*raw bits invalid*/);
@@ -1078,7 +1081,7 @@ instr_free_raw_bits(dcontext_t *dcontext, instr_t *instr)
 {
     if ((instr->flags & INSTR_RAW_BITS_ALLOCATED) == 0)
         return;
-    heap_free(dcontext, instr->bytes, instr->length HEAPACCT(ACCT_IR));
+    heap_ir_free(dcontext, instr->bytes, instr->length HEAPACCT(ACCT_IR));
     instr->flags &= ~INSTR_RAW_BITS_VALID;
     instr->flags &= ~INSTR_RAW_BITS_ALLOCATED;
 }
@@ -1095,7 +1098,7 @@ instr_allocate_raw_bits(dcontext_t *dcontext, instr_t *instr, uint num_bytes)
         original_bits = instr->bytes;
     if ((instr->flags & INSTR_RAW_BITS_ALLOCATED) == 0 ||
         instr->length != num_bytes) {
-        byte * new_bits = (byte *) heap_alloc(dcontext, num_bytes HEAPACCT(ACCT_IR));
+        byte * new_bits = (byte *) heap_ir_alloc(dcontext, num_bytes HEAPACCT(ACCT_IR));
         if (original_bits != NULL) {
             /* copy original bits into modified bits so can just modify
              * a few and still have all info in one place
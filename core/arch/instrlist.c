@@ -58,7 +58,7 @@
 instrlist_t*
 instrlist_create(dcontext_t *dcontext)
 {
-    instrlist_t *ilist = (instrlist_t*) heap_alloc(dcontext, sizeof(instrlist_t)
+    instrlist_t *ilist = (instrlist_t*) heap_ir_alloc(dcontext, sizeof(instrlist_t)
                                                HEAPACCT(ACCT_IR));
     CLIENT_ASSERT(ilist != NULL, "instrlist_create: allocation error");
     instrlist_init(ilist);
@@ -84,7 +84,7 @@ instrlist_destroy(dcontext_t *dcontext, instrlist_t *ilist)
 {
     CLIENT_ASSERT(ilist->first == NULL && ilist->last == NULL,
                   "instrlist_destroy: list not empty");
-    heap_free(dcontext, ilist, sizeof(instrlist_t) HEAPACCT(ACCT_IR));
+    heap_ir_free(dcontext, ilist, sizeof(instrlist_t) HEAPACCT(ACCT_IR));
 }
 
 /* frees the Instrs in the instrlist_t */
@@ -189,6 +189,7 @@ typedef struct {
     app_pc stop_pc;          /* Optional: NULL for normal termination rules.
                               * Only checked for full_decode.
                               */
+    bool ret_shadow_stack;   /* add -ret_shadow_stack code, if shared? */
 #ifdef CLIENT_INTERFACE
     bool pass_to_client;     /* pass to client, if a bb hook exists;
                               * we store this up front to avoid race conditions
@@ -254,6 +255,7 @@ init_build_bb(build_bb_t *bb, app_pc start_pc, bool app_interp, bool for_cache,
     bb->for_cache = for_cache;
     if (bb->for_cache)
         bb->record_vmlist = true;
+    bb->ret_shadow_stack = for_cache;
     bb->mangle_ilist = mangle_ilist;
     bb->record_translation = record_translation;
     bb->outf = outf;
@@ -331,6 +333,21 @@ mangle_bb_ilist(dcontext_t *dcontext, build_bb_t *bb);
 static void
 build_native_exec_bb(dcontext_t *dcontext, build_bb_t *bb);
 
+static void
+recreate_ib_inline_targets(dcontext_t *dcontext, fragment_t *f, instrlist_t *ilist);
+
+static bool
+ret_shadow_stack_bb(dcontext_t *dcontext, build_bb_t *bb);
+
+static instrlist_t *
+insert_ret_shadow_pushes(dcontext_t *dcontext, instrlist_t *ilist,
+                         bool record_translation, /*OUT*/uint *num_calls,
+                         /*OUT*/bool *ends_in_ret);
+
+static bool
+append_ret_shadow_stack(dcontext_t *dcontext, instrlist_t *ilist, instrlist_t *pads,
+                        bool ends_in_ret, bool record_translation);
+
 static bool
 at_native_exec_gateway(dcontext_t *dcontext, app_pc start, bool *is_call
                        _IF_DEBUG(bool xfer_target));
@@ -3210,6 +3227,9 @@ build_bb_ilist(dcontext_t *dcontext, build_bb_t *bb)
     uint eflags_6 = 0; /* holds arith eflags written so far (in read slots) */
 #ifdef HOT_PATCHING_INTERFACE
     bool hotp_should_inject = false, hotp_injected = false;
+#endif
+#ifdef CLIENT_INTERFACE
+    bool ir_arena;
 #endif
     app_pc page_start_pc = (app_pc) NULL;
     bool bb_build_nested = false;
@@ -4080,10 +4100,13 @@ build_bb_ilist(dcontext_t *dcontext, build_bb_t *bb)
     }
 #endif
 #ifdef CLIENT_INTERFACE
+    /* IR created or kept by the client comes from the regular heap */
+    ir_arena = heap_ir_arena_set_active(dcontext, false);
     if (!client_process_bb(dcontext, bb)) {
         bb_build_abort(dcontext, true/*free vmlist*/, false/*don't unlock*/);
         return;
     }
+    heap_ir_arena_set_active(dcontext, ir_arena);
     /* i#620: provide API to set fall-through and retaddr targets at end of bb */
     if (instrlist_get_return_target(bb->ilist) != NULL ||
         instrlist_get_fall_through_target(bb->ilist) != NULL) {
@@ -4371,6 +4394,9 @@ bb_build_abort(dcontext_t *dcontext, bool clean_vmarea, bool unlock)
             instrlist_clear_and_destroy(dcontext, bb->ilist);
             DODEBUG({ bb->ilist = NULL; });
         }
+        /* We may not return to the builder to restore the arena state. */
+        if (bb->for_cache)
+            heap_ir_arena_set_active(dcontext, false);
         if (clean_vmarea) {
             /* Free the vmlist and any locks held (we could have been in
              * the middle of check_thread_vm_area and had a decode fault
@@ -4414,6 +4440,9 @@ expand_should_set_translation(dcontext_t *dcontext)
 static bool
 mangle_bb_ilist(dcontext_t *dcontext, build_bb_t *bb)
 {
+    instrlist_t *ret_shadow_pads = NULL;
+    uint ret_shadow_calls = 0;
+    bool ret_shadow, ends_in_ret = false;
 #ifdef X86
     if (TEST(FRAG_SELFMOD_SANDBOXED, bb->flags)) {
         byte *selfmod_start, *selfmod_end;
@@ -4466,7 +4495,31 @@ mangle_bb_ilist(dcontext_t *dcontext, build_bb_t *bb)
         LOG(THREAD, LOG_INTERP, 4, "bb ilist before mangling:\n");
         instrlist_disassemble(dcontext, bb->start_pc, bb->ilist, THREAD);
     });
+    ret_shadow = ret_shadow_stack_bb(dcontext, bb);
+    if (ret_shadow) {
+        ret_shadow_pads = insert_ret_shadow_pushes(dcontext, bb->ilist,
+                                                   bb->record_translation,
+                                                   &ret_shadow_calls, &ends_in_ret);
+    }
     mangle(dcontext, bb->ilist, &bb->flags, true, bb->record_translation);
+    if (ret_shadow) {
+        bool checked = append_ret_shadow_stack(dcontext, bb->ilist, ret_shadow_pads,
+                                               ends_in_ret, bb->record_translation);
+        if (bb->for_cache) {
+            STATS_ADD(num_ret_shadow_calls, ret_shadow_calls);
+            if (checked)
+                STATS_INC(num_ret_shadow_rets);
+        }
+    }
+    /* Only shared bbs get inlined targets: the private copies of them that
+     * traces are built from must keep a plain final exit.
+     */
+    if (DYNAMO_OPTION(ib_inline_targets) > 0 && bb->for_cache &&
+        TEST(FRAG_SHARED, bb->flags) &&
+        !TESTANY(FRAG_COARSE_GRAIN|FRAG_SELFMOD_SANDBOXED, bb->flags)) {
+        append_ib_inline_targets(dcontext, bb->ilist, &bb->flags, bb->start_pc,
+                                 bb->record_translation);
+    }
     DOLOG(4, LOG_INTERP, {
         LOG(THREAD, LOG_INTERP, 4, "bb ilist after mangling:\n");
         instrlist_disassemble(dcontext, bb->start_pc, bb->ilist, THREAD);
@@ -4956,16 +5009,19 @@ at_native_exec_gateway(dcontext_t *dcontext, app_pc start, bool *is_call
 }
 
 /* Use when calling build_bb_ilist with for_cache = true.
- * Must hold bb_building_lock.
+ * Must hold bb_building_lock, unless !have_lock for -parallel_bb_build,
+ * in which case the caller acquires it before emitting.
  */
 static inline void
 init_interp_build_bb(dcontext_t *dcontext, build_bb_t *bb, app_pc start,
-                     uint initial_flags
+                     uint initial_flags, bool have_lock
                      _IF_CLIENT(bool for_trace)
                      _IF_CLIENT(instrlist_t **unmangled_ilist))
 {
-    ASSERT_OWN_MUTEX(USE_BB_BUILDING_LOCK() && !TEST(FRAG_TEMP_PRIVATE, initial_flags),
+    ASSERT_OWN_MUTEX(have_lock && USE_BB_BUILDING_LOCK() &&
+                     !TEST(FRAG_TEMP_PRIVATE, initial_flags),
                      &bb_building_lock);
+    ASSERT_DO_NOT_OWN_MUTEX(!have_lock && USE_BB_BUILDING_LOCK(), &bb_building_lock);
     /* We need to set up for abort prior to native exec and other checks
      * that can crash */
     ASSERT(dcontext->bb_build_info == NULL);
@@ -4978,7 +5034,7 @@ init_interp_build_bb(dcontext_t *dcontext, build_bb_t *bb, app_pc start,
                   INVALID_FILE, initial_flags |
                   (INTERNAL_OPTION(store_translations) ?
                    FRAG_HAS_TRANSLATION_INFO : 0), NULL/*no overlap*/);
-    if (!TEST(FRAG_TEMP_PRIVATE, initial_flags))
+    if (have_lock && !TEST(FRAG_TEMP_PRIVATE, initial_flags))
         bb->has_bb_building_lock = true;
 #ifdef CLIENT_INTERFACE
     /* We avoid races where there is no hook when we start building a
@@ -5041,81 +5097,75 @@ exit_interp_build_bb(dcontext_t *dcontext, build_bb_t *bb)
     instrlist_clear_and_destroy(dcontext, bb->ilist);
 }
 
-/* Interprets the application's instructions until the end of a basic
- * block is found, and then creates a fragment for the basic block.
- * DOES NOT look in the hashtable to see if such a fragment already exists!
+/* Sets up bb for start and fills in its ilist.  Returns false if we are going
+ * native instead, in which case there is nothing to emit.
  */
-fragment_t *
-build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flags,
-                           bool link, bool visible _IF_CLIENT(bool for_trace)
-                           _IF_CLIENT(instrlist_t **unmangled_ilist))
+static bool
+build_bb_ilist_for_cache(dcontext_t *dcontext, build_bb_t *bb, app_pc start,
+                         uint initial_flags, bool have_lock
+                         _IF_CLIENT(bool for_trace)
+                         _IF_CLIENT(instrlist_t **unmangled_ilist))
 {
-    fragment_t *f;
-    build_bb_t bb;
-    where_am_i_t wherewasi = dcontext->whereami;
-    bool image_entry;
-    KSTART(bb_building);
-    dcontext->whereami = WHERE_INTERP;
-
-    /* Neither thin_client nor hotp_only should be building any bbs. */
-    ASSERT(!RUNNING_WITHOUT_CODE_CACHE());
-
-    /* ASSUMPTION: image entry is reached via indirect transfer and
-     * so will be the start of a bb
-     */
-    image_entry = check_for_image_entry(start);
-
-    init_interp_build_bb(dcontext, &bb, start, initial_flags
+    init_interp_build_bb(dcontext, bb, start, initial_flags, have_lock
                          _IF_CLIENT(for_trace) _IF_CLIENT(unmangled_ilist));
-    if (at_native_exec_gateway(dcontext, start, &bb.native_call
+    if (at_native_exec_gateway(dcontext, start, &bb->native_call
                                _IF_DEBUG(false/*not xfer tgt*/))) {
-        DODEBUG({ report_native_module(dcontext, bb.start_pc); });
+        DODEBUG({ report_native_module(dcontext, bb->start_pc); });
 #ifdef CLIENT_INTERFACE
         /* PR 232617 - build_native_exec_bb doesn't support setting translation
          * info, but it also doesn't pass the built bb to the client (it
          * contains no app code) so we don't need it. */
-        bb.record_translation = false;
+        bb->record_translation = false;
 #endif
-        build_native_exec_bb(dcontext, &bb);
+        build_native_exec_bb(dcontext, bb);
     } else {
-        build_bb_ilist(dcontext, &bb);
-        if (dcontext->bb_build_info == NULL) { /* going native */
-            f = NULL;
-            goto build_basic_block_fragment_done;
-        }
-        if (bb.native_exec) {
+        build_bb_ilist(dcontext, bb);
+        if (dcontext->bb_build_info == NULL) /* going native */
+            return false;
+        if (bb->native_exec) {
             /* change bb to be a native_exec gateway */
-            bool is_call = bb.native_call;
+            bool is_call = bb->native_call;
             LOG(THREAD, LOG_INTERP, 2, "replacing built bb with native_exec bb\n");
-            instrlist_clear_and_destroy(dcontext, bb.ilist);
-            vm_area_destroy_list(dcontext, bb.vmlist);
+            instrlist_clear_and_destroy(dcontext, bb->ilist);
+            vm_area_destroy_list(dcontext, bb->vmlist);
             dcontext->bb_build_info = NULL;
-            init_interp_build_bb(dcontext, &bb, start, initial_flags
+            init_interp_build_bb(dcontext, bb, start, initial_flags, have_lock
                                  _IF_CLIENT(for_trace) _IF_CLIENT(unmangled_ilist));
 #ifdef CLIENT_INTERFACE
             /* PR 232617 - build_native_exec_bb doesn't support setting
              * translation info, but it also doesn't pass the built bb to the
              * client (it contains no app code) so we don't need it. */
-            bb.record_translation = false;
+            bb->record_translation = false;
 #endif
-            bb.native_call = is_call;
-            build_native_exec_bb(dcontext, &bb);
+            bb->native_call = is_call;
+            build_native_exec_bb(dcontext, bb);
         }
     }
+    return true;
+}
+
+/* Emits the fragment for the ilist built by build_bb_ilist_for_cache() and
+ * frees the ilist.  Must hold bb_building_lock.
+ */
+static fragment_t *
+emit_basic_block_fragment(dcontext_t *dcontext, build_bb_t *bb, app_pc start,
+                          bool image_entry, bool link, bool visible)
+{
+    fragment_t *f;
     /* case 9652: we do not want to persist the image entry point, so we keep
      * it fine-grained
      */
     if (image_entry)
-        bb.flags &= ~FRAG_COARSE_GRAIN;
+        bb->flags &= ~FRAG_COARSE_GRAIN;
 
-    if (DYNAMO_OPTION(opt_jit) && visible && is_jit_managed_area(bb.start_pc)) {
-        ASSERT(bb.overlap_info == NULL || bb.overlap_info->contiguous);
-        jitopt_add_dgc_bb(bb.start_pc, bb.end_pc, TEST(FRAG_IS_TRACE_HEAD, bb.flags));
+    if (DYNAMO_OPTION(opt_jit) && visible && is_jit_managed_area(bb->start_pc)) {
+        ASSERT(bb->overlap_info == NULL || bb->overlap_info->contiguous);
+        jitopt_add_dgc_bb(bb->start_pc, bb->end_pc, TEST(FRAG_IS_TRACE_HEAD, bb->flags));
     }
 
     /* emit fragment into fcache */
     KSTART(bb_emit);
-    f = emit_fragment_ex(dcontext, start, bb.ilist, bb.flags, bb.vmlist, link, visible);
+    f = emit_fragment_ex(dcontext, start, bb->ilist, bb->flags, bb->vmlist, link, visible);
     KSTOP(bb_emit);
 
 #ifdef CUSTOM_TRACES_RET_REMOVAL
@@ -5150,13 +5200,102 @@ build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flag
     DODEBUG({
         if (INTERNAL_OPTION(stress_recreate_pc)) {
             /* verify recreation */
-            stress_test_recreate(dcontext, f, bb.ilist);
+            stress_test_recreate(dcontext, f, bb->ilist);
         }
     });
 #endif
 
-    exit_interp_build_bb(dcontext, &bb);
- build_basic_block_fragment_done:
+    exit_interp_build_bb(dcontext, bb);
+    return f;
+}
+
+/* Interprets the application's instructions until the end of a basic
+ * block is found, and then creates a fragment for the basic block.
+ * DOES NOT look in the hashtable to see if such a fragment already exists!
+ */
+fragment_t *
+build_basic_block_fragment(dcontext_t *dcontext, app_pc start, uint initial_flags,
+                           bool link, bool visible _IF_CLIENT(bool for_trace)
+                           _IF_CLIENT(instrlist_t **unmangled_ilist))
+{
+    fragment_t *f;
+    build_bb_t bb;
+    where_am_i_t wherewasi = dcontext->whereami;
+    bool image_entry, ir_arena;
+    KSTART(bb_building);
+    dcontext->whereami = WHERE_INTERP;
+
+    /* Neither thin_client nor hotp_only should be building any bbs. */
+    ASSERT(!RUNNING_WITHOUT_CODE_CACHE());
+
+    /* ASSUMPTION: image entry is reached via indirect transfer and
+     * so will be the start of a bb
+     */
+    image_entry = check_for_image_entry(start);
+
+    ir_arena = heap_ir_arena_set_active(dcontext, true);
+    if (build_bb_ilist_for_cache(dcontext, &bb, start, initial_flags,
+                                 true/*have lock*/
+                                 _IF_CLIENT(for_trace) _IF_CLIENT(unmangled_ilist)))
+        f = emit_basic_block_fragment(dcontext, &bb, start, image_entry, link, visible);
+    else
+        f = NULL; /* going native */
+    heap_ir_arena_set_active(dcontext, ir_arena);
+
+    dcontext->whereami = wherewasi;
+    KSTOP(bb_building);
+    return f;
+}
+
+/* For dispatch() with -parallel_bb_build: like build_basic_block_fragment()
+ * with link and visible set, but decodes, instruments, and mangles without
+ * holding the bb_building_lock, which is only acquired to look start up
+ * again and emit.  If another thread published start in the meantime, our
+ * ilist is discarded and its fragment is returned (filling in wrapper if it
+ * is coarse-grain).  Always returns with the bb_building_lock held, to be
+ * released by the caller via SHARED_BB_UNLOCK().
+ */
+fragment_t *
+build_basic_block_fragment_parallel(dcontext_t *dcontext, app_pc start,
+                                    fragment_t *wrapper)
+{
+    fragment_t *f = NULL;
+    build_bb_t bb;
+    where_am_i_t wherewasi = dcontext->whereami;
+    bool image_entry, ir_arena;
+    KSTART(bb_building);
+    dcontext->whereami = WHERE_INTERP;
+
+    ASSERT(!RUNNING_WITHOUT_CODE_CACHE());
+    ASSERT(PARALLEL_BB_BUILD());
+    image_entry = check_for_image_entry(start);
+
+    ir_arena = heap_ir_arena_set_active(dcontext, true);
+    if (!build_bb_ilist_for_cache(dcontext, &bb, start, 0, false/*no lock*/
+                                  _IF_CLIENT(false/*!for_trace*/) _IF_CLIENT(NULL))) {
+        /* going native */
+        SHARED_BB_LOCK();
+    } else {
+        SHARED_BB_LOCK();
+        /* From here on, an abort must release the lock */
+        bb.has_bb_building_lock = true;
+        f = fragment_lookup_fine_and_coarse(dcontext, start, wrapper,
+                                            dcontext->last_exit);
+        if (f != NULL) {
+            /* Duplicate builds are rare and resolved here, at publish time,
+             * rather than by reserving tags up front.
+             */
+            LOG(THREAD, LOG_INTERP, 2,
+                "bb "PFX" was published by another thread: discarding ours\n", start);
+            STATS_INC(num_bb_build_races);
+            vm_area_destroy_list(dcontext, bb.vmlist);
+            exit_interp_build_bb(dcontext, &bb);
+        } else
+            f = emit_basic_block_fragment(dcontext, &bb, start, image_entry,
+                                          true/*link*/, true/*visible*/);
+    }
+    heap_ir_arena_set_active(dcontext, ir_arena);
+
     dcontext->whereami = wherewasi;
     KSTOP(bb_building);
     return f;
@@ -5177,7 +5316,7 @@ instrlist_t *
 recreate_bb_ilist(dcontext_t *dcontext, byte *pc, byte *pretend_pc, app_pc stop_pc,
                   uint flags, uint *res_flags OUT,
                   uint *res_exit_type OUT, bool check_vm_area, bool mangle,
-                  void **vmlist_out OUT
+                  bool ret_shadow_stack, void **vmlist_out OUT
                   _IF_CLIENT(bool call_client) _IF_CLIENT(bool for_trace))
 {
     build_bb_t bb;
@@ -5198,6 +5337,7 @@ recreate_bb_ilist(dcontext_t *dcontext, byte *pc, byte *pretend_pc, app_pc stop_
      * It only applies to full_decode.
      */
     bb.stop_pc = stop_pc;
+    bb.ret_shadow_stack = ret_shadow_stack;
     bb.check_vm_area = check_vm_area;
     if (check_vm_area && vmlist_out != NULL)
         bb.record_vmlist = true;
@@ -5319,12 +5459,16 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
         ilist = recreate_bb_ilist(dcontext, (byte *) f->tag, (byte *) f->tag,
                                   NULL/*default stop*/,
                                   0/*no pre flags*/, &flags, NULL,
-                                  true/*check vm area*/, mangle, NULL
+                                  true/*check vm area*/, mangle,
+                                  /* not for private trace-building copies */
+                                  TEST(FRAG_SHARED, f->flags), NULL
                                   _IF_CLIENT(call_client)
                                   _IF_CLIENT(false/*not for_trace*/));
         ASSERT(ilist != NULL);
         if (ilist == NULL) /* a race */
             goto recreate_fragment_done;
+        if (mangle && TEST(FRAG_HAS_INLINED_IB, f->flags))
+            recreate_ib_inline_targets(dcontext, f, ilist);
         if (PAD_FRAGMENT_JMPS(f->flags))
             nop_pad_ilist(dcontext, f, ilist, false /* set translation */);
         goto recreate_fragment_done;
@@ -5361,6 +5505,8 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
                                    0/*no pre flags*/,
                                    &flags, &md.final_exit_flags,
                                    true/*check vm area*/, !mangle_at_end,
+                                   /* traces are built from private copies */
+                                   false/*no -ret_shadow_stack*/,
                                    (mangle_at_end ? &vmlist : NULL)
                                    _IF_CLIENT(call_client)
                                    _IF_CLIENT(true/*for_trace*/));
@@ -5446,16 +5592,21 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
                 }
             } /* else we mangled one bb at a time up above */
 
-#ifdef INTERNAL
-            /* we only optimize traces */
-            if (dynamo_options.optimize) {
+            /* we only optimize traces, and not ones still waiting on
+             * -optimize_async
+             */
+            if (TRACE_OPTIMIZE_ENABLED()
+# ifdef CLIENT_SIDELINE
+                && !TRACE_FIELDS(f)->opt_deferred
+# endif
+                ) {
                 /* re-apply all optimizations to ilist
                  * assumption: all optimizations are deterministic and stateless,
                  * so we can exactly replicate their results
                  */
                 LOG(THREAD_GET, LOG_INTERP, 2,
                     "\tre-applying optimizations to F%d\n", f->id);
-# ifdef SIDELINE
+# if defined(INTERNAL) && defined(SIDELINE)
                 if (dynamo_options.sideline) {
                     if (!TEST(FRAG_DO_NOT_SIDELINE, f->flags))
                         optimize_trace(dcontext, f->tag, ilist);
@@ -5464,7 +5615,9 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
 # endif
                     optimize_trace(dcontext, f->tag, ilist);
             }
-#endif
+
+            if (TEST(FRAG_HAS_INLINED_IB, f->flags))
+                recreate_ib_inline_targets(dcontext, f, ilist);
 
             /* FIXME: case 4718 append_trace_speculate_last_ibl(true)
              * should be called as well
@@ -6460,6 +6613,500 @@ append_trace_speculate_last_ibl(dcontext_t *dcontext, instrlist_t *trace,
     return added_size;
 }
 
+/* -ib_inline_targets: restores the app's XCX at an inlined target's landing
+ * pad, from wherever the indirect branch mangling saved it for flags.
+ */
+static instr_t *
+ib_inline_restore_xcx(dcontext_t *dcontext, uint flags)
+{
+    if (DYNAMO_OPTION(private_ib_in_tls) || TEST(FRAG_SHARED, flags)) {
+        return instr_create_restore_from_tls(dcontext, SCRATCH_REG2,
+                                             MANGLE_XCX_SPILL_SLOT);
+    }
+    return instr_create_restore_from_dcontext(dcontext, SCRATCH_REG2,
+                                              SCRATCH_REG2_OFFS);
+}
+
+/* Adds delta to XCX without touching eflags, going through XAX when delta
+ * does not fit in a displacement.  Returns size to be added to the fragment.
+ */
+static int
+ib_inline_add_to_xcx(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                     ptr_int_t delta)
+{
+    int added_size = 0;
+#ifdef X64
+    if (!CHECK_TRUNCATE_TYPE_int(delta)) {
+        added_size += tracelist_add(dcontext, ilist, where,
+                                    instr_create_save_to_tls(dcontext, REG_XAX,
+                                                             PREFIX_XAX_SPILL_SLOT));
+        added_size += tracelist_add(dcontext, ilist, where,
+                                    INSTR_CREATE_mov_imm(dcontext,
+                                                         opnd_create_reg(REG_XAX),
+                                                         OPND_CREATE_INTPTR(delta)));
+        added_size += tracelist_add(dcontext, ilist, where,
+                                    INSTR_CREATE_lea
+                                    (dcontext, opnd_create_reg(REG_XCX),
+                                     opnd_create_base_disp(REG_XCX, REG_XAX, 1, 0,
+                                                           OPSZ_lea)));
+        added_size += tracelist_add(dcontext, ilist, where,
+                                    instr_create_restore_from_tls(dcontext, REG_XAX,
+                                                                  PREFIX_XAX_SPILL_SLOT));
+        return added_size;
+    }
+#endif
+    added_size += tracelist_add(dcontext, ilist, where,
+                                INSTR_CREATE_lea
+                                (dcontext, opnd_create_reg(REG_XCX),
+                                 opnd_create_base_disp(REG_XCX, REG_NULL, 0, (int) delta,
+                                                       OPSZ_lea)));
+    return added_size;
+}
+
+/* Inserts a check for each of targets ahead of the indirect branch exit that
+ * ends ilist, and a direct exit for each after it.  XCX holds the branch
+ * target, so, like insert_transparent_comparison(), each check subtracts the
+ * distance to its target with lea and jecxz's to a landing pad that restores
+ * the app's XCX and exits directly; if none match, XCX is restored to the
+ * target for the ibl:
+ *
+ *    lea    -t1(%xcx) -> %xcx    # via %xax if t1 does not fit in 32 bits
+ *    jecxz  pad1
+ *    lea    -(t2-t1)(%xcx) -> %xcx
+ *    jecxz  pad2
+ *    lea    t2(%xcx) -> %xcx
+ *    jmp    <exit stub: ibl>
+ *  pad1:
+ *    <restore app xcx>
+ *    jmp    t1
+ *  pad2:
+ *    <restore app xcx>
+ *    jmp    t2
+ *
+ * Past the first, targets too far from the previous one for a single lea are
+ * dropped, keeping every jecxz in reach of its pad; recreating from the
+ * fragment's exits then reproduces the same code.  The pads share the
+ * branch's translation, and as each is only entered from its jecxz, with the
+ * app's XCX still in its slot, state translation re-marks XCX as spilled past
+ * each preceding jmp (see translate_walk_jump_target()).
+ * Returns size to be added to the fragment and sets *num_inlined.
+ */
+static int
+insert_ib_inline_targets(dcontext_t *dcontext, instrlist_t *ilist, uint flags,
+                         app_pc *targets, uint num_targets, bool record_translation,
+                         /*OUT*/uint *num_inlined)
+{
+    int added_size = 0;
+#ifdef X86
+    instr_t *targeter = instrlist_last(ilist);
+    instr_t *where = targeter;
+    instr_t *pad[MAX_IB_INLINE_TARGETS];
+    app_pc inlined[MAX_IB_INLINE_TARGETS];
+    ptr_uint_t prev = 0;
+    uint i, j, num = 0;
+
+    ASSERT(num_targets <= MAX_IB_INLINE_TARGETS);
+    ASSERT(targeter != NULL && instr_is_exit_cti(targeter));
+    for (i = 0; i < num_targets; i++) {
+        if (targets[i] == NULL)
+            continue;
+        for (j = 0; j < num; j++) {
+            if (inlined[j] == targets[i])
+                break;
+        }
+        if (j < num)
+            continue;
+        if (num > 0 &&
+            !CHECK_TRUNCATE_TYPE_int((ptr_int_t)((ptr_uint_t)targets[i] - prev)))
+            continue;
+        inlined[num++] = targets[i];
+        prev = (ptr_uint_t) targets[i];
+    }
+    *num_inlined = num;
+    if (num == 0)
+        return 0;
+
+    if (record_translation)
+        instrlist_set_translation_target(ilist, instr_get_translation(targeter));
+    instrlist_set_our_mangling(ilist, true); /* PR 267260 */
+    prev = 0;
+    for (i = 0; i < num; i++) {
+        instr_t *jecxz;
+        pad[i] = ib_inline_restore_xcx(dcontext, flags);
+        added_size += ib_inline_add_to_xcx(dcontext, ilist, targeter, (ptr_int_t)
+                                           (prev - (ptr_uint_t)inlined[i]));
+        jecxz = INSTR_CREATE_jecxz(dcontext, opnd_create_instr(pad[i]));
+        /* do not treat jecxz as exit cti! */
+        instr_set_meta(jecxz);
+        added_size += tracelist_add(dcontext, ilist, targeter, jecxz);
+        prev = (ptr_uint_t) inlined[i];
+    }
+    /* no match: hand the target back to the ibl */
+    added_size += ib_inline_add_to_xcx(dcontext, ilist, targeter, (ptr_int_t) prev);
+    for (i = 0; i < num; i++) {
+        instr_t *jmp = XINST_CREATE_jump(dcontext, opnd_create_pc(inlined[i]));
+        instr_exit_branch_set_type(jmp, LINK_DIRECT|LINK_JMP);
+        added_size += tracelist_add_after(dcontext, ilist, where, pad[i]);
+        added_size += tracelist_add_after(dcontext, ilist, pad[i], jmp);
+        where = jmp;
+    }
+    if (record_translation)
+        instrlist_set_translation_target(ilist, NULL);
+    instrlist_set_our_mangling(ilist, false); /* PR 267260 */
+#elif defined(ARM)
+    /* FIXME i#1551: NYI on ARM (options.c disables -ib_inline_targets) */
+    ASSERT_NOT_IMPLEMENTED(false);
+    *num_inlined = 0;
+#endif
+    return added_size;
+}
+
+/* -ib_inline_targets: inlines checks for the dominant targets this thread has
+ * profiled at site ahead of the indirect branch exit ending ilist, if it
+ * ends in one, and marks *flags to match.
+ * Returns size to be added to the fragment.
+ */
+int
+append_ib_inline_targets(dcontext_t *dcontext, instrlist_t *ilist,
+                         /*IN/OUT*/uint *flags, app_pc site, bool record_translation)
+{
+    app_pc targets[MAX_IB_INLINE_TARGETS];
+    instr_t *last = instrlist_last(ilist);
+    cache_pc ibl;
+    uint num_targets, num_inlined;
+    int added_size;
+
+    ASSERT(DYNAMO_OPTION(ib_inline_targets) > 0);
+    if (last == NULL || !instr_is_exit_cti(last))
+        return 0;
+    ibl = opnd_get_pc(instr_get_target(last));
+    /* far branches also switch modes, and shared_syscall is no branch target */
+    if (!is_indirect_branch_lookup_routine(dcontext, ibl) ||
+        IF_WINDOWS(is_shared_syscall_routine(dcontext, ibl) ||)
+        TEST(LINK_FAR, instr_exit_branch_type(last)))
+        return 0;
+    num_targets = monitor_ib_site_targets(dcontext, site, targets,
+                                          DYNAMO_OPTION(ib_inline_targets));
+    if (num_targets == 0)
+        return 0;
+    added_size = insert_ib_inline_targets(dcontext, ilist, *flags, targets,
+                                          num_targets, record_translation,
+                                          &num_inlined);
+    if (num_inlined > 0) {
+        *flags |= FRAG_HAS_INLINED_IB;
+        STATS_INC(num_ib_inline_sites);
+        STATS_ADD(num_ib_inline_targets, num_inlined);
+        LOG(THREAD, LOG_INTERP, 3,
+            "append_ib_inline_targets: inlined %d target(s) at "PFX"\n",
+            num_inlined, site);
+    }
+    return added_size;
+}
+
+/* -ib_inline_targets: returns f's final indirect branch exit, or NULL if f
+ * ends in a direct exit, and fills in the targets inlined ahead of it: the
+ * direct exits that follow it.
+ */
+linkstub_t *
+get_ib_inline_targets(dcontext_t *dcontext, fragment_t *f,
+                      /*OUT*/app_pc *targets, /*OUT*/uint *num_targets)
+{
+    linkstub_t *l, *ib = NULL;
+    uint num = 0;
+    for (l = FRAGMENT_EXIT_STUBS(f); l != NULL; l = LINKSTUB_NEXT_EXIT(l)) {
+        if (LINKSTUB_INDIRECT(l->flags))
+            ib = l;
+    }
+    if (ib != NULL) {
+        for (l = LINKSTUB_NEXT_EXIT(ib); l != NULL; l = LINKSTUB_NEXT_EXIT(l)) {
+            if (!TEST(FRAG_HAS_INLINED_IB, f->flags)) {
+                /* a trace continuing past an internal indirect branch */
+                ib = NULL;
+                break;
+            }
+            ASSERT(num < MAX_IB_INLINE_TARGETS);
+            if (num < MAX_IB_INLINE_TARGETS)
+                targets[num++] = EXIT_TARGET_TAG(dcontext, f, l);
+        }
+    }
+    *num_targets = num;
+    return ib;
+}
+
+/* Re-inserts f's inlined indirect branch checks into its recreated ilist */
+static void
+recreate_ib_inline_targets(dcontext_t *dcontext, fragment_t *f, instrlist_t *ilist)
+{
+    app_pc targets[MAX_IB_INLINE_TARGETS];
+    uint num_targets, num_inlined;
+    DEBUG_DECLARE(linkstub_t *l =)
+        get_ib_inline_targets(dcontext, f, targets, &num_targets);
+    ASSERT(l != NULL && num_targets > 0);
+    insert_ib_inline_targets(dcontext, ilist, f->flags, targets, num_targets,
+                             true/*record translation*/, &num_inlined);
+    ASSERT(num_inlined == num_targets);
+}
+
+/* -ret_shadow_stack: whether bb gets shadow stack pushes at its calls and a
+ * check at its final return.  Only shared bbs do, as a shared fragment is
+ * only freed once every thread has emptied its stack at the flush synch point
+ * (see set_flushtime_last_update()), while the private copies that traces are
+ * built from must keep plain mangling.
+ */
+static bool
+ret_shadow_stack_bb(dcontext_t *dcontext, build_bb_t *bb)
+{
+    return (DYNAMO_OPTION(ret_shadow_stack) && bb->ret_shadow_stack &&
+            TEST(FRAG_SHARED, bb->flags) &&
+            !TESTANY(FRAG_COARSE_GRAIN|FRAG_SELFMOD_SANDBOXED, bb->flags)
+            IF_X64(&& X64_CACHE_MODE_DC(dcontext)));
+}
+
+/* Inserts ahead of each app call in the unmangled ilist a push of its return
+ * address and of a landing pad onto this thread's return shadow stack,
+ * leaving eflags alone:
+ *
+ *    mov    %xax -> xax slot
+ *    mov    %xbx -> xbx slot
+ *    mov    ret_shadow_sp slot -> %xax
+ *    lea    -16(%xax) -> %ax       # 16-bit: wraps within the 64KB ring
+ *    mov    %xax -> ret_shadow_sp slot
+ *    movl   $retaddr_lo -> (%xax)
+ *    movl   $retaddr_hi -> 4(%xax)
+ *    lea    pad -> %xbx            # rip-relative
+ *    mov    %xbx -> 8(%xax)
+ *    mov    xbx slot -> %xbx
+ *    mov    xax slot -> %xax
+ *
+ * Each pad restores the app's XCX from the return's mangling and exits
+ * directly to the return address.  They are returned in their own list, for
+ * append_ret_shadow_stack() to place past the final exit once mangling is
+ * done, or NULL if there are no calls.  The instrs inserted here are meta so
+ * that mangle() leaves their TLS references alone.  A pad translates to its
+ * return address, which makes it a mangling region of its own: state
+ * translation knows such a region can only be jumped to and takes XCX to be
+ * spilled on entry (see translate_walk_jump_entry_ilist()).
+ */
+static instrlist_t *
+insert_ret_shadow_pushes(dcontext_t *dcontext, instrlist_t *ilist,
+                         bool record_translation, /*OUT*/uint *num_calls,
+                         /*OUT*/bool *ends_in_ret)
+{
+    instrlist_t *pads = NULL;
+#ifdef X86
+    instr_t *in;
+    *num_calls = 0;
+    *ends_in_ret = false;
+    instrlist_set_our_mangling(ilist, true); /* PR 267260 */
+    for (in = instrlist_first(ilist); in != NULL; in = instr_get_next(in)) {
+        ptr_uint_t retaddr;
+        instr_t *pad, *exit;
+        int opc;
+        if (!instr_opcode_valid(in) || !instr_is_app(in))
+            continue;
+        opc = instr_get_opcode(in);
+        if (opc == OP_ret) {
+            /* the retaddr operand is always the final source */
+            if (opnd_get_size(instr_get_src(in, instr_num_srcs(in) - 1)) == OPSZ_PTR)
+                *ends_in_ret = true;
+            continue;
+        }
+        /* far and data16 calls do not push a full return address */
+        if ((opc != OP_call && opc != OP_call_ind) ||
+            opnd_get_size(instr_get_dst(in, 1)) != OPSZ_PTR)
+            continue;
+        retaddr = get_call_return_address(dcontext, ilist, in);
+        /* a call to the next instr only wants the pc: it is never returned to */
+        if (opc == OP_call && opnd_is_near_pc(instr_get_target(in)) &&
+            opnd_get_pc(instr_get_target(in)) == (app_pc) retaddr)
+            continue;
+
+        if (pads == NULL) {
+            pads = instrlist_create(dcontext);
+            instrlist_set_our_mangling(pads, true); /* PR 267260 */
+        }
+        if (record_translation)
+            instrlist_set_translation_target(pads, (app_pc) retaddr);
+        pad = instr_create_restore_from_tls(dcontext, REG_XCX, MANGLE_XCX_SPILL_SLOT);
+        instrlist_append(pads, pad);
+        exit = XINST_CREATE_jump(dcontext, opnd_create_pc((app_pc) retaddr));
+        instr_exit_branch_set_type(exit, LINK_DIRECT|LINK_JMP);
+        instrlist_append(pads, exit);
+
+        if (record_translation)
+            instrlist_set_translation_target(ilist, get_app_instr_xl8(in));
+        instrlist_meta_preinsert(ilist, in, instr_create_save_to_tls
+                                 (dcontext, REG_XAX, TLS_XAX_SLOT));
+        instrlist_meta_preinsert(ilist, in, instr_create_save_to_tls
+                                 (dcontext, REG_XBX, TLS_XBX_SLOT));
+        instrlist_meta_preinsert(ilist, in, instr_create_restore_from_tls
+                                 (dcontext, REG_XAX, TLS_RET_SHADOW_SP_SLOT));
+        instrlist_meta_preinsert(ilist, in, INSTR_CREATE_lea
+                                 (dcontext, opnd_create_reg(REG_AX),
+                                  opnd_create_base_disp(REG_XAX, REG_NULL, 0,
+                                                        -(int)RET_SHADOW_ENTRY_SIZE,
+                                                        OPSZ_lea)));
+        instrlist_meta_preinsert(ilist, in, instr_create_save_to_tls
+                                 (dcontext, REG_XAX, TLS_RET_SHADOW_SP_SLOT));
+        instrlist_meta_preinsert(ilist, in, INSTR_CREATE_mov_st
+                                 (dcontext, OPND_CREATE_MEM32(REG_XAX, 0),
+                                  OPND_CREATE_INT32((int)(retaddr & 0xffffffff))));
+#ifdef X64
+        instrlist_meta_preinsert(ilist, in, INSTR_CREATE_mov_st
+                                 (dcontext, OPND_CREATE_MEM32(REG_XAX, 4),
+                                  OPND_CREATE_INT32((int)(retaddr >> 32))));
+#endif
+        instrlist_meta_preinsert(ilist, in, INSTR_CREATE_lea
+                                 (dcontext, opnd_create_reg(REG_XBX),
+                                  opnd_create_mem_instr(pad, 0, OPSZ_lea)));
+        instrlist_meta_preinsert(ilist, in, INSTR_CREATE_mov_st
+                                 (dcontext, OPND_CREATE_MEMPTR(REG_XAX, sizeof(app_pc)),
+                                  opnd_create_reg(REG_XBX)));
+        instrlist_meta_preinsert(ilist, in, instr_create_restore_from_tls
+                                 (dcontext, REG_XBX, TLS_XBX_SLOT));
+        instrlist_meta_preinsert(ilist, in, instr_create_restore_from_tls
+                                 (dcontext, REG_XAX, TLS_XAX_SLOT));
+        (*num_calls)++;
+    }
+    if (record_translation)
+        instrlist_set_translation_target(ilist, NULL);
+    instrlist_set_our_mangling(ilist, false); /* PR 267260 */
+#elif defined(ARM)
+    /* FIXME i#1551: NYI on ARM (options.c disables -ret_shadow_stack) */
+    ASSERT_NOT_IMPLEMENTED(false);
+#endif
+    return pads;
+}
+
+/* Inserts the return shadow stack check ahead of the return exit that ends
+ * the mangled ilist.  XCX holds the return target, so, as in
+ * insert_ib_inline_targets(), it is compared with the top entry's return
+ * address using lea and jecxz.  The entry is popped either way; on a match
+ * we jump to its landing pad, else XCX is restored for the ibl:
+ *
+ *    mov    %xax -> xax slot
+ *    mov    %xbx -> xbx slot
+ *    mov    ret_shadow_sp slot -> %xax
+ *    mov    (%xax) -> %xbx
+ *    not    %xbx
+ *    lea    1(%xcx,%xbx) -> %xcx   # target - retaddr
+ *    not    %xbx
+ *    lea    16(%xax) -> %ax
+ *    mov    %xax -> ret_shadow_sp slot
+ *    jecxz  hit
+ *    lea    (%xcx,%xbx) -> %xcx
+ *    mov    xbx slot -> %xbx
+ *    mov    xax slot -> %xax
+ *    jmp    <exit stub: ibl>
+ *  hit:
+ *    lea    -8(%xax) -> %ax
+ *    mov    (%xax) -> %xcx
+ *    mov    xbx slot -> %xbx
+ *    mov    xax slot -> %xax
+ *    jmp    *%xcx
+ *
+ * The hit path shares the return's translation and is only reached from the
+ * jecxz, so state translation takes XAX and XBX to still be spilled there
+ * even though the walk has passed the miss path's restores.
+ */
+static void
+insert_ret_shadow_check(dcontext_t *dcontext, instrlist_t *ilist, instr_t *targeter,
+                        bool record_translation)
+{
+#ifdef X86
+    instr_t *hit, *jecxz, *jmp, *where;
+    hit = INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_AX),
+                           opnd_create_base_disp(REG_XAX, REG_NULL, 0,
+                                                 -(int)sizeof(app_pc), OPSZ_lea));
+    jecxz = INSTR_CREATE_jecxz(dcontext, opnd_create_instr(hit));
+    /* do not treat jecxz as exit cti! */
+    instr_set_meta(jecxz);
+    jmp = INSTR_CREATE_jmp_ind(dcontext, opnd_create_reg(REG_XCX));
+    instr_set_meta(jmp);
+
+    if (record_translation)
+        instrlist_set_translation_target(ilist, instr_get_translation(targeter));
+    instrlist_set_our_mangling(ilist, true); /* PR 267260 */
+    instrlist_preinsert(ilist, targeter, instr_create_save_to_tls
+                        (dcontext, REG_XAX, TLS_XAX_SLOT));
+    instrlist_preinsert(ilist, targeter, instr_create_save_to_tls
+                        (dcontext, REG_XBX, TLS_XBX_SLOT));
+    instrlist_preinsert(ilist, targeter, instr_create_restore_from_tls
+                        (dcontext, REG_XAX, TLS_RET_SHADOW_SP_SLOT));
+    instrlist_preinsert(ilist, targeter, INSTR_CREATE_mov_ld
+                        (dcontext, opnd_create_reg(REG_XBX),
+                         OPND_CREATE_MEMPTR(REG_XAX, 0)));
+    instrlist_preinsert(ilist, targeter, INSTR_CREATE_not
+                        (dcontext, opnd_create_reg(REG_XBX)));
+    instrlist_preinsert(ilist, targeter, INSTR_CREATE_lea
+                        (dcontext, opnd_create_reg(REG_XCX),
+                         opnd_create_base_disp(REG_XCX, REG_XBX, 1, 1, OPSZ_lea)));
+    instrlist_preinsert(ilist, targeter, INSTR_CREATE_not
+                        (dcontext, opnd_create_reg(REG_XBX)));
+    instrlist_preinsert(ilist, targeter, INSTR_CREATE_lea
+                        (dcontext, opnd_create_reg(REG_AX),
+                         opnd_create_base_disp(REG_XAX, REG_NULL, 0,
+                                               RET_SHADOW_ENTRY_SIZE, OPSZ_lea)));
+    instrlist_preinsert(ilist, targeter, instr_create_save_to_tls
+                        (dcontext, REG_XAX, TLS_RET_SHADOW_SP_SLOT));
+    instrlist_preinsert(ilist, targeter, jecxz);
+    /* no match: hand the target back to the ibl */
+    instrlist_preinsert(ilist, targeter, INSTR_CREATE_lea
+                        (dcontext, opnd_create_reg(REG_XCX),
+                         opnd_create_base_disp(REG_XCX, REG_XBX, 1, 0, OPSZ_lea)));
+    instrlist_preinsert(ilist, targeter, instr_create_restore_from_tls
+                        (dcontext, REG_XBX, TLS_XBX_SLOT));
+    instrlist_preinsert(ilist, targeter, instr_create_restore_from_tls
+                        (dcontext, REG_XAX, TLS_XAX_SLOT));
+
+    instrlist_postinsert(ilist, targeter, hit);
+    where = hit;
+    instrlist_postinsert(ilist, where, INSTR_CREATE_mov_ld
+                         (dcontext, opnd_create_reg(REG_XCX),
+                          OPND_CREATE_MEMPTR(REG_XAX, 0)));
+    where = instr_get_next(where);
+    instrlist_postinsert(ilist, where, instr_create_restore_from_tls
+                         (dcontext, REG_XBX, TLS_XBX_SLOT));
+    where = instr_get_next(where);
+    instrlist_postinsert(ilist, where, instr_create_restore_from_tls
+                         (dcontext, REG_XAX, TLS_XAX_SLOT));
+    where = instr_get_next(where);
+    instrlist_postinsert(ilist, where, jmp);
+    if (record_translation)
+        instrlist_set_translation_target(ilist, NULL);
+    instrlist_set_our_mangling(ilist, false); /* PR 267260 */
+#elif defined(ARM)
+    /* FIXME i#1551: NYI on ARM (options.c disables -ret_shadow_stack) */
+    ASSERT_NOT_IMPLEMENTED(false);
+#endif
+}
+
+/* Completes -ret_shadow_stack for a mangled bb: checks the stack ahead of its
+ * final exit if that is a return's, and appends the landing pads from
+ * insert_ret_shadow_pushes(), destroying their list.
+ * Returns whether the return check was added.
+ */
+static bool
+append_ret_shadow_stack(dcontext_t *dcontext, instrlist_t *ilist, instrlist_t *pads,
+                        bool ends_in_ret, bool record_translation)
+{
+    instr_t *last = instrlist_last(ilist);
+    bool checked = false;
+    if (ends_in_ret && last != NULL && instr_is_exit_cti(last) &&
+        TEST(LINK_RETURN, instr_exit_branch_type(last)) &&
+        !TEST(LINK_FAR, instr_exit_branch_type(last)) &&
+        is_indirect_branch_lookup_routine(dcontext, opnd_get_pc(instr_get_target(last)))) {
+        insert_ret_shadow_check(dcontext, ilist, last, record_translation);
+        checked = true;
+    }
+    if (pads != NULL) {
+        instrlist_append(ilist, instrlist_first(pads));
+        instrlist_init(pads); /* to clear fields to make destroy happy */
+        instrlist_destroy(dcontext, pads);
+    }
+    return checked;
+}
+
 #ifdef HASHTABLE_STATISTICS
 /* Add a counter on last IBL exit
  * if speculate_next_tag is not NULL then check case 4817's possible success
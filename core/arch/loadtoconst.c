@@ -1881,8 +1881,8 @@ instr_replace_inplace(dcontext_t *dcontext, instr_t *in, instr_t *replacee)
 
     instr_set_next(in,next);
     instr_set_prev(in,prev);
-    heap_free(dcontext,replacee,sizeof(instr_t)
-              HEAPACCT(ACCT_INSTR));
+    heap_ir_free(dcontext,replacee,sizeof(instr_t)
+                 HEAPACCT(ACCT_INSTR));
 }
 
 void
@@ -1250,6 +1250,10 @@ void
 insert_push_retaddr(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
                     ptr_int_t retaddr, opnd_size_t opsize)
 {
+    /* Case 9581: we mark the instrs holding retaddr so that emit can record
+     * where it lands in a coarse unit's cache for relocation at load time.
+     */
+    instr_t *push, *mov;
     if (opsize == OPSZ_2) {
         ptr_int_t val = retaddr & (ptr_int_t) 0x0000ffff;
         /* can't do a non-default operand size with a push immed so we emulate */
@@ -1257,12 +1261,16 @@ insert_push_retaddr(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
             INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XSP),
                              opnd_create_base_disp(REG_XSP, REG_NULL, 0, -2,
                                                    OPSZ_lea)));
-        PRE(ilist, instr,
-            INSTR_CREATE_mov_st(dcontext, OPND_CREATE_MEM16(REG_XSP, 2),
-                                OPND_CREATE_INT16(val)));
+        mov = INSTR_CREATE_mov_st(dcontext, OPND_CREATE_MEM16(REG_XSP, 2),
+                                  OPND_CREATE_INT16(val));
+        mov->flags |= INSTR_RETADDR_PUSH;
+        PRE(ilist, instr, mov);
     } else if (opsize == OPSZ_PTR
                IF_X64(|| (!X64_CACHE_MODE_DC(dcontext) && opsize == OPSZ_4))) {
-        insert_push_immed_ptrsz(dcontext, retaddr, ilist, instr, NULL, NULL);
+        insert_push_immed_ptrsz(dcontext, retaddr, ilist, instr, &push, &mov);
+        push->flags |= INSTR_RETADDR_PUSH;
+        if (mov != NULL)
+            mov->flags |= INSTR_RETADDR_PUSH;
     } else {
 #ifdef X64
         ptr_int_t val = retaddr & (ptr_int_t) 0xffffffff;
@@ -1272,9 +1280,10 @@ insert_push_retaddr(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr,
             INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XSP),
                              opnd_create_base_disp(REG_XSP, REG_NULL, 0, -4,
                                                    OPSZ_lea)));
-        PRE(ilist, instr,
-            INSTR_CREATE_mov_st(dcontext, OPND_CREATE_MEM32(REG_XSP, 0),
-                                OPND_CREATE_INT32((int)val)));
+        mov = INSTR_CREATE_mov_st(dcontext, OPND_CREATE_MEM32(REG_XSP, 0),
+                                  OPND_CREATE_INT32((int)val));
+        mov->flags |= INSTR_RETADDR_PUSH;
+        PRE(ilist, instr, mov);
 #else
         ASSERT_NOT_REACHED();
 #endif
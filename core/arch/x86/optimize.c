@@ -40,10 +40,6 @@
  * (old offline optimization stuff is in mangle.c)
  */
 
-#include "../globals.h"   /* just to disable warning C4206 about an empty file */
-
-#ifdef INTERNAL /* around whole file */
-
 #include "../globals.h"
 #include "arch.h"
 #include "instr.h"
@@ -72,25 +68,29 @@
 /* if these are useful elsewhere, un-static them */
 
 /* optimizations */
-static void instr_counts(dcontext_t *dcontext, app_pc tag, instrlist_t *trace, bool pre);
 static void constant_propagation(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
 static void call_return_matching(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
-static void remove_unnecessary_zeroing(dcontext_t *dcontext, app_pc tag,
-                                       instrlist_t *trace);
 static void stack_adjust_combiner(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
-
-static void prefetch_optimize_trace(dcontext_t *dcontext,
-                                    app_pc tag, instrlist_t *trace);
+static void remove_dead_spills(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
 void remove_redundant_loads(dcontext_t *dcontext, app_pc tag,
                             instrlist_t *trace);
 
+/* The remaining optimizations are IA-32 only and are only available
+ * through their internal options.
+ */
+#if defined(INTERNAL) && !defined(X64)
+static void instr_counts(dcontext_t *dcontext, app_pc tag, instrlist_t *trace, bool pre);
+static void remove_unnecessary_zeroing(dcontext_t *dcontext, app_pc tag,
+                                       instrlist_t *trace);
+static void prefetch_optimize_trace(dcontext_t *dcontext,
+                                    app_pc tag, instrlist_t *trace);
 static void peephole_optimize(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
-
 static void identify_for_loop(dcontext_t *dcontext,
                               app_pc tag, instrlist_t *trace);
 static void unroll_loops(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
-#ifdef IA32_ON_IA64
+# ifdef IA32_ON_IA64
 static void test_i64(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
+# endif
 #endif
 
 /* utility routines */
@@ -98,15 +98,21 @@ bool is_store_to_ecxoff(dcontext_t *dcontext, instr_t *inst);
 bool is_load_from_ecxoff(dcontext_t *dcontext, instr_t *inst);
 bool opnd_is_constant_address(opnd_t address);
 static bool is_zeroing_instr(instr_t *inst);
-static bool replace_inc_with_add(dcontext_t *dcontext, instr_t *inst,
-                                 instrlist_t *trace);
 static bool safe_write(instr_t *mem_writer);
 static bool instruction_affects_mem_access(instr_t *instr,opnd_t mem_access);
+static bool instr_kills_reg(instr_t *inst, reg_id_t reg);
 static bool is_dead_register(reg_id_t reg,instr_t *where);
-static reg_id_t find_dead_register_across_instrs(instr_t *start,instr_t *end);
+static reg_id_t find_dead_register_across_instrs(instr_t *start,instr_t *end,
+                                                 opnd_size_t size);
 static bool is_nop(instr_t *inst);
 void remove_inst(dcontext_t *dcontext, instrlist_t *ilist, instr_t *inst);
+static bool check_eflags_cr(instr_t *inst);
+static bool is_DR_spill_or_restore(dcontext_t *dcontext, instr_t *inst, bool *tls,
+                                   bool *spill, reg_id_t *reg);
 
+#if defined(INTERNAL) && !defined(X64)
+static bool replace_inc_with_add(dcontext_t *dcontext, instr_t *inst,
+                                 instrlist_t *trace);
 /* for using a 24 entry bool array to represent some property about
  * about normal registers and sub register (eax -> dl) */
 /* propagates the value into all sub registers, doesn't propagate up
@@ -118,6 +124,7 @@ static bool check_down(bool *reg_rep, int index);
 
 /* given a cbr, finds the previous instr that writes the flag the cbr reads */
 static instr_t *get_decision_instr(instr_t *jmp);
+#endif
 
 /* exported utility routines */
 void loginst(dcontext_t *dcontext, uint level, instr_t *instr, const char *string);
@@ -130,17 +137,22 @@ void logtrace(dcontext_t *dcontext, uint level, instrlist_t *trace, const char *
 /****************************************************************************/
 /* master routine */
 
+/* A pass runs if its internal option asks for it or if -opt_trace_level is at
+ * least the level that turns it on (see the option's description).
+ */
+#ifdef INTERNAL
+# define OPT_PASS_ON(name, level) \
+    (dynamo_options.name || OPT_TRACE_LEVEL() >= (level))
+/* the aggressiveness digits of -constant_prop and -remove_dead_code */
+# define OPT_AGGRESSIVENESS(name) (dynamo_options.name)
+#else
+# define OPT_PASS_ON(name, level) (OPT_TRACE_LEVEL() >= (level))
+# define OPT_AGGRESSIVENESS(name) 0
+#endif
+
 void
 optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 {
-    /* we have un-truncation-check 32-bit casts for opnd_get_immed_int(), for
-     * one thing, here and in loadtoconst.c */
-    IF_X64(ASSERT_NOT_IMPLEMENTED(false));
-
-    /* FIXME: this routine is of course not in its final form
-     * we are still playing with different optimizations
-     */
-
     /* all opts want to expand all bundles and many want cti info including instr_t
      * targets, so we go ahead and do that up front
      */
@@ -155,14 +167,17 @@ optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 
 #endif
 
+#if defined(INTERNAL) && !defined(X64)
     if (dynamo_options.instr_counts) {
         instr_counts(dcontext, tag, trace, true);
     }
+#endif
 
-    if (dynamo_options.call_return_matching) {
+    if (OPT_PASS_ON(call_return_matching, 3)) {
         call_return_matching(dcontext, tag, trace);
     }
 
+#if defined(INTERNAL) && !defined(X64)
     if (dynamo_options.unroll_loops) {
         unroll_loops(dcontext, tag, trace);
     }
@@ -174,40 +189,49 @@ optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     if (dynamo_options.prefetch) {
         prefetch_optimize_trace(dcontext, tag, trace);
     }
+#endif
 
-    if (dynamo_options.rlr) {
+    if (OPT_PASS_ON(rlr, 2)) {
         remove_redundant_loads(dcontext, tag, trace);
     }
 
+#if defined(INTERNAL) && !defined(X64)
     if (dynamo_options.remove_unnecessary_zeroing) {
         remove_unnecessary_zeroing(dcontext, tag, trace);
     }
+#endif
 
-    if (dynamo_options.constant_prop) {
+    if (OPT_PASS_ON(constant_prop, 3)) {
         constant_propagation(dcontext, tag, trace);
     }
 
-    if (dynamo_options.remove_dead_code) {
+    if (OPT_PASS_ON(remove_dead_code, 2)) {
         remove_dead_code(dcontext, tag, trace);
     }
 
-    if (dynamo_options.stack_adjust) {
+    if (OPT_PASS_ON(stack_adjust, 2)) {
         stack_adjust_combiner(dcontext, tag, trace);
     }
 
+    if (OPT_PASS_ON(remove_dead_spills, 1)) {
+        remove_dead_spills(dcontext, tag, trace);
+    }
+
+#if defined(INTERNAL) && !defined(X64)
     if (dynamo_options.peephole) {
         peephole_optimize(dcontext, tag, trace);
     }
 
-#ifdef IA32_ON_IA64
+# ifdef IA32_ON_IA64
     if (dynamo_options.test_i64) {
         test_i64(dcontext, tag, trace);
     }
-#endif
+# endif
 
     if (dynamo_options.instr_counts) {
         instr_counts(dcontext, tag, trace, false);
     }
+#endif
 
 #ifdef DEBUG
     LOG(THREAD, LOG_OPTS, 3, "\nafter optimization:\n");
@@ -261,6 +285,9 @@ static struct {
     /* call return matching */
     int num_returns_removed;
     int num_return_instrs_removed;
+    /* dead spill removal */
+    int dead_restores_removed;
+    int spill_pairs_removed;
 #ifdef IA32_ON_IA64
     bool i64_test;
     int ia64_num_entries;
@@ -273,7 +300,7 @@ static struct {
 void
 print_optimization_stats()
 {
-    if (dynamo_options.rlr) {
+    if (OPT_PASS_ON(rlr, 2)) {
         uint top, bottom;
         LOG(GLOBAL, LOG_OPTS, 1,
             "%u loads examined for rlr\n", opt_stats_t.loads_examined);
@@ -298,6 +325,7 @@ print_optimization_stats()
         LOG(GLOBAL, LOG_OPTS, 1,"%d rlr's were saved by using a dead register to save value\n",
             opt_stats_t.val_saved_in_dead_reg);
     }
+#if defined(INTERNAL) && !defined(X64)
     if (dynamo_options.peephole && proc_get_family() == FAMILY_PENTIUM_4) {
         LOG(GLOBAL, LOG_OPTS, 1, "%d inc/dec examined, %d replaced with add/sub\n",
             opt_stats_t.incs_examined, opt_stats_t.incs_replaced);
@@ -305,14 +333,15 @@ print_optimization_stats()
     if (dynamo_options.unroll_loops) {
         LOG(GLOBAL, LOG_OPTS, 1, "%d loops unrolled\n", opt_stats_t.loops_unrolled);
     }
+#endif
 
-    if (dynamo_options.call_return_matching) {
+    if (OPT_PASS_ON(call_return_matching, 3)) {
         LOG(GLOBAL, LOG_OPTS, 1, "Call Return Matching - stats\n");
         LOG(GLOBAL, LOG_OPTS, 1, "   %d returns removed\n", opt_stats_t.num_returns_removed);
         LOG(GLOBAL, LOG_OPTS, 1, "   %d return instrs removed\n", opt_stats_t.num_return_instrs_removed);
     }
 
-    if (dynamo_options.constant_prop) {
+    if (OPT_PASS_ON(constant_prop, 3)) {
         LOG(GLOBAL, LOG_OPTS, 1, "Constant Prop - stats\n");
         LOG(GLOBAL, LOG_OPTS, 1, "   %d operands simplified\n", opt_stats_t.num_opnds_simplified);
         LOG(GLOBAL, LOG_OPTS, 1, "   %d constant loads from immutable memory discoverd (included in operands simplified)\n", opt_stats_t.num_const_add_const_mem);
@@ -322,21 +351,30 @@ print_optimization_stats()
         LOG(GLOBAL, LOG_OPTS, 1, "   %d jecxz related instrs removed, (6 per jecxz instr)\n", opt_stats_t.num_jecxz_instrs_removed);
     }
 
+#if defined(INTERNAL) && !defined(X64)
     if (dynamo_options.remove_unnecessary_zeroing) {
         LOG(GLOBAL, LOG_OPTS, 1, "%d unnecessary zeroing instances removed\n", opt_stats_t.xors_removed);
 
     }
+#endif
 
-    if (dynamo_options.stack_adjust) {
+    if (OPT_PASS_ON(stack_adjust, 2)) {
         LOG(GLOBAL, LOG_OPTS, 1, "Stack Adjustment Combiner - stats\n");
         LOG(GLOBAL, LOG_OPTS, 1, "   %d stack adjustments removed\n", opt_stats_t.num_stack_adjust_removed);
     }
 
-    if (dynamo_options.remove_dead_code) {
+    if (OPT_PASS_ON(remove_dead_code, 2)) {
         LOG(GLOBAL, LOG_OPTS, 1, "Dead Code Elimination - stats\n");
         LOG(GLOBAL, LOG_OPTS, 1, "   %d dead instructions removed\n", opt_stats_t.dead_loads_removed);
     }
 
+    if (OPT_PASS_ON(remove_dead_spills, 1)) {
+        LOG(GLOBAL, LOG_OPTS, 1, "Dead Spill Removal - stats\n");
+        LOG(GLOBAL, LOG_OPTS, 1, "   %d dead restores removed\n", opt_stats_t.dead_restores_removed);
+        LOG(GLOBAL, LOG_OPTS, 1, "   %d restore/spill pairs removed\n", opt_stats_t.spill_pairs_removed);
+    }
+
+#if defined(INTERNAL) && !defined(X64)
     if (dynamo_options.instr_counts) {
         LOG(GLOBAL, LOG_OPTS, 1, "Prior to optimizations\n");
         LOG(GLOBAL, LOG_OPTS, 1, "     %d instrs in traces\n", opt_stats_t.pre_num_instrs_seen);
@@ -346,7 +384,7 @@ print_optimization_stats()
         LOG(GLOBAL, LOG_OPTS, 1, "     %d jmps (cbr) in traces\n", opt_stats_t.post_num_jmps_seen);
     }
 
-#ifdef IA32_ON_IA64
+# ifdef IA32_ON_IA64
     if (dynamo_options.test_i64) {
         if (opt_stats_t.i64_test)
             LOG(GLOBAL, LOG_OPTS, 1, "IA64 test succeeded!\n");
@@ -354,11 +392,13 @@ print_optimization_stats()
             LOG(GLOBAL, LOG_OPTS, 1, "IA64 test failed!\n");
         LOG(GLOBAL, LOG_OPTS, 1, "%d entries into Itanium code\n", opt_stats_t.ia64_num_entries);
     }
+# endif
 #endif
 
 }
 #endif
 
+#if defined(INTERNAL) && !defined(X64) /* IA-32-only passes */
 /****************************************************************************/
 
 /* op1 and op2 are both memory references */
@@ -1242,6 +1282,7 @@ instr_counts(dcontext_t *dcontext, app_pc tag, instrlist_t *trace, bool pre)
 #endif
 }
 
+#endif /* INTERNAL && !X64 */
 
 /***************************************************************************/
 /* from Tim */
@@ -1268,7 +1309,7 @@ typedef struct _prop_state_t {
     byte reg_state[8];
     int reg_vals[8];
     /* constant address */
-    int addresses[NUM_CONSTANT_ADDRESS];
+    ptr_int_t addresses[NUM_CONSTANT_ADDRESS];
     int address_vals[NUM_CONSTANT_ADDRESS];
     byte address_state[NUM_CONSTANT_ADDRESS];
 
@@ -1304,8 +1345,8 @@ set_stack_val(prop_state_t *state, int disp, int val, byte flags)
     }
     if (cont) {
         LOG(THREAD, LOG_OPTS, 3, "stack cache overflow\n");
-        i = disp % NUM_STACK_SLOTS;
-        ASSERT(i>0 && i<NUM_STACK_SLOTS);
+        i = (int)((uint)disp % NUM_STACK_SLOTS);
+        ASSERT(i>=0 && i<NUM_STACK_SLOTS);
         state->stack_offsets_ebp[i] = disp;
         state->stack_vals[i] = val;
         state->stack_scope[i] = state->cur_scope;
@@ -1378,7 +1419,7 @@ clear_stack_val(prop_state_t *state, int address)
 
 /* adds an address value pair to the constant address cache */
 static void
-set_address_val(prop_state_t *state, int address, int val, byte flags)
+set_address_val(prop_state_t *state, ptr_int_t address, int val, byte flags)
 {
 #ifdef DEBUG
     dcontext_t *dcontext = state->dcontext;
@@ -1395,8 +1436,8 @@ set_address_val(prop_state_t *state, int address, int val, byte flags)
     }
     if (cont) {
         LOG(THREAD, LOG_OPTS, 3, "constant address cache overflow\n");
-        i = address % NUM_CONSTANT_ADDRESS;
-        ASSERT(i>0 && i<NUM_CONSTANT_ADDRESS);
+        i = (int)((ptr_uint_t)address % NUM_CONSTANT_ADDRESS);
+        ASSERT(i>=0 && i<NUM_CONSTANT_ADDRESS);
         state->addresses[i] = address;
         state->address_vals[i] = val;
         state->address_state[i] = flags;
@@ -1407,7 +1448,7 @@ set_address_val(prop_state_t *state, int address, int val, byte flags)
 /* updates and address value pair in the constant address cache if the address is
  * already there, else adds it */
 static void
-update_address_val(prop_state_t *state, int address, int val)
+update_address_val(prop_state_t *state, ptr_int_t address, int val)
 {
 #ifdef DEBUG
     dcontext_t *dcontext = state->dcontext;
@@ -1430,7 +1471,7 @@ update_address_val(prop_state_t *state, int address, int val)
 
 /* removes the address from the constant address cache */
 static void
-clear_address_val(prop_state_t *state, int address)
+clear_address_val(prop_state_t *state, ptr_int_t address)
 {
 #ifdef DEBUG
     dcontext_t *dcontext = state->dcontext;
@@ -1457,22 +1498,19 @@ get_immutable_value(opnd_t address, prop_state_t *state, int size)
     switch(size) {
     case OPSZ_1:
         {
-            char *ptr_byte = ((char*)(ptr_int_t)opnd_get_disp(address));
-            IF_X64(ASSERT_NOT_IMPLEMENTED(false));
+            char *ptr_byte = (char *) opnd_get_addr(address);
             result = *ptr_byte;
             break;
         }
     case OPSZ_2:
         {
-            short *ptr_byte = ((short*)(ptr_int_t)opnd_get_disp(address));
-            IF_X64(ASSERT_NOT_IMPLEMENTED(false));
+            short *ptr_byte = (short *) opnd_get_addr(address);
             result = *ptr_byte;
             break;
         }
     case OPSZ_4:
         {
-            int *ptr_byte = ((int*)(ptr_int_t)opnd_get_disp(address));
-            IF_X64(ASSERT_NOT_IMPLEMENTED(false));
+            int *ptr_byte = (int *) opnd_get_addr(address);
             result = *ptr_byte;
             break;
         }
@@ -1494,13 +1532,13 @@ get_immutable_value(opnd_t address, prop_state_t *state, int size)
 }
 
 
-/* returns true if the opnd is a stack  address (ebp)
- * i.e. is memory access with ebp as reg base and null as index reg */
+/* returns true if the opnd is a stack  address (xbp)
+ * i.e. is memory access with xbp as reg base and null as index reg */
 static bool
 opnd_is_stack_address(opnd_t address)
 {
     return (opnd_is_near_base_disp(address) &&
-            (opnd_get_base(address) == REG_EBP) &&
+            (opnd_get_base(address) == REG_XBP) &&
             (opnd_get_index(address) == REG_NULL));
 }
 
@@ -1530,14 +1568,31 @@ const_address_const_mem(opnd_t address, prop_state_t *state, bool prefix_data)
 
     /* FIXME : is is_execuatable always right here? */
     /* i.e. is it going to be true, forever, that this location isn't writable */
-    IF_X64(ASSERT_NOT_IMPLEMENTED(false));
     if (cp_global_aggr > 1 &&
-        is_executable_address((app_pc)(ptr_int_t)opnd_get_disp(address)))
+        is_executable_address((app_pc)opnd_get_addr(address)))
         success = true;
 
     return success;
 }
 
+/* Returns the reg_state[] index of reg as an address base or index register,
+ * or -1 if we do not track it.  Tracked values are 32-bit and on x64 they
+ * are zero-extended (see update_prop_state()), so there only full 64-bit
+ * registers qualify.
+ */
+static int
+prop_address_reg(reg_id_t reg)
+{
+    reg_id_t start = IF_X64_ELSE(REG_START_64, REG_START_32);
+    if (reg >= start && reg < start + 8)
+        return reg - start;
+    return -1;
+}
+
+/* the full register value of a PS_VALID_VAL reg_state[] entry */
+#define PROP_REG_VALUE(state, idx) \
+    ((ptr_int_t) IF_X64((uint)) (state)->reg_vals[idx])
+
 /* takes an opnd and returns a simplified version, simplifies address and
  * regs based on the information in propState
  */
@@ -1545,17 +1600,20 @@ static opnd_t
 propagate_address(opnd_t old, prop_state_t *state)
 {
     reg_id_t base_reg, index_reg, seg;
-    int disp, scale;
+    int base_idx, index_idx, scale;
+    ptr_int_t disp;
     opnd_size_t size;
     bool modified;
 
-    if (!opnd_is_memory_reference(old))
+    /* absolute and rip-relative references have nothing to simplify */
+    if (!opnd_is_base_disp(old))
         return old;
-    IF_X64(ASSERT_NOT_IMPLEMENTED(false)); /* rel and abs mem refs NYI */
     /* tries to simplify the address calculation with propagated values */
-    base_reg = opnd_get_base(old) - REG_START_32;
+    base_reg = opnd_get_base(old);
+    base_idx = prop_address_reg(base_reg);
     disp = opnd_get_disp(old);
-    index_reg = opnd_get_index(old) - REG_START_32;
+    index_reg = opnd_get_index(old);
+    index_idx = prop_address_reg(index_reg);
     scale = opnd_get_scale(old);
     seg = REG_NULL;
     size = opnd_get_size(old);
@@ -1565,42 +1623,43 @@ propagate_address(opnd_t old, prop_state_t *state)
         seg = opnd_get_segment(old);
     }
 
-    if (index_reg < 8 /* rules out underflow */ &&
-        ((state->reg_state[index_reg] & PS_VALID_VAL) != 0)) {
+    if (index_idx >= 0 &&
+        ((state->reg_state[index_idx] & PS_VALID_VAL) != 0)) {
 
-        disp += (state->reg_vals[index_reg] * scale);
+        disp += (PROP_REG_VALUE(state, index_idx) * scale);
         index_reg = REG_NULL;
         modified = true;
-    } else {
-        index_reg += REG_START_32;
     }
 
-    if (base_reg < 8 /* rules out underflow */ &&
-        ((state->reg_state[base_reg] & PS_VALID_VAL) != 0)) {
+    if (base_idx >= 0 &&
+        ((state->reg_state[base_idx] & PS_VALID_VAL) != 0)) {
 
-        disp += state->reg_vals[base_reg];
+        disp += PROP_REG_VALUE(state, base_idx);
         /* don't think this is necessary  *******FIXME*************
-           if ((seg == REG_NULL) && ((base_reg + REG_START_32 == REG_ESP) ||
-           (base_reg + REG_START_32 == REG_EBP))) {
+           if ((seg == REG_NULL) && ((base_reg == REG_ESP) ||
+           (base_reg == REG_EBP))) {
            seg = SEG_SS;
            }
         */
         base_reg = REG_NULL;
         modified = true;
-    } else {
-        base_reg += REG_START_32;
     }
 
     if (!modified)
         return old;
+#ifdef X64
+    /* the new displacement must still be a sign-extended 32-bit value */
+    if (disp != (int)disp)
+        return old;
+#endif
 
     if (seg == REG_NULL) {
         /* return base disp */
-        return opnd_create_base_disp(base_reg, index_reg, scale, disp, size);
+        return opnd_create_base_disp(base_reg, index_reg, scale, (int)disp, size);
     }
 
     /* return far base disp */
-    return opnd_create_far_base_disp(seg, base_reg, index_reg, scale, disp, size);
+    return opnd_create_far_base_disp(seg, base_reg, index_reg, scale, (int)disp, size);
 }
 
 /* attempts to simplify the opnd with propagated information */
@@ -1617,6 +1676,20 @@ propagate_opnd(opnd_t old, prop_state_t *state, bool prefix_data)
 #endif
 
     if (opnd_is_reg(old)) {
+#ifdef X64
+        reg = opnd_get_reg(old) - REG_START_64;
+        if (reg < 8 /* rules out underflow */) {
+            /* the value is zero-extended, so it is only expressible as a
+             * sign-extended 32-bit immediate if it is non-negative
+             */
+            if ((state->reg_state[reg] & PS_VALID_VAL) != 0 &&
+                state->reg_vals[reg] >= 0) {
+                immed = state->reg_vals[reg];
+                return opnd_create_immed_int(immed, OPSZ_4);
+            } else
+                return old;
+        }
+#endif
         reg = opnd_get_reg(old) - REG_START_32;
         if (reg < 8 /* rules out underflow */) {
             if ((state->reg_state[reg] & PS_VALID_VAL) != 0) {
@@ -1682,7 +1755,8 @@ propagate_opnd(opnd_t old, prop_state_t *state, bool prefix_data)
         }
     }
 
-    if (opnd_is_stack_address(old) && cp_local_aggr > 0) {
+    /* our caches only hold 32-bit values */
+    if (opnd_is_stack_address(old) && cp_local_aggr > 0 && size == OPSZ_4) {
         // check stack value
         disp = opnd_get_disp(old);
         for (i = 0; i < NUM_STACK_SLOTS; i++) {
@@ -1705,11 +1779,11 @@ propagate_opnd(opnd_t old, prop_state_t *state, bool prefix_data)
 #endif
             immed = get_immutable_value(old, state, size);
             return opnd_create_immed_int(immed, size);
-        } else {
+        } else if (size == OPSZ_4) {
             // check for constant address
-            disp = opnd_get_disp(old);
+            ptr_int_t address = (ptr_int_t) opnd_get_addr(old);
             for (i = 0; i < NUM_CONSTANT_ADDRESS; i++) {
-                if (state->addresses[i] == disp && (state->address_state[i] & PS_VALID_VAL) != 0) {
+                if (state->addresses[i] == address && (state->address_state[i] & PS_VALID_VAL) != 0) {
                     logopnd(state->dcontext, 3, old, " found cached constant address\n");
                     immed = state->address_vals[i];
                     return opnd_create_immed_int(immed, size);
@@ -1990,6 +2064,11 @@ make_to_imm_store(instr_t *inst, int value, prop_state_t *state)
     dcontext_t *dcontext = state->dcontext;
 
     if (value == 0 && opnd_is_reg(dst)) {
+#ifdef X64
+        /* the 32-bit xor zeroes the whole register and is shorter */
+        if (reg_is_64bit(opnd_get_reg(dst)))
+            dst = opnd_create_reg(reg_64_to_32(opnd_get_reg(dst)));
+#endif
         replacement = INSTR_CREATE_xor(dcontext, dst, dst);
         if (instr_get_prefix_flag(inst, PREFIX_DATA)) {
             instr_set_prefix_flag(replacement, PREFIX_DATA);
@@ -2002,11 +2081,17 @@ make_to_imm_store(instr_t *inst, int value, prop_state_t *state)
         } else {
             loginst(dcontext, 3, inst, " unable to simplify move zero to xor, e-flags check failed ");
             instr_destroy(dcontext, replacement);
+            dst = instr_get_dst(inst, 0);
         }
     }
 
     /* is always creating the right sized imm? */
-    replacement = INSTR_CREATE_mov_st(state->dcontext, dst,  opnd_create_immed_int(value, opnd_get_size(dst)));
+    replacement = INSTR_CREATE_mov_st(state->dcontext, dst,
+                                      /* a 64-bit dst takes a sign-extended imm32 */
+                                      opnd_create_immed_int(value,
+                                                            IF_X64(opnd_get_size(dst) ==
+                                                                   OPSZ_8 ? OPSZ_4 :)
+                                                            opnd_get_size(dst)));
     /* handle prefixes, imm->reg (data) imm->mem (data & addr) */
     if (instr_get_prefix_flag(inst, PREFIX_DATA)) {
         instr_set_prefix_flag(replacement, PREFIX_DATA);
@@ -2058,6 +2143,28 @@ calculate_zf_pf_sf(int immed)
     return result;
 }
 
+#ifdef X64
+/* returns true if inst has a 64-bit register or memory operand */
+static bool
+instr_has_qword_opnd(instr_t *inst)
+{
+    int i;
+    for (i = 0; i < instr_num_srcs(inst); i++) {
+        opnd_t opnd = instr_get_src(inst, i);
+        if ((opnd_is_reg(opnd) || opnd_is_memory_reference(opnd)) &&
+            opnd_get_size(opnd) == OPSZ_8)
+            return true;
+    }
+    for (i = 0; i < instr_num_dsts(inst); i++) {
+        opnd_t opnd = instr_get_dst(inst, i);
+        if ((opnd_is_reg(opnd) || opnd_is_memory_reference(opnd)) &&
+            opnd_get_size(opnd) == OPSZ_8)
+            return true;
+    }
+    return false;
+}
+#endif
+
 /* simplifies an instruction where possible */
 /* NOTE that at this point all subsized arguments have been sign extended */
 /* if op takes subsize note signextend (movzx and shifts for ex.) must */
@@ -2077,12 +2184,22 @@ prop_simplify(instr_t *inst, prop_state_t *state)
 
     if (opcode == OP_lea) {
         temp_opnd = instr_get_src(inst, 0);
-        if (opnd_is_constant_address(temp_opnd)) {
+        /* the sign-extended disp is the full result */
+        if (opnd_is_abs_base_disp(temp_opnd)) {
             inst = make_to_imm_store(inst, opnd_get_disp(temp_opnd), state);
         }
         return inst;
     }
 
+#ifdef X64
+    /* we fold in 32-bit arithmetic, so for 64-bit operands we only simplify
+     * moves, whose immediates are sign-extended the way our values are
+     */
+    if (opcode != OP_mov_st && opcode != OP_mov_ld && opcode != OP_movzx &&
+        opcode != OP_movsx && opcode != OP_push && instr_has_qword_opnd(inst))
+        return inst;
+#endif
+
     if ((num_src == 1) && (num_dst == 1) && opnd_is_immed_int(instr_get_src(inst, 0))) {
         immed1 = (int) opnd_get_immed_int(instr_get_src(inst, 0));
         switch(opcode) {
@@ -2172,8 +2289,9 @@ prop_simplify(instr_t *inst, prop_state_t *state)
                 instr_set_src(inst, 1, temp_opnd);
             }
         }
+#ifndef X64
         /* jecxz hack, Should only match our indirect branch handling thing */
-        if (opcode == OP_jecxz) {
+        if (opcode == OP_jecxz && instr_is_meta(inst)) {
             if (immed1 == 0) {
                 /* NOTE : this hardcodes indirect branch stuff */
                 instr_t *inst2, *inst3;
@@ -2263,6 +2381,7 @@ prop_simplify(instr_t *inst, prop_state_t *state)
                 loginst(dcontext, 1, inst, "ERROR : Constant prop predicts indirect branch exit from trace always taken! If this is part of a reconstruct for exception state then the pc calculated is going to be wrong, if it isn't then something is broken regarding constant prop");
             }
         }
+#endif
         return inst;
     }
 
@@ -2480,8 +2599,11 @@ get_trace_constant(prop_state_t *state)
     /* probably only use exc so just put it in, and maby eax to since is fav */
     /* when need to store flags/pass arg, can always add more location later */
     /* probably cleaner way of getting addresses but who cares for now */
+    /* x64 keeps its ib spills in tls and never uses these */
+#ifndef X64
     set_address_val(state, opnd_get_disp(opnd_create_dcontext_field(state->dcontext, XCX_OFFSET)), 0, PS_KEEP);
     set_address_val(state, opnd_get_disp(opnd_create_dcontext_field(state->dcontext, XAX_OFFSET)), 0, PS_KEEP);
+#endif
 }
 
 /* updates the prop state as appropriate */
@@ -2504,7 +2626,19 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
             val = (int) opnd_get_immed_int(instr_get_src(inst, 0));
         opnd = instr_get_dst(inst, 0);
         if (opnd_is_reg(opnd)) {
-            reg = opnd_get_reg(opnd) - REG_START_32;
+            reg = opnd_get_reg(opnd);
+#ifdef X64
+            /* We only track values whose top 32 bits are zero, as any 32-bit
+             * write leaves them: a full-width write of such a value is the
+             * same as the 32-bit write, while others invalidate below.
+             */
+            if (reg_is_64bit(reg) &&
+                (is_zeroing ||
+                 (opnd_get_immed_int(instr_get_src(inst, 0)) >= 0 &&
+                  opnd_get_immed_int(instr_get_src(inst, 0)) <= INT_MAX)))
+                reg = reg_64_to_32(reg);
+#endif
+            reg -= REG_START_32;
             if (reg < 8 /* rules out underflow */) {
                 /* if resetting to same value then just nop the instruction */
                 if (intrace && (state->reg_state[reg] & PS_VALID_VAL) != 0 && state->reg_vals[reg] == val) {
@@ -2558,7 +2692,7 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
                             for (i = 0; i < 8; i++) {
                                 if (instr_writes_to_reg(inst,
                                                         REG_START_32 + (reg_id_t)i,
-                                                        DR_QUERY_DEFAULT)) {
+                                                        DR_QUERY_INCLUDE_ALL)) {
                                     state->reg_state[i] = 0;
                                 }
                             }
@@ -2568,23 +2702,31 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
             }
         } else {
             // do constant addresses
-            if (opnd_is_constant_address(opnd) && cp_global_aggr > 0 ) {
-                int disp = opnd_get_disp(opnd);
+            /* our caches only hold 32-bit values */
+            if (opnd_is_constant_address(opnd) && cp_global_aggr > 0 &&
+                opnd_get_size(opnd) != OPSZ_4) {
+                clear_address_val(state, (ptr_int_t) opnd_get_addr(opnd));
+            } else if (opnd_is_constant_address(opnd) && cp_global_aggr > 0 ) {
+                ptr_int_t address = (ptr_int_t) opnd_get_addr(opnd);
                 for (i = 0; i < NUM_CONSTANT_ADDRESS; i++) {
-                    if (state->addresses[i] == disp && state->address_vals[i] == val && (state->address_state[i] & PS_VALID_VAL) != 0) {
+                    if (state->addresses[i] == address && state->address_vals[i] == val && (state->address_state[i] & PS_VALID_VAL) != 0) {
                         loginst(dcontext, 3, inst, " mem location already set to val, simplify ");
                         backup = INSTR_CREATE_nop(dcontext);
                         replace_inst(dcontext, state->trace, inst, backup);
                         loginst(dcontext, 3, backup, " to ");
                         inst = backup;
+                        break;
                     }
                 }
-                update_address_val(state, disp, val);
+                update_address_val(state, address, val);
             }
 
             // do stack vals
 
-            if (opnd_is_stack_address(opnd) && cp_local_aggr > 0) {
+            if (opnd_is_stack_address(opnd) && cp_local_aggr > 0 &&
+                opnd_get_size(opnd) != OPSZ_4) {
+                clear_stack_val(state, opnd_get_disp(opnd));
+            } else if (opnd_is_stack_address(opnd) && cp_local_aggr > 0) {
                 int disp = opnd_get_disp(opnd);
                 for (i = 0; i < NUM_STACK_SLOTS; i++) {
                     if (state->stack_offsets_ebp[i] == disp && state->stack_vals[i] == val && (state->stack_address_state[i] & PS_VALID_VAL) != 0 && state->stack_scope[i] == state->cur_scope) {
@@ -2593,6 +2735,7 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
                         replace_inst(dcontext, state->trace, inst, backup);
                         loginst(dcontext, 3, backup, " to ");
                         inst = backup;
+                        break;
                     }
                 }
 
@@ -2611,7 +2754,8 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
         // update for regs written to, actually if xh then don't need to
         // invalidate xl and vice versa, but to much work to check for that probably unlikely occurrence
         for (i = 0; i < 8; i++) {
-            if (instr_writes_to_reg(inst, REG_START_32 + (reg_id_t)i, DR_QUERY_DEFAULT)) {
+            /* a predicated write might happen */
+            if (instr_writes_to_reg(inst, REG_START_32 + (reg_id_t)i, DR_QUERY_INCLUDE_ALL)) {
                 state->reg_state[i] = 0;
             }
         }
@@ -2619,7 +2763,7 @@ update_prop_state(prop_state_t *state, instr_t *inst, bool intrace)
         for (i = 0; i < num_dst; i++) {
             opnd = instr_get_dst(inst, i);
             if (opnd_is_constant_address(opnd) && cp_global_aggr >0) {
-                clear_address_val(state, opnd_get_disp(opnd));
+                clear_address_val(state, (ptr_int_t) opnd_get_addr(opnd));
             }
         }
         // update stack cahes
@@ -2657,9 +2801,9 @@ handle_stack(prop_state_t *state, instr_t *inst)
     if (instr_get_opcode(inst) == OP_enter ||
         ((instr_get_opcode(inst) == OP_mov_st || instr_get_opcode(inst) == OP_mov_ld) &&
          opnd_is_reg(instr_get_src(inst, 0)) &&
-         opnd_get_reg(instr_get_src(inst, 0)) == REG_ESP &&
+         opnd_get_reg(instr_get_src(inst, 0)) == REG_XSP &&
          opnd_is_reg(instr_get_dst(inst, 0)) &&
-         opnd_get_reg(instr_get_dst(inst, 0)) == REG_EBP)) {
+         opnd_get_reg(instr_get_dst(inst, 0)) == REG_XBP)) {
         state->cur_scope++;
         LOG(THREAD, LOG_OPTS, 3, "Adjust scope up to %d\n", state->cur_scope);
         return inst;
@@ -2667,7 +2811,7 @@ handle_stack(prop_state_t *state, instr_t *inst)
     if (instr_get_opcode(inst) == OP_leave ||
         (instr_get_opcode(inst) == OP_pop &&
          opnd_is_reg(instr_get_dst(inst, 0)) &&
-         opnd_get_reg(instr_get_dst(inst, 0)) == REG_EBP)) {
+         opnd_get_reg(instr_get_dst(inst, 0)) == REG_XBP)) {
         state->cur_scope--;
 
         for (i = 0; i < NUM_STACK_SLOTS; i++) {
@@ -2679,7 +2823,7 @@ handle_stack(prop_state_t *state, instr_t *inst)
         LOG(THREAD, LOG_OPTS, 3, "Adjust scope down to %d\n", state->cur_scope);
         return inst;
     }
-    if (instr_writes_to_reg(inst, REG_EBP, DR_QUERY_DEFAULT)) {
+    if (instr_writes_to_reg(inst, REG_XBP, DR_QUERY_DEFAULT)) {
         loginst(dcontext, 2, inst, "Lost stack scope count");
         state->lost_scope_count = true;
         for (i = 0; i< NUM_STACK_SLOTS; i++) {
@@ -2732,8 +2876,8 @@ constant_propagation(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
      * and why set this for every trace?  options are static!
      * have some kind of optimize_init to set these
      */
-    cp_global_aggr = dynamo_options.constant_prop % 10;
-    cp_local_aggr = (dynamo_options.constant_prop - cp_global_aggr) / 10;
+    cp_global_aggr = OPT_AGGRESSIVENESS(constant_prop) % 10;
+    cp_local_aggr = (OPT_AGGRESSIVENESS(constant_prop) - cp_global_aggr) / 10;
 
     LOG(THREAD, LOG_OPTS, 3,
         "starting constant prop, global aggresiveness %d local aggresiveness %d\n",
@@ -2763,6 +2907,16 @@ constant_propagation(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
         backup = NULL;
         is_zeroing = false;
 
+        /* Leave DR's own mangling alone, as fault translation recognizes it
+         * by its exact form (on IA-32 the jecxz hack in prop_simplify() does
+         * rely on simplifying the ib mangling around the spills).
+         */
+        if (IF_X64_ELSE(!instr_is_app(inst) || instr_is_our_mangling(inst),
+                        is_DR_spill_or_restore(dcontext, inst, NULL, NULL, NULL))) {
+            update_prop_state(&state, inst, false);
+            continue;
+        }
+
         inst = handle_stack(&state, inst);
         ASSERT(inst != NULL);
 
@@ -2851,6 +3005,7 @@ constant_propagation(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 #endif
 }
 
+#if defined(INTERNAL) && !defined(X64)
 /***************************************************************************/
 /* from Tim */
 /* remove unnecsary zeroing */
@@ -2919,23 +3074,72 @@ remove_unnecessary_zeroing(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
         }
     }
 }
+#endif /* INTERNAL && !X64 */
 
 /****************************************************************************/
 /* from Tim */
 /* removes dead code
  * removes some nops (that use dead registers) but not all
- * relies to some degree on the ordering of enum reg in instr.h
+ * never removes DR's own mangling, though it tracks its dependencies
  */
 
 #define NUM_ADD_CACHE 16
 #define ADD_KEEP 0x01
 #define ADD_DEAD 0x02
 
+/* the pieces of a general-purpose register whose liveness we track */
+#define REG_PART_B0     0x1 /* bits 0-7 */
+#define REG_PART_B1     0x2 /* bits 8-15 */
+#define REG_PART_W1     0x4 /* bits 16-31 */
+#define REG_PART_D1     0x8 /* bits 32-63 */
+#define REG_PARTS_32    (REG_PART_B0 | REG_PART_B1 | REG_PART_W1)
+#define REG_PARTS_ALL   (REG_PARTS_32 | IF_X64_ELSE(REG_PART_D1, 0))
+
 static int dc_global_aggr;
 static int dc_local_aggr;
 
+/* Returns the index of reg's containing general-purpose register and sets
+ * *parts to the pieces of it that reg covers, or returns -1 if reg is not a
+ * general-purpose register.  On x64 writing a 32-bit register also zeroes
+ * its top half.
+ */
+static int
+reg_parts(reg_id_t reg, bool write, uint *parts)
+{
+    if (!reg_is_gpr(reg))
+        return -1;
+    if (reg >= REG_START_x86_8 && reg <= REG_STOP_x86_8)
+        *parts = REG_PART_B1;
+    else {
+        switch (reg_get_size(reg)) {
+        case OPSZ_1: *parts = REG_PART_B0; break;
+        case OPSZ_2: *parts = REG_PART_B0 | REG_PART_B1; break;
+        case OPSZ_4: *parts = write ? REG_PARTS_ALL : REG_PARTS_32; break;
+        default:     *parts = REG_PARTS_ALL; break;
+        }
+    }
+    return reg_to_pointer_sized(reg) - DR_REG_START_GPR;
+}
+
+/* marks the parts of reg (and those of any register it is used in the
+ * address of) as free or live
+ */
+static void
+reg_set_free(uint *free, reg_id_t reg, bool is_free)
+{
+    uint parts;
+    int idx = reg_parts(reg, is_free, &parts);
+    if (idx < 0)
+        return;
+    if (is_free)
+        free[idx] |= parts;
+    else
+        free[idx] &= ~parts;
+}
+
 static void
-add_address(dcontext_t *dcontext, int address, byte flag, int *adds, byte *flags)
+add_address(dcontext_t *dcontext, ptr_int_t address, byte flag, ptr_int_t *adds,
+            byte *flags)
 {
     bool cont = true;
     int i;
@@ -2948,7 +3152,7 @@ add_address(dcontext_t *dcontext, int address, byte flag, int *adds, byte *flags
     }
     if (cont) {
         LOG(THREAD, LOG_OPTS, 3, "constant address cache overflow\n");
-        i = address % NUM_ADD_CACHE;
+        i = (int)((ptr_uint_t)address % NUM_ADD_CACHE);
         adds[i] = address;
         flags[i] = flag;
     }
@@ -2956,7 +3160,7 @@ add_address(dcontext_t *dcontext, int address, byte flag, int *adds, byte *flags
 }
 
 static bool
-address_is_dead(dcontext_t *dcontext, int address, int *adds, byte *flags)
+address_is_dead(dcontext_t *dcontext, ptr_int_t address, ptr_int_t *adds, byte *flags)
 {
     int i = 0;
     for (; i < NUM_ADD_CACHE; i++)
@@ -2966,7 +3170,8 @@ address_is_dead(dcontext_t *dcontext, int address, int *adds, byte *flags)
 }
 
 static void
-address_set_dead(dcontext_t *dcontext, int address, int *adds, byte *flags, bool dead)
+address_set_dead(dcontext_t *dcontext, ptr_int_t address, ptr_int_t *adds, byte *flags,
+                 bool dead)
 {
     int i = 0;
     for (; i < NUM_ADD_CACHE; i++) {
@@ -2984,18 +3189,6 @@ address_set_dead(dcontext_t *dcontext, int address, int *adds, byte *flags, bool
     }
 }
 
-static void
-add_init(dcontext_t *dcontext, int *addresses, byte *flags)
-{
-    /* can add all dynamo addresses here, they are never aliased so always */
-    /* safe to optimize, but takes up space in our cache, with new jump code */
-    /* probably only use exc so just put it in, and maby eax to since is fav */
-    /* when need to store flags/pass arg, can always add more location later */
-    /* probably cleaner way of getting addresses but who cares for now */
-    add_address(dcontext, opnd_get_disp(opnd_create_dcontext_field(dcontext, XCX_OFFSET)), ADD_KEEP, addresses, flags);
-    add_address(dcontext, opnd_get_disp(opnd_create_dcontext_field(dcontext, XAX_OFFSET)), ADD_KEEP, addresses, flags);
-}
-
 #if 0 /* not used */
 static void
 add_stack_address(dcontext_t *dcontext, int address, byte flag, int scope, int *adds, byte *flags, int *scopes)
@@ -3051,10 +3244,12 @@ stack_address_set_dead(dcontext_t *dcontext, int address, int scope, int *adds,
 void
 remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 {
-    instr_t *inst, *prev_inst, *ecx_load;
+    instr_t *inst, *prev_inst;
     opnd_t dst, src;
-    bool free[24];
-    int addresses[NUM_ADD_CACHE];
+    /* for each register, the parts of it that are dead */
+    uint free[DR_NUM_GPR_REGS];
+    uint parts;
+    ptr_int_t addresses[NUM_ADD_CACHE];
     byte address_state[NUM_ADD_CACHE];
 
     int stack_scope[NUM_STACK_SLOTS];
@@ -3062,13 +3257,12 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     byte stack_state[NUM_STACK_SLOTS];
     int scope = 0; /* good as any default */
 
-    int i, j, dst_reg, opcode, num_dsts, num_srcs, src_reg;
+    int i, j, dst_reg, opcode, num_dsts, num_srcs;
     uint eflags;
     bool killinst;
-    bool kill_ecx_load = false;
 
-    dc_global_aggr = dynamo_options.remove_dead_code % 10;
-    dc_local_aggr = (dynamo_options.remove_dead_code - dc_global_aggr) / 10;
+    dc_global_aggr = OPT_AGGRESSIVENESS(remove_dead_code) % 10;
+    dc_local_aggr = (OPT_AGGRESSIVENESS(remove_dead_code) - dc_global_aggr) / 10;
 #ifdef DEBUG
     LOG(THREAD, LOG_OPTS, 3, "removing dead loads, global aggressiveness %d local aggressiveness %d\n", dc_global_aggr, dc_local_aggr);
     if (stats->loglevel >= 4 && (stats->logmask & LOG_OPTS) != 0)
@@ -3077,8 +3271,8 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     /* initialize */
 
     eflags = EFLAGS_READ_ALL;
-    for (i = 0; i < 24; i++)
-        free[i] = false;
+    for (i = 0; i < DR_NUM_GPR_REGS; i++)
+        free[i] = 0;
     for (i = 0; i < NUM_ADD_CACHE; i++) {
         addresses[i] = 0;
         address_state[i] = 0;
@@ -3088,19 +3282,17 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
         stack_scope[i] = 0;
         stack_state[i] = 0;
     }
-    add_init(dcontext, addresses, address_state);
-    ecx_load = NULL;
 
     /* main loop runs from bottom of trace to top */
     for (inst = instrlist_last(trace); inst != NULL; inst = prev_inst) {
         prev_inst = instr_get_prev(inst);
         loginst(dcontext,3,inst,"remove_dead_code working on:");
-        if (instr_is_cti(inst) || instr_is_interrupt(inst)) {
+        if (instr_is_cti(inst) || instr_is_interrupt(inst) || instr_is_syscall(inst)) {
             /* perhaps to a bit of multi-trace search here to see if really
              * necessary to mark all flags and regs as live when hit cti? */
             eflags = EFLAGS_READ_ALL;
-            for (i = 0; i < 24; i++)
-                free[i] = false;
+            for (i = 0; i < DR_NUM_GPR_REGS; i++)
+                free[i] = 0;
             for (i = 0; i < NUM_ADD_CACHE; i++) {
                 if ((address_state[i] & ADD_KEEP) != 0)
                     address_state[i] &= (~ADD_DEAD);
@@ -3117,7 +3309,6 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                     stack_offsets_ebp[i] = 0; stack_scope[i]=0;
                 }
             }
-            ecx_load = NULL;
             /* skip over the bit of control flow in indirect branch */
             if (instr_get_opcode(inst) == OP_jmp && prev_inst != NULL &&
                 instr_get_prev(prev_inst) != NULL &&
@@ -3138,16 +3329,16 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             if (opcode == OP_leave ||
                 (opcode == OP_pop &&
                  opnd_is_reg(instr_get_dst(inst, 0)) &&
-                 opnd_get_reg(instr_get_dst(inst, 0))== REG_EBP)) {
+                 opnd_get_reg(instr_get_dst(inst, 0))== REG_XBP)) {
                 scope++;
                 LOG(THREAD, LOG_OPTS, 3, "cur scope + to %d\n", scope);
             } else {
                 if (opcode == OP_enter ||
                     ((opcode == OP_mov_st || opcode == OP_mov_ld) &&
                      opnd_is_reg(instr_get_src(inst, 0)) &&
-                     opnd_get_reg(instr_get_src(inst, 0)) == REG_ESP &&
+                     opnd_get_reg(instr_get_src(inst, 0)) == REG_XSP &&
                      opnd_is_reg(instr_get_dst(inst, 0)) &&
-                     opnd_get_reg(instr_get_dst(inst, 0)) == REG_EBP)) {
+                     opnd_get_reg(instr_get_dst(inst, 0)) == REG_XBP)) {
                     scope--;
                     LOG(THREAD, LOG_OPTS, 3, "cur scope - to %d\n", scope);
                     for (i = 0; i < NUM_STACK_SLOTS; i++) {
@@ -3156,7 +3347,7 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                         }
                     }
                 } else {
-                    if (instr_writes_to_reg(inst, REG_EBP, DR_QUERY_DEFAULT)) {
+                    if (instr_writes_to_reg(inst, REG_XBP, DR_QUERY_DEFAULT)) {
                         LOG(THREAD, LOG_OPTS, 2, "dead code lost count of scope nesting, clearing cache\n");
                         for (i = 0; i < NUM_STACK_SLOTS; i++)
                             stack_state[i] = 0;
@@ -3169,26 +3360,21 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             /* dst and eflags.  Allow test, cmp, sahf to be killed */
             killinst = killinst && !((num_dsts == 0) && (opcode != OP_sahf) &&
                                      (opcode != OP_cmp) && (opcode != OP_test));
+            /* our own mangling and client code stay */
+            killinst = killinst && instr_is_app(inst) && !instr_is_our_mangling(inst);
+            /* a predicated write might not happen, so it does not kill */
+            killinst = killinst && !instr_is_predicated(inst);
             /* check that all destinations are dead, (also not mem etc.) */
             for (i = 0; (i < num_dsts) && killinst; i++) {
                 dst = instr_get_dst(inst, i);
                 if (opnd_is_reg(dst)) {
-                    dst_reg = opnd_get_reg(dst) - REG_START_32;
-                    killinst = killinst && check_down(free, dst_reg);
+                    dst_reg = reg_parts(opnd_get_reg(dst), true, &parts);
+                    killinst = killinst && dst_reg >= 0 && TESTALL(parts, free[dst_reg]);
                 } else {
                     if (opnd_is_constant_address(dst)) {
-                        if (ecx_load != NULL && is_store_to_ecxoff(dcontext, inst)) {
-                            killinst = true;
-                            if (kill_ecx_load) {
-#ifdef DEBUG
-                                opt_stats_t.dead_loads_removed++;
-                                loginst(dcontext, 3, ecx_load, "removed dead code ");
-#endif
-                                remove_inst(dcontext, trace, ecx_load);
-                            }
-                        } else {
-                            killinst = killinst && address_is_dead(dcontext, opnd_get_disp(dst), addresses, address_state);
-                        }
+                        killinst = killinst && opnd_get_size(dst) == OPSZ_4 &&
+                            address_is_dead(dcontext, (ptr_int_t) opnd_get_addr(dst),
+                                            addresses, address_state);
                     } else {
                         if (opnd_is_stack_address(dst)) {
                             killinst = killinst && stack_address_is_dead(dcontext, opnd_get_disp(dst), scope, stack_offsets_ebp, stack_state, stack_scope);
@@ -3204,12 +3390,8 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                                        EFLAGS_WRITE_ALL) &
                   eflags) == 0);
             /* always kill if nop */
-            killinst = killinst || is_nop(inst);
-            /* check ecx load */
-            if (is_load_from_ecxoff(dcontext, inst)) {
-                ecx_load = inst;
-                kill_ecx_load = !killinst;
-            }
+            killinst = killinst ||
+                (is_nop(inst) && instr_is_app(inst) && !instr_is_our_mangling(inst));
             if (killinst) {
                 /* delete the instruction */
 #ifdef DEBUG
@@ -3228,23 +3410,26 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                 for (i = 0; i < num_dsts; i++) {
                     dst = instr_get_dst(inst, i);
                     if (opnd_is_reg(dst)) {
-                        /* mark dst reg and sub regs as free */
-                        dst_reg = opnd_get_reg(dst) - REG_START_32;
-                        propagate_down(free, dst_reg, true);
+                        /* mark dst reg and sub regs as free, unless the
+                         * write might not happen
+                         */
+                        if (!instr_is_predicated(inst))
+                            reg_set_free(free, opnd_get_reg(dst), true);
                     }
                     else {
                         if (opnd_is_constant_address(dst)) {
-                            address_set_dead(dcontext, opnd_get_disp(dst),
-                                             addresses, address_state, true);
+                            /* we only track whole 32-bit slots */
+                            address_set_dead(dcontext, (ptr_int_t) opnd_get_addr(dst),
+                                             addresses, address_state,
+                                             opnd_get_size(dst) == OPSZ_4 &&
+                                             !instr_is_predicated(inst));
                         } else {
                             if (opnd_is_stack_address(dst)) {
                                 stack_address_set_dead(dcontext, opnd_get_disp(dst), scope, stack_offsets_ebp, stack_state, stack_scope, true);
                             }
                             /* reg used in address mark as unfree */
-                            for (j=opnd_num_regs_used(dst)-1; j>=0; j--) {
-                                dst_reg = opnd_get_reg_used(dst, j) - REG_START_32;
-                                propagate_down(free, dst_reg, false);
-                            }
+                            for (j=opnd_num_regs_used(dst)-1; j>=0; j--)
+                                reg_set_free(free, opnd_get_reg_used(dst, j), false);
                         }
                     }
                 }
@@ -3255,16 +3440,14 @@ remove_dead_code(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                         /* mark src regs and sub regs not free */
                         src = instr_get_src(inst, i);
                         if (opnd_is_constant_address(src)) {
-                            address_set_dead(dcontext, opnd_get_disp(src),
+                            address_set_dead(dcontext, (ptr_int_t) opnd_get_addr(src),
                                              addresses, address_state, false);
                         } else {
                             if (opnd_is_stack_address(src)) {
                                 stack_address_set_dead(dcontext, opnd_get_disp(src), scope, stack_offsets_ebp, stack_state, stack_scope, false);
                             }
-                            for (j=opnd_num_regs_used(src)-1; j>=0; j--) {
-                                src_reg = opnd_get_reg_used(src, j) - REG_START_32;
-                                propagate_down(free, src_reg, false);
-                            }
+                            for (j=opnd_num_regs_used(src)-1; j>=0; j--)
+                                reg_set_free(free, opnd_get_reg_used(src, j), false);
                         }
                     }
                 }
@@ -3294,18 +3477,26 @@ static bool
 is_stack_adjustment(instr_t *inst)
 {
     int opcode = instr_get_opcode(inst);
+    /* we rewrite or remove these, so leave DR's own (such as the ret
+     * mangling's lea) and client ones alone
+     */
+    if (!instr_is_app(inst) || instr_is_our_mangling(inst))
+        return false;
     return (
             ((opcode == OP_add || opcode == OP_sub) &&
              opnd_is_reg(instr_get_dst(inst, 0)) &&
-             opnd_get_reg(instr_get_dst(inst, 0)) == REG_ESP &&
-             opnd_is_immed_int(instr_get_src(inst, 0))) ||
+             opnd_get_reg(instr_get_dst(inst, 0)) == REG_XSP &&
+             opnd_is_immed_int(instr_get_src(inst, 0)) &&
+             /* combining changes the flags these write */
+             check_eflags_cr(instr_get_next(inst))) ||
 
             (opcode == OP_lea &&
-             opnd_get_reg(instr_get_dst(inst, 0)) == REG_ESP &&
-             ((opnd_get_base(instr_get_src(inst, 0)) == REG_ESP &&
+             opnd_get_reg(instr_get_dst(inst, 0)) == REG_XSP &&
+             opnd_is_near_base_disp(instr_get_src(inst, 0)) &&
+             ((opnd_get_base(instr_get_src(inst, 0)) == REG_XSP &&
                opnd_get_index(instr_get_src(inst, 0)) == REG_NULL ) ||
               (opnd_get_base(instr_get_src(inst, 0)) == REG_NULL &&
-               opnd_get_index(instr_get_src(inst, 0)) == REG_ESP &&
+               opnd_get_index(instr_get_src(inst, 0)) == REG_XSP &&
                opnd_get_scale(instr_get_src(inst, 0)) == 1))));
 }
 
@@ -3329,7 +3520,7 @@ set_stack_adjustment(instr_t *inst, int adjust)
     int opcode = instr_get_opcode(inst);
     opnd_t temp_opnd;
     if (opcode == OP_lea) {
-        instr_set_src(inst, 0, opnd_create_base_disp(REG_ESP, REG_NULL, 0, adjust, OPSZ_lea));
+        instr_set_src(inst, 0, opnd_create_base_disp(REG_XSP, REG_NULL, 0, adjust, OPSZ_lea));
         return;
     }
     if (opcode == OP_sub)
@@ -3393,8 +3584,9 @@ stack_adjust_combiner(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             /* could mangle pushes and pops instead of restoring, is */
             /* helpfull?, check for store to ecx_off, might mangle indirect */
             /* macro's by inserting a clean up instruction */
-            if (!instr_uses_reg(inst, REG_ESP) && !instr_is_cti(inst) &&
-                !instr_is_interrupt(inst) && !instr_is_call(inst)) {
+            if (!instr_uses_reg(inst, REG_XSP) && !instr_is_cti(inst) &&
+                !instr_is_interrupt(inst) && !instr_is_call(inst) &&
+                !instr_is_syscall(inst)) {
                 /* skip writes to constant address, presume that they will never be stack */
                 if ((opcode == OP_mov_st || opcode == OP_mov_imm) &&
                     opnd_is_constant_address(instr_get_dst(inst, 0))) {
@@ -3477,6 +3669,148 @@ stack_adjust_combiner(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 
 
 
+/****************************************************************************/
+/* dead spill removal
+ * Our mangling brackets its scratch register uses with a spill and a restore.
+ * A restore whose register the app overwrites before reading it is dead, and
+ * a restore followed by a respill of the same register to the same slot can
+ * go away along with the respill.  Either way the app value stays in its slot,
+ * where recreate_app_state() knows to find it (see translate_walk_track()).
+ */
+
+#define MAX_SPILL_DIST 64
+
+/* returns whether any branch in the trace targets an instr in [start, end] */
+static bool
+range_is_branch_target(instrlist_t *trace, instr_t *start, instr_t *end)
+{
+    instr_t *inst, *in;
+    for (inst = instrlist_first(trace); inst != NULL; inst = instr_get_next(inst)) {
+        if ((!instr_is_ubr(inst) && !instr_is_cbr(inst)) ||
+            !opnd_is_instr(instr_get_target(inst)))
+            continue;
+        for (in = start; in != NULL; in = instr_get_next(in)) {
+            if (in == opnd_get_instr(instr_get_target(inst)))
+                return true;
+            if (in == end)
+                break;
+        }
+    }
+    return false;
+}
+
+/* Returns the spill whose value restore reloads: the closest preceding spill
+ * of reg, or NULL if a restore of reg or a spill to another slot comes first.
+ */
+static instr_t *
+find_spill_for_restore(dcontext_t *dcontext, instr_t *restore, bool tls, reg_id_t reg,
+                       opnd_t slot)
+{
+    instr_t *in;
+    bool in_tls, in_spill;
+    reg_id_t in_reg;
+    for (in = instr_get_prev(restore); in != NULL; in = instr_get_prev(in)) {
+        if (is_DR_spill_or_restore(dcontext, in, &in_tls, &in_spill, &in_reg) &&
+            in_reg == reg) {
+            if (in_spill && in_tls == tls && opnd_same(instr_get_dst(in, 0), slot))
+                return in;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Removed restores leave their spill live past the end of its mangling
+ * region: we mark the spill INSTR_SPILL_CARRIED so fault translation
+ * (translate.c) knows to restore the register from its slot there.
+ */
+static void
+remove_dead_spills(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    instr_t *inst, *next_inst, *scan, *respill, *spill_inst;
+    bool tls, spill, scan_tls, scan_spill, dead;
+    reg_id_t reg, scan_reg;
+    opnd_t slot;
+    int dist, i;
+#ifdef DEBUG
+    LOG(THREAD, LOG_OPTS, 3, "starting dead spill removal\n");
+    if (stats->loglevel >= 3 && (stats->logmask & LOG_OPTS) != 0)
+        instrlist_disassemble(dcontext, tag, trace, THREAD);
+#endif
+    for (inst = instrlist_first(trace); inst != NULL; inst = next_inst) {
+        next_inst = instr_get_next(inst);
+        if (!is_DR_spill_or_restore(dcontext, inst, &tls, &spill, &reg) || spill)
+            continue;
+        slot = instr_get_src(inst, 0);
+        respill = NULL;
+        dead = false;
+        for (scan = next_inst, dist = 0; scan != NULL && dist < MAX_SPILL_DIST;
+             scan = instr_get_next(scan), dist++) {
+            if (instr_is_cti(scan) || instr_is_syscall(scan) ||
+                instr_is_interrupt(scan) || instr_is_label(scan) || instr_is_meta(scan))
+                break;
+            if (is_DR_spill_or_restore(dcontext, scan, &scan_tls, &scan_spill,
+                                       &scan_reg) && scan_reg == reg) {
+                if (scan_spill && scan_tls == tls &&
+                    opnd_same(instr_get_dst(scan, 0), slot))
+                    respill = scan;
+                break;
+            }
+            if (instr_reads_from_reg(scan, reg, DR_QUERY_INCLUDE_ALL))
+                break;
+            if (instr_writes_to_reg(scan, reg, DR_QUERY_INCLUDE_ALL)) {
+                dead = instr_is_app(scan) && !instr_is_our_mangling(scan) &&
+                    instr_kills_reg(scan, reg);
+                break;
+            }
+            for (i = 0; i < instr_num_dsts(scan); i++) {
+                if (opnd_is_memory_reference(instr_get_dst(scan, i)) &&
+                    opnd_same_address(instr_get_dst(scan, i), slot))
+                    break;
+            }
+            if (i < instr_num_dsts(scan))
+                break;
+        }
+        if (respill == NULL && !dead)
+            continue;
+        if (range_is_branch_target(trace, inst, respill != NULL ? respill : scan)) {
+            loginst(dcontext, 3, inst, "restore range is a branch target, keeping");
+            continue;
+        }
+        spill_inst = find_spill_for_restore(dcontext, inst, tls, reg, slot);
+        if (spill_inst == NULL) {
+            loginst(dcontext, 3, inst, "restore has no matching spill, keeping");
+            continue;
+        }
+        spill_inst->flags |= INSTR_SPILL_CARRIED;
+        if (respill != NULL) {
+            if (next_inst == respill)
+                next_inst = instr_get_next(respill);
+            loginst(dcontext, 3, inst, "removing restore");
+            loginst(dcontext, 3, respill, "removing respill");
+            remove_inst(dcontext, trace, inst);
+            remove_inst(dcontext, trace, respill);
+#ifdef DEBUG
+            opt_stats_t.spill_pairs_removed++;
+#endif
+        } else {
+            loginst(dcontext, 3, inst, "removing dead restore");
+            loginst(dcontext, 3, scan, "register killed by");
+            remove_inst(dcontext, trace, inst);
+#ifdef DEBUG
+            opt_stats_t.dead_restores_removed++;
+#endif
+        }
+    }
+#ifdef DEBUG
+    LOG(THREAD, LOG_OPTS, 3, "done dead spill removal\n");
+    if (stats->loglevel >= 3 && (stats->logmask & LOG_OPTS) != 0)
+        instrlist_disassemble(dcontext, tag, trace, THREAD);
+#endif
+}
+
+
+
 /****************************************************************************/
 /* call return matching, attempts to match calls with their corresponding
  * returns, may not always be safe
@@ -3501,6 +3835,7 @@ check_eflags_cr(instr_t *inst)
     return false;
 }
 
+#ifndef X64
 /* removes the return code, pattern matches on our return macro */
 static instr_t *
 remove_return_no_save_eflags(dcontext_t *dcontext, instrlist_t *trace, instr_t *inst)
@@ -3782,6 +4117,146 @@ check_return(dcontext_t *dcontext, instr_t *inst, instr_t *push)
                 opnd_get_immed_int(instr_get_src(push, 0)));
     }
 }
+#else /* X64 */
+/* Returns the return address pushed by the call mangling starting at push.
+ * A target outside the sign-extended 32-bit range has its top half written
+ * by a separate store after the push (see insert_push_immed_arch()).
+ */
+static ptr_int_t
+get_call_push_value(instr_t *push)
+{
+    ptr_int_t val = (ptr_int_t) opnd_get_immed_int(instr_get_src(push, 0));
+    instr_t *hi = instr_get_next(push);
+    if (hi != NULL && instr_is_our_mangling(hi) &&
+        instr_get_opcode(hi) == OP_mov_st &&
+        opnd_is_near_base_disp(instr_get_dst(hi, 0)) &&
+        opnd_get_base(instr_get_dst(hi, 0)) == REG_XSP &&
+        opnd_get_index(instr_get_dst(hi, 0)) == REG_NULL &&
+        opnd_get_disp(instr_get_dst(hi, 0)) == 4 &&
+        opnd_is_immed_int(instr_get_src(hi, 0))) {
+        val = (ptr_int_t)
+            (((ptr_uint_t)(uint) val) |
+             (((ptr_uint_t) opnd_get_immed_int(instr_get_src(hi, 0))) << 32));
+    }
+    return val;
+}
+
+/* Pattern matches on the return mangling plus the trace stay-on-trace check
+ * (mangle_x64_ib_in_trace()) starting at inst, which must be our spill of xcx.
+ * Returns the last instruction of the sequence, or NULL if it does not match.
+ * The inlined target is returned in tag and any ret immediate in extra_pop.
+ */
+static instr_t *
+match_return_x64(dcontext_t *dcontext, instr_t *inst, ptr_int_t *tag,
+                 int *extra_pop)
+{
+    instr_t *last;
+    bool spill, found_tag = false;
+    reg_id_t reg;
+    int opcode;
+
+    if (!is_DR_spill_or_restore(dcontext, inst, NULL, &spill, &reg) ||
+        !spill || reg != REG_XCX)
+        return NULL;
+    inst = instr_get_next(inst);
+    if (inst == NULL || !instr_is_our_mangling(inst) ||
+        instr_get_opcode(inst) != OP_pop ||
+        !opnd_is_reg(instr_get_dst(inst, 0)) ||
+        opnd_get_reg(instr_get_dst(inst, 0)) != REG_XCX)
+        return NULL;
+    *extra_pop = 0;
+    inst = instr_get_next(inst);
+    if (inst != NULL && instr_is_our_mangling(inst) &&
+        instr_get_opcode(inst) == OP_lea &&
+        opnd_get_reg(instr_get_dst(inst, 0)) == REG_XSP) {
+        opnd_t src = instr_get_src(inst, 0);
+        if (!opnd_is_near_base_disp(src) || opnd_get_base(src) != REG_XSP ||
+            opnd_get_index(src) != REG_NULL)
+            return NULL;
+        *extra_pop = opnd_get_disp(src);
+        inst = instr_get_next(inst);
+    }
+    /* the comparison, up to and including the jne to the exit */
+    for (; inst != NULL && instr_is_our_mangling(inst); inst = instr_get_next(inst)) {
+        opcode = instr_get_opcode(inst);
+        if (opcode == OP_jnz) {
+            if (!instr_is_exit_cti(inst))
+                return NULL;
+            break;
+        } else if (opcode == OP_mov_imm) {
+            if (found_tag || !opnd_is_reg(instr_get_dst(inst, 0)) ||
+                opnd_get_reg(instr_get_dst(inst, 0)) != REG_XAX ||
+                !opnd_is_immed_int(instr_get_src(inst, 0)))
+                return NULL;
+            *tag = (ptr_int_t) opnd_get_immed_int(instr_get_src(inst, 0));
+            found_tag = true;
+        } else if (opcode == OP_cmp) {
+            if (!opnd_is_reg(instr_get_src(inst, 0)) ||
+                opnd_get_reg(instr_get_src(inst, 0)) != REG_XCX)
+                return NULL;
+        } else if (opcode == OP_mov_st) {
+            /* xax spill, possibly to the xbx slot to hold the tag */
+            if (!opnd_is_reg(instr_get_src(inst, 0)) ||
+                opnd_get_reg(instr_get_src(inst, 0)) != REG_XAX)
+                return NULL;
+        } else if (opcode != OP_lahf && opcode != OP_seto)
+            return NULL;
+    }
+    if (inst == NULL || !instr_is_our_mangling(inst) || !found_tag)
+        return NULL;
+    /* the restores that follow are only present when the values are live */
+    last = inst;
+    for (inst = instr_get_next(inst); inst != NULL && instr_is_our_mangling(inst);
+         inst = instr_get_next(inst)) {
+        opcode = instr_get_opcode(inst);
+        if (is_DR_spill_or_restore(dcontext, inst, NULL, &spill, &reg)) {
+            if (spill || (reg != REG_XCX && reg != REG_XAX))
+                break;
+        } else if (opcode == OP_add) {
+            if (!opnd_is_reg(instr_get_dst(inst, 0)) ||
+                opnd_get_reg(instr_get_dst(inst, 0)) != REG_AL)
+                break;
+        } else if (opcode != OP_sahf)
+            break;
+        last = inst;
+    }
+    return last;
+}
+
+/* Replaces the return sequence inst..last with a single stack adjustment.
+ * The lea leaves the eflags alone so nothing else needs restoring.
+ */
+static instr_t *
+remove_return_x64(dcontext_t *dcontext, instrlist_t *trace, instr_t *inst,
+                  instr_t *last, int extra_pop)
+{
+    instr_t *pop = instr_get_next(inst);
+    instr_t *lea = INSTR_CREATE_lea(dcontext, opnd_create_reg(REG_XSP),
+                                    opnd_create_base_disp(REG_XSP, REG_NULL, 0,
+                                                          XSP_SZ + extra_pop,
+                                                          OPSZ_lea));
+    instr_t *next;
+    instr_set_translation(lea, instr_get_translation(pop));
+    instr_set_our_mangling(lea, true);
+    instrlist_preinsert(trace, inst, lea);
+#ifdef DEBUG
+    opt_stats_t.num_returns_removed++;
+#endif
+    while (true) {
+        next = instr_get_next(inst);
+        loginst(dcontext, 3, inst, "removing");
+        remove_inst(dcontext, trace, inst);
+#ifdef DEBUG
+        opt_stats_t.num_return_instrs_removed++;
+#endif
+        if (inst == last)
+            break;
+        inst = next;
+    }
+    loginst(dcontext, 3, lea, "adjusting stack");
+    return lea;
+}
+#endif /* X64 */
 
 
 #define CALL_RETURN_STACK_SIZE 40
@@ -3794,6 +4269,11 @@ call_return_matching(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     instr_t *a[CALL_RETURN_STACK_SIZE];
     instr_t *inst, *next_inst;
     int top, i, opcode;
+#ifdef X64
+    instr_t *last;
+    ptr_int_t ret_tag;
+    int extra_pop;
+#endif
     top = 0;
 #ifdef DEBUG
     LOG(THREAD, LOG_OPTS, 3, "starting call return matching\n");
@@ -3806,7 +4286,10 @@ call_return_matching(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
         // look for push_imm from call and add to state
         if (next_inst != NULL) {
             opcode = instr_get_opcode(next_inst);
-            if ((opcode == OP_push_imm) && (opnd_get_size(instr_get_src(next_inst, 0)) == OPSZ_4))  {
+            if ((opcode == OP_push_imm) &&
+                opnd_is_immed_int(instr_get_src(next_inst, 0)) &&
+                (opnd_get_size(instr_get_src(next_inst, 0)) == OPSZ_4)
+                IF_X64(&& instr_is_our_mangling(next_inst)))  {
                 inst = next_inst;
                 loginst(dcontext, 3, inst, "found call push");
                 if (top < CALL_RETURN_STACK_SIZE) {
@@ -3822,6 +4305,24 @@ call_return_matching(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             }
         }
         // look for pop from return and remove instruction is possible
+#ifdef X64
+        last = match_return_x64(dcontext, inst, &ret_tag, &extra_pop);
+        if (last != NULL) {
+            loginst(dcontext, 3, inst, "found start of return");
+            while (top > 0 && get_call_push_value(a[top-1]) != ret_tag) {
+                top--;
+                loginst(dcontext, 3, a[top], "ignoring probable non call push immed on call return stack");
+            }
+            if (top > 0) {
+                loginst(dcontext, 3, a[top-1], "corresponding push was");
+                LOG(THREAD, LOG_OPTS, 3, "attempting to remove return code\n");
+                next_inst = remove_return_x64(dcontext, trace, inst, last, extra_pop);
+                top--;
+            } else {
+                LOG(THREAD, LOG_OPTS, 3, "call return stack underflow\n");
+            }
+        }
+#else
         if (is_return(dcontext, inst)) {
             loginst(dcontext, 3, inst, "found start of return");
             while ((top > 0) && (!check_return(dcontext, instr_get_next(instr_get_next(inst)), a[top-1]))) {
@@ -3837,6 +4338,7 @@ call_return_matching(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                 LOG(THREAD, LOG_OPTS, 3, "call return stack underflow\n");
             }
         }
+#endif
     }
 #ifdef DEBUG
     LOG(THREAD, LOG_OPTS, 3, "done call return matching\n");
@@ -3845,6 +4347,7 @@ call_return_matching(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 #endif
 }
 
+#if defined(INTERNAL) && !defined(X64)
 /****************************************************************************/
 
 /* peephole driver
@@ -3984,10 +4487,27 @@ replace_inc_with_add(dcontext_t *dcontext, instr_t *inst, instrlist_t *trace)
     replace_inst(dcontext, trace, inst, in);
     return true;
 }
+#endif /* INTERNAL && !X64 */
 
 /****************************************************************************/
 /* josh's load removal optimization */
 #define MAX_DIST 40
+
+/* whether reg_opnd can stand in for the memory operand mem: only full
+ * general purpose registers of the same size are handled
+ */
+static bool
+rlr_opnd_ok(opnd_t reg_opnd, opnd_t mem)
+{
+    reg_id_t reg;
+    if (!opnd_is_reg(reg_opnd))
+        return false;
+    reg = opnd_get_reg(reg_opnd);
+    return (reg_is_gpr(reg) &&
+            (reg_is_32bit(reg) IF_X64(|| reg_is_64bit(reg))) &&
+            reg_get_size(reg) == opnd_get_size(mem));
+}
+
 void
 remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 {
@@ -4002,6 +4522,10 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     for (instr = instrlist_first(trace); instr != NULL; instr = next_inst) {
         next_inst = instr_get_next(instr);
 
+        /* leave our own mangling alone, translation relies on its exact form */
+        if (!instr_is_app(instr) || instr_is_our_mangling(instr))
+            continue;
+
         //ensures that it is an instruction which reads memory
         if (instr_reads_memory(instr)) {
 #ifdef DEBUG
@@ -4026,7 +4550,8 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 
         /* to simply things for debugging, just worry about cases where the read
            is indirect off the base pointer. this should be removed later */
-        if (opnd_get_base(mem_read)!=REG_EBP||opnd_get_index(mem_read)!=REG_NULL)
+        if (!opnd_is_near_base_disp(mem_read) ||
+            opnd_get_base(mem_read)!=REG_XBP||opnd_get_index(mem_read)!=REG_NULL)
             continue;
         LOG(THREAD, LOG_OPTS, 3,"\n");
         loginst(dcontext, 3,instr," reads memory, try to eliminate. ");
@@ -4082,8 +4607,10 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
                              opnd_is_near_base_disp(mem_read) &&
                              (opnd_get_base(mem_read) == opnd_get_base(writeopnd)) &&
                              (opnd_get_index(mem_read) == opnd_get_index(writeopnd))) {
-                        int scratch = opnd_get_disp(mem_read) - opnd_get_disp(writeopnd);
-                        if ((scratch < 4) && (scratch > -4)) {
+                        int rd = opnd_get_disp(mem_read);
+                        int wd = opnd_get_disp(writeopnd);
+                        if (rd < wd + (int) opnd_size_in_bytes(opnd_get_size(writeopnd)) &&
+                            wd < rd + (int) opnd_size_in_bytes(opnd_get_size(mem_read))) {
                             first_mem_access=NULL;
                             break;
                         }
@@ -4133,6 +4660,10 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             LOG(THREAD, LOG_OPTS, 3, "passed MAX_DIST threshold of %d\n",MAX_DIST);
             continue;
         }
+        if (!instr_is_app(first_mem_access) || instr_is_our_mangling(first_mem_access)) {
+            loginst(dcontext, 3, first_mem_access, "not an app instr, can't reuse");
+            continue;
+        }
 
 
         ASSERT(instr_num_dsts(first_mem_access)==1&&instr_num_srcs(first_mem_access)==1);
@@ -4155,7 +4686,7 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 
             //checks if something overwrites the register
 
-            if (instr_writes_to_reg(reg_write_checker,orig_reg, DR_QUERY_DEFAULT)) {
+            if (instr_writes_to_reg(reg_write_checker,orig_reg, DR_QUERY_INCLUDE_ALL)) {
 #ifdef DEBUG
                 opt_stats_t.reg_overwritten++;
 #endif
@@ -4164,7 +4695,8 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             }
         }
 
-        if (!opnd_is_reg_32bit(orig_reg_opnd)||!opnd_is_reg_32bit(instr_get_dst(instr,0)))
+        if (!rlr_opnd_ok(orig_reg_opnd, mem_read) ||
+            !rlr_opnd_ok(instr_get_dst(instr,0), mem_read))
             continue;
 
         if (reg_write_checker==instr) {
@@ -4212,17 +4744,28 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
             reg_id_t dead_reg;
             opnd_t dead_reg_opnd;
             instr_t *copy_to_dead_instr;
-            dead_reg=find_dead_register_across_instrs(first_mem_access,instr);
+            dead_reg=find_dead_register_across_instrs(first_mem_access,instr,
+                                                      opnd_get_size(mem_read));
             if (dead_reg!=REG_NULL) {
-
+                bool ok;
                 dead_reg_opnd=opnd_create_reg(dead_reg);
+                ok = instr_replace_src_opnd(instr,mem_read,dead_reg_opnd);
+                ASSERT(ok);
+                if (!instr_is_encoding_possible(instr)) {
+                    loginst(dcontext, 3,instr,"encoding not possible ;( reverting to orig. instr\n");
+                    ok = instr_replace_src_opnd(instr,dead_reg_opnd,mem_read);
+                    ASSERT(ok);
+                    continue;
+                }
+                loginst(dcontext,3,instr,"modified this instr to use the new dead register");
+
                 LOG(THREAD, LOG_OPTS, 3,"looks like %s is free to hold the reg though!\n",reg_names[dead_reg]);
                 copy_to_dead_instr=INSTR_CREATE_mov_ld(dcontext,dead_reg_opnd,orig_reg_opnd);
+                /* a fault here should be reported at the next app instr */
+                instr_set_translation(copy_to_dead_instr,
+                                      instr_get_translation(instr_get_next(first_mem_access)));
                 instrlist_postinsert(trace,first_mem_access,copy_to_dead_instr);
                 loginst(dcontext,3,copy_to_dead_instr,"inserted this to save val. in dead register");
-
-                instr_replace_src_opnd(instr,mem_read,dead_reg_opnd);
-                loginst(dcontext,3,instr,"modified this instr to use the new dead register");
 #ifdef DEBUG
                 opt_stats_t.val_saved_in_dead_reg++;
                 opt_stats_t.ctis_in_load_removal+=ctis;
@@ -4240,21 +4783,24 @@ remove_redundant_loads(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
     LOG(THREAD, LOG_OPTS, 3,"leaving remove_loads optimization\n");
 }
 
+/* returns a register of the given size that is dead at start and not used
+ * before end, or REG_NULL
+ */
 static reg_id_t
-find_dead_register_across_instrs(instr_t *start,instr_t *end)
+find_dead_register_across_instrs(instr_t *start,instr_t *end,opnd_size_t size)
 {
     reg_id_t a;
-    instr_t *instr = NULL;
+    instr_t *instr;
 
-    for (a=REG_EAX;a<=REG_EDI;a++) {
-        if (is_dead_register(a,start)) {
-            for (instr=start;instr!=end;instr=instr_get_next(instr)) {
-                if (instr_uses_reg(instr,a))
-                    break;
-            }
+    for (a=REG_XAX;a<=IF_X64_ELSE(REG_R15,REG_XDI);a++) {
+        if (!is_dead_register(a,start))
+            continue;
+        for (instr=start;instr!=end;instr=instr_get_next(instr)) {
+            if (instr_uses_reg(instr,a))
+                break;
         }
         if (instr==end)
-            return a;
+            return reg_resize_to_opsz(a,size);
     }
     return REG_NULL;
 }
@@ -4305,6 +4851,7 @@ find_dead_register_across_instrs_H(instr_t *start,instr_t *end)
 }
 #endif /* #if 0 */
 
+#if defined(INTERNAL) && !defined(X64)
 /****************************************************************************/
 /* prefetching */
 
@@ -4394,6 +4941,7 @@ prefetch_optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 
     }
 }
+#endif /* INTERNAL && !X64 */
 
 /* Removed josh's attempt at using the SSE2 xmm registers to hold some local vars -
    you can find it in the attic optimize.c 1.95
@@ -4427,11 +4975,12 @@ is_load_from_ecxoff(dcontext_t *dcontext, instr_t *inst)
 }
 
 /* returns true if the opnd is a constant address
- * i.e. is memory access with null base and index registers */
+ * i.e. is memory access with null base and index registers (or rip-relative);
+ * use opnd_get_addr() for the address */
 bool
 opnd_is_constant_address(opnd_t address)
 {
-    return (opnd_is_abs_addr(address) IF_X64(|| opnd_is_rel_addr(address)));
+    return (opnd_is_near_abs_addr(address) IF_X64(|| opnd_is_near_rel_addr(address)));
 }
 
 /* checks to see if the instr zeros a reg (and does nothing else) */
@@ -4445,20 +4994,62 @@ is_zeroing_instr(instr_t *inst)
     return false;
 }
 
+/* returns true if inst overwrites all of the pointer-sized reg, which on
+ * x64 includes a write to its 32-bit subregister
+ */
+static bool
+instr_kills_reg(instr_t *inst, reg_id_t reg)
+{
+    int i;
+    if (instr_is_predicated(inst))
+        return false;
+    for (i = 0; i < instr_num_dsts(inst); i++) {
+        opnd_t dst = instr_get_dst(inst, i);
+        if (opnd_is_reg(dst) &&
+            (opnd_get_reg(dst) == reg
+             IF_X64(|| (reg_is_32bit(opnd_get_reg(dst)) &&
+                        reg_to_pointer_sized(opnd_get_reg(dst)) == reg))))
+            return true;
+    }
+    return false;
+}
+
+/* whether inst is a spill or restore to a DR slot that our own mangling
+ * inserted; the out params are optional
+ */
+static bool
+is_DR_spill_or_restore(dcontext_t *dcontext, instr_t *inst, bool *tls,
+                       bool *spill, reg_id_t *reg)
+{
+    bool my_tls, my_spill;
+    reg_id_t my_reg;
+    if (!instr_is_our_mangling(inst) ||
+        !instr_is_DR_reg_spill_or_restore(dcontext, inst, &my_tls, &my_spill, &my_reg))
+        return false;
+    if (tls != NULL)
+        *tls = my_tls;
+    if (spill != NULL)
+        *spill = my_spill;
+    if (reg != NULL)
+        *reg = my_reg;
+    return true;
+}
+
+/* reg is a pointer-sized register */
 static bool
 is_dead_register(reg_id_t reg,instr_t *where)
 {
     //something tells me its a bad call to mess with these...
-    if (reg==REG_EBP||reg==REG_ESP)
+    if (reg==REG_XBP||reg==REG_XSP)
         return false;
 
     while (!instr_is_cti(where)) {
-        if (instr_reg_in_src(where,reg))
+        if (instr_reads_from_reg(where, reg, DR_QUERY_INCLUDE_ALL))
             return false;
-        else if (instr_writes_to_reg(where, reg, DR_QUERY_DEFAULT))
+        else if (instr_kills_reg(where, reg))
             return true;
-        //!instr_writes_to_reg(...).  probably writing to mem indirectly through reg
-        else if (instr_reg_in_dst(where,reg))
+        //a partial write
+        else if (instr_writes_to_reg(where, reg, DR_QUERY_INCLUDE_ALL))
             return false;
 
         where=instr_get_next(where);
@@ -4504,10 +5095,16 @@ is_dead_reg(dcontext_t *dcontext, instr_t *start_inst, int reg)
 }
 #endif
 
-/* replaces old with new and destroys old inst */
+/* replaces old with new and destroys old inst; new takes over old's
+ * translation and mangling status, for fault translation
+ */
 void
 replace_inst(dcontext_t *dcontext, instrlist_t *ilist, instr_t *old, instr_t *new)
 {
+    instr_set_translation(new, instr_get_translation(old));
+    if (instr_is_meta(old))
+        instr_set_meta(new);
+    instr_set_our_mangling(new, instr_is_our_mangling(old));
     instrlist_preinsert(ilist, old, new);
     instrlist_remove(ilist, old);
     instr_destroy(dcontext, old);
@@ -4549,7 +5146,7 @@ safe_write(instr_t *mem_writer)
     else if (opnd_get_base(mem_write)==REG_NULL) //if there's no base, its prob. a constant mem addr
         return true;
 
-    else if (opnd_get_base(mem_write)!=REG_EBP || opnd_get_index(mem_write)!=REG_NULL)
+    else if (opnd_get_base(mem_write)!=REG_XBP || opnd_get_index(mem_write)!=REG_NULL)
         return false;
 
     return true;
@@ -4621,7 +5218,7 @@ replace_self_loop_with_instr(dcontext_t *dcontext, app_pc tag,
 
 }
 
-
+#if defined(INTERNAL) && !defined(X64)
 /* given a cbr, finds the previous instr that writes the flag the cbr reads */
 static instr_t *
 get_decision_instr(instr_t *jmp)
@@ -4668,6 +5265,7 @@ check_down(bool *reg_rep, int index)
                                ((index >= 4) || (reg_rep[index+16] &&
                                                  reg_rep[index+20])))));
 }
+#endif /* INTERNAL && !X64 */
 
 /* return true, if this instr is a nop, of one of a class of nops */
 /* does not check for all types of nops, since there are many */
@@ -4679,9 +5277,13 @@ is_nop(instr_t *inst)
     if (opcode == OP_nop)
         return true;
     if ((opcode == OP_mov_ld || opcode == OP_mov_st || opcode == OP_xchg) &&
-        opnd_same(instr_get_src(inst, 0), instr_get_dst(inst, 0)))
+        opnd_same(instr_get_src(inst, 0), instr_get_dst(inst, 0))
+        /* on x64 a 32-bit register move zeroes the top half */
+        IF_X64(&& !opnd_is_reg_32bit(instr_get_dst(inst, 0))))
         return true;
     if (opcode == OP_lea &&
+        opnd_is_base_disp(instr_get_src(inst, 0)) &&
+        IF_X64(!opnd_is_reg_32bit(instr_get_dst(inst, 0)) &&)
         opnd_get_disp(instr_get_src(inst, 0)) == 0 &&
         ((opnd_get_base(instr_get_src(inst, 0)) == opnd_get_reg(instr_get_dst(inst, 0)) &&
           opnd_get_index(instr_get_src(inst, 0)) == REG_NULL) ||
@@ -4693,4 +5295,3 @@ is_nop(instr_t *inst)
     return false;
 }
 
-#endif /* INTERNAL around whole file */
@@ -190,24 +190,40 @@ dispatch(dcontext_t *dcontext)
             }
             if (targetf != NULL)
                 break;
-            /* must call outside of USE_BB_BUILDING_LOCK guard for bb_lock_would_have: */
-            SHARED_BB_LOCK();
-            if (USE_BB_BUILDING_LOCK() || targetf == NULL) {
-                /* must re-lookup while holding lock and keep the lock until we've
-                 * built the bb and added it to the lookup table
-                 * FIXME: optimize away redundant lookup: flags to know why came out?
+            if (PARALLEL_BB_BUILD()) {
+                /* Build w/o the lock; this re-looks-up and emits while holding it,
+                 * and returns with it held.
                  */
-                targetf = fragment_lookup_fine_and_coarse(dcontext, dcontext->next_tag,
-                                                          &coarse_f, dcontext->last_exit);
-            }
-            if (targetf == NULL) {
                 SELF_PROTECT_LOCAL(dcontext, WRITABLE);
-                targetf =
-                    build_basic_block_fragment(dcontext, dcontext->next_tag,
-                                               0, true/*link*/, true/*visible*/
-                                               _IF_CLIENT(false/*!for_trace*/)
-                                               _IF_CLIENT(NULL));
+                targetf = build_basic_block_fragment_parallel(dcontext,
+                                                              dcontext->next_tag,
+                                                              &coarse_f);
                 SELF_PROTECT_LOCAL(dcontext, READONLY);
+            } else {
+                /* must call outside of USE_BB_BUILDING_LOCK guard for
+                 * bb_lock_would_have:
+                 */
+                SHARED_BB_LOCK();
+                if (USE_BB_BUILDING_LOCK() || targetf == NULL) {
+                    /* must re-lookup while holding lock and keep the lock until
+                     * we've built the bb and added it to the lookup table
+                     * FIXME: optimize away redundant lookup: flags to know why
+                     * came out?
+                     */
+                    targetf = fragment_lookup_fine_and_coarse(dcontext,
+                                                              dcontext->next_tag,
+                                                              &coarse_f,
+                                                              dcontext->last_exit);
+                }
+                if (targetf == NULL) {
+                    SELF_PROTECT_LOCAL(dcontext, WRITABLE);
+                    targetf =
+                        build_basic_block_fragment(dcontext, dcontext->next_tag,
+                                                   0, true/*link*/, true/*visible*/
+                                                   _IF_CLIENT(false/*!for_trace*/)
+                                                   _IF_CLIENT(NULL));
+                    SELF_PROTECT_LOCAL(dcontext, READONLY);
+                }
             }
             if (targetf != NULL && TEST(FRAG_COARSE_GRAIN, targetf->flags)) {
                 /* targetf is a static temp fragment protected by bb_building_lock,
@@ -367,6 +383,12 @@ dispatch_enter_fcache(dcontext_t *dcontext, fragment_t *targetf)
         coarse_lazy_link(dcontext, targetf);
     }
 
+    /* Every entry from here, trace head counting included, is an execution
+     * sample; must be done while still couldbelinking.
+     */
+    if (DYNAMO_OPTION(cache_generational))
+        fcache_promote_fragment(dcontext, targetf);
+
     if (!enter_nolinking(dcontext, targetf, true)) {
         /* not actually entering cache, so back to couldbelinking */
         enter_couldbelinking(dcontext, NULL, true);
@@ -1018,6 +1040,13 @@ dispatch_exit_fcache(dcontext_t *dcontext)
          * be building a bb as well -- no very quick check though
          */
         SELF_PROTECT_LOCAL(dcontext, READONLY);
+
+        /* -ib_inline_targets: profile the branch's targets */
+        if (DYNAMO_OPTION(ib_inline_targets) > 0 &&
+            !LINKSTUB_FAKE(dcontext->last_exit)) {
+            monitor_ib_site_record(dcontext, dcontext->last_fragment,
+                                   dcontext->last_exit, dcontext->next_tag);
+        }
     } /* LINKSTUB_INDIRECT */
 
     /* ref bug 2323, we need monitor to restore last fragment now,
@@ -1949,6 +1978,11 @@ handle_system_call(dcontext_t *dcontext)
         SELF_PROTECT_LOCAL(dcontext, READONLY);
 
         set_at_syscall(dcontext, true);
+        /* we return via the syscall linkstub, holding no fragment */
+#ifdef WINDOWS
+        if (!use_prev_dcontext)
+#endif
+            flush_epoch_park(dcontext);
         KSTART_DC(dcontext, syscall_fcache); /* stopped in dispatch_exit_fcache_stats */
         enter_fcache(dcontext, (fcache_enter_func_t)
                      /* DEFAULT_ISA_MODE as we want the ISA mode of our gencode */
@@ -2002,6 +2036,7 @@ handle_post_system_call(dcontext_t *dcontext)
     ASSERT(get_at_syscall(dcontext));
 
     set_at_syscall(dcontext, false);
+    flush_epoch_unpark(dcontext);
 
     /* some syscalls require modifying local memory */
     SELF_PROTECT_LOCAL(dcontext, WRITABLE);
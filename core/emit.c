@@ -51,6 +51,7 @@
 #include "instr_create.h"
 #include "monitor.h"
 #include "translate.h"
+#include "perscache.h"
 #include <string.h> /* memcpy */
 
 #ifdef DEBUG
@@ -173,6 +174,40 @@ final_exit_shares_prev_stub(dcontext_t *dcontext, instrlist_t *ilist, uint frag_
     return false;
 }
 
+#ifdef X86
+/* Case 9581: records in f's coarse unit where inst, just encoded at pc,
+ * placed the return address pushed by insert_push_retaddr(), keyed on the
+ * last 4 bytes of inst, which for "push imm32" is the immediate.
+ */
+static void
+emit_retaddr_reloc(dcontext_t *dcontext, fragment_t *f, instr_t *inst,
+                   cache_pc pc, cache_pc next_pc)
+{
+    instr_t *prev = instr_get_prev(inst);
+    uint kind;
+    if (instr_get_opcode(inst) == OP_push_imm) {
+        IF_X64(instr_t *next = instr_get_next(inst);)
+        ASSERT(*pc == RAW_OPCODE_push_imm32 && next_pc - pc == PUSH_IMM32_LENGTH);
+        kind = PERSIST_RELOC_PUSH_IMM32;
+# ifdef X64
+        /* the top half goes in a separate "mov hi32 -> 4(%rsp)" */
+        if (next != NULL && TEST(INSTR_RETADDR_PUSH, next->flags)) {
+            ASSERT(instr_length(dcontext, next) ==
+                   PERSIST_RELOC_HI32_OFFS - (PUSH_IMM32_LENGTH - 1) + sizeof(int));
+            kind = PERSIST_RELOC_PUSH_IMM64;
+        }
+# endif
+    } else if (prev != NULL && TEST(INSTR_RETADDR_PUSH, prev->flags) &&
+               instr_get_opcode(prev) == OP_push_imm) {
+        /* the top half of a PERSIST_RELOC_PUSH_IMM64 */
+        return;
+    } else
+        kind = PERSIST_RELOC_UNSUPPORTED;
+    coarse_unit_add_reloc(dcontext, get_fragment_coarse_info(f),
+                          next_pc - sizeof(int), kind);
+}
+#endif
+
 /* Walks ilist and f's linkstubs, setting each linkstub_t's fields appropriately
  * for the corresponding exit cti in ilist.
  * If emit is true, also encodes each instr in ilist to f's cache slot,
@@ -368,8 +403,14 @@ set_linkstub_fields(dcontext_t *dcontext, fragment_t *f, instrlist_t *ilist,
         } /* exit cti */
         if (instr_ok_to_emit(inst)) {
             if (emit) {
+                IF_X86(cache_pc prev_pc = pc;)
                 pc = instr_encode(dcontext, inst, pc);
                 ASSERT(pc != NULL);
+#ifdef X86
+                if (TEST(INSTR_RETADDR_PUSH, inst->flags) &&
+                    TEST(FRAG_COARSE_GRAIN, f->flags))
+                    emit_retaddr_reloc(dcontext, f, inst, prev_pc, pc);
+#endif
             } else {
                 pc += instr_length(dcontext, inst);
             }
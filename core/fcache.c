@@ -403,6 +403,7 @@ typedef struct _fcache_unit_t {
     dcontext_t *dcontext;
 #endif
     bool writable;             /* remember state of cache memory protection */
+    bool guarded;              /* reservation has guard pages (FCACHE_UNIT_GUARDED) */
 #ifdef WINDOWS_PC_SAMPLE
     /* We cache these values for units_to_{flush,free} units whose cache
      * field has been invalidated
@@ -518,6 +519,7 @@ typedef struct _fcache_thread_units_t {
     /* we delay unmapping units, but only one at a time: */
     cache_pc pending_unmap_pc;
     size_t pending_unmap_size;
+    bool pending_unmap_guarded;
     /* are there units waiting to be flushed at a safe spot? */
     bool pending_flush;
 } fcache_thread_units_t;
@@ -538,6 +540,24 @@ typedef struct _fcache_thread_units_t {
     (!(cache)->is_shared || (cache)->is_local || \
      OWN_MUTEX(&(cache)->lock) || dynamo_all_threads_synched)
 
+/* Under -vm_huge_pages the (non-coarse) shared caches, whose units the
+ * options raise to HUGE_PAGE_SIZE multiples, commit in huge page steps.
+ * Units of those caches with a huge-page-multiple reservation get no guard
+ * pages, as those would split every 2MB range; all other units keep them.
+ */
+#ifdef LINUX
+# define CACHE_HUGE_PAGES(cache)                                    \
+    (DYNAMO_OPTION(vm_huge_pages) && (cache)->is_shared && !(cache)->is_coarse)
+# define CACHE_COMMIT_INCREMENT(cache)                              \
+    (CACHE_HUGE_PAGES(cache) ?                                      \
+     HUGE_PAGE_SIZE : DYNAMO_OPTION(cache_commit_increment))
+# define FCACHE_UNIT_GUARDED(cache, reserve_size) \
+    (!CACHE_HUGE_PAGES(cache) || !ALIGNED(reserve_size, HUGE_PAGE_SIZE))
+#else
+# define CACHE_COMMIT_INCREMENT(cache) DYNAMO_OPTION(cache_commit_increment)
+# define FCACHE_UNIT_GUARDED(cache, reserve_size) true
+#endif
+
 /**************************************************
  * global, unique thread-shared structure:
  */
@@ -573,6 +593,8 @@ DECLARE_CXTSWPROT_VAR(static mutex_t unit_flush_lock, INIT_LOCK_FREE(unit_flush_
 
 static fcache_t *shared_cache_bb;
 static fcache_t *shared_cache_trace;
+/* -hot_bb_cache: shared bbs likely to run often, kept apart from shared_cache_bb */
+static fcache_t *shared_cache_bb_hot;
 
 /* To locate the fcache_unit_t corresponding to a fragment or empty slot
  * we use an interval data structure rather than waste space with a
@@ -636,6 +658,12 @@ DECLARE_FREQPROT_VAR(uint reset_every_nth_unit[CACHE_NUM_TYPES], {0,});
         STATS_MAX(fcache_bb_##stat1, fcache_bb_##stat2);         \
 })
 
+/* commits that can be backed by whole huge pages under -vm_huge_pages */
+#define STATS_FCACHE_HUGE_COMMIT(pc, size) DOSTATS({                   \
+    if (ALIGNED(pc, HUGE_PAGE_SIZE) && ALIGNED(size, HUGE_PAGE_SIZE)) \
+        STATS_ADD(fcache_huge_committed, size);                        \
+})
+
 #ifdef DEBUG
 /* forward decl */
 # ifdef INTERNAL
@@ -822,6 +850,13 @@ fcache_reset_init(void)
         ASSERT(shared_cache_bb != NULL);
         LOG(GLOBAL, LOG_CACHE, 1, "Initial shared bb cache is %d KB\n",
             shared_cache_bb->init_unit_size/1024);
+        if (DYNAMO_OPTION(hot_bb_cache)) {
+            shared_cache_bb_hot = fcache_cache_init(GLOBAL_DCONTEXT, FRAG_SHARED, true);
+            ASSERT(shared_cache_bb_hot != NULL);
+            DODEBUG({ shared_cache_bb_hot->name = "Basic block (shared, hot)"; });
+            LOG(GLOBAL, LOG_CACHE, 1, "Initial shared hot bb cache is %d KB\n",
+                shared_cache_bb_hot->init_unit_size/1024);
+        }
     }
     if (DYNAMO_OPTION(shared_traces)) {
         shared_cache_trace = fcache_cache_init(GLOBAL_DCONTEXT,
@@ -947,7 +982,7 @@ fcache_really_free_unit(fcache_unit_t *u, bool on_dead_list, bool dealloc_unit)
      */
     vmvector_remove(fcache_unit_areas, u->start_pc, u->reserved_end_pc);
     if (dealloc_unit)
-        heap_munmap((void*)u->start_pc, UNIT_RESERVED_SIZE(u));
+        heap_munmap_ex((void*)u->start_pc, UNIT_RESERVED_SIZE(u), u->guarded);
     /* always dealloc the metadata */
     nonpersistent_heap_free(GLOBAL_DCONTEXT, u, sizeof(fcache_unit_t)
                             HEAPACCT(ACCT_MEM_MGT));
@@ -972,6 +1007,13 @@ fcache_stats_exit()
             fcache_cache_stats(GLOBAL_DCONTEXT, cache);
             PROTECT_CACHE(cache, unlock);
         }
+        cache = shared_cache_bb_hot;
+        if (cache != NULL) {
+            ASSERT_DO_NOT_OWN_MUTEX(cache->is_shared, &cache->lock);
+            PROTECT_CACHE(cache, lock);
+            fcache_cache_stats(GLOBAL_DCONTEXT, cache);
+            PROTECT_CACHE(cache, unlock);
+        }
     }
     if (DYNAMO_OPTION(shared_traces)) {
         fcache_t *cache = shared_cache_trace;
@@ -1010,6 +1052,10 @@ fcache_reset_free(void)
     if (DYNAMO_OPTION(shared_bbs)) {
         fcache_cache_free(GLOBAL_DCONTEXT, shared_cache_bb, true);
         shared_cache_bb = NULL;
+        if (shared_cache_bb_hot != NULL) {
+            fcache_cache_free(GLOBAL_DCONTEXT, shared_cache_bb_hot, true);
+            shared_cache_bb_hot = NULL;
+        }
     }
     if (DYNAMO_OPTION(shared_traces)) {
         fcache_cache_free(GLOBAL_DCONTEXT, shared_cache_trace, true);
@@ -1275,6 +1321,7 @@ fcache_create_unit(dcontext_t *dcontext, fcache_t *cache, cache_pc pc, size_t si
             u = allunits->dead;
             while (u != NULL) {
                 if (u->size >= size &&
+                    u->guarded == FCACHE_UNIT_GUARDED(cache, UNIT_RESERVED_SIZE(u)) &&
                     (cache->max_size == 0 || cache->size + u->size <= cache->max_size)) {
                     /* remove from dead list */
                     if (prev_u == NULL)
@@ -1310,14 +1357,20 @@ fcache_create_unit(dcontext_t *dcontext, fcache_t *cache, cache_pc pc, size_t si
                                      HEAPACCT(ACCT_MEM_MGT));
         if (pc != NULL) {
             u->start_pc = pc;
+            /* not ours to unmap, so its layout does not matter */
+            u->guarded = true;
             commit_size = size;
             STATS_FCACHE_ADD(cache, claimed, size);
             STATS_ADD(fcache_combined_claimed, size);
         } else {
             /* allocate new unit */
-            commit_size = DYNAMO_OPTION(cache_commit_increment);
+            commit_size = CACHE_COMMIT_INCREMENT(cache);
             ASSERT(commit_size <= size);
-            u->start_pc = (cache_pc) heap_mmap_reserve(size, commit_size);
+            u->guarded = FCACHE_UNIT_GUARDED(cache, size);
+            u->start_pc = (cache_pc)
+                heap_mmap_ex(size, commit_size, MEMPROT_EXEC|MEMPROT_READ|MEMPROT_WRITE,
+                             u->guarded);
+            STATS_FCACHE_HUGE_COMMIT(u->start_pc, commit_size);
         }
         ASSERT(u->start_pc != NULL);
         ASSERT(proc_is_cache_aligned((void *)u->start_pc));
@@ -1841,6 +1894,7 @@ cache_extend_commitment(fcache_unit_t *unit, size_t commit_size)
     ASSERT(unit != NULL);
     ASSERT(ALIGNED(commit_size, DYNAMO_OPTION(cache_commit_increment)));
     heap_mmap_extend_commitment(unit->end_pc, commit_size);
+    STATS_FCACHE_HUGE_COMMIT(unit->end_pc, commit_size);
     unit->end_pc += commit_size;
     unit->size += commit_size;
     unit->cache->size += commit_size;
@@ -1864,6 +1918,7 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
                      uint slot_size)
 {
     bool reallocated = false;
+    bool new_guarded = unit->guarded;
     cache_pc new_memory = NULL;
     ssize_t shift;
     size_t new_size = unit->size;
@@ -1906,7 +1961,8 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
         u = allunits->dead;
         prev_u = NULL;
         while (u != NULL) {
-            if (UNIT_RESERVED_SIZE(u) >= new_size) {
+            if (UNIT_RESERVED_SIZE(u) >= new_size &&
+                u->guarded == FCACHE_UNIT_GUARDED(cache, UNIT_RESERVED_SIZE(u))) {
                 fcache_thread_units_t *tu = (fcache_thread_units_t *)
                     dcontext->fcache_field;
                 /* remove from dead list */
@@ -1945,6 +2001,8 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
                 ASSERT(tu->pending_unmap_pc == NULL);
                 tu->pending_unmap_pc = unit->start_pc;
                 tu->pending_unmap_size = UNIT_RESERVED_SIZE(unit);
+                tu->pending_unmap_guarded = unit->guarded;
+                unit->guarded = u->guarded;
                 STATS_FCACHE_SUB(cache, capacity, unit->size);
                 STATS_SUB(fcache_combined_capacity, unit->size);
 #ifdef WINDOWS_PC_SAMPLE
@@ -1971,13 +2029,16 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
         reallocated = true;
         commit_size = 0;
         while (commit_size < slot_size && unit->size + commit_size < new_size) {
-            commit_size += DYNAMO_OPTION(cache_commit_increment);
+            commit_size += CACHE_COMMIT_INCREMENT(cache);
         }
         /* FIXME: If not we have a problem -- this routine should return failure */
         ASSERT(commit_size >= slot_size);
         commit_size += unit->size;
         ASSERT(commit_size <= new_size);
-        new_memory = (cache_pc) heap_mmap_reserve(new_size, commit_size);
+        new_guarded = FCACHE_UNIT_GUARDED(cache, new_size);
+        new_memory = (cache_pc)
+            heap_mmap_ex(new_size, commit_size, MEMPROT_EXEC|MEMPROT_READ|MEMPROT_WRITE,
+                         new_guarded);
         STATS_FCACHE_SUB(cache, capacity, unit->size);
         STATS_FCACHE_ADD(cache, capacity, commit_size);
         STATS_FCACHE_MAX(cache, capacity_peak, capacity);
@@ -2019,6 +2080,8 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
         ASSERT(tu->pending_unmap_pc == NULL);
         tu->pending_unmap_pc = unit->start_pc;
         tu->pending_unmap_size = UNIT_RESERVED_SIZE(unit);
+        tu->pending_unmap_guarded = unit->guarded;
+        unit->guarded = new_guarded;
     }
 
     /* whether newly allocated or taken from dead list, increase cache->size
@@ -2149,7 +2212,8 @@ fcache_thread_reset_free(dcontext_t *dcontext)
          */
         vmvector_remove(fcache_unit_areas, tu->pending_unmap_pc,
                         tu->pending_unmap_pc+tu->pending_unmap_size);
-        heap_munmap(tu->pending_unmap_pc, tu->pending_unmap_size);
+        heap_munmap_ex(tu->pending_unmap_pc, tu->pending_unmap_size,
+                       tu->pending_unmap_guarded);
         tu->pending_unmap_pc = NULL;
     }
     if (tu->bb != NULL) {
@@ -2467,7 +2531,7 @@ static bool
 try_for_more_space(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
                    uint slot_size)
 {
-    uint commit_size = DYNAMO_OPTION(cache_commit_increment);
+    uint commit_size = CACHE_COMMIT_INCREMENT(cache);
     ASSERT(CACHE_PROTECTED(cache));
 
     if (unit->end_pc < unit->reserved_end_pc &&
@@ -2744,9 +2808,24 @@ force_fragment_from_cache(dcontext_t *dcontext, fcache_t *cache, fragment_t *vic
     }
 }
 
+/* -cache_generational: whether f counts as executed since it was last
+ * considered for eviction.  Besides fcache_promote_fragment()'s mark from
+ * dispatch, a live incoming link counts for a private fragment, as code
+ * reached through links never comes back to dispatch.
+ */
+static inline bool
+fragment_is_tenured(dcontext_t *dcontext, fragment_t *f)
+{
+    return (TEST(FRAG_CACHE_TENURED, f->flags) ||
+            (!TEST(FRAG_SHARED, f->flags) && incoming_linked_exists(dcontext, f)));
+}
+
+/* If spare_tenured, fails rather than evict a -cache_generational promoted
+ * fragment that is contiguously after fifo.
+ */
 static bool
 replace_fragments(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
-                  fragment_t *f, fragment_t *fifo, uint slot_size)
+                  fragment_t *f, fragment_t *fifo, uint slot_size, bool spare_tenured)
 {
     fragment_t *victim;
     uint slot_so_far;
@@ -2763,7 +2842,8 @@ replace_fragments(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
     pc = FRAG_HDR_START(fifo);
     victim = fifo;
     while (true) {
-        if (TEST(FRAG_CANNOT_DELETE, victim->flags)) {
+        if (TEST(FRAG_CANNOT_DELETE, victim->flags) ||
+            (spare_tenured && fragment_is_tenured(dcontext, victim))) {
             DODEBUG({ cache->consistent = true; });
             return false;
         }
@@ -2855,6 +2935,49 @@ replace_fragments(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
     return true;
 }
 
+/* -cache_generational: the FIFO doubles as a nursery, with fragments promoted
+ * by fcache_promote_fragment() or still linked to (see fragment_is_tenured())
+ * forming the tenured generation.  We walk the FIFO once, replacing only
+ * nursery fragments.  A tenured fragment at the walk position is demoted and
+ * moved to the FIFO tail, so it must execute again, or stay linked, before
+ * its next turn to stay resident.
+ */
+static bool
+replace_nursery(dcontext_t *dcontext, fcache_t *cache, fragment_t *f, uint slot_size,
+                fragment_t *fifo)
+{
+    fcache_unit_t *unit;
+    fragment_t *next, *last;
+    ASSERT(USE_FIFO(f));
+    ASSERT(CACHE_PROTECTED(cache));
+    if (fifo == NULL)
+        return false;
+    /* demoted fragments are re-appended, so stop at the original tail */
+    last = FIFO_PREV(cache->fifo);
+    while (true) {
+        next = FIFO_NEXT(fifo);
+        if (fragment_is_tenured(dcontext, fifo)) {
+            LOG(THREAD, LOG_CACHE, 4, "	demoting F%d to the nursery\n", FRAG_ID(fifo));
+            fifo->flags &= ~FRAG_CACHE_TENURED;
+            fifo_remove(dcontext, cache, fifo);
+            fifo_append(cache, fifo);
+            STATS_INC(num_fragments_demoted);
+        } else {
+            unit = FIFO_UNIT(fifo);
+            if ((ptr_uint_t)(unit->end_pc - FRAG_HDR_START(fifo)) >= slot_size) {
+                DOLOG(4, LOG_CACHE, { verify_fifo(dcontext, cache); });
+                if (replace_fragments(dcontext, cache, unit, f, fifo, slot_size,
+                                      true/*spare tenured*/))
+                    return true;
+            }
+        }
+        if (fifo == last || next == NULL)
+            break;
+        fifo = next;
+    }
+    return false;
+}
+
 static inline bool
 replace_fifo(dcontext_t *dcontext, fcache_t *cache, fragment_t *f, uint slot_size,
              fragment_t *fifo)
@@ -2862,6 +2985,14 @@ replace_fifo(dcontext_t *dcontext, fcache_t *cache, fragment_t *f, uint slot_siz
     fcache_unit_t *unit;
     ASSERT(USE_FIFO(f));
     ASSERT(CACHE_PROTECTED(cache));
+    if (DYNAMO_OPTION(cache_generational) && cache->finite_cache) {
+        if (replace_nursery(dcontext, cache, f, slot_size, fifo))
+            return true;
+        /* Under pressure: every candidate was promoted or blocked by a promoted
+         * neighbor.  Demotion may have moved fifo, so restart from the head.
+         */
+        fifo = cache->fifo;
+    }
     while (fifo != NULL) {
         unit = FIFO_UNIT(fifo);
         if ((ptr_uint_t)(unit->end_pc - FRAG_HDR_START(fifo)) >= slot_size) {
@@ -2869,7 +3000,7 @@ replace_fifo(dcontext_t *dcontext, fcache_t *cache, fragment_t *f, uint slot_siz
              * could fail if un-deletable frags
              */
             DOLOG(4, LOG_CACHE, { verify_fifo(dcontext, cache); });
-            if (replace_fragments(dcontext, cache, unit, f, fifo, slot_size))
+            if (replace_fragments(dcontext, cache, unit, f, fifo, slot_size, false))
                 return true;
         }
         fifo = FIFO_NEXT(fifo);
@@ -3247,7 +3378,8 @@ add_fragment_common(dcontext_t *dcontext, fcache_t *cache, fragment_t *f, uint s
                  */
                 LOG(THREAD, LOG_CACHE, 4, "\ttrying to fit in empty slot\n");
                 DOLOG(4, LOG_CACHE, { verify_fifo(dcontext, cache); });
-                if (replace_fragments(dcontext, cache, unit, f, fifo, slot_size))
+                if (replace_fragments(dcontext, cache, unit, f, fifo, slot_size,
+                                      false))
                     return;
             }
             fifo = FIFO_NEXT(fifo);
@@ -3514,6 +3646,30 @@ fcache_return_extra_space(dcontext_t *dcontext, fragment_t *f, size_t space_in)
                        released ? returnable_space : 0);
 }
 
+/* For -hot_bb_cache: a new shared bb is hot if its tag was executed as a
+ * trace head in an earlier life without becoming a trace (a bb superseded by
+ * a trace is cold, as the trace is what runs), or if enough existing
+ * fragments are waiting to link to it.
+ * Fragments are never moved once placed: as thread-shared code cannot be
+ * relocated without synching all threads, a bb is re-placed according to
+ * its history when it is re-created after a flush or deletion.
+ */
+static bool
+shared_bb_is_hot(dcontext_t *dcontext, fragment_t *f)
+{
+    if (monitor_trace_head_count(dcontext, f->tag) > 0) {
+        STATS_INC(fcache_shared_bb_hot_counter);
+        return true;
+    }
+    if (DYNAMO_OPTION(hot_bb_links) > 0 &&
+        future_incoming_count(dcontext, f->tag, DYNAMO_OPTION(hot_bb_links)) >=
+        DYNAMO_OPTION(hot_bb_links)) {
+        STATS_INC(fcache_shared_bb_hot_links);
+        return true;
+    }
+    return false;
+}
+
 static fcache_t *
 get_cache_for_new_fragment(dcontext_t *dcontext, fragment_t *f)
 {
@@ -3551,6 +3707,8 @@ get_cache_for_new_fragment(dcontext_t *dcontext, fragment_t *f)
         } else {
             if (IN_TRACE_CACHE(f->flags))
                 return shared_cache_trace;
+            else if (shared_cache_bb_hot != NULL && shared_bb_is_hot(dcontext, f))
+                return shared_cache_bb_hot;
             else
                 return shared_cache_bb;
         }
@@ -3598,7 +3756,8 @@ fcache_add_fragment(dcontext_t *dcontext, fragment_t *f)
         vmvector_remove(fcache_unit_areas, tu->pending_unmap_pc,
                         tu->pending_unmap_pc+tu->pending_unmap_size);
         /* caller must dec stats since here we don't know type of cache */
-        heap_munmap(tu->pending_unmap_pc, tu->pending_unmap_size);
+        heap_munmap_ex(tu->pending_unmap_pc, tu->pending_unmap_size,
+                       tu->pending_unmap_guarded);
         tu->pending_unmap_pc = NULL;
     }
 
@@ -3672,6 +3831,20 @@ fcache_remove_fragment(dcontext_t *dcontext, fragment_t *f)
 }
 
 
+/* Marks a private fragment as executed for -cache_generational.  Callers
+ * must be couldbelinking, as a flusher may otherwise be updating f->flags.
+ */
+void
+fcache_promote_fragment(dcontext_t *dcontext, fragment_t *f)
+{
+    ASSERT(DYNAMO_OPTION(cache_generational));
+    if (!USE_FIFO(f) || TESTANY(FRAG_FAKE | FRAG_CACHE_TENURED, f->flags))
+        return;
+    ASSERT(is_couldbelinking(dcontext));
+    f->flags |= FRAG_CACHE_TENURED;
+    STATS_INC(num_fragments_tenured);
+}
+
 #ifdef SIDELINE
 dcontext_t *
 get_dcontext_for_fragment(fragment_t *f)
@@ -4049,6 +4222,8 @@ fcache_flush_all_caches()
      */
     if (DYNAMO_OPTION(shared_bbs)) {
         fcache_mark_units_for_free(dcontext, shared_cache_bb);
+        if (shared_cache_bb_hot != NULL)
+            fcache_mark_units_for_free(dcontext, shared_cache_bb_hot);
     }
     if (DYNAMO_OPTION(shared_traces)) {
         fcache_mark_units_for_free(dcontext, shared_cache_trace);
@@ -4233,6 +4408,7 @@ fcache_reset_all_caches_proactively(uint target)
                 /* monitor must go first to remove any undeletable private fragments */
                 monitor_thread_reset_free(dcontext);
                 fragment_thread_reset_free(dcontext);
+                link_thread_reset_free(dcontext);
                 fcache_thread_reset_free(dcontext);
                 /* arch and os data is all persistent */
                 vm_areas_thread_reset_free(dcontext);
@@ -107,6 +107,7 @@ void fcache_add_fragment(dcontext_t *dcontext, fragment_t *f);
 void fcache_shift_start_pc(dcontext_t *dcontext, fragment_t *f, uint space);
 void fcache_return_extra_space(dcontext_t *dcontext, fragment_t *f, size_t space);
 void fcache_remove_fragment(dcontext_t *dcontext, fragment_t *f);
+void fcache_promote_fragment(dcontext_t *dcontext, fragment_t *f);
 
 bool fcache_is_flush_pending(dcontext_t *dcontext);
 bool fcache_flush_pending_units(dcontext_t *dcontext, fragment_t *was_I_flushed);
@@ -165,6 +165,75 @@ DECLARE_CXTSWPROT_VAR(mutex_t shared_cache_flush_lock,
  */
 DECLARE_FREQPROT_VAR(uint flushtime_global, 0);
 
+/* For -flush_epoch_reclaim, live threads are grouped by flushtime_last_update
+ * in increasing order, so the oldest flushtime any thread may still be using
+ * is that of the head and pending deletion entries need no ref counts.
+ * Protected by shared_cache_flush_lock.
+ */
+typedef struct _flush_epoch_t {
+    uint flushtime;
+    uint num_threads;
+    struct _flush_epoch_t *prev;
+    struct _flush_epoch_t *next;
+} flush_epoch_t;
+DECLARE_CXTSWPROT_VAR(static flush_epoch_t *flush_epochs_head, NULL);
+DECLARE_CXTSWPROT_VAR(static flush_epoch_t *flush_epochs_tail, NULL);
+
+/* A -flush_epoch_reclaim flush that synchs with no thread records its region
+ * here, in increasing flushtime order, for each thread to act on wrt its own
+ * trace and futures at its next synch point.  Protected by shared_cache_flush_lock.
+ */
+typedef struct _flush_region_t {
+    uint flushtime;
+    app_pc base;
+    app_pc end;
+    bool free_futures;
+    struct _flush_region_t *prev;
+    struct _flush_region_t *next;
+} flush_region_t;
+DECLARE_CXTSWPROT_VAR(static flush_region_t *flush_regions_head, NULL);
+DECLARE_CXTSWPROT_VAR(static flush_region_t *flush_regions_tail, NULL);
+
+/* Such a flush cannot unlink private fragments, clear private ibt tables, or
+ * relink thread-private gencode without visiting each thread.
+ */
+#define FLUSH_EPOCH_NO_SYNCH_CONFIG()                                    \
+    (DYNAMO_OPTION(flush_epoch_reclaim) && !RUNNING_WITHOUT_CODE_CACHE() && \
+     (!SHARED_IB_TARGETS() || SHARED_IBT_TABLES_ENABLED()) &&           \
+     !special_ibl_xfer_is_thread_private()                              \
+     IF_WINDOWS(&& (!DYNAMO_OPTION(shared_syscalls) ||                  \
+                    IS_SHARED_SYSCALL_THREAD_SHARED)))
+
+/* Instead of waiting on each couldbelinking thread, such a flush closes a gate
+ * at enter_couldbelinking() and waits for the count of couldbelinking threads
+ * to drain.  Updated atomically; written on every cache transition, so unprotected.
+ */
+DECLARE_NEVERPROT_VAR(static volatile int flush_gate_linking, 0);
+DECLARE_NEVERPROT_VAR(static volatile int flush_gate_closed, 0);
+/* The flusher blocks on flush_gate_drained until the count reaches 0, and
+ * threads arriving at the closed gate block on their flush_gate_opened events,
+ * queued on flush_gate_waiters, until the flusher opens it again.
+ */
+static event_t flush_gate_drained;
+DECLARE_CXTSWPROT_VAR(static mutex_t flush_gate_lock, INIT_LOCK_FREE(flush_gate_lock));
+DECLARE_CXTSWPROT_VAR(static per_thread_t *flush_gate_waiters, NULL);
+/* Threads with private fragments in their tables: such a flush is only done
+ * when there are none.  Only incremented while couldbelinking.
+ */
+DECLARE_NEVERPROT_VAR(static volatile int flush_private_threads, 0);
+
+static void
+flush_epoch_join(dcontext_t *dcontext, uint flushtime);
+
+static void
+flush_epoch_leave(dcontext_t *dcontext);
+
+static void
+flush_regions_free(uint flushtime);
+
+static void
+flush_gate_exit(void);
+
 #ifdef CLIENT_INTERFACE
 DECLARE_CXTSWPROT_VAR(mutex_t client_flush_request_lock,
                       INIT_LOCK_FREE(client_flush_request_lock));
@@ -1293,6 +1362,8 @@ fragment_reset_init(void)
      * reset the global flushtime here
      */
     flushtime_global = 0;
+    /* threads are all starting over, so no region is still to be acted on */
+    flush_regions_free(UINT_MAX);
     mutex_unlock(&shared_cache_flush_lock);
 
     if (SHARED_FRAGMENTS_ENABLED()) {
@@ -1435,6 +1506,9 @@ fragment_init()
         memset(dead_lists, 0, sizeof(*dead_lists));
     }
 
+    if (DYNAMO_OPTION(flush_epoch_reclaim))
+        flush_gate_drained = create_event();
+
     fragment_reset_init();
 
 #if defined(INTERNAL) || defined(CLIENT_INTERFACE)
@@ -1614,6 +1688,18 @@ fragment_exit()
     });
 #endif
 
+    /* threads not cleaned up at exit never left their flush epoch */
+    mutex_lock(&shared_cache_flush_lock);
+    flush_regions_free(UINT_MAX);
+    while (flush_epochs_head != NULL) {
+        flush_epoch_t *next = flush_epochs_head->next;
+        HEAP_TYPE_FREE(GLOBAL_DCONTEXT, flush_epochs_head, flush_epoch_t,
+                       ACCT_OTHER, PROTECTED);
+        flush_epochs_head = next;
+    }
+    flush_epochs_tail = NULL;
+    mutex_unlock(&shared_cache_flush_lock);
+
     fragment_reset_free();
 
 #ifdef RETURN_AFTER_CALL
@@ -1695,6 +1781,10 @@ fragment_exit()
 
     if (SHARED_IBT_TABLES_ENABLED())
         DELETE_LOCK(dead_tables_lock);
+    if (DYNAMO_OPTION(flush_epoch_reclaim)) {
+        ASSERT(flush_gate_waiters == NULL);
+        destroy_event(flush_gate_drained);
+    }
 #ifdef SHARING_STUDY
     if (INTERNAL_OPTION(fragment_sharing_study)) {
         DELETE_LOCK(shared_blocks_lock);
@@ -1712,6 +1802,7 @@ fragment_exit()
     DELETE_LOCK(client_flush_request_lock);
 #endif
     DELETE_LOCK(shared_cache_flush_lock);
+    DELETE_LOCK(flush_gate_lock);
 }
 
 /* Decrement the ref-count for any reference to table that the
@@ -1828,6 +1919,27 @@ dec_all_table_ref_counts(dcontext_t *dcontext, per_thread_t *pt)
     }
 }
 
+/* -ret_shadow_stack: empties dcontext's return shadow stack.  An empty entry
+ * holds a non-canonical address, which no return can target: were an app to
+ * return there anyway, the jump to the entry's pad faults just as the return
+ * would have.
+ */
+static void
+ret_shadow_stack_reset(dcontext_t *dcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    /* use dcontext->local_state to support being called from other threads */
+    local_state_extended_t *state = (local_state_extended_t *) dcontext->local_state;
+    app_pc *entry = (app_pc *)
+        ALIGN_FORWARD(pt->ret_shadow_stack, RET_SHADOW_STACK_SIZE);
+    uint i;
+    ASSERT(state != NULL && DYNAMO_OPTION(ibl_table_in_tls));
+    for (i = 0; i < RET_SHADOW_STACK_SIZE / sizeof(app_pc); i++)
+        entry[i] = (app_pc) IF_X64_ELSE(0x8000000000000000ULL, 0);
+    state->ret_shadow_sp = (byte *) entry;
+    STATS_INC(num_ret_shadow_resets);
+}
+
 /* re-initializes non-persistent memory */
 void
 fragment_thread_reset_init(dcontext_t *dcontext)
@@ -1848,6 +1960,21 @@ fragment_thread_reset_init(dcontext_t *dcontext)
      * so we have to explicitly set to 0 for that case.
      */
     pt->flushtime_last_update = (dynamo_resetting) ? 0 : flushtime_global;
+    pt->flush_epoch = NULL;
+    pt->flush_epoch_private = false;
+    pt->flush_epoch_parked = false;
+    pt->flushtime_parked = 0;
+    pt->flush_epoch_missed = false;
+    if (DYNAMO_OPTION(flush_epoch_reclaim)) {
+        mutex_lock(&shared_cache_flush_lock);
+        /* re-read under the lock so no flush can slip in between */
+        if (!dynamo_resetting)
+            pt->flushtime_last_update = flushtime_global;
+        flush_epoch_join(dcontext, pt->flushtime_last_update);
+        mutex_unlock(&shared_cache_flush_lock);
+    }
+    if (pt->ret_shadow_stack != NULL)
+        ret_shadow_stack_reset(dcontext);
 
     /* set initial hashtable sizes */
     hashtable_fragment_init(dcontext, &pt->bb, INIT_HTABLE_SIZE_BB,
@@ -2026,6 +2153,10 @@ fragment_thread_init(dcontext_t *dcontext)
     pt = (per_thread_t *) global_heap_alloc(sizeof(per_thread_t) HEAPACCT(ACCT_OTHER));
     dcontext->fragment_field = (void *) pt;
 
+    /* over-allocate to align the ring: see RET_SHADOW_STACK_SIZE */
+    pt->ret_shadow_stack = DYNAMO_OPTION(ret_shadow_stack) ?
+        (byte *) heap_mmap(2 * RET_SHADOW_STACK_SIZE) : NULL;
+
     fragment_thread_reset_init(dcontext);
 
 #if defined(INTERNAL) || defined(CLIENT_INTERFACE)
@@ -2047,8 +2178,12 @@ fragment_thread_init(dcontext_t *dcontext)
     pt->finished_with_unlink = create_event();
     ASSIGN_INIT_LOCK_FREE(pt->linking_lock, linking_lock);
     pt->finished_all_unlink = create_event();
+    pt->flush_gate_opened =
+        DYNAMO_OPTION(flush_epoch_reclaim) ? create_event() : NULL;
+    pt->flush_gate_next = NULL;
     pt->soon_to_be_linking = false;
     pt->at_syscall_at_flush = false;
+    pt->flush_at_cache_entry = NULL;
 }
 
 static bool
@@ -2177,6 +2312,18 @@ fragment_thread_reset_free(dcontext_t *dcontext)
 # endif
 
 #endif /* !DEBUG */
+
+    if (pt->flush_epoch != NULL) {
+        /* we no longer hold back freeing of anything flushed */
+        mutex_lock(&shared_cache_flush_lock);
+        flush_epoch_leave(dcontext);
+        mutex_unlock(&shared_cache_flush_lock);
+    }
+    if (pt->flush_epoch_private) {
+        /* our private fragments are all gone */
+        pt->flush_epoch_private = false;
+        ATOMIC_DEC(int, flush_private_threads);
+    }
 }
 
 /* atexit cleanup */
@@ -2207,16 +2354,27 @@ fragment_thread_exit(dcontext_t *dcontext)
 
     fragment_thread_reset_free(dcontext);
 
+    if (pt->could_be_linking && DYNAMO_OPTION(flush_epoch_reclaim)) {
+        /* exiting without enter_threadexit(): a gated flusher must not wait on us */
+        pt->could_be_linking = false;
+        flush_gate_exit();
+    }
+
     /* events are global */
     destroy_event(pt->waiting_for_unlink);
     destroy_event(pt->finished_with_unlink);
     destroy_event(pt->finished_all_unlink);
+    if (pt->flush_gate_opened != NULL)
+        destroy_event(pt->flush_gate_opened);
     DELETE_LOCK(pt->linking_lock);
 
 #if defined(CLIENT_INTERFACE) && defined(CLIENT_SIDELINE)
     DELETE_LOCK(pt->fragment_delete_mutex);
 #endif
 
+    if (pt->ret_shadow_stack != NULL)
+        heap_munmap(pt->ret_shadow_stack, 2 * RET_SHADOW_STACK_SIZE);
+
     global_heap_free(pt, sizeof(per_thread_t) HEAPACCT(ACCT_OTHER));
     dcontext->fragment_field = NULL;
 }
@@ -2319,6 +2477,9 @@ fragment_init_heap(fragment_t *f, app_pc tag, int direct_exits, int indirect_exi
          * but we need a non-zero value for linkstub_fragment()
          */
         t->num_bbs = 1;
+#ifdef CLIENT_SIDELINE
+        t->opt_deferred = 0;
+#endif
 #ifdef PROFILE_RDTSC
         t->count = 0UL;
         t->total_time = (uint64) 0;
@@ -2970,6 +3131,13 @@ fragment_add(dcontext_t *dcontext, fragment_t *f)
     resized = fragment_add_to_hashtable(dcontext, f, table);
     TABLE_RWLOCK(table, write, unlock);
 
+    if (!TEST(FRAG_SHARED, f->flags) && DYNAMO_OPTION(flush_epoch_reclaim) &&
+        !pt->flush_epoch_private) {
+        /* adds are made couldbelinking, so no flush behind the gate can miss this */
+        pt->flush_epoch_private = true;
+        ATOMIC_INC(int, flush_private_threads);
+    }
+
     /* After resizing a table that is targeted by inlined IBL heads
      * the current fragment will need to be repatched; but, we don't have
      * to update the stubs when using per-type trace tables since the
@@ -5439,11 +5607,269 @@ get_flushtime_last_update(dcontext_t *dcontext)
     return pt->flushtime_last_update;
 }
 
+/* Adds dcontext's thread to the -flush_epoch_reclaim bucket for flushtime.
+ * Threads only ever move up to flushtime_global, so new buckets go at the tail.
+ * Caller must hold shared_cache_flush_lock.
+ */
+static void
+flush_epoch_join(dcontext_t *dcontext, uint flushtime)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    flush_epoch_t *epoch = flush_epochs_tail;
+    ASSERT_OWN_MUTEX(true, &shared_cache_flush_lock);
+    ASSERT(pt->flush_epoch == NULL);
+    ASSERT(epoch == NULL || epoch->flushtime <= flushtime);
+    if (epoch == NULL || epoch->flushtime != flushtime) {
+        epoch = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, flush_epoch_t, ACCT_OTHER, PROTECTED);
+        epoch->flushtime = flushtime;
+        epoch->num_threads = 0;
+        epoch->prev = flush_epochs_tail;
+        epoch->next = NULL;
+        if (flush_epochs_tail == NULL)
+            flush_epochs_head = epoch;
+        else
+            flush_epochs_tail->next = epoch;
+        flush_epochs_tail = epoch;
+    }
+    epoch->num_threads++;
+    pt->flush_epoch = epoch;
+}
+
+/* Removes dcontext's thread from its -flush_epoch_reclaim bucket.
+ * Caller must hold shared_cache_flush_lock.
+ */
+static void
+flush_epoch_leave(dcontext_t *dcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    flush_epoch_t *epoch = pt->flush_epoch;
+    ASSERT_OWN_MUTEX(true, &shared_cache_flush_lock);
+    ASSERT(epoch != NULL && epoch->num_threads > 0);
+    pt->flush_epoch = NULL;
+    epoch->num_threads--;
+    if (epoch->num_threads > 0)
+        return;
+    if (epoch->prev == NULL)
+        flush_epochs_head = epoch->next;
+    else
+        epoch->prev->next = epoch->next;
+    if (epoch->next == NULL)
+        flush_epochs_tail = epoch->prev;
+    else
+        epoch->next->prev = epoch->prev;
+    HEAP_TYPE_FREE(GLOBAL_DCONTEXT, epoch, flush_epoch_t, ACCT_OTHER, PROTECTED);
+}
+
+/* Returns the lowest flushtime_last_update of any live thread not parked at a
+ * syscall: every pending deletion entry at or below it is no longer referenced
+ * by any thread.
+ * Caller must hold shared_cache_flush_lock.
+ */
+uint
+flush_epoch_oldest(void)
+{
+    ASSERT(DYNAMO_OPTION(flush_epoch_reclaim));
+    ASSERT_OWN_MUTEX(true, &shared_cache_flush_lock);
+    return (flush_epochs_head == NULL) ? flushtime_global : flush_epochs_head->flushtime;
+}
+
+/* Frees the recorded flush regions at or below flushtime, oldest first.
+ * Caller must hold shared_cache_flush_lock.
+ */
+static void
+flush_regions_free(uint flushtime)
+{
+    ASSERT_OWN_MUTEX(true, &shared_cache_flush_lock);
+    while (flush_regions_head != NULL && flush_regions_head->flushtime <= flushtime) {
+        flush_region_t *next = flush_regions_head->next;
+        HEAP_TYPE_FREE(GLOBAL_DCONTEXT, flush_regions_head, flush_region_t,
+                       ACCT_OTHER, PROTECTED);
+        flush_regions_head = next;
+        if (next == NULL)
+            flush_regions_tail = NULL;
+        else
+            next->prev = NULL;
+    }
+}
+
+/* Records [base, base+size) as flushed at the current flushtime_global by a
+ * flush that synched with no thread, and frees the regions every thread in the
+ * buckets is past.  Caller must hold shared_cache_flush_lock.
+ */
+static void
+flush_region_add(app_pc base, size_t size)
+{
+    flush_region_t *region;
+    ASSERT_OWN_MUTEX(true, &shared_cache_flush_lock);
+    flush_regions_free(flush_epoch_oldest());
+    if (size == 0)
+        return;
+    region = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, flush_region_t, ACCT_OTHER, PROTECTED);
+    region->flushtime = flushtime_global;
+    region->base = base;
+    region->end = base + size;
+    region->free_futures = false;
+    region->prev = flush_regions_tail;
+    region->next = NULL;
+    if (flush_regions_tail == NULL)
+        flush_regions_head = region;
+    else
+        flush_regions_tail->next = region;
+    flush_regions_tail = region;
+}
+
+/* Acts on dcontext's behalf on every region flushed since its
+ * flushtime_last_update by a flush that did not synch with it: squashes a
+ * trace in progress that crosses one and frees its futures and trace head
+ * counters there.  Its private fragments need no unlinking, as such a flush
+ * only happens when no thread has any.
+ * Caller must hold dcontext's linking_lock and be couldbelinking.
+ */
+static void
+flush_epoch_catch_up(dcontext_t *dcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    flush_region_t *region;
+    /* regions may have been freed while we were parked */
+    bool squash = pt->flush_epoch_missed && is_building_trace(dcontext);
+    ASSERT(pt->could_be_linking);
+    pt->flush_epoch_missed = false;
+    mutex_lock(&shared_cache_flush_lock);
+    for (region = flush_regions_tail;
+         region != NULL && region->flushtime > pt->flushtime_last_update;
+         region = region->prev) {
+        if (!squash && is_building_trace(dcontext)) {
+            void *trace_vmlist = cur_trace_vmlist(dcontext);
+            squash = (trace_vmlist != NULL &&
+                      vm_list_overlaps(dcontext, trace_vmlist, region->base,
+                                       region->end));
+        }
+        if (region->free_futures) {
+            acquire_recursive_lock(&change_linking_lock);
+            fragment_delete_futures_in_region(dcontext, region->base, region->end);
+            thcounter_range_remove(dcontext, region->base, region->end);
+            release_recursive_lock(&change_linking_lock);
+        }
+    }
+    mutex_unlock(&shared_cache_flush_lock);
+    if (squash) {
+        LOG(THREAD, LOG_FRAGMENT, 2, "\tsquashing trace crossing a flushed region\n");
+        trace_abort(dcontext);
+    }
+}
+
+/* Called at a syscall from dispatch: until flush_epoch_unpark() the thread
+ * references no fragment (it returns via the syscall linkstub), so it leaves
+ * the buckets rather than hold back freeing for as long as it is blocked.
+ */
+void
+flush_epoch_park(dcontext_t *dcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    if (!DYNAMO_OPTION(flush_epoch_reclaim) || RUNNING_WITHOUT_CODE_CACHE() ||
+        pt->flush_epoch == NULL)
+        return;
+    ASSERT(!is_couldbelinking(dcontext));
+    mutex_lock(&shared_cache_flush_lock);
+    flush_epoch_leave(dcontext);
+    pt->flush_epoch_parked = true;
+    pt->flushtime_parked = pt->flushtime_last_update;
+    mutex_unlock(&shared_cache_flush_lock);
+}
+
+void
+flush_epoch_unpark(dcontext_t *dcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    if (!DYNAMO_OPTION(flush_epoch_reclaim) || RUNNING_WITHOUT_CODE_CACHE() ||
+        !pt->flush_epoch_parked)
+        return;
+    mutex_lock(&shared_cache_flush_lock);
+    pt->flush_epoch_parked = false;
+    /* anything flushed meanwhile may already be freed, so we rejoin at the
+     * newest flushtime and squash any trace on our next synch
+     */
+    flush_epoch_join(dcontext, flushtime_global);
+    if (pt->flushtime_parked < flushtime_global) {
+        pt->flush_epoch_missed = true;
+        set_flushtime_last_update(dcontext, flushtime_global);
+    }
+    mutex_unlock(&shared_cache_flush_lock);
+}
+
+/* Counts dcontext as couldbelinking, first waiting out any flush behind the gate. */
+static void
+flush_gate_enter(dcontext_t *dcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    while (true) {
+        ATOMIC_INC(int, flush_gate_linking);
+        /* a flusher can become couldbelinking itself, e.g. to abort a trace */
+        if (flush_gate_closed == 0 || dcontext == flusher)
+            break;
+        flush_gate_exit();
+        STATS_INC(num_wait_flush);
+        /* the flusher opens the gate under the lock, so we cannot miss it */
+        mutex_lock(&flush_gate_lock);
+        if (flush_gate_closed == 0) {
+            mutex_unlock(&flush_gate_lock);
+            continue;
+        }
+        pt->flush_gate_next = flush_gate_waiters;
+        flush_gate_waiters = pt;
+        mutex_unlock(&flush_gate_lock);
+        wait_for_event(pt->flush_gate_opened);
+    }
+}
+
+static void
+flush_gate_exit(void)
+{
+    ASSERT(flush_gate_linking > 0);
+    /* the last thread out wakes a flusher waiting behind the closed gate */
+    if (atomic_dec_becomes_zero(&flush_gate_linking) && flush_gate_closed != 0)
+        signal_event(flush_gate_drained);
+}
+
+/* Opens the gate and wakes every thread that blocked at it. */
+static void
+flush_gate_open(void)
+{
+    per_thread_t *waiter;
+    mutex_lock(&flush_gate_lock);
+    ATOMIC_DEC(int, flush_gate_closed);
+    for (waiter = flush_gate_waiters; waiter != NULL; ) {
+        /* a woken thread may re-queue itself on the next flush */
+        per_thread_t *next = waiter->flush_gate_next;
+        waiter->flush_gate_next = NULL;
+        signal_event(waiter->flush_gate_opened);
+        waiter = next;
+    }
+    flush_gate_waiters = NULL;
+    mutex_unlock(&flush_gate_lock);
+}
+
 void
 set_flushtime_last_update(dcontext_t *dcontext, uint val)
 {
     per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
     pt->flushtime_last_update = val;
+    if (pt->flush_epoch != NULL && pt->flush_epoch->flushtime != val) {
+        if (pt->flush_epoch->num_threads == 1 && pt->flush_epoch == flush_epochs_tail) {
+            /* sole newest thread: move the bucket rather than re-allocate it */
+            ASSERT_OWN_MUTEX(true, &shared_cache_flush_lock);
+            ASSERT(val > pt->flush_epoch->flushtime);
+            pt->flush_epoch->flushtime = val;
+        } else {
+            flush_epoch_leave(dcontext);
+            flush_epoch_join(dcontext, val);
+        }
+    }
+    /* shared fragments flushed before val may be freed once all threads
+     * are past it, so their landing pads must be gone from our stack
+     */
+    if (pt->ret_shadow_stack != NULL)
+        ret_shadow_stack_reset(dcontext);
 }
 
 void
@@ -5471,6 +5897,15 @@ check_flush_queue(dcontext_t *dcontext, fragment_t *was_I_flushed)
     per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
     bool not_flushed = true;
     ASSERT_OWN_MUTEX(true, &pt->linking_lock);
+    if (DYNAMO_OPTION(flush_epoch_reclaim)) {
+        if (pt->could_be_linking &&
+            (pt->flushtime_last_update < flushtime_global || pt->flush_epoch_missed))
+            flush_epoch_catch_up(dcontext);
+        if (pt->flush_epoch_private && pt->bb.entries == 0 && pt->trace.entries == 0) {
+            pt->flush_epoch_private = false;
+            ATOMIC_DEC(int, flush_private_threads);
+        }
+    }
     /* first check private queue and act on pending deletions */
     if (pt->flush_queue_nonempty) {
         bool local_prot = local_heap_protected(dcontext);
@@ -5719,6 +6154,8 @@ enter_nolinking(dcontext_t *dcontext, fragment_t *was_I_flushed, bool cache_tran
     wait_for_flusher_linking(dcontext);
     not_flushed = not_flushed && check_flush_queue(dcontext, was_I_flushed);
     pt->could_be_linking = false;
+    if (DYNAMO_OPTION(flush_epoch_reclaim))
+        flush_gate_exit();
     mutex_unlock(&pt->linking_lock);
 
     if (!cache_transition)
@@ -5779,6 +6216,14 @@ enter_nolinking(dcontext_t *dcontext, fragment_t *was_I_flushed, bool cache_tran
     }
 #endif
 
+    if (pt->flush_at_cache_entry != NULL) {
+        app_pc pc = pt->flush_at_cache_entry;
+        pt->flush_at_cache_entry = NULL;
+        flush_fragments_from_region(dcontext, pc, 1, false/*don't force synchall*/);
+        /* as below, we can't tell whether was_I_flushed went with it */
+        not_flushed = false;
+    }
+
 #ifdef CLIENT_INTERFACE
     /* Handle flush requests queued via dr_flush_fragments()/dr_delay_flush_region() */
     /* thread private list */
@@ -5806,6 +6251,16 @@ enter_nolinking(dcontext_t *dcontext, fragment_t *was_I_flushed, bool cache_tran
     return not_flushed;
 }
 
+void
+request_flush_at_cache_entry(dcontext_t *dcontext, app_pc pc)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    ASSERT(dcontext != GLOBAL_DCONTEXT && pc != NULL);
+    if (RUNNING_WITHOUT_CODE_CACHE())
+        return;
+    pt->flush_at_cache_entry = pc;
+}
+
 /* Returns false iff was_I_flushed ends up being deleted */
 bool
 enter_couldbelinking(dcontext_t *dcontext, fragment_t *was_I_flushed, bool cache_transition)
@@ -5819,6 +6274,8 @@ enter_couldbelinking(dcontext_t *dcontext, fragment_t *was_I_flushed, bool cache
 
     DOCHECK(1, { check_safe_for_flush_synch(dcontext); });
 
+    if (DYNAMO_OPTION(flush_epoch_reclaim))
+        flush_gate_enter(dcontext);
     mutex_lock(&pt->linking_lock);
     ASSERT(!pt->could_be_linking);
     /* ensure not still marked at_syscall */
@@ -5860,6 +6317,8 @@ enter_threadexit(dcontext_t *dcontext)
     mutex_lock(&pt->linking_lock);
     /* must dec ref count on shared regions before we die */
     check_flush_queue(dcontext, NULL);
+    if (pt->could_be_linking && DYNAMO_OPTION(flush_epoch_reclaim))
+        flush_gate_exit();
     pt->could_be_linking = false;
     if (pt->wait_for_unlink) {
         /* make sure don't get into deadlock w/ flusher */
@@ -5951,6 +6410,8 @@ DECLARE_NEVERPROT_VAR(static int flush_num_threads, 0);
 DECLARE_NEVERPROT_VAR(static int pending_delete_threads, 0);
 DECLARE_NEVERPROT_VAR(static int shared_flushed, 0);
 DECLARE_NEVERPROT_VAR(static bool flush_synchall, false);
+/* -flush_epoch_reclaim flush done behind the gate rather than synching with threads */
+DECLARE_NEVERPROT_VAR(static bool flush_gated, false);
 #ifdef DEBUG
 DECLARE_NEVERPROT_VAR(static int num_flushed, 0);
 DECLARE_NEVERPROT_VAR(static int flush_last_stage, 0);
@@ -5964,14 +6425,22 @@ flush_fragments_free_futures(app_pc base, size_t size)
     ASSERT_OWN_MUTEX(true, &thread_initexit_lock);
     ASSERT((allsynch_flusher == NULL && flusher == get_thread_private_dcontext()) ||
            (flusher == NULL && allsynch_flusher == get_thread_private_dcontext()));
-    ASSERT(flush_num_threads > 0);
-    ASSERT(flush_threads != NULL);
+    ASSERT(flush_gated || flush_num_threads > 0);
+    ASSERT(flush_gated || flush_threads != NULL);
     if (DYNAMO_OPTION(free_unmapped_futures) && !RUNNING_WITHOUT_CODE_CACHE()) {
         /* We need to free the futures after all fragments have been unlinked,
          * as unlinking will create new futures
          */
+        if (flush_gated) {
+            /* each thread frees its own at its next synch point */
+            mutex_lock(&shared_cache_flush_lock);
+            if (flush_regions_tail != NULL && flush_regions_tail->base == base &&
+                flush_regions_tail->end == base + size)
+                flush_regions_tail->free_futures = true;
+            mutex_unlock(&shared_cache_flush_lock);
+        }
         acquire_recursive_lock(&change_linking_lock);
-        for (i=0; i<flush_num_threads; i++) {
+        for (i=0; !flush_gated && i<flush_num_threads; i++) {
             tgt_dcontext = flush_threads[i]->dcontext;
             if (tgt_dcontext != NULL) {
                 fragment_delete_futures_in_region(tgt_dcontext, base, base + size);
@@ -6469,6 +6938,64 @@ flush_fragments_synch_priv(dcontext_t *dcontext, app_pc base, size_t size,
     }
 }
 
+/* With -flush_epoch_reclaim, tries to begin a flush without synchronizing with
+ * each thread: closes the gate at enter_couldbelinking() and waits for the
+ * couldbelinking threads to drain, after which no thread can change linking or
+ * vm area state until flush_fragments_end_synch() opens it again.  Threads in
+ * the cache or at syscalls are left alone: shared fragments are unlinked and
+ * freed once no thread's flushtime is behind them, and each thread acts on
+ * its own trace and futures via the recorded region at its next synch point.
+ * Returns false, having undone everything, if any thread has private fragments,
+ * which only a walk of the threads can unlink.
+ */
+static bool
+flush_fragments_gated_start(dcontext_t *dcontext, app_pc base, size_t size,
+                            bool own_initexit_lock)
+{
+    if (!FLUSH_EPOCH_NO_SYNCH_CONFIG() || flush_private_threads > 0)
+        return false;
+    if (!own_initexit_lock)
+        mutex_lock(&thread_initexit_lock);
+    ASSERT_OWN_MUTEX(true, &thread_initexit_lock);
+    ASSERT(flush_gate_closed == 0);
+    /* the atomic inc orders the close before our reads of the count, just as a
+     * thread's atomic inc of the count orders it before its read of the gate
+     */
+    ATOMIC_INC(int, flush_gate_closed);
+    /* A signal can be left over from a count that drained while the gate was
+     * open or on an earlier flush, so we re-check after each wakeup.
+     */
+    while (flush_gate_linking > 0)
+        wait_for_event(flush_gate_drained);
+    /* no thread can add a private fragment now */
+    if (flush_private_threads > 0) {
+        flush_gate_open();
+        if (!own_initexit_lock)
+            mutex_unlock(&thread_initexit_lock);
+        return false;
+    }
+    flusher = dcontext;
+    flush_gated = true;
+    flush_base = base;
+    flush_size = size;
+    /* pending deletion entries are freed by flushtime, not ref count */
+    pending_delete_threads = 0;
+    ASSERT(flush_last_stage == 0);
+    DODEBUG({
+        flush_last_stage = 1;
+        num_flushed = 0;
+    });
+    STATS_INC(num_flushes_epoch);
+    LOG(THREAD, LOG_FRAGMENT, 2, "\tgate closed: not synching with threads\n");
+#ifdef WINDOWS
+    if (DYNAMO_OPTION(shared_syscalls))
+        unlink_shared_syscall(GLOBAL_DCONTEXT);
+#endif
+    /* i#849: unlink while we clear out ibt */
+    unlink_special_ibl_xfer(GLOBAL_DCONTEXT);
+    return true;
+}
+
 /* This routine begins a flush of the group of fragments in the memory
  * region [base, base+size) by synchronizing with each thread and unlinking
  * all private fragments in the region.
@@ -6537,8 +7064,10 @@ flush_fragments_synch_unlink_priv(dcontext_t *dcontext, app_pc base, size_t size
         return true;
     }
 
-    flush_fragments_synch_priv(dcontext, base, size, own_initexit_lock,
-                               flush_fragments_thread_unlink _IF_DGCDIAG(written_pc));
+    if (!flush_fragments_gated_start(dcontext, base, size, own_initexit_lock)) {
+        flush_fragments_synch_priv(dcontext, base, size, own_initexit_lock,
+                                   flush_fragments_thread_unlink _IF_DGCDIAG(written_pc));
+    }
 
     return true;
 }
@@ -6567,8 +7096,8 @@ flush_fragments_unlink_shared(dcontext_t *dcontext, app_pc base, size_t size,
         "FLUSH STAGE 2: unlink_shared(thread "TIDFMT"): flusher is "TIDFMT"\n",
         dcontext->owning_thread, (flusher == NULL) ? -1 : flusher->owning_thread);
     ASSERT_OWN_MUTEX(true, &thread_initexit_lock);
-    ASSERT(flush_threads != NULL);
-    ASSERT(flush_num_threads > 0);
+    ASSERT(flush_gated || flush_threads != NULL);
+    ASSERT(flush_gated || flush_num_threads > 0);
     ASSERT(flush_last_stage == 1);
     DODEBUG({ flush_last_stage = 2; });
 
@@ -6615,6 +7144,11 @@ flush_fragments_unlink_shared(dcontext_t *dcontext, app_pc base, size_t size,
          * shared fragments.
          */
         increment_global_flushtime();
+        if (flush_gated) {
+            /* threads we did not synch with act on the region themselves */
+            ASSERT(DYNAMO_OPTION(shared_deletion));
+            flush_region_add(base, size);
+        }
         /* Both vm_area_unlink_fragments and unlink_fragments_for_deletion call
          * back to flush_invalidate_ibl_shared_target to remove shared
          * fragments from private/shared ibl tables
@@ -6668,8 +7202,8 @@ flush_invalidate_ibl_shared_target(dcontext_t *dcontext, fragment_t *f)
     ASSERT(is_self_flushing());
     ASSERT(!flush_synchall);
     ASSERT_OWN_MUTEX(true, &thread_initexit_lock);
-    ASSERT(flush_threads != NULL);
-    ASSERT(flush_num_threads > 0);
+    ASSERT(flush_gated || flush_threads != NULL);
+    ASSERT(flush_gated || flush_num_threads > 0);
     ASSERT(flush_last_stage == 2);
     ASSERT(TEST(FRAG_SHARED, f->flags));
     /*case 7966: has no pt, no flushing either */
@@ -6693,6 +7227,7 @@ flush_invalidate_ibl_shared_target(dcontext_t *dcontext, fragment_t *f)
          * here since we're post-synch for all threads.
          */
         int i;
+        ASSERT(!flush_gated);
         for (i=0; i<flush_num_threads; i++) {
             fragment_prepare_for_removal(flush_threads[i]->dcontext, f);
         }
@@ -6723,8 +7258,8 @@ flush_fragments_end_synch(dcontext_t *dcontext, bool keep_initexit_lock)
 
     ASSERT_OWN_MUTEX(true, &thread_initexit_lock);
 
-    ASSERT(flush_threads != NULL);
-    ASSERT(flush_num_threads > 0);
+    ASSERT(flush_gated || flush_threads != NULL);
+    ASSERT(flush_gated || flush_num_threads > 0);
     ASSERT(flush_last_stage == 2);
     DODEBUG({ flush_last_stage = 0; });
 
@@ -6733,6 +7268,16 @@ flush_fragments_end_synch(dcontext_t *dcontext, bool keep_initexit_lock)
         return;
     }
 
+    if (flush_gated) {
+        /* let couldbelinking threads in again: each catches up at its synch point */
+        flush_gated = false;
+        flusher = NULL;
+        flush_gate_open();
+        if (!keep_initexit_lock)
+            mutex_unlock(&thread_initexit_lock);
+        return;
+    }
+
     /* now can let all threads at DR synch point go
      * FIXME: if implement thread-private optimization above, this would turn into
      * re-setting exec areas lock to treat all threads uniformly
@@ -95,6 +95,11 @@
 /* used by vmarea to distinguish fragment_t from its own multi unit struct */
 #define FRAG_IS_EXTRA_VMAREA        0x040000
 #define FRAG_IS_EXTRA_VMAREA_INIT   0x080000
+/* -ib_inline_targets: checks for profiled targets precede this fragment's final
+ * indirect branch exit, each with a direct exit following it.  Shares a bit
+ * with FRAG_IS_EXTRA_VMAREA_INIT, which is only ever set on FRAG_FAKE structs.
+ */
+#define FRAG_HAS_INLINED_IB         FRAG_IS_EXTRA_VMAREA_INIT
 
 #ifdef PROGRAM_SHEPHERDING
 /* indicates from memory that wasn't part of code from image on disk */
@@ -156,6 +161,11 @@
 
 /* This fragment immediately follows a free entry in the fcache */
 #define FRAG_FOLLOWS_FREE_ENTRY   0x80000000
+/* -cache_generational: this private fragment has executed since it was last
+ * considered for eviction.  Shares a bit with FRAG_FOLLOWS_FREE_ENTRY, which
+ * is only ever set on fragments in shared free-list caches.
+ */
+#define FRAG_CACHE_TENURED        FRAG_FOLLOWS_FREE_ENTRY
 
 /* Flags that a future fragment can transfer to a real on taking its place:
  * Naturally we don't want FRAG_IS_FUTURE or FRAG_WAS_DELETED.
@@ -330,6 +340,12 @@ typedef struct _trace_only_t {
     /* holds the tags (and other info) for all constituent basic blocks */
     trace_bb_info_t *bbs;
     uint    num_bbs;
+#ifdef CLIENT_SIDELINE
+    /* -optimize_async: while emitted unoptimized and pending replacement,
+     * the nonzero ticket of its queued request; 0 otherwise
+     */
+    uint    opt_deferred;
+#endif
 } trace_only_t;
 
 /* trace extension of fragment_t */
@@ -516,11 +532,33 @@ typedef struct _per_thread_t {
     bool           soon_to_be_linking; /* tells flusher thread is at cache exit synch */
     /* for shared_deletion protocol */
     uint           flushtime_last_update;
+    /* -flush_epoch_reclaim: the bucket of threads sharing flushtime_last_update */
+    struct _flush_epoch_t *flush_epoch;
+    /* -flush_epoch_reclaim: counted among the threads that have private fragments */
+    bool           flush_epoch_private;
+    /* -flush_epoch_reclaim: out of the buckets while at a syscall from dispatch,
+     * since flushtime_parked
+     */
+    bool           flush_epoch_parked;
+    uint           flushtime_parked;
+    /* -flush_epoch_reclaim: flushed regions may have been missed while parked */
+    bool           flush_epoch_missed;
+    /* -flush_epoch_reclaim: signaled when the flush gate we wait at opens,
+     * and the next waiter in the list, both under flush_gate_lock
+     */
+    event_t        flush_gate_opened;
+    struct _per_thread_t *flush_gate_next;
     /* for syscalls_synch_flush, only used to cache whether a thread was at
      * a syscall during early flushing stages for use in later stages.
      * not used while not flushing.
      */
     bool           at_syscall_at_flush;
+    /* region start to flush at the next cache entry, for callers that cannot
+     * flush where they are (see request_flush_at_cache_entry())
+     */
+    app_pc         flush_at_cache_entry;
+    /* -ret_shadow_stack: allocation holding the 64KB-aligned shadow stack */
+    byte          *ret_shadow_stack;
 } per_thread_t;
 
 
@@ -1010,6 +1048,13 @@ enter_nolinking(dcontext_t *dcontext, fragment_t *watch, bool temporary);
 bool
 enter_couldbelinking(dcontext_t *dcontext, fragment_t *watch, bool temporary);
 
+/* Flushes the fragments containing pc the next time this thread enters the
+ * cache, at which point it is nolinking and holds no locks.  Only the latest
+ * request is kept.
+ */
+void
+request_flush_at_cache_entry(dcontext_t *dcontext, app_pc pc);
+
 void
 enter_threadexit(dcontext_t *dcontext);
 
@@ -1019,6 +1064,16 @@ get_flushtime_last_update(dcontext_t *dcontext);
 void
 set_flushtime_last_update(dcontext_t *dcontext, uint val);
 
+/* caller must hold shared_cache_flush_lock */
+uint
+flush_epoch_oldest(void);
+
+void
+flush_epoch_park(dcontext_t *dcontext);
+
+void
+flush_epoch_unpark(dcontext_t *dcontext);
+
 /* caller must hold shared_cache_flush_lock */
 void
 increment_global_flushtime(void);
@@ -276,10 +276,36 @@ typedef struct _thread_units_t {
 #define SEPARATE_NONPERSISTENT_HEAP() \
     (DYNAMO_OPTION(enable_reset) IF_CLIENT_INTERFACE(|| true))
 
+/* A chunk of the per-thread IR build arena.  Allocations are bumped out of
+ * the chunk and only counted on free: once every allocation from a chunk has
+ * been freed, the chunk is rewound for reuse.
+ * IR that escapes a build (kept by a client, or by the trace being built)
+ * thus simply pins its chunk rather than needing to be copied out.
+ * The chunks are laid out back to back in one reservation so that a free
+ * finds its chunk from the address alone.
+ */
+typedef struct _ir_arena_chunk_t {
+    byte *cur;   /* next free byte */
+    uint live;   /* allocations not yet freed */
+} ir_arena_chunk_t;
+
+#define IR_ARENA_CHUNK_SIZE (16*1024)
+#define IR_ARENA_NUM_CHUNKS 16
+#define IR_ARENA_RESERVE_SIZE (IR_ARENA_NUM_CHUNKS * IR_ARENA_CHUNK_SIZE)
+#define IR_ARENA_CHUNK_START(th, i) ((th)->ir_arena + (i) * IR_ARENA_CHUNK_SIZE)
+/* larger requests go to the regular heap so they cannot strand a chunk */
+#define IR_ARENA_MAX_ALLOC (IR_ARENA_CHUNK_SIZE / 8)
+
 /* per-thread structure: */
 typedef struct _thread_heap_t {
     thread_units_t *local_heap;
     thread_units_t *nonpersistent_heap;
+    /* IR build arena, reserved on first use; chunks are committed in order */
+    byte *ir_arena;
+    uint ir_arena_committed;
+    uint ir_arena_cur; /* chunk being bumped from */
+    ir_arena_chunk_t ir_arena_chunks[IR_ARENA_NUM_CHUNKS];
+    bool ir_arena_active;
 } thread_heap_t;
 
 /* global, unique thread-shared structure:
@@ -735,7 +761,16 @@ vmm_heap_unit_init(vm_heap_t *vmh, size_t size)
 {
     ptr_uint_t preferred;
     heap_error_code_t error_code;
+    /* alignment of the reservation start */
+    size_t align = VMM_BLOCK_SIZE;
     ASSIGN_INIT_LOCK_FREE(vmh->lock, vmh_lock);
+#ifdef LINUX
+    /* A huge page can only back a 2MB-aligned range, so the block bitmap
+     * must start on one for vmm_heap_reserve_blocks to hand out such ranges.
+     */
+    if (DYNAMO_OPTION(vm_huge_pages))
+        align = HUGE_PAGE_SIZE;
+#endif
 
     size = ALIGN_FORWARD(size, VMM_BLOCK_SIZE);
     ASSERT(size <= MAX_VMM_HEAP_UNIT_SIZE);
@@ -756,7 +791,7 @@ vmm_heap_unit_init(vm_heap_t *vmh, size_t size)
     preferred = (DYNAMO_OPTION(vm_base)
                  + get_random_offset(DYNAMO_OPTION(vm_max_offset)/VMM_BLOCK_SIZE)
                  *VMM_BLOCK_SIZE);
-    preferred = ALIGN_FORWARD(preferred, VMM_BLOCK_SIZE);
+    preferred = ALIGN_FORWARD(preferred, align);
     /* overflow check: w/ vm_base shouldn't happen so debug-only check */
     ASSERT(!POINTER_OVERFLOW_ON_ADD(preferred, size));
 
@@ -781,19 +816,19 @@ vmm_heap_unit_init(vm_heap_t *vmh, size_t size)
          * syslog or assert here
          */
         /* need extra size to ensure alignment */
-        vmh->alloc_size = size + VMM_BLOCK_SIZE;
+        vmh->alloc_size = size + align;
 #ifdef X64
         /* PR 215395, make sure allocation satisfies heap reachability contraints */
         vmh->alloc_start = os_heap_reserve_in_region
             ((void *)ALIGN_FORWARD(heap_allowable_region_start, PAGE_SIZE),
              (void *)ALIGN_BACKWARD(heap_allowable_region_end, PAGE_SIZE),
-             size + VMM_BLOCK_SIZE, &error_code,
+             size + align, &error_code,
              true/*+x*/);
 #else
         vmh->alloc_start = (heap_pc)
-            os_heap_reserve(NULL, size + VMM_BLOCK_SIZE, &error_code, true/*+x*/);
+            os_heap_reserve(NULL, size + align, &error_code, true/*+x*/);
 #endif
-        vmh->start_addr = (heap_pc) ALIGN_FORWARD(vmh->alloc_start, VMM_BLOCK_SIZE);
+        vmh->start_addr = (heap_pc) ALIGN_FORWARD(vmh->alloc_start, align);
         LOG(GLOBAL, LOG_HEAP, 1, "vmm_heap_unit_init unable to allocate at preferred="
             PFX" letting OS place sz=%dM addr="PFX" \n",
             preferred, size/(1024*1024), vmh->start_addr);
@@ -828,6 +863,18 @@ vmm_heap_unit_init(vm_heap_t *vmh, size_t size)
         ASSERT_NOT_REACHED();
     }
     vmh->end_addr = vmh->start_addr + size;
+#ifdef LINUX
+    if (DYNAMO_OPTION(vm_huge_pages)) {
+        /* This is only advice: commits still happen at page granularity and
+         * the kernel falls back to small pages for any 2MB range that is not
+         * entirely committed with a single protection.
+         */
+        if (os_heap_advise_huge_pages(vmh->start_addr, size))
+            STATS_ADD(vmm_vsize_huge_advised, size);
+        else
+            SYSLOG_INTERNAL_WARNING_ONCE("-vm_huge_pages: madvise failed");
+    }
+#endif
     ASSERT_TRUNCATE(vmh->num_blocks, uint, size / VMM_BLOCK_SIZE);
     vmh->num_blocks = (uint) (size / VMM_BLOCK_SIZE);
     vmh->num_free_blocks = vmh->num_blocks;
@@ -970,6 +1017,33 @@ rel32_reachable_from_vmcode(byte *tgt)
 #endif
 }
 
+#ifdef LINUX
+/* Claims the first free run of request blocks that starts on a HUGE_PAGE_SIZE
+ * boundary, for -vm_huge_pages.  Returns BITMAP_NOT_FOUND if there is none.
+ * Caller must hold vmh->lock.
+ */
+static uint
+vmm_heap_allocate_huge_aligned(vm_heap_t *vmh, uint request)
+{
+    uint stride = HUGE_PAGE_SIZE / VMM_BLOCK_SIZE;
+    uint first, i;
+    ASSERT_OWN_MUTEX(true, &vmh->lock);
+    ASSERT(ALIGNED(vmh->start_addr, HUGE_PAGE_SIZE));
+    for (first = 0; first + request <= vmh->num_blocks; first += stride) {
+        for (i = 0; i < request; i++) {
+            if (!bitmap_test(vmh->blocks, first + i))
+                break;
+        }
+        if (i == request) {
+            for (i = 0; i < request; i++)
+                bitmap_clear(vmh->blocks, first + i);
+            return first;
+        }
+    }
+    return BITMAP_NOT_FOUND;
+}
+#endif
+
 /* Reservations here are done with VMM_BLOCK_SIZE alignment
  * (e.g. 64KB) but the caller is not forced to request at that
  * alignment.  We explicitly synchronize reservations and decommits
@@ -999,7 +1073,18 @@ vmm_heap_reserve_blocks(vm_heap_t *vmh, size_t size_in)
         mutex_unlock(&vmh->lock);
         return NULL;
     }
-    first_block = bitmap_allocate_blocks(vmh->blocks, vmh->num_blocks, request);
+    first_block = BITMAP_NOT_FOUND;
+#ifdef LINUX
+    if (DYNAMO_OPTION(vm_huge_pages) && size >= HUGE_PAGE_SIZE) {
+        first_block = vmm_heap_allocate_huge_aligned(vmh, request);
+        DOSTATS({
+            if (first_block != BITMAP_NOT_FOUND)
+                STATS_INC(vmm_huge_aligned_allocs);
+        });
+    }
+    if (first_block == BITMAP_NOT_FOUND)
+#endif
+        first_block = bitmap_allocate_blocks(vmh->blocks, vmh->num_blocks, request);
     if (first_block != BITMAP_NOT_FOUND) {
         vmh->num_free_blocks -= request;
     }
@@ -1274,6 +1359,13 @@ vmm_heap_commit(vm_addr_t p, size_t size, uint prot, heap_error_code_t *error_co
             }
         });
     }
+#ifdef LINUX
+    DOSTATS({
+        if (res && DYNAMO_OPTION(vm_huge_pages) &&
+            p >= heapmgt->vmheap.start_addr && p < heapmgt->vmheap.end_addr)
+            STATS_ADD(vmm_vsize_huge_committed, size);
+    });
+#endif
 
     return res;
 }
@@ -3169,6 +3261,10 @@ heap_thread_init(dcontext_t *dcontext)
             global_heap_alloc(sizeof(thread_units_t) HEAPACCT(ACCT_MEM_MGT));
     } else
         th->nonpersistent_heap = NULL;
+    th->ir_arena = NULL;
+    th->ir_arena_committed = 0;
+    th->ir_arena_cur = 0;
+    th->ir_arena_active = false;
     heap_thread_reset_init(dcontext);
 }
 
@@ -3191,6 +3287,20 @@ void
 heap_thread_exit(dcontext_t *dcontext)
 {
     thread_heap_t *th = (thread_heap_t *) dcontext->heap_field;
+    if (th->ir_arena != NULL) {
+        /* any live count here is IR leaked by whoever built it */
+        DOLOG(1, LOG_HEAP, {
+            uint i;
+            for (i = 0; i < th->ir_arena_committed; i++) {
+                if (th->ir_arena_chunks[i].live > 0) {
+                    LOG(THREAD, LOG_HEAP, 1, "IR arena chunk %d has %d live allocs\n",
+                        i, th->ir_arena_chunks[i].live);
+                }
+            }
+        });
+        heap_munmap_ex(th->ir_arena, IR_ARENA_RESERVE_SIZE, false/*unguarded*/);
+        th->ir_arena = NULL;
+    }
     threadunits_exit(th->local_heap, dcontext);
     heap_thread_reset_free(dcontext);
     global_heap_free(th->local_heap, sizeof(thread_units_t) HEAPACCT(ACCT_MEM_MGT));
@@ -3774,6 +3884,114 @@ heap_free(dcontext_t *dcontext, void *p, size_t size HEAPACCT(which_heap_t which
     ASSERT(ok);
 }
 
+/* Turns the IR build arena on or off for this thread, returning the prior
+ * state so that callers can nest and restore it.
+ */
+bool
+heap_ir_arena_set_active(dcontext_t *dcontext, bool active)
+{
+    thread_heap_t *th;
+    bool prior;
+    if (dcontext == GLOBAL_DCONTEXT || !DYNAMO_OPTION(ir_arena))
+        return false;
+    th = (thread_heap_t *) dcontext->heap_field;
+    prior = th->ir_arena_active;
+    th->ir_arena_active = active;
+    return prior;
+}
+
+/* Returns the index of a chunk of th's arena with no live allocations,
+ * committing a new one if need be, or -1 if all are pinned.
+ */
+static int
+ir_arena_find_free_chunk(thread_heap_t *th)
+{
+    uint i;
+    for (i = 0; i < th->ir_arena_committed; i++) {
+        if (th->ir_arena_chunks[i].live == 0)
+            return i;
+    }
+    if (th->ir_arena_committed == IR_ARENA_NUM_CHUNKS)
+        return -1;
+    if (th->ir_arena == NULL) {
+        th->ir_arena = (byte *) heap_mmap_ex(IR_ARENA_RESERVE_SIZE, IR_ARENA_CHUNK_SIZE,
+                                    MEMPROT_READ|MEMPROT_WRITE, false/*unguarded*/);
+    } else {
+        extend_commitment((vm_addr_t) IR_ARENA_CHUNK_START(th, th->ir_arena_committed),
+                          IR_ARENA_CHUNK_SIZE, MEMPROT_READ|MEMPROT_WRITE,
+                          false/*not initial commit*/);
+        STATS_SUB(mmap_reserved_only, IR_ARENA_CHUNK_SIZE);
+        STATS_ADD_PEAK(mmap_capacity, IR_ARENA_CHUNK_SIZE);
+    }
+    STATS_INC(heap_ir_arena_chunks);
+    th->ir_arena_chunks[th->ir_arena_committed].live = 0;
+    return th->ir_arena_committed++;
+}
+
+/* IR allocation: served from the thread's build arena while it is active,
+ * else from the regular heap.
+ */
+void *
+heap_ir_alloc(dcontext_t *dcontext, size_t size HEAPACCT(which_heap_t which))
+{
+    thread_heap_t *th;
+    ir_arena_chunk_t *chunk;
+    byte *p;
+    if (dcontext == GLOBAL_DCONTEXT)
+        return global_heap_alloc(size HEAPACCT(which));
+    th = (thread_heap_t *) dcontext->heap_field;
+    if (!th->ir_arena_active || size > IR_ARENA_MAX_ALLOC)
+        return heap_alloc(dcontext, size HEAPACCT(which));
+    size = ALIGN_FORWARD(size, HEAP_ALIGNMENT);
+    chunk = (th->ir_arena == NULL) ? NULL : &th->ir_arena_chunks[th->ir_arena_cur];
+    if (chunk == NULL || chunk->cur + size >
+        IR_ARENA_CHUNK_START(th, th->ir_arena_cur) + IR_ARENA_CHUNK_SIZE) {
+        /* the current chunk, if full, stays pinned by its escaped IR */
+        int i = ir_arena_find_free_chunk(th);
+        if (i < 0)
+            return heap_alloc(dcontext, size HEAPACCT(which));
+        th->ir_arena_cur = i;
+        chunk = &th->ir_arena_chunks[i];
+        chunk->cur = IR_ARENA_CHUNK_START(th, i);
+    }
+    p = chunk->cur;
+    chunk->cur += size;
+    chunk->live++;
+    STATS_INC(heap_ir_arena_allocs);
+    return p;
+}
+
+/* Frees memory from heap_ir_alloc().  Must be passed the same dcontext that
+ * allocated it, as with heap_free().
+ */
+void
+heap_ir_free(dcontext_t *dcontext, void *p, size_t size HEAPACCT(which_heap_t which))
+{
+    thread_heap_t *th;
+    ir_arena_chunk_t *chunk;
+    uint i;
+    if (dcontext == GLOBAL_DCONTEXT) {
+        global_heap_free(p, size HEAPACCT(which));
+        return;
+    }
+    th = (thread_heap_t *) dcontext->heap_field;
+    if (th->ir_arena == NULL || (byte *)p < th->ir_arena ||
+        (byte *)p >= th->ir_arena + IR_ARENA_RESERVE_SIZE) {
+        heap_free(dcontext, p, size HEAPACCT(which));
+        return;
+    }
+    i = (uint) (((byte *)p - th->ir_arena) / IR_ARENA_CHUNK_SIZE);
+    chunk = &th->ir_arena_chunks[i];
+    ASSERT(i < th->ir_arena_committed && chunk->live > 0 && (byte *)p < chunk->cur);
+#ifdef DEBUG_MEMORY
+    DOCHECK(CHKLVL_MEMFILL, memset(p, HEAP_UNALLOCATED_BYTE, size););
+#endif
+    chunk->live--;
+    /* the current chunk is rewound right away; others once picked again */
+    if (chunk->live == 0 && i == th->ir_arena_cur)
+        chunk->cur = IR_ARENA_CHUNK_START(th, i);
+}
+
 bool local_heap_protected(dcontext_t *dcontext)
 {
     thread_heap_t *th = (thread_heap_t *) dcontext->heap_field;
@@ -94,6 +94,8 @@ typedef enum {
 
 typedef byte * heap_pc;
 #define HEAP_ALIGNMENT sizeof(heap_pc*)
+/* the transparent huge page size for -vm_huge_pages (x86 and 4K-page aarch64) */
+#define HUGE_PAGE_SIZE (2*1024*1024)
 extern vm_area_vector_t *landing_pad_areas;
 
 #ifdef X64
@@ -192,6 +194,15 @@ bool is_stack_overflow(dcontext_t *dcontext, byte *sp);
 void *heap_alloc(dcontext_t *dcontext, size_t size HEAPACCT(which_heap_t which));
 void heap_free(dcontext_t *dcontext, void *p, size_t size HEAPACCT(which_heap_t which));
 
+/* IR allocations: bump-allocated from a per-thread arena while it is active
+ * (during bb building and trace emission under -ir_arena), else heap_alloc.
+ * Memory must be freed with heap_ir_free() and the allocating dcontext.
+ */
+bool heap_ir_arena_set_active(dcontext_t *dcontext, bool active);
+void *heap_ir_alloc(dcontext_t *dcontext, size_t size HEAPACCT(which_heap_t which));
+void heap_ir_free(dcontext_t *dcontext, void *p, size_t size
+                  HEAPACCT(which_heap_t which));
+
 #ifdef HEAP_ACCOUNTING
 void print_heap_statistics(void);
 #endif
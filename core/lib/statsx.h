@@ -235,6 +235,7 @@
     STATS_DEF("Write fault races, one selfmod", num_write_fault_races_selfmod)
     STATS_DEF("Flushes racy, no exec removal since selfmod", flush_selfmod_race_no_remove)
     STATS_DEF("Cache consistency flushes", num_flushes)
+    STATS_DEF("Cache consistency flushes w/o thread synch", num_flushes_epoch)
     STATS_DEF("Cache consistency flushes that flushed nothing", num_empty_flushes)
     STATS_DEF("Cache consistency flushes via synchall", flush_synchall)
     STATS_DEF("Thread not translated in synchall flush (race)", flush_synchall_races)
@@ -264,6 +265,7 @@
     STATS_DEF("Shared deletion max flushtime diff", num_shared_flush_maxdiff)
     STATS_DEF("Shared deletion max pending", num_shared_flush_maxpending)
     STATS_DEF("Shared deletion region removals: ref 0", num_shared_flush_refzero)
+    STATS_DEF("Shared deletion region removals: epoch passed", num_shared_flush_epochzero)
     STATS_DEF("Shared deletion region removals: at exit", num_shared_flush_atexit)
     STATS_DEF("Shared deletion region removals: at reset", num_shared_flush_atreset)
     STATS_DEF("Shared deletion: shared IBT tables unlinked",
@@ -386,7 +388,10 @@
 
     STATS_DEF("Fragments generated, bb and trace", num_fragments)
     RSTATS_DEF("Basic block fragments generated", num_bbs)
+    STATS_DEF("Parallel-built bbs discarded for a racing publish", num_bb_build_races)
     RSTATS_DEF("Trace fragments generated", num_traces)
+    STATS_DEF("Traces replaced by background optimization", num_traces_optimized_async)
+    STATS_DEF("Background trace optimizations dropped", num_traces_opt_async_dropped)
 #ifdef X64
     STATS_DEF("32-bit basic block fragments generated", num_32bit_bbs)
     STATS_DEF("32-bit trace fragments generated", num_32bit_traces)
@@ -409,6 +414,9 @@
     STATS_DEF("Trace wannabes prevented from being traces", num_wannabe_traces)
     STATS_DEF("Trace head too large to be a trace", num_huge_fragments)
     STATS_DEF("Shared trace links shifted back to trace head", links_shared_trace_to_head)
+    STATS_DEF("Incoming link lists indexed", incoming_lists_indexed)
+    STATS_DEF("Incoming links found through the index", incoming_index_hits)
+    STATS_DEF("Incoming link index entries out of date", incoming_index_stale)
     STATS_DEF("Shadowed trace head deleted", shadowed_trace_head_deleted)
     STATS_DEF("Trace head counters reset on trace deletion", th_counter_reset)
     STATS_DEF("Trace heads re-marked", trace_head_remark)
@@ -474,6 +482,9 @@
     STATS_DEF("Shared fragments deleted no-flush, race", shared_delete_noflush_race)
     STATS_DEF("Trace component fragments deleted", trace_components_deleted)
     STATS_DEF("Fragments deleted due to capacity conflicts", num_fragments_replaced)
+    STATS_DEF("Fragments promoted for -cache_generational", num_fragments_tenured)
+    STATS_DEF("Promoted fragments given a second chance on eviction",
+              num_fragments_demoted)
     STATS_DEF("Fragments deleted on thread/process death", num_fragments_deleted_exit)
     STATS_DEF("Fragments deleted on thread/process reset", num_fragments_deleted_reset)
     STATS_DEF("Trace heads marked", num_trace_heads_marked)
@@ -829,6 +840,8 @@
     STATS_DEF("Fcache shared bb return last", fcache_shared_bb_return_last)
     STATS_DEF("Fcache shared bb free use larger bucket", fcache_shared_bb_free_use_larger)
     STATS_DEF("Fcache shared bb free split", fcache_shared_bb_free_split)
+    STATS_DEF("Fcache shared bbs placed hot: trace head history", fcache_shared_bb_hot_counter)
+    STATS_DEF("Fcache shared bbs placed hot: incoming links", fcache_shared_bb_hot_links)
 
     STATS_DEF("Fcache shared trace capacity (bytes)", fcache_shared_trace_capacity)
     STATS_DEF("Fcache shared trace peak capacity (bytes)", fcache_shared_trace_capacity_peak)
@@ -873,6 +886,8 @@
     STATS_DEF("Fcache combined claimed (bytes)", fcache_combined_claimed)
     STATS_DEF("Fcache combined capacity (bytes)", fcache_combined_capacity)
     STATS_DEF("Peak fcache combined capacity (bytes)", peak_fcache_combined_capacity)
+    STATS_DEF("Fcache capacity committed in whole huge pages (bytes)",
+              fcache_huge_committed)
     RSTATS_DEF("Fcache units on live list", fcache_num_live)
     RSTATS_DEF("Peak fcache units on live list", peak_fcache_num_live)
     RSTATS_DEF("Fcache units on free list", fcache_num_free)
@@ -904,6 +919,8 @@
     STATS_DEF("Peak heap bucket pad space (bytes)", peak_heap_bucket_pad)
     STATS_DEF("Heap allocs in buckets", heap_allocs_buckets)
     STATS_DEF("Heap allocs variable-sized", heap_allocs_variable)
+    STATS_DEF("IR allocs from the build arena", heap_ir_arena_allocs)
+    STATS_DEF("IR build arena chunks allocated", heap_ir_arena_chunks)
     STATS_DEF("Total reserved memory", reserved_memory_capacity)
     STATS_DEF("Peak total reserved memory", peak_reserved_memory_capacity)
     STATS_DEF("Guard pages, reserved virtual pages", guard_pages)
@@ -979,6 +996,9 @@
     STATS_DEF("Peak wasted vmm space due to alignment", peak_vmm_vsize_wasted)
     STATS_DEF("Allocations using multiple vmm blocks", vmm_multi_block_allocs)
     STATS_DEF("Blocks used for multi-block allocs", vmm_multi_blocks)
+    STATS_DEF("Vmm space advised for huge pages", vmm_vsize_huge_advised)
+    STATS_DEF("Vmm allocs placed on a huge page boundary", vmm_huge_aligned_allocs)
+    STATS_DEF("Vmm space committed under huge page advice", vmm_vsize_huge_committed)
     STATS_DEF("Our virtual memory in use (bytes)", vmm_vsize_used)
     STATS_DEF("Our peak virtual memory in use (bytes)", peak_vmm_vsize_used)
     STATS_DEF("Number of landing pad areas allocated", num_landing_pad_areas)
@@ -1129,6 +1149,13 @@
     STATS_DEF("Trace fragment ending with an IBL, syscall", num_traces_end_at_ibl_syscall)
     STATS_DEF("Trace fragment ending at MUST_END_TRACE", num_traces_at_must_end_trace)
     STATS_DEF("Trace fragment ending with an IBL, speculative", num_traces_end_at_ibl_speculative_link)
+    STATS_DEF("Indirect branch sites profiled", num_ib_sites_profiled)
+    STATS_DEF("Indirect branch sites with inlined targets", num_ib_inline_sites)
+    STATS_DEF("Indirect branch targets inlined", num_ib_inline_targets)
+    STATS_DEF("Indirect branch sites flushed to re-inline", num_ib_inline_repatches)
+    STATS_DEF("Calls pushing on the return shadow stack", num_ret_shadow_calls)
+    STATS_DEF("Returns checked against the return shadow stack", num_ret_shadow_rets)
+    STATS_DEF("Return shadow stack resets", num_ret_shadow_resets)
     STATS_DEF("Yields in intercept_apc wait dynamo_initialized", apc_yields_while_initializing)
     STATS_DEF("IBL Tables groomed", num_ibt_groomed)
     STATS_DEF("IBL Tables reached maximum capacity", num_ibt_max_capacity)
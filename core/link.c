@@ -256,8 +256,39 @@ typedef struct thread_link_data_t {
      * may be stale wrt dcontext->last_exit.
      */
     int linkstub_deleted_ordinal;
+    /* -incoming_index_threshold index for private fragments */
+    generic_table_t *incoming_index;
 } thread_link_data_t;
 
+/* -incoming_index_threshold: an incoming list that a search had to walk too
+ * far down has every entry mapped, keyed by the source linkstub, to its
+ * predecessor in the list (INCOMING_INDEX_HEAD for the first entry).  The
+ * list itself, and thus its order, is left alone.  The index is only a hint
+ * that is checked against the list on each use, so code that splices lists
+ * directly costs us a fallback search rather than correctness.
+ */
+#define INCOMING_INDEX_HEAD ((void *)(ptr_uint_t)1)
+#define INCOMING_INDEX_TABLE_BITS 8
+#define INCOMING_INDEX_TABLE_LOAD 75
+
+/* Index for shared fragments.  Its lists only change under change_linking_lock,
+ * but the table still needs its own lock to satisfy the hashtable asserts.
+ */
+static generic_table_t *shared_incoming_index;
+
+static generic_table_t *
+incoming_index_create(dcontext_t *dcontext)
+{
+    generic_table_t *index =
+        generic_hash_create(dcontext, INCOMING_INDEX_TABLE_BITS,
+                            INCOMING_INDEX_TABLE_LOAD,
+                            HASHTABLE_PERSISTENT |
+                            (dcontext == GLOBAL_DCONTEXT ? HASHTABLE_SHARED : 0),
+                            NULL _IF_DEBUG("incoming link index"));
+    index->hash_func = HASH_FUNCTION_MULTIPLY_PHI;
+    return index;
+}
+
 /* thread-shared initialization that should be repeated after a reset */
 void
 link_reset_init(void)
@@ -273,6 +304,8 @@ link_reset_init(void)
                                         false /* not persistent */);
 #endif
     }
+    if (DYNAMO_OPTION(incoming_index_threshold) > 0)
+        shared_incoming_index = incoming_index_create(GLOBAL_DCONTEXT);
 }
 
 /* Free all thread-shared state not critical to forward progress;
@@ -288,6 +321,10 @@ link_reset_free(void)
         special_heap_exit(stub32_heap);
 #endif
     }
+    if (shared_incoming_index != NULL) {
+        generic_hash_destroy(GLOBAL_DCONTEXT, shared_incoming_index);
+        shared_incoming_index = NULL;
+    }
 }
 
 void
@@ -318,12 +355,28 @@ link_thread_init(dcontext_t *dcontext)
     /* Mark as fake */
     ldata->linkstub_deleted_fragment.flags = FRAG_FAKE;
     ldata->linkstub_deleted.flags = LINK_FAKE;
+    if (DYNAMO_OPTION(incoming_index_threshold) > 0)
+        ldata->incoming_index = incoming_index_create(dcontext);
+    else
+        ldata->incoming_index = NULL;
+}
+
+/* Frees all thread-private state that refers to fragments */
+void
+link_thread_reset_free(dcontext_t *dcontext)
+{
+    thread_link_data_t *ldata = (thread_link_data_t *) dcontext->link_field;
+    /* the private fragments whose linkstubs are its keys are all gone */
+    if (ldata->incoming_index != NULL)
+        generic_hash_clear(dcontext, ldata->incoming_index);
 }
 
 void
 link_thread_exit(dcontext_t *dcontext)
 {
     thread_link_data_t *ldata = (thread_link_data_t *) dcontext->link_field;
+    if (ldata->incoming_index != NULL)
+        generic_hash_destroy(dcontext, ldata->incoming_index);
     HEAP_TYPE_FREE(dcontext, ldata, thread_link_data_t, ACCT_OTHER, PROTECTED);
 }
 
@@ -1245,6 +1298,104 @@ incoming_direct_linkstubs_match(common_direct_linkstub_t *dl1,
              ((direct_linkstub_t *)dl1)->stub_pc == ((direct_linkstub_t *)dl2)->stub_pc));
 }
 
+/* Returns the -incoming_index_threshold index that covers targetf's incoming
+ * list, or NULL.  Coarse units keep their own lists and are never indexed.
+ */
+static inline generic_table_t *
+incoming_index_for(dcontext_t *dcontext, fragment_t *targetf)
+{
+    if (TEST(FRAG_COARSE_GRAIN, targetf->flags))
+        return NULL;
+    if (TEST(FRAG_SHARED, targetf->flags))
+        return shared_incoming_index;
+    if (dcontext == GLOBAL_DCONTEXT)
+        return NULL;
+    return ((thread_link_data_t *) dcontext->link_field)->incoming_index;
+}
+
+static inline void *
+incoming_index_get(dcontext_t *dcontext, generic_table_t *index,
+                   common_direct_linkstub_t *dl)
+{
+    void *entry;
+    TABLE_RWLOCK(index, read, lock);
+    entry = generic_hash_lookup(dcontext, index, (ptr_uint_t)dl);
+    TABLE_RWLOCK(index, read, unlock);
+    return entry;
+}
+
+static inline bool
+incoming_index_remove(dcontext_t *dcontext, generic_table_t *index,
+                      common_direct_linkstub_t *dl)
+{
+    bool found;
+    TABLE_RWLOCK(index, write, lock);
+    found = generic_hash_remove(dcontext, index, (ptr_uint_t)dl);
+    TABLE_RWLOCK(index, write, unlock);
+    return found;
+}
+
+static inline void
+incoming_index_set(dcontext_t *dcontext, generic_table_t *index,
+                   common_direct_linkstub_t *dl, common_direct_linkstub_t *prev)
+{
+    TABLE_RWLOCK(index, write, lock);
+    generic_hash_remove(dcontext, index, (ptr_uint_t)dl);
+    generic_hash_add(dcontext, index, (ptr_uint_t)dl,
+                     prev == NULL ? INCOMING_INDEX_HEAD : (void *)prev);
+    TABLE_RWLOCK(index, write, unlock);
+}
+
+/* Returns whether the index places dl in *inlist, and if so its predecessor */
+static bool
+incoming_index_lookup(dcontext_t *dcontext, generic_table_t *index,
+                      common_direct_linkstub_t **inlist, common_direct_linkstub_t *dl,
+                      OUT common_direct_linkstub_t **prev)
+{
+    void *entry = incoming_index_get(dcontext, index, dl);
+    if (entry == NULL)
+        return false;
+    if (entry == INCOMING_INDEX_HEAD) {
+        if (*inlist != dl) {
+            STATS_INC(incoming_index_stale);
+            return false;
+        }
+        *prev = NULL;
+    } else {
+        if (((common_direct_linkstub_t *)entry)->next_incoming != (linkstub_t *)dl) {
+            STATS_INC(incoming_index_stale);
+            return false;
+        }
+        *prev = (common_direct_linkstub_t *) entry;
+    }
+    STATS_INC(incoming_index_hits);
+    return true;
+}
+
+/* Indexes every entry of *inlist, after a search walked steps entries */
+static void
+incoming_index_build(dcontext_t *dcontext, fragment_t *targetf,
+                     common_direct_linkstub_t **inlist, uint steps)
+{
+    generic_table_t *index;
+    common_direct_linkstub_t *s, *prevs;
+    dcontext_t *alloc_dc;
+    /* checked first: a removal that emptied the list may have deleted targetf */
+    if (DYNAMO_OPTION(incoming_index_threshold) == 0 ||
+        steps < DYNAMO_OPTION(incoming_index_threshold))
+        return;
+    index = incoming_index_for(dcontext, targetf);
+    if (index == NULL)
+        return;
+    alloc_dc = FRAGMENT_ALLOC_DC(dcontext, targetf->flags);
+    for (s = *inlist, prevs = NULL; s != NULL;
+         prevs = s, s = (common_direct_linkstub_t *) s->next_incoming)
+        incoming_index_set(alloc_dc, index, s, prevs);
+    LOG(THREAD, LOG_LINKS, 3, "indexed incoming list of "PFX" after %d steps\n",
+        targetf->tag, steps);
+    STATS_INC(incoming_lists_indexed);
+}
+
 /* Returns the linkstub_t * for the link from f's exit l if it exists in
  * targetf's incoming list.  N.B.: if target is coarse, its unit lock
  * is released prior to returning the pointer!
@@ -1279,10 +1430,21 @@ incoming_find_link(dcontext_t *dcontext, fragment_t *f, linkstub_t *l,
         }
         mutex_unlock(&info->incoming_lock);
     } else {
+        generic_table_t *index = incoming_index_for(dcontext, targetf);
+        uint steps = 0;
+        if (index != NULL && !LINKSTUB_FAKE(l)) {
+            common_direct_linkstub_t *prev;
+            if (incoming_index_lookup(FRAGMENT_ALLOC_DC(dcontext, targetf->flags),
+                                      index, inlist, dl, &prev))
+                return l;
+        }
         for (s = *inlist; s != NULL; s = (common_direct_linkstub_t *) s->next_incoming) {
             ASSERT(LINKSTUB_DIRECT(s->l.flags));
-            if (incoming_direct_linkstubs_match(s, dl))
+            if (incoming_direct_linkstubs_match(s, dl)) {
+                incoming_index_build(dcontext, targetf, inlist, steps);
                 return (linkstub_t *)s;
+            }
+            steps++;
         }
     }
     return NULL;
@@ -1309,6 +1471,7 @@ incoming_remove_link_nosearch(dcontext_t *dcontext, fragment_t *f, linkstub_t *l
 {
     common_direct_linkstub_t *dl = (common_direct_linkstub_t *) l;
     common_direct_linkstub_t *dprev = (common_direct_linkstub_t *) prevl;
+    generic_table_t *index;
     ASSERT(LINKSTUB_DIRECT(l->flags));
     ASSERT(prevl == NULL || LINKSTUB_DIRECT(prevl->flags));
     ASSERT(linkstub_owned_by_fragment(dcontext, f, l));
@@ -1319,6 +1482,17 @@ incoming_remove_link_nosearch(dcontext_t *dcontext, fragment_t *f, linkstub_t *l
     ASSERT(!NEED_SHARED_LOCK(f->flags) ||
            self_owns_recursive_lock(&change_linking_lock));
 
+    index = incoming_index_for(dcontext, targetf);
+    if (index != NULL) {
+        dcontext_t *alloc_dc = FRAGMENT_ALLOC_DC(dcontext, targetf->flags);
+        /* if l was indexed, so is the rest of its list */
+        if (incoming_index_remove(alloc_dc, index, dl) &&
+            dl->next_incoming != NULL) {
+            incoming_index_set(alloc_dc, index,
+                               (common_direct_linkstub_t *) dl->next_incoming, dprev);
+        }
+    }
+
     if (dprev != NULL)
         dprev->next_incoming = dl->next_incoming;
     else {
@@ -1370,12 +1544,22 @@ incoming_remove_link_search(dcontext_t *dcontext, fragment_t *f, linkstub_t *l,
                             fragment_t *targetf, common_direct_linkstub_t **inlist)
 {
     common_direct_linkstub_t *s, *prevs, *dl;
+    generic_table_t *index = incoming_index_for(dcontext, targetf);
+    uint steps = 0;
     dl = (common_direct_linkstub_t *) l;
     ASSERT(LINKSTUB_DIRECT(l->flags));
     ASSERT(linkstub_owned_by_fragment(dcontext, f, l));
     ASSERT(!LINKSTUB_FAKE(l) ||
            (LINKSTUB_COARSE_PROXY(l->flags) &&
             TEST(FRAG_COARSE_GRAIN, f->flags) && LINKSTUB_NORMAL_DIRECT(l->flags)));
+    /* a proxy is not the stored entry, so it can only be matched by a search */
+    if (index != NULL && !LINKSTUB_FAKE(l) &&
+        incoming_index_lookup(FRAGMENT_ALLOC_DC(dcontext, targetf->flags), index,
+                              inlist, dl, &prevs)) {
+        incoming_remove_link_nosearch(dcontext, f, l, targetf, (linkstub_t *)prevs,
+                                      inlist);
+        return true;
+    }
     for (s = *inlist, prevs = NULL; s;
          prevs = s, s = (common_direct_linkstub_t *) s->next_incoming) {
         ASSERT(LINKSTUB_DIRECT(s->l.flags));
@@ -1386,8 +1570,11 @@ incoming_remove_link_search(dcontext_t *dcontext, fragment_t *f, linkstub_t *l,
              */
             incoming_remove_link_nosearch(dcontext, f, (linkstub_t *)s,
                                           targetf, (linkstub_t *)prevs, inlist);
+            /* the rest of a long list is likely to be removed one by one too */
+            incoming_index_build(dcontext, targetf, inlist, steps);
             return true;
         }
+        steps++;
     }
     return false;
 }
@@ -1445,10 +1632,20 @@ add_to_incoming_list(dcontext_t *dcontext, fragment_t *f, linkstub_t *l,
         common_direct_linkstub_t **inlist =
             (common_direct_linkstub_t **) FRAG_INCOMING_ADDR(targetf);
         common_direct_linkstub_t *dl = (common_direct_linkstub_t *) l;
+        generic_table_t *index;
         /* ensure not added twice b/c future not unlinked, etc. */
         ASSERT(*inlist != dl);
         ASSERT(!LINKSTUB_FAKE(l) || LINKSTUB_COARSE_PROXY(l->flags));
         ASSERT(!is_empty_fragment(linkstub_fragment(dcontext, l)));
+        index = incoming_index_for(dcontext, targetf);
+        if (index != NULL && *inlist != NULL) {
+            dcontext_t *alloc_dc = FRAGMENT_ALLOC_DC(dcontext, targetf->flags);
+            /* keep an indexed list fully indexed */
+            if (incoming_index_get(alloc_dc, index, *inlist) != NULL) {
+                incoming_index_set(alloc_dc, index, *inlist, dl);
+                incoming_index_set(alloc_dc, index, dl, NULL);
+            }
+        }
         dl->next_incoming = (linkstub_t *) *inlist;
         *inlist = dl;
     }
@@ -1559,6 +1756,42 @@ add_incoming(dcontext_t *dcontext, fragment_t *f, linkstub_t *l,
     }
 }
 
+/* Returns how many exits of existing fragments are waiting to be linked to
+ * tag, counting no higher than max.
+ */
+uint
+future_incoming_count(dcontext_t *dcontext, app_pc tag, uint max)
+{
+    future_fragment_t *fut;
+    linkstub_t *l;
+    uint count = 0;
+    SHARED_RECURSIVE_LOCK(acquire, change_linking_lock);
+    fut = fragment_lookup_future(dcontext, tag);
+    if (fut != NULL) {
+        for (l = fut->incoming_stubs; l != NULL && count < max;
+             l = LINKSTUB_NEXT_INCOMING(l))
+            count++;
+    }
+    SHARED_RECURSIVE_LOCK(release, change_linking_lock);
+    return count;
+}
+
+/* Returns whether another fragment's exit is currently linked to the private
+ * fragment f, which then runs without coming back to dispatch.
+ */
+bool
+incoming_linked_exists(dcontext_t *dcontext, fragment_t *f)
+{
+    linkstub_t *l;
+    /* only the owning thread changes a private fragment's links */
+    ASSERT(!TEST(FRAG_SHARED, f->flags));
+    for (l = f->in_xlate.incoming_stubs; l != NULL; l = LINKSTUB_NEXT_INCOMING(l)) {
+        if (TEST(LINK_LINKED, l->flags) && linkstub_fragment(dcontext, l) != f)
+            return true;
+    }
+    return false;
+}
+
 /* fragment_t f is being removed */
 future_fragment_t *
 incoming_remove_fragment(dcontext_t *dcontext, fragment_t *f)
@@ -2636,6 +2869,16 @@ prepend_new_coarse_incoming(coarse_info_t *info, cache_pc coarse, linkstub_t *fi
         entry->coarse = false;
         /* We put the whole linkstub_t list as one entry */
         entry->in.fine_l = fine;
+        if (shared_incoming_index != NULL) {
+            /* coarse lists are only ever searched, so drop any index entries
+             * before the list's links are freed by coarse-only paths
+             */
+            linkstub_t *l;
+            for (l = fine; l != NULL; l = LINKSTUB_NEXT_INCOMING(l)) {
+                incoming_index_remove(GLOBAL_DCONTEXT, shared_incoming_index,
+                                      (common_direct_linkstub_t *) l);
+            }
+        }
         LOG(THREAD_GET, LOG_LINKS, 4,
             "created new coarse_incoming_t "PFX" fine from "PFX"\n",
             entry, entry->in.fine_l);
@@ -384,6 +384,7 @@ void link_reset_init(void);
 void link_reset_free(void);
 void link_thread_init(dcontext_t *dcontext);
 void link_thread_exit(dcontext_t *dcontext);
+void link_thread_reset_free(dcontext_t *dcontext);
 
 /* coarse-grain support */
 
@@ -535,6 +536,8 @@ void unlink_fragment_incoming(dcontext_t *dcontext, fragment_t *f);
 void shift_links_to_new_fragment(dcontext_t *dcontext, fragment_t *old_f,
                                  fragment_t *new_f);
 future_fragment_t * incoming_remove_fragment(dcontext_t *dcontext, fragment_t *f);
+uint future_incoming_count(dcontext_t *dcontext, app_pc tag, uint max);
+bool incoming_linked_exists(dcontext_t *dcontext, fragment_t *f);
 
 /* if this linkstub shares the stub with the next linkstub, returns the
  * next linkstub; else returns NULL
@@ -45,7 +45,7 @@
 #include "emit.h"
 #include "fcache.h"
 #include "monitor.h"
-#ifdef CUSTOM_TRACES
+#if defined(CUSTOM_TRACES) || defined(CLIENT_SIDELINE)
 #  include "instrument.h"
 #endif
 #include <string.h> /* for memset */
@@ -101,6 +101,38 @@ static void reset_trace_state(dcontext_t *dcontext, bool grab_link_lock);
 /* synchronization of shared traces */
 DECLARE_CXTSWPROT_VAR(mutex_t trace_building_lock, INIT_LOCK_FREE(trace_building_lock));
 
+#ifdef CLIENT_SIDELINE
+/* -optimize_async: rather than running optimize_trace() on the app thread
+ * at emit time, shared traces are emitted unoptimized and queued for a
+ * DR-owned thread, which decodes each one from the cache, optimizes it, and
+ * swaps it in.  App threads never wait on the optimizer.
+ */
+typedef struct _trace_opt_req_t {
+    app_pc tag;
+    /* The trace's opt_deferred.  Rather than the fragment_t pointer, which
+     * may be freed and reused for a later trace for tag before the request
+     * is serviced, the ticket identifies the queued trace: no other trace
+     * carries the same one.
+     */
+    uint ticket;
+    struct _trace_opt_req_t *next;
+} trace_opt_req_t;
+
+/* Past this backlog new traces simply stay unoptimized. */
+# define TRACE_OPT_MAX_PENDING 1024
+
+# define OPTIMIZE_ASYNC(flags) \
+    (dynamo_options.optimize_async && TEST(FRAG_SHARED, (flags)))
+
+static trace_opt_req_t *trace_opt_head;
+static trace_opt_req_t *trace_opt_tail;
+static uint trace_opt_pending;
+static uint trace_opt_next_ticket; /* protected by trace_building_lock */
+static bool trace_opt_thread_started;
+static event_t trace_opt_wakeup;
+DECLARE_CXTSWPROT_VAR(static mutex_t trace_opt_lock, INIT_LOCK_FREE(trace_opt_lock));
+#endif
+
 /* For clearing counters on trace deletion we follow a lazy strategy
  * using a sentinel value to determine whether we've built a trace or not
  */
@@ -304,6 +336,10 @@ monitor_init()
      * this does not include exit stubs
      */
     ASSERT(MAX_TRACE_BUFFER_SIZE <= MAX_FRAGMENT_SIZE);
+#ifdef CLIENT_SIDELINE
+    if (dynamo_options.optimize_async)
+        trace_opt_wakeup = create_event();
+#endif
 }
 
 /* re-initializes non-persistent memory */
@@ -335,6 +371,19 @@ monitor_exit()
 {
     LOG(GLOBAL, LOG_MONITOR|LOG_STATS, 1,
         "Trace fragments generated: %d\n", GLOBAL_STAT(num_traces));
+#ifdef CLIENT_SIDELINE
+    if (dynamo_options.optimize_async) {
+        /* the optimization thread has been cleaned up with the others */
+        while (trace_opt_head != NULL) {
+            trace_opt_req_t *req = trace_opt_head;
+            trace_opt_head = req->next;
+            HEAP_TYPE_FREE(GLOBAL_DCONTEXT, req, trace_opt_req_t, ACCT_TRACE,
+                           PROTECTED);
+        }
+        destroy_event(trace_opt_wakeup);
+    }
+    DELETE_LOCK(trace_opt_lock);
+#endif
     DELETE_LOCK(trace_building_lock);
 }
 
@@ -344,6 +393,28 @@ thcounter_free(dcontext_t *dcontext, void *p)
     COUNTER_FREE(dcontext, p, sizeof(trace_head_counter_t) HEAPACCT(ACCT_THCOUNTER));
 }
 
+/* -ib_inline_targets profile of one indirect branch site, keyed by the tag of
+ * the bb ending in the branch.  The counts are Misra-Gries frequent-item
+ * counters, so a site's dominant targets hold their slots however many
+ * others it has.
+ */
+typedef struct _ib_site_profile_t {
+    app_pc site;
+    app_pc targets[MAX_IB_INLINE_TARGETS];
+    uint   counts[MAX_IB_INLINE_TARGETS];
+    uint   misses;    /* ibl exits past the site's inlined targets */
+    uint   repatches; /* flushes requested to re-inline the site */
+} ib_site_profile_t;
+
+/* bounds the flushing a site whose targets keep shifting can cause */
+#define IB_SITE_MAX_REPATCHES 2
+
+static void
+ib_site_free(dcontext_t *dcontext, void *p)
+{
+    COUNTER_FREE(dcontext, p, sizeof(ib_site_profile_t) HEAPACCT(ACCT_THCOUNTER));
+}
+
 void
 monitor_thread_init(dcontext_t *dcontext)
 {
@@ -371,6 +442,13 @@ monitor_thread_init(dcontext_t *dcontext)
                                           HASHTABLE_PERSISTENT,
                                           thcounter_free _IF_DEBUG("trace heads"));
     md->thead_table->hash_func = HASH_FUNCTION_MULTIPLY_PHI;
+    if (DYNAMO_OPTION(ib_inline_targets) > 0) {
+        md->ib_site_table = generic_hash_create(dcontext, INIT_COUNTER_TABLE_SIZE,
+                                                COUNTER_TABLE_LOAD,
+                                                HASHTABLE_PERSISTENT,
+                                                ib_site_free _IF_DEBUG("ib sites"));
+        md->ib_site_table->hash_func = HASH_FUNCTION_MULTIPLY_PHI;
+    }
 }
 
 /* atexit cleanup */
@@ -399,6 +477,8 @@ monitor_thread_exit(dcontext_t *dcontext)
      */
     if (!RUNNING_WITHOUT_CODE_CACHE()) {
         generic_hash_destroy(dcontext, md->thead_table);
+        if (md->ib_site_table != NULL)
+            generic_hash_destroy(dcontext, md->ib_site_table);
         heap_free(dcontext, md, sizeof(monitor_data_t) HEAPACCT(ACCT_TRACE));
     }
 #endif
@@ -434,6 +514,123 @@ thcounter_range_remove(dcontext_t *dcontext, app_pc start, app_pc end)
     monitor_data_t *md = (monitor_data_t *) dcontext->monitor_field;
     generic_hash_range_remove(dcontext, md->thead_table,
                               (ptr_uint_t) start, (ptr_uint_t) end);
+    if (md->ib_site_table != NULL) {
+        generic_hash_range_remove(dcontext, md->ib_site_table,
+                                  (ptr_uint_t) start, (ptr_uint_t) end);
+    }
+}
+
+void
+monitor_ib_site_record(dcontext_t *dcontext, fragment_t *f, linkstub_t *l,
+                       app_pc target)
+{
+    monitor_data_t *md = (monitor_data_t *) dcontext->monitor_field;
+    app_pc inlined[MAX_IB_INLINE_TARGETS];
+    ib_site_profile_t *e;
+    app_pc site;
+    uint i, num_inlined, slot = MAX_IB_INLINE_TARGETS;
+
+    ASSERT(LINKSTUB_INDIRECT(l->flags) && !LINKSTUB_FAKE(l));
+    if (md->ib_site_table == NULL || TEST(FRAG_COARSE_GRAIN, f->flags))
+        return;
+    /* only final exits can have targets inlined, and for a trace we can name
+     * the component bb of no other without -ret_after_call's exit counts
+     */
+    if (get_ib_inline_targets(dcontext, f, inlined, &num_inlined) != l)
+        return;
+    if (TEST(FRAG_IS_TRACE, f->flags))
+        site = TRACE_FIELDS(f)->bbs[TRACE_FIELDS(f)->num_bbs - 1].tag;
+    else
+        site = f->tag;
+
+    e = (ib_site_profile_t *) generic_hash_lookup(dcontext, md->ib_site_table,
+                                                  (ptr_uint_t) site);
+    if (e == NULL) {
+        e = COUNTER_ALLOC(dcontext, sizeof(ib_site_profile_t) HEAPACCT(ACCT_THCOUNTER));
+        memset(e, 0, sizeof(*e));
+        e->site = site;
+        generic_hash_add(dcontext, md->ib_site_table, (ptr_uint_t) site, e);
+        STATS_INC(num_ib_sites_profiled);
+    }
+    for (i = 0; i < MAX_IB_INLINE_TARGETS; i++) {
+        if (e->counts[i] > 0 && e->targets[i] == target) {
+            e->counts[i]++;
+            break;
+        }
+        if (e->counts[i] == 0 && slot == MAX_IB_INLINE_TARGETS)
+            slot = i;
+    }
+    if (i == MAX_IB_INLINE_TARGETS) {
+        if (slot < MAX_IB_INLINE_TARGETS) {
+            e->targets[slot] = target;
+            e->counts[slot] = 1;
+        } else {
+            for (i = 0; i < MAX_IB_INLINE_TARGETS; i++)
+                e->counts[i]--;
+        }
+    }
+
+    /* Once enough lookups get past the inlined targets, flush the site so its
+     * next build inlines what the profile now says is dominant.
+     */
+    if (num_inlined > 0 && DYNAMO_OPTION(ib_inline_repatch) > 0 &&
+        e->repatches < IB_SITE_MAX_REPATCHES) {
+        e->misses++;
+        if (e->misses >= DYNAMO_OPTION(ib_inline_repatch)) {
+            LOG(THREAD, LOG_MONITOR, 2,
+                "ib site "PFX" missed its %d inlined target(s) %d times: re-inlining\n",
+                site, num_inlined, e->misses);
+            e->misses = 0;
+            e->repatches++;
+            STATS_INC(num_ib_inline_repatches);
+            request_flush_at_cache_entry(dcontext, site);
+        }
+    }
+}
+
+uint
+monitor_ib_site_targets(dcontext_t *dcontext, app_pc site, /*OUT*/app_pc *targets,
+                        uint max)
+{
+    monitor_data_t *md = (monitor_data_t *) dcontext->monitor_field;
+    ib_site_profile_t *e;
+    uint j, num = 0;
+    bool taken[MAX_IB_INLINE_TARGETS] = {false,};
+
+    if (dcontext == GLOBAL_DCONTEXT || md == NULL || md->ib_site_table == NULL)
+        return 0;
+    e = (ib_site_profile_t *) generic_hash_lookup(dcontext, md->ib_site_table,
+                                                  (ptr_uint_t) site);
+    if (e == NULL)
+        return 0;
+    /* most frequent first, as the earlier checks are cheaper */
+    while (num < max) {
+        uint best = MAX_IB_INLINE_TARGETS;
+        for (j = 0; j < MAX_IB_INLINE_TARGETS; j++) {
+            if (!taken[j] && e->counts[j] > 0 &&
+                (best == MAX_IB_INLINE_TARGETS || e->counts[j] > e->counts[best]))
+                best = j;
+        }
+        if (best == MAX_IB_INLINE_TARGETS)
+            break;
+        taken[best] = true;
+        targets[num++] = e->targets[best];
+    }
+    return num;
+}
+
+/* Returns how many times tag has been entered as a trace head by this thread,
+ * or 0 if it is not a trace head or has already been turned into a trace.
+ * The counter outlives the head's fragment, so this is still valid when the
+ * fragment is being re-created.
+ */
+uint
+monitor_trace_head_count(dcontext_t *dcontext, app_pc tag)
+{
+    trace_head_counter_t *ctr = thcounter_lookup(dcontext, tag);
+    if (ctr == NULL || ctr->counter >= TH_COUNTER_CREATED_TRACE_VALUE())
+        return 0;
+    return ctr->counter;
 }
 
 bool
@@ -1180,6 +1377,165 @@ trace_flags_from_trace_head_flags(uint head_flags)
     return trace_flags;
 }
 
+#ifdef CLIENT_SIDELINE
+/* Swaps the shared trace for tag queued with ticket for an optimized copy,
+ * unless it has been flushed or replaced since it was queued.  The optimizer runs on a private
+ * decoded copy with no locks held; trace_building_lock is only taken to
+ * snapshot f and, afterward, to check it is still current and swap.
+ */
+static void
+trace_opt_replace(dcontext_t *dcontext, app_pc tag, uint ticket)
+{
+    fragment_t *f, *new_f;
+    instrlist_t *ilist;
+    void *vmlist = NULL;
+    trace_bb_info_t *bbs;
+    byte *buf;
+    uint bufsz, buf_alloc_sz, num_bbs, flags, flushtime;
+    DEBUG_DECLARE(int id;)
+
+    /* keeps f and its vm areas from being flushed while we copy them */
+    enter_couldbelinking(dcontext, NULL, false);
+    mutex_lock(&trace_building_lock);
+    f = fragment_lookup_trace(dcontext, tag);
+    flags = (f == NULL) ? 0 :
+        (f->flags & ~(FRAG_LINKED_OUTGOING | FRAG_LINKED_INCOMING |
+                      FRAG_TRACE_LINKS_SHIFTED | FRAG_FOLLOWS_FREE_ENTRY));
+    if (f == NULL || !TEST(FRAG_SHARED, f->flags) ||
+        TRACE_FIELDS(f)->opt_deferred != ticket ||
+        !vm_area_add_to_list(dcontext, tag, &vmlist, flags, f, false/*no locks*/)) {
+        mutex_unlock(&trace_building_lock);
+        enter_nolinking(dcontext, NULL, false);
+        STATS_INC(num_traces_opt_async_dropped);
+        return;
+    }
+    num_bbs = TRACE_FIELDS(f)->num_bbs;
+    bbs = (trace_bb_info_t *)
+        nonpersistent_heap_alloc(GLOBAL_DCONTEXT, num_bbs*sizeof(trace_bb_info_t)
+                                 HEAPACCT(ACCT_TRACE));
+    memcpy(bbs, TRACE_FIELDS(f)->bbs, num_bbs*sizeof(trace_bb_info_t));
+    /* the ilist points into buf, not the cache, so it outlives f */
+    buf_alloc_sz = f->size;
+    bufsz = buf_alloc_sz;
+    buf = (byte *) heap_alloc(dcontext, buf_alloc_sz HEAPACCT(ACCT_TRACE));
+    ilist = decode_fragment(dcontext, f, buf, &bufsz, f->flags, NULL, NULL);
+    ASSERT(bufsz <= buf_alloc_sz);
+    flushtime = flushtime_global;
+    DODEBUG({ id = f->id; });
+    mutex_unlock(&trace_building_lock);
+    enter_nolinking(dcontext, NULL, false);
+
+    LOG(THREAD, LOG_MONITOR, 2, "optimizing trace F%d ("PFX") in the background\n",
+        id, tag);
+    optimize_trace(dcontext, tag, ilist);
+
+    enter_couldbelinking(dcontext, NULL, false);
+    mutex_lock(&trace_building_lock);
+    /* A flush may have invalidated the code or vmlist, and f may have been
+     * deleted or replaced by a new trace for tag, possibly at the same
+     * address: the ticket tells them apart.
+     */
+    if (flushtime_global == flushtime && fragment_lookup_trace(dcontext, tag) == f &&
+        TRACE_FIELDS(f)->opt_deferred == ticket) {
+        /* fragment_remove_shared_no_flush() takes trace_building_lock itself.
+         * Threads reaching tag go through its head until the new trace is added.
+         */
+        TRACE_FIELDS(f)->opt_deferred = 0;
+        mutex_unlock(&trace_building_lock);
+        fragment_remove_shared_no_flush(dcontext, f);
+        mutex_lock(&trace_building_lock);
+        if (flushtime_global == flushtime &&
+            fragment_lookup_trace(dcontext, tag) == NULL) {
+            new_f = emit_fragment(dcontext, tag, ilist, flags, vmlist, true/*link*/);
+            TRACE_FIELDS(new_f)->bbs = bbs;
+            TRACE_FIELDS(new_f)->num_bbs = num_bbs;
+            vmlist = NULL;
+            STATS_INC(num_traces_optimized_async);
+            DOLOG(3, LOG_MONITOR, {
+                LOG(THREAD, LOG_MONITOR, 3, "optimized trace is F%d\n", new_f->id);
+                disassemble_fragment(dcontext, new_f, false);
+            });
+        }
+    }
+    if (vmlist != NULL) {
+        vm_area_destroy_list(dcontext, vmlist);
+        nonpersistent_heap_free(GLOBAL_DCONTEXT, bbs, num_bbs*sizeof(trace_bb_info_t)
+                                HEAPACCT(ACCT_TRACE));
+        STATS_INC(num_traces_opt_async_dropped);
+    }
+    mutex_unlock(&trace_building_lock);
+    enter_nolinking(dcontext, NULL, false);
+    instrlist_clear_and_destroy(dcontext, ilist);
+    heap_free(dcontext, buf, buf_alloc_sz HEAPACCT(ACCT_TRACE));
+}
+
+static void
+trace_opt_thread_main(void *arg)
+{
+    dcontext_t *dcontext = get_thread_private_dcontext();
+    trace_opt_req_t *req;
+    LOG(THREAD, LOG_MONITOR, 1, "trace optimization thread started\n");
+    while (true) {
+        mutex_lock(&trace_opt_lock);
+        req = trace_opt_head;
+        if (req != NULL) {
+            trace_opt_head = req->next;
+            if (trace_opt_head == NULL)
+                trace_opt_tail = NULL;
+            trace_opt_pending--;
+        }
+        mutex_unlock(&trace_opt_lock);
+        if (req == NULL) {
+            /* idle: a safe spot for synch_with_all_threads(), as in dr_sleep() */
+            dcontext->client_data->client_thread_safe_for_synch = true;
+            wait_for_event(trace_opt_wakeup);
+            dcontext->client_data->client_thread_safe_for_synch = false;
+            continue;
+        }
+        trace_opt_replace(dcontext, req->tag, req->ticket);
+        HEAP_TYPE_FREE(GLOBAL_DCONTEXT, req, trace_opt_req_t, ACCT_TRACE, PROTECTED);
+    }
+}
+
+/* Hands the just-emitted trace for tag, whose opt_deferred is ticket, to the
+ * optimization thread, starting it on first use.  Caller must hold no locks.
+ */
+static void
+trace_opt_enqueue(dcontext_t *dcontext, app_pc tag, uint ticket)
+{
+    trace_opt_req_t *req;
+    bool start_thread = false;
+    mutex_lock(&trace_opt_lock);
+    if (trace_opt_pending >= TRACE_OPT_MAX_PENDING) {
+        mutex_unlock(&trace_opt_lock);
+        STATS_INC(num_traces_opt_async_dropped);
+        return;
+    }
+    req = HEAP_TYPE_ALLOC(GLOBAL_DCONTEXT, trace_opt_req_t, ACCT_TRACE, PROTECTED);
+    req->tag = tag;
+    req->ticket = ticket;
+    req->next = NULL;
+    if (trace_opt_tail == NULL)
+        trace_opt_head = req;
+    else
+        trace_opt_tail->next = req;
+    trace_opt_tail = req;
+    trace_opt_pending++;
+    if (!trace_opt_thread_started) {
+        trace_opt_thread_started = true;
+        start_thread = true;
+    }
+    mutex_unlock(&trace_opt_lock);
+    if (start_thread) {
+        if (!dr_create_client_thread(trace_opt_thread_main, NULL)) {
+            /* queued traces will simply never be optimized */
+            SYSLOG_INTERNAL_WARNING("failed to create trace optimization thread");
+        }
+    } else
+        signal_event(trace_opt_wakeup);
+}
+#endif /* CLIENT_SIDELINE */
+
 /* Be careful with the case where the current fragment f to be executed
  * has the same tag as the one we're emitting as a trace.
  */
@@ -1196,6 +1552,10 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
     bool replace_trace_head = false;
     fragment_t wrapper;
     uint i;
+    bool ir_arena;
+#ifdef CLIENT_SIDELINE
+    uint opt_ticket = 0;
+#endif
 #if defined(DEBUG) || defined(INTERNAL) || defined(CLIENT_INTERFACE)
     /* was the trace passed through optimizations or the client interface? */
     bool externally_mangled = false;
@@ -1222,6 +1582,10 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         }
     });
 
+    /* Mangling and emit use the IR arena (if enabled), but not the client's
+     * trace hook, which may hold onto what it creates.
+     */
+    ir_arena = heap_ir_arena_set_active(dcontext, false);
 #ifdef CLIENT_INTERFACE
     if (md->pass_to_client) {
         /* PR 299808: we pass the unmangled ilist we've been maintaining to the
@@ -1236,6 +1600,7 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         } /* else, leave translation flag if any bb requested it */
 
         /* We now have to re-mangle and re-chain */
+        heap_ir_arena_set_active(dcontext, true);
         if (!mangle_trace(dcontext, &md->unmangled_ilist, md)) {
             trace_abort(dcontext);
             STATS_INC(num_aborted_traces_client);
@@ -1247,6 +1612,7 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
         instrlist_init(&md->unmangled_ilist);
     }
 #endif
+    heap_ir_arena_set_active(dcontext, true);
 
     if (INTERNAL_OPTION(cbr_single_stub) &&
         final_exit_shares_prev_stub(dcontext, trace, md->trace_flags)) {
@@ -1335,16 +1701,31 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
      * must change recreate_app_state in arch/arch.c as well
      */
 
-#ifdef INTERNAL
-    if (dynamo_options.optimize
-#  ifdef SIDELINE
+    if (TRACE_OPTIMIZE_ENABLED()
+#if defined(INTERNAL) && defined(SIDELINE)
         && !dynamo_options.sideline
-#  endif
+#endif
+#ifdef CLIENT_SIDELINE
+        && !OPTIMIZE_ASYNC(md->trace_flags)
+#endif
         ) {
         optimize_trace(dcontext, tag, trace);
         externally_mangled = true;
     }
-#endif /* INTERNAL */
+
+    /* After the optimizer, so its passes never see the inlined checks.  Traces
+     * -optimize_async will decode from the cache keep a plain final exit.
+     */
+    if (DYNAMO_OPTION(ib_inline_targets) > 0
+#ifdef CLIENT_SIDELINE
+        && !OPTIMIZE_ASYNC(md->trace_flags)
+#endif
+        ) {
+        md->emitted_size +=
+            append_ib_inline_targets(dcontext, trace, &md->trace_flags,
+                                     md->blk_info[md->num_blks - 1].info.tag,
+                                     false/*no translation*/);
+    }
 
 #ifdef PROFILE_RDTSC
     if (dynamo_options.profile_times) {
@@ -1531,9 +1912,23 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
                                  HEAPACCT(ACCT_TRACE));
     for (i = 0; i < md->num_blks; i++)
         trace_tr->bbs[i] = md->blk_info[i].info;
+#ifdef CLIENT_SIDELINE
+    if (TRACE_OPTIMIZE_ENABLED() && OPTIMIZE_ASYNC(md->trace_flags)) {
+        ASSERT_OWN_MUTEX(true, &trace_building_lock);
+        if (++trace_opt_next_ticket == 0) /* 0 means not deferred */
+            trace_opt_next_ticket = 1;
+        opt_ticket = trace_opt_next_ticket;
+        trace_tr->opt_deferred = opt_ticket;
+    }
+#endif
 
     if (TEST(FRAG_SHARED, md->trace_flags))
         mutex_unlock(&trace_building_lock);
+#ifdef CLIENT_SIDELINE
+    /* trace_f may already be gone once we are out of the lock */
+    if (opt_ticket != 0)
+        trace_opt_enqueue(dcontext, tag, opt_ticket);
+#endif
 
     RSTATS_INC(num_traces);
     DOSTATS({ IF_X86_64(if (FRAG_IS_32(trace_f->flags)) STATS_INC(num_32bit_traces);) });
@@ -1617,6 +2012,7 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
 #endif
 
  end_and_emit_trace_return:
+    heap_ir_arena_set_active(dcontext, ir_arena);
     if (cur_f == NULL && cur_f_tag == tag)
         return trace_f;
     else {
@@ -84,6 +84,7 @@ uint should_be_trace_head(dcontext_t *dcontext, fragment_t *from_f, linkstub_t *
 fragment_t *monitor_cache_enter(dcontext_t *dcontext, fragment_t *f);
 void monitor_cache_exit(dcontext_t *dcontext);
 bool is_building_trace(dcontext_t *dcontext);
+uint monitor_trace_head_count(dcontext_t *dcontext, app_pc tag);
 app_pc cur_trace_tag(dcontext_t *dcontext);
 void * cur_trace_vmlist(dcontext_t *dcontext);
 
@@ -104,6 +105,18 @@ void trace_abort_and_delete(dcontext_t *dcontext);
 void
 thcounter_range_remove(dcontext_t *dcontext, app_pc start, app_pc end);
 
+/* -ib_inline_targets: records that the indirect branch exit l of f went to
+ * target through the ibl, and returns up to max of the dominant targets
+ * profiled for the branch ending the bb at site.
+ */
+void
+monitor_ib_site_record(dcontext_t *dcontext, fragment_t *f, linkstub_t *l,
+                       app_pc target);
+
+uint
+monitor_ib_site_targets(dcontext_t *dcontext, app_pc site, /*OUT*/app_pc *targets,
+                        uint max);
+
 bool
 mangle_trace_at_end(void);
 
@@ -162,6 +175,8 @@ typedef struct _monitor_data_t {
      * separate table and not in the fragment_t structure.
      */
     generic_table_t  *thead_table;
+    /* -ib_inline_targets profile of indirect branch sites, also thread-private */
+    generic_table_t  *ib_site_table;
 
 #ifdef CLIENT_INTERFACE
     /* PR 299808: we re-build each bb and pass to the client */
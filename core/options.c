@@ -1208,6 +1208,11 @@ check_option_compatibility_helper(int recurse_count)
         dynamo_options.syscalls_synch_flush = false;
         changed_options = true;
     }
+    if (DYNAMO_OPTION(flush_epoch_reclaim) && !DYNAMO_OPTION(shared_deletion)) {
+        USAGE_ERROR("-flush_epoch_reclaim requires -shared_deletion, disabling");
+        dynamo_options.flush_epoch_reclaim = false;
+        changed_options = true;
+    }
     if (DYNAMO_OPTION(free_private_stubs) && !DYNAMO_OPTION(separate_private_stubs)) {
         USAGE_ERROR("-free_private_stubs requires -separate_private_stubs, disabling");
         dynamo_options.free_private_stubs = false;
@@ -1401,6 +1406,37 @@ check_option_compatibility_helper(int recurse_count)
         changed_options = true;
     }
 
+#ifdef LINUX
+    if (DYNAMO_OPTION(vm_huge_pages) && !DYNAMO_OPTION(vm_reserve)) {
+        USAGE_ERROR("-vm_huge_pages requires -vm_reserve, disabling");
+        dynamo_options.vm_huge_pages = false;
+        changed_options = true;
+    }
+    if (DYNAMO_OPTION(vm_huge_pages)) {
+        /* The shared caches commit in HUGE_PAGE_SIZE steps, so their units
+         * and any cap must be whole huge pages (a zero cap stays unlimited).
+         */
+# define HUGE_PAGE_UNIT(opt) do {                                            \
+        if (!ALIGNED(dynamo_options.opt, HUGE_PAGE_SIZE)) {                  \
+            SYSLOG_INTERNAL_INFO("-vm_huge_pages rounding -"#opt" up to 2MB"); \
+            dynamo_options.opt = ALIGN_FORWARD(dynamo_options.opt, HUGE_PAGE_SIZE); \
+            changed_options = true;                                          \
+        }                                                                    \
+    } while (0)
+        HUGE_PAGE_UNIT(cache_shared_bb_unit_init);
+        HUGE_PAGE_UNIT(cache_shared_bb_unit_max);
+        HUGE_PAGE_UNIT(cache_shared_bb_unit_quadruple);
+        HUGE_PAGE_UNIT(cache_shared_bb_unit_upgrade);
+        HUGE_PAGE_UNIT(cache_shared_bb_max);
+        HUGE_PAGE_UNIT(cache_shared_trace_unit_init);
+        HUGE_PAGE_UNIT(cache_shared_trace_unit_max);
+        HUGE_PAGE_UNIT(cache_shared_trace_unit_quadruple);
+        HUGE_PAGE_UNIT(cache_shared_trace_unit_upgrade);
+        HUGE_PAGE_UNIT(cache_shared_trace_max);
+# undef HUGE_PAGE_UNIT
+    }
+#endif
+
 #ifdef WINDOWS
 # ifdef PROGRAM_SHEPHERDING
     if (DYNAMO_OPTION(IAT_convert) && !DYNAMO_OPTION(emulate_IAT_writes)) {
@@ -1938,6 +1974,100 @@ check_option_compatibility_helper(int recurse_count)
         changed_options = true;
     }
 #endif
+    if (DYNAMO_OPTION(opt_trace_level) > OPT_TRACE_LEVEL_MAX) {
+        USAGE_ERROR("-opt_trace_level must be at most %d, lowering",
+                    OPT_TRACE_LEVEL_MAX);
+        dynamo_options.opt_trace_level = OPT_TRACE_LEVEL_MAX;
+        changed_options = true;
+    }
+#ifndef X86
+    if (DYNAMO_OPTION(opt_trace_level) > 0) {
+        /* FIXME i#1551: optimize_trace() is NYI on ARM */
+        USAGE_ERROR("-opt_trace_level is not supported on ARM, disabling");
+        dynamo_options.opt_trace_level = 0;
+        changed_options = true;
+    }
+#endif
+    if (DYNAMO_OPTION(ib_inline_targets) > MAX_IB_INLINE_TARGETS) {
+        USAGE_ERROR("-ib_inline_targets must be at most %d, lowering",
+                    MAX_IB_INLINE_TARGETS);
+        dynamo_options.ib_inline_targets = MAX_IB_INLINE_TARGETS;
+        changed_options = true;
+    }
+    if (DYNAMO_OPTION(ib_inline_targets) > 0) {
+#ifndef X86
+        /* the inlined checks rely on jecxz and lea */
+        USAGE_ERROR("-ib_inline_targets is not supported on ARM, disabling");
+        dynamo_options.ib_inline_targets = 0;
+        changed_options = true;
+#endif
+#ifdef X64
+        if (DYNAMO_OPTION(x86_to_x64)) {
+            USAGE_ERROR("-ib_inline_targets incompatible with -x86_to_x64, disabling");
+            dynamo_options.ib_inline_targets = 0;
+            changed_options = true;
+        }
+#endif
+#ifdef RETURN_AFTER_CALL
+        /* an inlined target is reached through a direct exit, bypassing the
+         * security checks done on indirect branch exits
+         */
+        if (DYNAMO_OPTION(ret_after_call)
+# ifdef RCT_IND_BRANCH
+            || DYNAMO_OPTION(rct_ind_call) != OPTION_DISABLED
+            || DYNAMO_OPTION(rct_ind_jump) != OPTION_DISABLED
+# endif
+            ) {
+            USAGE_ERROR("-ib_inline_targets incompatible with C, E, and F policies, "
+                        "disabling");
+            dynamo_options.ib_inline_targets = 0;
+            changed_options = true;
+        }
+#endif
+    }
+    if (DYNAMO_OPTION(ib_inline_targets) > 0 && DYNAMO_OPTION(speculate_last_exit)) {
+        /* both add direct exits after a trace's final indirect branch */
+        USAGE_ERROR("-speculate_last_exit incompatible with -ib_inline_targets, "
+                    "disabling");
+        dynamo_options.speculate_last_exit = false;
+        changed_options = true;
+    }
+    if (DYNAMO_OPTION(ret_shadow_stack)) {
+#if !defined(X86) || !defined(X64)
+        /* an empty shadow entry relies on a non-canonical address for a sentinel */
+        USAGE_ERROR("-ret_shadow_stack is only supported on x86_64, disabling");
+        dynamo_options.ret_shadow_stack = false;
+        changed_options = true;
+#else
+        if (DYNAMO_OPTION(x86_to_x64)) {
+            USAGE_ERROR("-ret_shadow_stack incompatible with -x86_to_x64, disabling");
+            dynamo_options.ret_shadow_stack = false;
+            changed_options = true;
+        }
+#endif
+        if (!DYNAMO_OPTION(ibl_table_in_tls)) {
+            /* the shadow stack pointer lives past the ibl table slots */
+            USAGE_ERROR("-ret_shadow_stack requires -ibl_table_in_tls, disabling");
+            dynamo_options.ret_shadow_stack = false;
+            changed_options = true;
+        }
+#ifdef RETURN_AFTER_CALL
+        /* a predicted return is reached through a direct exit, bypassing the
+         * security checks done on indirect branch exits
+         */
+        if (DYNAMO_OPTION(ret_after_call)) {
+            USAGE_ERROR("-ret_shadow_stack incompatible with the C policy, disabling");
+            dynamo_options.ret_shadow_stack = false;
+            changed_options = true;
+        }
+#endif
+    }
+    if (DYNAMO_OPTION(ret_shadow_stack) && DYNAMO_OPTION(ib_inline_targets) > 0) {
+        /* both add direct exits after a bb's final indirect branch */
+        USAGE_ERROR("-ib_inline_targets incompatible with -ret_shadow_stack, disabling");
+        dynamo_options.ib_inline_targets = 0;
+        changed_options = true;
+    }
 
 #ifdef DEBUG
     if (INTERNAL_OPTION(log_at_fragment_count) > 0 && stats->loglevel > 1) {
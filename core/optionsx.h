@@ -480,6 +480,17 @@
         }
      }, "enable high performance at potential loss in client fidelity",
         STATIC, OP_PCACHE_NOP)
+    /* Trace optimization under -opt_speed: 1 removes dead spills and restores
+     * of DR's own mangling, 2 adds redundant load and dead code removal and
+     * stack adjustment combining, 3 adds constant propagation and call/return
+     * matching, which assumes callees do not rewrite their return address.
+     */
+    OPTION_DEFAULT(uint, opt_trace_level, 0,
+        "with -opt_speed, trace optimization level (0-3)")
+#ifdef CLIENT_SIDELINE
+    OPTION_DEFAULT(bool, optimize_async, false,
+        "optimize shared traces on a background thread after emitting them")
+#endif
 
     /* We turned -coarse_units off by default due to PR 326815 */
     OPTION_COMMAND(bool, opt_memory, false, "opt_memory", {
@@ -814,6 +825,14 @@
     /* PR 361894: if no TLS available, we fall back to thread-private */
     PC_OPTION_DEFAULT(bool, shared_bbs, IF_HAVE_TLS_ELSE(true, false),
                       "use thread-shared basic blocks")
+    /* Off by default since it lets clients' bb events run concurrently for
+     * shared bbs, and for the same tag when two threads race to build it.
+     */
+    OPTION_DEFAULT(bool, parallel_bb_build, false,
+                   "build shared basic blocks in parallel, serializing only their emit")
+    /* Off by default: IR from the arena must be freed by the thread that built it. */
+    OPTION_DEFAULT(bool, ir_arena, false,
+                   "bump-allocate IR during bb building and trace emission")
     /* Note that if we want traces off by default we would have to turn
      * off -shared_traces to avoid tripping over un-initialized ibl tables
      * PR 361894: if no TLS available, we fall back to thread-private
@@ -865,6 +884,13 @@
     OPTION_DEFAULT(bool, syscalls_synch_flush, true, "syscalls are flush synch points (currently for shared_deletion only)")
     OPTION_DEFAULT(uint, lazy_deletion_max_pending, 128,
         "maximum size of lazy shared deletion list before moving to normal list")
+    /* Ref counting each pending deletion entry costs every lagging thread a
+     * decrement per entry at each synch point.
+     */
+    OPTION_DEFAULT(bool, flush_epoch_reclaim, false,
+        "free shared deletion entries once every thread's flushtime has passed them "
+        "instead of ref counting each entry, and flush without synching with each "
+        "thread when no thread has private fragments")
 
     OPTION_DEFAULT(bool, free_unmapped_futures, true,
         "free futures on app mem dealloc (potential perf hit)")
@@ -1009,6 +1035,21 @@
                    "share ibl routine for traces")
     OPTION_DEFAULT(bool, speculate_last_exit, false,
         "enable speculative linking of trace last IB exit")
+    OPTION_DEFAULT(uint, ib_inline_targets, 0,
+        "inline compare-and-jump checks for up to this many (max 4) profiled targets "
+        "ahead of the lookup at indirect branch sites")
+    OPTION_DEFAULT(uint, ib_inline_repatch, 64,
+        "lookup misses at an inlined indirect branch site before it is rebuilt from "
+        "its current profile (0 = never)")
+    OPTION_DEFAULT(bool, ret_shadow_stack, false,
+        "predict return targets from a per-thread shadow stack pushed by calls in "
+        "shared bbs")
+    /* Searching a fragment's incoming link list is linear in its fan-in, which
+     * makes unlinking and flushing popular targets slow.
+     */
+    OPTION_DEFAULT(uint, incoming_index_threshold, 0,
+        "index an incoming link list by source exit once a search walks this far "
+        "(0=never)")
 
     OPTION_DEFAULT(uint, max_trace_bbs, 128, "maximum number of basic blocks in a trace")
 
@@ -1253,6 +1294,13 @@
         "adaptive working set shared trace cache management")
     OPTION_DEFAULT(bool, finite_coarse_bb_cache, false,
         "adaptive working set shared bb cache management")
+    /* Promotes private fragments seen executing (entered from dispatch or
+     * counted as a trace head) or still linked to from another fragment so
+     * that a full finite cache evicts them only after every unpromoted
+     * fragment has been tried.
+     */
+    OPTION_DEFAULT(bool, cache_generational, false,
+        "second-chance eviction of executed fragments in finite private caches")
     OPTION_DEFAULT(uint_size, cache_bb_unit_upgrade, (64*1024),
         "bb cache units are always upgraded to this size, in KB or MB")
         /* default size is in Kilobytes, Examples: 4, 4k, 4m, or 0 for unlimited */
@@ -1324,6 +1372,13 @@
     /* FIXME: separate for bb and trace shared caches? */
     OPTION_DEFAULT(bool, cache_shared_free_list, true,
         "use size-separated free lists to manage empty shared cache slots")
+    /* Keeps the shared bbs most likely to run together in their own units, away
+     * from the one-shot blocks, to cut the cache's i-cache and iTLB footprint.
+     */
+    OPTION_DEFAULT(bool, hot_bb_cache, false,
+        "place shared bbs with execution or linking history in a separate hot cache")
+    OPTION_DEFAULT(uint, hot_bb_links, 2,
+        "with -hot_bb_cache, pending incoming links that make a new bb hot (0=ignore)")
 
     /* FIXME i#1674: enable on ARM once bugs are fixed, along with all the
      * reset_* trigger options as well.
@@ -1414,6 +1469,14 @@
                    "requested size, try smaller sizes instead of dying")
     OPTION_DEFAULT(bool, vm_base_near_app, true,
                    "allocate vm region near the app")
+#ifdef LINUX
+    /* Also raises the shared cache unit sizes to HUGE_PAGE_SIZE and drops their
+     * guard pages, which would otherwise split every 2MB range.
+     */
+    OPTION_DEFAULT(bool, vm_huge_pages, false,
+                   "align the vm reservation and shared cache units to 2MB and "
+                   "advise the kernel to back them with transparent huge pages")
+#endif
 #ifdef X64
     /* We prefer low addresses in general, and only need this option if it's
      * an absolute requirement (XXX i#829: it is required for mixed-mode).
@@ -2135,7 +2198,8 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
     /* case 8640: relies on -executable_{if_rx_text,after_load} */
     PC_OPTION_DEFAULT(bool, coarse_merge_iat, true,
         "merge iat page into coarse unit at +rx transition")
-    /* PR 214084: avoid push of abs addr in pcache
+    /* PR 214084: avoid push of abs addr in pcache.  If disabled, pcaches
+     * record these pushes for rebasing (case 9581).
      * TODO: should auto-enable (on Linux or Vista+ only?) for -coarse_enable_freeze?
      */
     PC_OPTION_DEFAULT(bool, coarse_split_calls, false,
@@ -2833,6 +2897,7 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
         /* possible (but hopefully unlikely) expense of correctness    */
 
     OPTIMIZE_OPTION(bool, call_return_matching)
+    OPTIMIZE_OPTION(bool, remove_dead_spills)
     OPTIMIZE_OPTION(bool, remove_unnecessary_zeroing) // FIXME: unnecessarily long option
     OPTIMIZE_OPTION(bool, peephole)
 # undef OPTIMIZE_OPTION
@@ -140,6 +140,11 @@ bool os_heap_systemwide_overcommit(heap_error_code_t last_error_code);
 
 bool os_heap_get_commit_limit(size_t *commit_used, size_t *commit_limit);
 
+/* Asks the kernel to back the reserved range [p, p+size) with huge pages
+ * once it is committed and touched.  Returns false where unsupported.
+ */
+bool os_heap_advise_huge_pages(void *p, size_t size);
+
 thread_id_t get_thread_id(void);
 process_id_t get_process_id(void);
 void os_thread_yield(void);
@@ -229,6 +229,7 @@ coarse_unit_free(dcontext_t *dcontext, coarse_info_t *info)
     ASSERT(info->htable == NULL);
     ASSERT(info->th_htable == NULL);
     ASSERT(info->pclookup_htable == NULL);
+    ASSERT(info->reloc_htable == NULL);
     ASSERT(info->cache == NULL);
     ASSERT(info->incoming == NULL);
     ASSERT(info->stubs == NULL);
@@ -245,6 +246,19 @@ coarse_unit_free(dcontext_t *dcontext, coarse_info_t *info)
     RSTATS_DEC(num_coarse_units);
 }
 
+/* Case 9581: for the relocs in a unit of a few hundred fragments */
+#define RELOC_HTABLE_INIT_SIZE 6
+
+static generic_table_t *
+coarse_reloc_htable_create(void)
+{
+    return generic_hash_create(GLOBAL_DCONTEXT, RELOC_HTABLE_INIT_SIZE,
+                               80 /* load factor: not perf-critical */,
+                               HASHTABLE_ENTRY_SHARED | HASHTABLE_SHARED |
+                               HASHTABLE_RELAX_CLUSTER_CHECKS,
+                               NULL _IF_DEBUG("coarse reloc table"));
+}
+
 void
 coarse_unit_init(coarse_info_t *info, void *cache)
 {
@@ -253,10 +267,102 @@ coarse_unit_init(coarse_info_t *info, void *cache)
     ASSERT_OWN_MUTEX(true, &info->lock);
     fragment_coarse_htable_create(info, 0, 0);
     coarse_stubs_create(info, NULL, 0);
+    /* Created here rather than lazily so emit need not grab info->lock */
+    info->reloc_htable = coarse_reloc_htable_create();
     /* cache is passed in since it can't be created while holding info->lock */
     info->cache = cache;
 }
 
+/* Case 9581: records that the immediate at imm in info's cache holds a return
+ * address of PERSIST_RELOC_* kind that must be rebased should info be persisted
+ * and later loaded at a different base.  info must have been through
+ * coarse_unit_init() or else be frozen and not yet visible to other threads.
+ */
+void
+coarse_unit_add_reloc(dcontext_t *dcontext, coarse_info_t *info, cache_pc imm,
+                      uint kind)
+{
+    generic_table_t *table;
+    ASSERT(kind != 0);
+    if (info->reloc_htable == NULL) {
+        ASSERT(info->frozen);
+        info->reloc_htable = coarse_reloc_htable_create();
+    }
+    table = (generic_table_t *) info->reloc_htable;
+    LOG(THREAD, LOG_CACHE, 4, "  reloc kind %d @"PFX" in %s\n", kind, imm,
+        info->module);
+    TABLE_RWLOCK(table, write, lock);
+    generic_hash_add(GLOBAL_DCONTEXT, table, (ptr_uint_t) imm,
+                     (void *)(ptr_uint_t) kind);
+    TABLE_RWLOCK(table, write, unlock);
+}
+
+/* Case 9581: copies src's relocs for the code in [src_start, src_end), which was
+ * just copied to dst_start in dst's cache, over to dst.
+ */
+static void
+coarse_unit_transfer_relocs(dcontext_t *dcontext, coarse_info_t *src,
+                            cache_pc src_start, cache_pc src_end,
+                            coarse_info_t *dst, cache_pc dst_start)
+{
+#ifdef X86
+    generic_table_t *table = (generic_table_t *) src->reloc_htable;
+    cache_pc pc = src_start;
+    if (table == NULL || table->entries == 0)
+        return;
+    while (pc < src_end) {
+        /* Relocs are keyed on the last 4 bytes of their instr, which for
+         * "push imm32" is the immediate itself (see emit_retaddr_reloc()).
+         */
+        cache_pc next_pc = decode_next_pc(dcontext, pc);
+        uint kind;
+        if (next_pc == NULL)
+            break;
+        if (next_pc - pc >= sizeof(int)) {
+            TABLE_RWLOCK(table, read, lock);
+            kind = (uint)(ptr_uint_t)
+                generic_hash_lookup(GLOBAL_DCONTEXT, table,
+                                    (ptr_uint_t)(next_pc - sizeof(int)));
+            TABLE_RWLOCK(table, read, unlock);
+            if (kind != 0) {
+                coarse_unit_add_reloc(dcontext, dst,
+                                      dst_start + (next_pc - sizeof(int) - src_start),
+                                      kind);
+            }
+        }
+        pc = next_pc;
+    }
+#endif
+}
+
+/* Case 9581: adds all of src's relocs, shifted by delta, to dst.
+ * dst must not yet be visible to other threads.
+ */
+static void
+coarse_unit_shift_relocs(dcontext_t *dcontext, coarse_info_t *src,
+                         coarse_info_t *dst, ssize_t delta)
+{
+    generic_table_t *table = (generic_table_t *) src->reloc_htable;
+    ptr_uint_t key;
+    void *payload;
+    int iter = 0;
+    if (table == NULL)
+        return;
+    ASSERT(dst->frozen);
+    if (dst->reloc_htable == NULL)
+        dst->reloc_htable = coarse_reloc_htable_create();
+    /* dst is local, so we avoid nesting same-rank table locks */
+    DODEBUG({ ((generic_table_t *) dst->reloc_htable)->is_local = true; });
+    TABLE_RWLOCK(table, read, lock);
+    while ((iter = generic_hash_iterate_next(GLOBAL_DCONTEXT, table, iter,
+                                             &key, &payload)) >= 0) {
+        generic_hash_add(GLOBAL_DCONTEXT, (generic_table_t *) dst->reloc_htable,
+                         (ptr_uint_t)((cache_pc)key + delta), payload);
+    }
+    TABLE_RWLOCK(table, read, unlock);
+    DODEBUG({ ((generic_table_t *) dst->reloc_htable)->is_local = false; });
+}
+
 /* If caller holds change_linking_lock and info->lock, have_locks should be true.
  * If !need_info_lock, info must be a thread-local, unlinked, private pointer!
  */
@@ -289,6 +395,10 @@ coarse_unit_reset_free_internal(dcontext_t *dcontext, coarse_info_t *info,
     fragment_coarse_htable_free(info);
     coarse_stubs_delete(info);
     fcache_coarse_cache_delete(dcontext, info);
+    if (info->reloc_htable != NULL) {
+        generic_hash_destroy(GLOBAL_DCONTEXT, (generic_table_t *) info->reloc_htable);
+        info->reloc_htable = NULL;
+    }
     if (info->in_use && abdicate_primary)
         coarse_unit_unmark_primary(info);
     if (info->frozen) {
@@ -350,6 +460,10 @@ coarse_unit_reset_free_internal(dcontext_t *dcontext, coarse_info_t *info,
                 }
 #endif
             }
+            if (info->relocs != NULL) {
+                HEAP_ARRAY_FREE(GLOBAL_DCONTEXT, info->relocs, persisted_reloc_t,
+                                info->num_relocs, ACCT_MEM_MGT, PROTECTED);
+            }
         }
     } else {
         ASSERT(info->mmap_size == 0);
@@ -640,6 +754,7 @@ coarse_replace_unit(dcontext_t *dcontext, coarse_info_t *dst, coarse_info_t *src
     dst->non_frozen = non_frozen;
     DODEBUG({ dst->module = modname; });
     ASSERT(dst->incoming == src->incoming);
+    src->reloc_htable = NULL; /* now owned by dst */
     /* update pointers from src to dst */
     fcache_coarse_set_info(dcontext, dst);
     patch_coarse_exit_prefix(dcontext, dst);
@@ -1091,6 +1206,8 @@ transfer_coarse_fragment(dcontext_t *dcontext, coarse_freeze_info_t *freeze_info
     /* copy body of fragment, up to start of cti */
     sz = pc - body;
     memcpy(freeze_info->cache_cur_pc, body, sz);
+    coarse_unit_transfer_relocs(dcontext, freeze_info->src_info, body, pc,
+                                freeze_info->dst_info, freeze_info->cache_cur_pc);
     freeze_info->cache_cur_pc += sz;
     DODEBUG({ freeze_info->app_code_size += sz; });
 
@@ -1723,6 +1840,9 @@ coarse_merge_without_dups(dcontext_t *dcontext, coarse_freeze_info_t *freeze_inf
             /* copy body of fragment, including cti (if not ending @ fall-through) */
             size_t sz = next_pc - src_body;
             memcpy(freeze_info->cache_cur_pc, src_body, sz);
+            coarse_unit_transfer_relocs(dcontext, freeze_info->src_info, src_body,
+                                        next_pc, freeze_info->dst_info,
+                                        freeze_info->cache_cur_pc);
             freeze_info->cache_cur_pc += sz;
         }
 
@@ -1970,6 +2090,8 @@ coarse_unit_merge(dcontext_t *dcontext, coarse_info_t *info1, coarse_info_t *inf
      */
     cachelg_size = (src_lg == info2) ? cache2_size : cache1_size;
     memcpy(merged->cache_start_pc, src_lg->cache_start_pc, cachelg_size);
+    coarse_unit_shift_relocs(dcontext, src_lg, merged,
+                             merged->cache_start_pc - src_lg->cache_start_pc);
 
     memset(&freeze_info, 0, sizeof(freeze_info));
     freeze_info.dst_info = merged;
@@ -2939,6 +3061,51 @@ pad_persist_file(dcontext_t *dcontext, file_t fd, size_t bytes, coarse_info_t *i
     return true;
 }
 
+/* Applies the persisted relocs to info's cache, which must be writable.
+ * Returns false if a value cannot be rebased by rewriting its immediate(s).
+ */
+static bool
+coarse_unit_apply_relocs(dcontext_t *dcontext, coarse_info_t *info,
+                         persisted_reloc_t *relocs, uint num_relocs, ssize_t delta)
+{
+    size_t cache_len = info->cache_end_pc - info->cache_start_pc;
+    uint i;
+    for (i = 0; i < num_relocs; i++) {
+        byte *imm = info->cache_start_pc + relocs[i].cache_offs;
+        ptr_int_t val;
+        if (relocs[i].cache_offs + sizeof(int) > cache_len)
+            return false;
+        if (relocs[i].kind == PERSIST_RELOC_PUSH_IMM32) {
+            val = (ptr_int_t) ((ptr_uint_t) (ptr_int_t) *(int *)imm + delta);
+#ifdef X64
+            /* The push sign-extends, so a value that no longer fits would
+             * need the two-instruction form.
+             */
+            if (!CHECK_TRUNCATE_TYPE_int(val))
+                return false;
+#endif
+            *(int *)imm = (int) val;
+        }
+#ifdef X64
+        else if (relocs[i].kind == PERSIST_RELOC_PUSH_IMM64) {
+            byte *hi = imm + PERSIST_RELOC_HI32_OFFS;
+            if (relocs[i].cache_offs + PERSIST_RELOC_HI32_OFFS + sizeof(int) >
+                cache_len)
+                return false;
+            val = (ptr_int_t) ((((ptr_uint_t) *(uint *)hi << 32) | *(uint *)imm) +
+                               delta);
+            *(uint *)imm = (uint) val;
+            *(uint *)hi = (uint) ((ptr_uint_t)val >> 32);
+        }
+#endif
+        else
+            return false;
+    }
+    LOG(THREAD, LOG_CACHE, 2, "  applied %d relocs with delta "SZFMT"\n",
+        num_relocs, delta);
+    return true;
+}
+
 /* Fills in pers with data from info */
 static void
 coarse_unit_set_persist_data(dcontext_t *dcontext, coarse_info_t *info,
@@ -3025,10 +3192,42 @@ coarse_unit_set_persist_data(dcontext_t *dcontext, coarse_info_t *info,
     x_offs += pers->hotp_patch_list_len;
 #endif
 
-    /* FIXME case 9581 NYI: need to add to coarse_unit_calculate_persist_info()
-     * and coarse_unit_merge_persist_info() as well.
+    /* Case 9581: we calculate the relocs here rather than in
+     * coarse_unit_calculate_persist_info() as a merge produces a new cache.
      */
-    pers->reloc_len = 0;
+    if (info->relocs != NULL) {
+        HEAP_ARRAY_FREE(GLOBAL_DCONTEXT, info->relocs, persisted_reloc_t,
+                        info->num_relocs, ACCT_MEM_MGT, PROTECTED);
+        info->relocs = NULL;
+    }
+    info->num_relocs = 0;
+    if (info->reloc_htable != NULL) {
+        generic_table_t *table = (generic_table_t *) info->reloc_htable;
+        ptr_uint_t key;
+        void *payload;
+        int iter = 0;
+        TABLE_RWLOCK(table, read, lock);
+        if (table->entries > 0) {
+            info->relocs = HEAP_ARRAY_ALLOC(GLOBAL_DCONTEXT, persisted_reloc_t,
+                                            table->entries, ACCT_MEM_MGT, PROTECTED);
+        }
+        while ((iter = generic_hash_iterate_next(GLOBAL_DCONTEXT, table, iter,
+                                                 &key, &payload)) >= 0) {
+            ASSERT(info->num_relocs < table->entries);
+            ASSERT((cache_pc)key >= info->cache_start_pc &&
+                   (cache_pc)key + sizeof(int) <= info->cache_end_pc);
+            IF_X64(ASSERT(CHECK_TRUNCATE_TYPE_uint((cache_pc)key -
+                                                   info->cache_start_pc)));
+            info->relocs[info->num_relocs].cache_offs =
+                (uint) ((cache_pc)key - info->cache_start_pc);
+            info->relocs[info->num_relocs].kind = (uint)(ptr_uint_t) payload;
+            info->num_relocs++;
+        }
+        ASSERT(info->num_relocs == table->entries);
+        TABLE_RWLOCK(table, read, unlock);
+    }
+    LOG(THREAD, LOG_CACHE, 2, "  %d relocs for %s\n", info->num_relocs, info->module);
+    pers->reloc_len = sizeof(persisted_reloc_t) * info->num_relocs;
     x_offs += pers->reloc_len;
 
 #ifdef RETURN_AFTER_CALL
@@ -3456,7 +3655,10 @@ coarse_unit_persist(dcontext_t *dcontext, coarse_info_t *info)
     }
 #endif
 
-    /* FIXME case 9581 NYI: write reloc section */
+    if (pers.reloc_len > 0) {
+        if (!write_persist_file(dcontext, fd, info->relocs, pers.reloc_len))
+            goto coarse_unit_persist_exit; /* logs, stats are in write_persist_file */
+    }
 
 #ifdef RETURN_AFTER_CALL
     if (pers.rac_htable_len > 0) {
@@ -3817,6 +4019,7 @@ coarse_unit_load(dcontext_t *dcontext, app_pc start, app_pc end,
     persisted_module_info_t modinfo;
     app_pc modbase = get_module_base(start);
     bool success = false;
+    size_t i;
     DEBUG_DECLARE(bool ok;)
 
     KSTART(persisted_load);
@@ -3995,12 +4198,19 @@ coarse_unit_load(dcontext_t *dcontext, app_pc start, app_pc end,
             /* XXX: may not be at_map if re-add coarse post-load (e.g., IAT or other
              * special cases): how know?
              */
-            !module_has_text_relocs(modbase, dynamo_initialized/*at_map*/)) {
+            !module_has_text_relocs(modbase, dynamo_initialized/*at_map*/) &&
+            /* The RAC and RCT tables hold absolute app addresses that we do
+             * not rebase.
+             */
+            pers->rac_htable_len == 0 && pers->rct_htable_len == 0) {
+            /* Our own position-dependent immediates are rebased by applying
+             * the reloc section below (case 9581).
+             */
             LOG(THREAD, LOG_CACHE, 1, "  module base mismatch "PFX" vs persisted "PFX
                 ", but no text relocs so ok\n", modbase, pers->modinfo.base);
         } else {
 #endif
-            /* FIXME case 9581/9649: Bail out for now since relocs NYI
+            /* FIXME case 9581/9649: Bail out since app relocs are NYI.
              * Once we do support them, make sure to do the right thing when merging:
              * current code will always apply relocs before merging.
              */
@@ -4036,7 +4246,9 @@ coarse_unit_load(dcontext_t *dcontext, app_pc start, app_pc end,
          + pers->fcache_return_prefix_len);
 
     if (TEST(PERSCACHE_MAP_RW_SEPARATE, pers->flags) &&
-        DYNAMO_OPTION(persist_map_rw_separate)) {
+        DYNAMO_OPTION(persist_map_rw_separate) &&
+        /* case 9581: the cache must stay copy-on-write to apply relocs */
+        (modbase == pers->modinfo.base || pers->reloc_len == 0)) {
         size_t ro_size;
         map2_size = stubs_and_prefixes_len + sizeof(persisted_footer_t);
         ro_size = (size_t)file_size/*un-aligned*/ - map2_size;
@@ -4282,9 +4494,29 @@ coarse_unit_load(dcontext_t *dcontext, app_pc start, app_pc end,
 #endif
     }
 
-    /* FIXME case 9581 NYI: reloc section */
     if (offsetof(coarse_persisted_info_t, reloc_len) < pers->header_len) {
         pc -= pers->reloc_len;
+        /* case 9581: rebase our call->push immed manglings.  The cache is still
+         * writable (and copy-on-write) until we set the final protections below.
+         */
+        if (pers->reloc_len > 0 && modbase != pers->modinfo.base) {
+            ASSERT(map2 == NULL);
+            if (!coarse_unit_apply_relocs(dcontext, info, (persisted_reloc_t *) pc,
+                                          (uint) (pers->reloc_len /
+                                                  sizeof(persisted_reloc_t)),
+                                          modbase - pers->modinfo.base)) {
+                LOG(THREAD, LOG_CACHE, 1, "  error: unable to apply relocs\n");
+                STATS_INC(perscache_base_mismatch);
+                goto coarse_unit_load_exit;
+            }
+        }
+        /* Keep them for re-persisting after a merge */
+        for (i = 0; i < pers->reloc_len / sizeof(persisted_reloc_t); i++) {
+            persisted_reloc_t *reloc = ((persisted_reloc_t *) pc) + i;
+            coarse_unit_add_reloc(dcontext, info,
+                                  info->cache_start_pc + reloc->cache_offs,
+                                  reloc->kind);
+        }
     }
 
 #ifdef HOT_PATCHING_INTERFACE
@@ -46,6 +46,37 @@
  * COARSE-GRAIN UNITS
  */
 
+/* Case 9581: a position-dependent immediate in a frozen cache that must be
+ * rebased when the module is loaded at a different base than it had when
+ * persisted.  The only such immediates our coarse-grain mangling produces
+ * are the return addresses pushed in place of calls (see comments in
+ * coarse_persisted_info_t).
+ */
+typedef struct _persisted_reloc_t {
+    uint cache_offs; /* offset from cache start of the 4-byte immediate */
+    uint kind;       /* PERSIST_RELOC_* */
+} persisted_reloc_t;
+
+enum {
+    /* 0 is reserved so a kind can serve as a non-NULL hashtable payload */
+    /* "push imm32": the value is sign-extended to pointer size */
+    PERSIST_RELOC_PUSH_IMM32 = 1,
+#ifdef X64
+    /* "push lo32; mov hi32 -> 4(%rsp)": the high half's immediate is
+     * PERSIST_RELOC_HI32_OFFS bytes past the low half's
+     */
+    PERSIST_RELOC_PUSH_IMM64,
+#endif
+    /* An emulated push of a non-pointer-sized return address, which we do
+     * not rebase: a unit with one of these is not loaded at a new base.
+     */
+    PERSIST_RELOC_UNSUPPORTED,
+};
+
+#ifdef X64
+# define PERSIST_RELOC_HI32_OFFS 8
+#endif
+
 /* Information kept per coarse-grain region.
  * FIXME: for sharing we want to keep htable, stubs, and incoming
  * per unit, not per cache.  That will require changing fcache_unit_t and
@@ -101,6 +132,13 @@ struct _coarse_info_t {
     /* cache pclookups to avoid htable walk (i#658) */
     void *pclookup_last_htable; /* opaque htable caching recent non-entry pclookups */
 
+    /* Case 9581: opaque htable mapping the cache pc of each position-dependent
+     * immediate to its PERSIST_RELOC_* kind.  Filled in at emit time, carried
+     * through freezing and merging, and re-populated when loading a persisted
+     * unit.
+     */
+    void *reloc_htable;
+
     void *stubs; /* opaque special heap */
 
     cache_pc fcache_return_prefix;
@@ -167,6 +205,12 @@ struct _coarse_info_t {
     /* case 10525: leave stubs as writable if written too many times */
     uint stubs_write_count;
 
+    /* Case 9581: reloc_htable flattened into the array we write out.
+     * Calculated at persist time only.
+     */
+    persisted_reloc_t *relocs;
+    uint num_relocs;
+
     /* case 9521: we can have a second unit in the same region for new,
      * non-frozen coarse code if the primary unit is frozen.
      * Presumably frozen unit is larger so we put it first.
@@ -223,6 +267,10 @@ coarse_unit_create(app_pc base_pc, app_pc end_pc, module_digest_t *digest,
 void
 coarse_unit_init(coarse_info_t *info, void *cache);
 
+void
+coarse_unit_add_reloc(dcontext_t *dcontext, coarse_info_t *info, cache_pc imm,
+                      uint kind);
+
 /* If caller holds change_linking_lock and info->lock, have_locks should be true */
 void
 coarse_unit_reset_free(dcontext_t *dcontext, coarse_info_t *info,
@@ -317,7 +365,7 @@ coarse_unit_merge(dcontext_t *dcontext, coarse_info_t *info1, coarse_info_t *inf
 
 enum {
     PERSISTENT_CACHE_MAGIC = 0x244f4952, /* RIO$ */
-    PERSISTENT_CACHE_VERSION = 10,
+    PERSISTENT_CACHE_VERSION = 11,
 };
 
 /* Global flags we need to process if present in a persisted cache */
@@ -520,14 +568,18 @@ typedef struct _coarse_persisted_info_t {
      */
 #endif
 
-    /* Relocations
-     * FIXME case 9581 NYI: other than app code relocs, all
-     * we add w/ coarse bbs are "call->push immed" manglings.  Once have traces,
+    /* Relocations: an array of persisted_reloc_t.
+     * Other than app code relocs, all we add w/ coarse bbs are "call->push immed"
+     * manglings, which is all this section records (case 9581): they are
+     * marked when mangled and located when emitted, and are only present
+     * with -no_coarse_split_calls.  Once have traces,
      * also stay-on-trace cmp.  No off-fragment jmps are currently allowed
      * except for fcache/trace-head return and ibl, which are indirected.
-     * For app relocs we can either store in our own format at freeze time
-     * or do all processing at load time.
-     * FIXME: our non-entry pclookup is slow -- how slow will applying relocs be?
+     * App code relocs are not handled: we refuse to load at a different base
+     * unless the module is known to have no text relocs.
+     * Rip-relative references are kept out of coarse units by
+     * -coarse_split_riprel, as their displacements would also depend on
+     * where the cache itself is mapped.
      * FIXME case 9649: We could make our own call->push manglings
      * PIC using pc-relative addressing on x86-64.
      */
@@ -84,6 +84,10 @@ typedef struct _translate_walk_t {
      */
     bool reg_spilled[REG_SPILL_NUM];
     bool reg_tls[REG_SPILL_NUM];
+    /* Spills whose restore the trace optimizer removed (INSTR_SPILL_CARRIED),
+     * which stay live past the end of their mangling region
+     */
+    bool reg_carried[REG_SPILL_NUM];
     /* PR 267260: Track our own mangle-inserted pushes and pops, for
      * restoring state in the middle of our indirect branch mangling.
      * This is the adjustment in the forward direction.
@@ -95,6 +99,10 @@ typedef struct _translate_walk_t {
     bool in_mangle_region;
     /* What is the translation target of the current mangle region */
     app_pc translation;
+    /* The last instr was an unconditional jump, so the next is only reached
+     * by jumping to it
+     */
+    bool at_jump_entry;
 } translate_walk_t;
 
 static void
@@ -175,6 +183,10 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
     reg_id_t reg, r;
     bool spill, spill_tls;
 
+#ifdef X86
+    walk->at_jump_entry = (instr_is_ubr(inst) || instr_get_opcode(inst) == OP_jmp_ind);
+#endif
+
     /* Two mangle regions can be adjacent: distinguish by translation field */
     if (walk->in_mangle_region &&
         /* On ARM, we spill registers across an app instr, so go solely on xl8 */
@@ -190,12 +202,33 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
         walk->xsp_adjust = 0;
         for (r = 0; r < REG_SPILL_NUM; r++) {
             /* we should have seen a restore for every spill, unless at
-             * fragment-ending jump to ibl, which shouldn't come here
+             * fragment-ending jump to ibl, which shouldn't come here, or
+             * unless the trace optimizer removed the restore as dead
+             * (remove_dead_spills()): then the app value stays in its slot
+             * until the app overwrites the register or a later restore.
              */
+            if (walk->reg_spilled[r] && walk->reg_carried[r])
+                continue;
             ASSERT(!walk->reg_spilled[r]);
             walk->reg_spilled[r] = false; /* be paranoid */
         }
     }
+#ifdef X86
+    if (!instr_is_our_mangling(inst)) {
+        /* a spill carried out of its mangling region is dead once the app
+         * overwrites the register
+         */
+        for (r = 0; r < REG_SPILL_NUM; r++) {
+            if (walk->reg_spilled[r] && walk->reg_carried[r] &&
+                instr_writes_to_reg(inst, r + REG_START_SPILL, DR_QUERY_INCLUDE_ALL)) {
+                LOG(THREAD_GET, LOG_INTERP, 5, "\tcarried spill of %s is dead\n",
+                    reg_names[r + REG_START_SPILL]);
+                walk->reg_spilled[r] = false;
+                walk->reg_carried[r] = false;
+            }
+        }
+    }
+#endif
 
     if (instr_is_our_mangling(inst)) {
         if (!walk->in_mangle_region) {
@@ -260,8 +293,10 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
             /* FIXME i#1551: add ARM version of the series of trace cti checks above */
             IF_ARM(ASSERT_NOT_IMPLEMENTED(DYNAMO_OPTION(disable_traces)));
             /* reset for non-exit non-trace-jecxz cti (i.e., selfmod cti) */
-            for (r = 0; r < REG_SPILL_NUM; r++)
+            for (r = 0; r < REG_SPILL_NUM; r++) {
                 walk->reg_spilled[r] = false;
+                walk->reg_carried[r] = false;
+            }
         }
         if (instr_is_DR_reg_spill_or_restore(tdcontext, inst, &spill_tls, &spill, &reg)) {
             r = reg - REG_START_SPILL;
@@ -282,6 +317,7 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
                 ASSERT(spill || walk->reg_tls[r] == spill_tls);
                 walk->reg_spilled[r] = spill;
                 walk->reg_tls[r] = spill_tls;
+                walk->reg_carried[r] = spill && TEST(INSTR_SPILL_CARRIED, inst->flags);
                 LOG(THREAD_GET, LOG_INTERP, 5,
                     "\tspill update: %s %s %s\n", spill ? "spill" : "restore",
                     spill_tls ? "tls" : "mcontext", reg_names[reg]);
@@ -360,6 +396,109 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
     }
 }
 
+#ifdef X86
+/* Our landing pads are only entered by jumps: insert_ib_inline_targets()'s
+ * from a jecxz ahead of the indirect branch exit, within their mangling
+ * region, and -ret_shadow_stack's from the return check's jmp* into pads
+ * past the final exit that form regions of their own.  By the time the
+ * linear walk reaches a pad it has passed restores on the paths laid out
+ * ahead of it, but any register the pad restores before spilling is still
+ * in its slot on entry, so we mark it spilled again.
+ * Called on each instr from a jump target up to the next cti, with seen
+ * tracking the registers decided so far; returns whether to keep going.
+ */
+static bool
+translate_walk_jump_target(dcontext_t *tdcontext, translate_walk_t *walk,
+                           instr_t *inst, bool *seen)
+{
+    reg_id_t reg, r;
+    bool spill, spill_tls;
+    if (instr_is_DR_reg_spill_or_restore(tdcontext, inst, &spill_tls, &spill, &reg)) {
+        r = reg - REG_START_SPILL;
+        ASSERT(r < REG_SPILL_NUM);
+        if (!seen[r] && !spill && !walk->reg_spilled[r]) {
+            LOG(THREAD_GET, LOG_INTERP, 5, "\tjump target restores %s: still spilled\n",
+                reg_names[reg]);
+            walk->reg_spilled[r] = true;
+            walk->reg_tls[r] = spill_tls;
+            walk->reg_carried[r] = false;
+        }
+        seen[r] = true;
+    }
+    return !instr_is_cti(inst);
+}
+
+/* Calls translate_walk_jump_target() on the code following jump in ilist,
+ * if that is our mangling.  When it starts a new mangling region we leave the
+ * current one here, as nothing falls through from its spills.
+ */
+static void
+translate_walk_jump_entry_ilist(dcontext_t *tdcontext, translate_walk_t *walk,
+                                instr_t *jump)
+{
+    bool seen[REG_SPILL_NUM] = {false,};
+    instr_t *in, *entry;
+    app_pc xl8;
+    reg_id_t r;
+    walk->at_jump_entry = false;
+    for (entry = instr_get_next(jump); entry != NULL && instr_is_label(entry);
+         entry = instr_get_next(entry))
+        ; /* nothing */
+    if (entry == NULL || !instr_is_our_mangling(entry))
+        return;
+    xl8 = instr_get_translation(entry);
+    if (xl8 == NULL) /* clean call: not tracked */
+        return;
+    if (walk->in_mangle_region && xl8 != walk->translation) {
+        LOG(THREAD_GET, LOG_INTERP, 5, "%s: jump to new mangle region xl8="PFX"\n",
+            __FUNCTION__, xl8);
+        walk->in_mangle_region = false;
+        walk->unsupported_mangle = false;
+        walk->xsp_adjust = 0;
+        for (r = 0; r < REG_SPILL_NUM; r++) {
+            walk->reg_spilled[r] = false;
+            walk->reg_carried[r] = false;
+        }
+    }
+    for (in = entry; in != NULL; in = instr_get_next(in)) {
+        if (instr_is_label(in))
+            continue;
+        if (!instr_is_our_mangling(in) || instr_get_translation(in) != xl8 ||
+            !translate_walk_jump_target(tdcontext, walk, in, seen))
+            break;
+    }
+}
+
+/* Calls translate_walk_jump_target() on the code at cpc, which follows a jump
+ * in the identical region of info's i-1th entry translating to jump_xl8.
+ */
+static void
+translate_walk_jump_entry_info(dcontext_t *tdcontext, translate_walk_t *walk,
+                               const translation_info_t *info, uint i,
+                               byte *start_cache, byte *end_cache, byte *cpc,
+                               app_pc jump_xl8)
+{
+    bool seen[REG_SPILL_NUM] = {false,};
+    instr_t instr;
+    walk->at_jump_entry = false;
+    instr_init(tdcontext, &instr);
+    while (cpc != NULL && cpc < end_cache) {
+        if (i < info->num_entries &&
+            cpc - start_cache >= info->translation[i].cache_offs) {
+            if (info->translation[i].app != jump_xl8 ||
+                !TEST(TRANSLATE_OUR_MANGLING, info->translation[i].flags))
+                break;
+            i++;
+        }
+        instr_reset(tdcontext, &instr);
+        cpc = decode(tdcontext, cpc, &instr);
+        if (cpc == NULL || !translate_walk_jump_target(tdcontext, walk, &instr, seen))
+            break;
+    }
+    instr_free(tdcontext, &instr);
+}
+#endif
+
 static bool
 translate_walk_good_state(dcontext_t *tdcontext, translate_walk_t *walk,
                           app_pc translate_pc)
@@ -369,24 +508,57 @@ translate_walk_good_state(dcontext_t *tdcontext, translate_walk_t *walk,
             (walk->in_mangle_region && translate_pc != walk->translation));
 }
 
+/* Restores the app values of all registers currently in spill slots, or of
+ * only those the trace optimizer carried past their region if carried_only.
+ */
+static void
+translate_walk_restore_spills(dcontext_t *tdcontext, translate_walk_t *walk,
+                              bool carried_only)
+{
+    reg_id_t r;
+    for (r = 0; r < REG_SPILL_NUM; r++) {
+        if (walk->reg_spilled[r] && (!carried_only || walk->reg_carried[r])) {
+            reg_id_t reg = r + REG_START_SPILL;
+            reg_t value;
+            if (walk->reg_tls[r]) {
+                value = *(reg_t *)(((byte*)&tdcontext->local_state->spill_space) +
+                                   /* special handling r10, mangle instr inserted
+                                    * in mangle_syscall_arch
+                                    */
+                                   (IF_ARM(reg == DR_REG_R10 ?
+                                           reg_spill_tls_offs(DR_REG_R1) :)
+                                    reg_spill_tls_offs(reg)));
+            } else {
+                value = reg_get_value_priv(reg, get_mcontext(tdcontext));
+            }
+            LOG(THREAD_GET, LOG_INTERP, 2,
+                "\trestoring spilled %s to "PFX"\n", reg_names[reg], value);
+            STATS_INC(recreate_spill_restores);
+            reg_set_value_priv(reg, walk->mc, value);
+        }
+    }
+}
+
 static void
 translate_walk_restore(dcontext_t *tdcontext, translate_walk_t *walk,
                        app_pc translate_pc)
 {
-    reg_id_t r;
+    IF_DEBUG(reg_id_t r;)
 
     if (translate_pc != walk->translation) {
         /* When we walk we update only each instr we pass.  If we're
          * now sitting at the instr AFTER the mangle region, we do
          * NOT want to adjust xsp, since we're not translating to
-         * before that instr.  We should not have any outstanding spills.
+         * before that instr.  We should not have any outstanding spills,
+         * except those the trace optimizer carried past their region.
          */
         LOG(THREAD_GET, LOG_INTERP, 2,
             "\ttranslation "PFX" is post-walk "PFX" so not fixing xsp\n",
             translate_pc, walk->translation);
+        translate_walk_restore_spills(tdcontext, walk, true/*carried only*/);
         DOCHECK(1, {
             for (r = 0; r < REG_SPILL_NUM; r++)
-                ASSERT(!walk->reg_spilled[r]
+                ASSERT(!walk->reg_spilled[r] || walk->reg_carried[r]
                        /* The special stolen register mangling from
                         * mangle_syscall_arch() for a non-restartable syscall ends
                         * up here due to the nop having a xl8 post-syscall.
@@ -402,27 +574,7 @@ translate_walk_restore(dcontext_t *tdcontext, translate_walk_t *walk,
      * FIXME: for rip-rel loads, we may have clobbered the destination
      * already, and won't be able to restore it: but that's a minor issue.
      */
-    for (r = 0; r < REG_SPILL_NUM; r++) {
-        if (walk->reg_spilled[r]) {
-            reg_id_t reg = r + REG_START_SPILL;
-            reg_t value;
-            if (walk->reg_tls[r]) {
-                value = *(reg_t *)(((byte*)&tdcontext->local_state->spill_space) +
-                                   /* special handling r10, mangle instr inserted
-                                    * in mangle_syscall_arch
-                                    */
-                                   (IF_ARM(reg == DR_REG_R10 ?
-                                           reg_spill_tls_offs(DR_REG_R1) :)
-                                    reg_spill_tls_offs(reg)));
-            } else {
-                value = reg_get_value_priv(reg, get_mcontext(tdcontext));
-            }
-            LOG(THREAD_GET, LOG_INTERP, 2,
-                "\trestoring spilled %s to "PFX"\n", reg_names[reg], value);
-            STATS_INC(recreate_spill_restores);
-            reg_set_value_priv(reg, walk->mc, value);
-        }
-    }
+    translate_walk_restore_spills(tdcontext, walk, false/*all*/);
     /* PR 267260: Restore stack-adjust mangling of ctis.
      * FIXME: we do NOT undo writes to the stack, so we're not completely
      * transparent.  If we ever do restore memory, we'll want to pass in
@@ -469,7 +621,7 @@ recreate_app_state_from_info(dcontext_t *tdcontext, const translation_info_t *in
     byte *cpc, *prev_cpc;
     cache_pc target_cache = mc->pc;
     uint i;
-    bool contig = true, ours = false;
+    bool contig = true, ours = false, carried;
     recreate_success_t res = (just_pc ? RECREATE_SUCCESS_PC : RECREATE_SUCCESS_STATE);
     instr_t instr;
     translate_walk_t walk;
@@ -498,6 +650,7 @@ recreate_app_state_from_info(dcontext_t *tdcontext, const translation_info_t *in
     ASSERT(cpc - start_cache == info->translation[0].cache_offs);
     i = 0;
     while (cpc < end_cache) {
+        carried = false;
         /* we can go beyond the end of the table: then use the last point */
         if (i < info->num_entries &&
             cpc - start_cache >= info->translation[i].cache_offs) {
@@ -505,6 +658,7 @@ recreate_app_state_from_info(dcontext_t *tdcontext, const translation_info_t *in
             answer = info->translation[i].app;
             contig = !TEST(TRANSLATE_IDENTICAL, info->translation[i].flags);
             ours = TEST(TRANSLATE_OUR_MANGLING, info->translation[i].flags);
+            carried = TEST(TRANSLATE_SPILL_CARRIED, info->translation[i].flags);
             i++;
         }
 
@@ -528,7 +682,18 @@ recreate_app_state_from_info(dcontext_t *tdcontext, const translation_info_t *in
         prev_cpc = cpc;
         cpc = decode(tdcontext, cpc, &instr);
         instr_set_our_mangling(&instr, ours);
+        if (carried)
+            instr.flags |= INSTR_SPILL_CARRIED;
         translate_walk_track(tdcontext, &instr, &walk);
+#ifdef X86
+        if (walk.at_jump_entry) {
+            if (ours && !contig) {
+                translate_walk_jump_entry_info(tdcontext, &walk, info, i, start_cache,
+                                               end_cache, cpc, answer);
+            } else
+                walk.at_jump_entry = false;
+        }
+#endif
 
         /* advance translation by the stride: either instr length or 0 */
         if (contig)
@@ -799,6 +964,10 @@ recreate_app_state_from_ilist(dcontext_t *tdcontext, instrlist_t *ilist,
         }
 
         translate_walk_track(tdcontext, inst, &walk);
+#ifdef X86
+        if (walk.at_jump_entry)
+            translate_walk_jump_entry_ilist(tdcontext, &walk, inst);
+#endif
 
         cpc += len;
     }
@@ -845,7 +1014,8 @@ recreate_selfmod_ilist(dcontext_t *dcontext, fragment_t *f)
                               /* Be sure to limit the size (i#1441) */
                               selfmod_copy + FRAGMENT_SELFMOD_COPY_CODE_SIZE(f),
                               FRAG_SELFMOD_SANDBOXED, NULL, NULL,
-                              false/*don't check vm areas!*/, true/*mangle*/, NULL
+                              false/*don't check vm areas!*/, true/*mangle*/,
+                              false/*no -ret_shadow_stack*/, NULL
                               _IF_CLIENT(true/*call client*/)
                               _IF_CLIENT(false/*!for_trace*/));
     ASSERT(ilist != NULL); /* shouldn't fail: our own code is always readable! */
@@ -1358,14 +1528,16 @@ translation_info_print(const translation_info_t *info, cache_pc start, file_t fi
     ASSERT(file != INVALID_FILE);
     print_file(file, "translation info "PFX"\n", info);
     for (i=0; i<info->num_entries; i++) {
-        print_file(file, "\t%d +%5d == "PFX" => "PFX" %s%s\n",
+        print_file(file, "\t%d +%5d == "PFX" => "PFX" %s%s%s\n",
                    i, info->translation[i].cache_offs,
                    start + info->translation[i].cache_offs,
                    info->translation[i].app,
                    TEST(TRANSLATE_IDENTICAL, info->translation[i].flags) ?
                    "identical" : "contiguous",
                    TEST(TRANSLATE_OUR_MANGLING, info->translation[i].flags) ?
-                   " ours" : "");
+                   " ours" : "",
+                   TEST(TRANSLATE_SPILL_CARRIED, info->translation[i].flags) ?
+                   " carried" : "");
     }
 }
 
@@ -1536,6 +1708,19 @@ record_translation_info(dcontext_t *dcontext, fragment_t *f, instrlist_t *existi
             last_contig = !identical;
             i++;
         }
+        /* The walk must see which spills the trace optimizer carried past
+         * their region, so such a spill always starts an entry.
+         */
+        if (TEST(INSTR_SPILL_CARRIED, inst->flags)) {
+            if (i == prev_i) {
+                set_translation(dcontext, &entries, &num_entries, i,
+                                (ushort) (cpc - f->start_pc),
+                                app, true/*identical*/, instr_is_our_mangling(inst));
+                last_contig = false;
+                i++;
+            }
+            entries[i-1].flags |= TRANSLATE_SPILL_CARRIED;
+        }
         last_len = instr_length(dcontext, inst);
         cpc += last_len;
         ASSERT(CHECK_TRUNCATE_TYPE_ushort(cpc - f->start_pc));
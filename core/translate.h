@@ -53,6 +53,7 @@ enum {
      */
     TRANSLATE_IDENTICAL      = 0x0001, /* otherwise contiguous */
     TRANSLATE_OUR_MANGLING   = 0x0002, /* added by our own mangling (PR 267260) */
+    TRANSLATE_SPILL_CARRIED  = 0x0004, /* 1st instr is INSTR_SPILL_CARRIED */
 }; /* no typedef b/c we need ushort not int */
 
 /* Translation table entry (case 3559).
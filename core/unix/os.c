@@ -2943,6 +2943,30 @@ os_heap_get_commit_limit(size_t *commit_used, size_t *commit_limit)
     return false;
 }
 
+bool
+os_heap_advise_huge_pages(void *p, size_t size)
+{
+#ifdef LINUX
+    /* We use transparent huge pages rather than MAP_HUGETLB: the latter needs
+     * a preallocated hugetlbfs pool and cannot be reserved with PROT_NONE and
+     * committed piecemeal via mprotect.  The advice sticks to the vma across
+     * the later mprotect splits.
+     */
+# ifndef MADV_HUGEPAGE
+#  define MADV_HUGEPAGE 14
+# endif
+    long res;
+    ASSERT(ALIGNED(p, PAGE_SIZE) && ALIGNED(size, PAGE_SIZE));
+    res = dynamorio_syscall(SYS_madvise, 3, p, size, MADV_HUGEPAGE);
+    LOG(GLOBAL, LOG_HEAP, 2, "os_heap_advise_huge_pages: %d bytes @ "PFX" => %d\n",
+        size, p, res);
+    /* EINVAL if the kernel was built without transparent huge pages */
+    return res == 0;
+#else
+    return false;
+#endif
+}
+
 /* yield the current thread */
 void
 os_thread_yield()
@@ -368,6 +368,9 @@ enum {
 #if defined(CLIENT_SIDELINE) && defined(CLIENT_INTERFACE)
     LOCK_RANK(sideline_mutex),
 #endif
+#ifdef CLIENT_SIDELINE
+    LOCK_RANK(trace_opt_lock), /* < global_alloc_lock */
+#endif
 
     LOCK_RANK(shared_cache_flush_lock), /* < shared_cache_count_lock,
                                            < shared_delete_lock,
@@ -544,6 +547,7 @@ enum {
 
     LOCK_RANK(initstack_mutex),  /* FIXME: NOT TESTED */
 
+    LOCK_RANK(flush_gate_lock), /* < event_lock */
     LOCK_RANK(event_lock),  /* FIXME: NOT TESTED */
     LOCK_RANK(do_threshold_mutex),  /* FIXME: NOT TESTED */
     LOCK_RANK(threads_killed_lock),  /* FIXME: NOT TESTED */
@@ -864,6 +868,14 @@ extern bool dr_modload_hook_exists(void); /* hard to include instrument.h here *
 /* anyone guarding the bb_building_lock with this must use SHARED_BB_{UN,}LOCK */
 #define USE_BB_BUILDING_LOCK()                                               \
     (USE_BB_BUILDING_LOCK_STEADY_STATE() && bb_lock_start)
+/* -parallel_bb_build: dispatch() builds shared bbs without the bb_building_lock,
+ * only taking it to emit.  The shared vmareas lock still serializes
+ * first-execution module load events (i#884), which is why thread-private bbs
+ * do not qualify.
+ */
+#define PARALLEL_BB_BUILD()                                                  \
+    (DYNAMO_OPTION(parallel_bb_build) && DYNAMO_OPTION(shared_bbs) &&        \
+     !INTERNAL_OPTION(single_thread_in_DR) && USE_BB_BUILDING_LOCK())
 #define SHARED_BB_LOCK() do {                                                \
     if (USE_BB_BUILDING_LOCK())                                              \
         mutex_lock(&(bb_building_lock));                                     \
@@ -347,6 +347,8 @@ typedef struct _pending_delete_t {
     uint flushtime_deleted;
     /* we use a simple linked list of entries */
     struct _pending_delete_t *next;
+    /* -flush_epoch_reclaim frees from the tail */
+    struct _pending_delete_t *prev;
 } pending_delete_t;
 
 /* We keep these list pointers on the heap for selfprot (case 8074). */
@@ -358,7 +360,7 @@ typedef struct _deletion_lists_t {
      * it, so we keep a linked list of fragment lists.
      */
     pending_delete_t *shared_delete;
-    /* We maintain the tail solely for fcache_free_pending_units() */
+    /* We maintain the tail for fcache_free_pending_units() and -flush_epoch_reclaim */
     pending_delete_t *shared_delete_tail;
     /* count used for reset threshold */
     uint shared_delete_count;
@@ -8893,12 +8895,14 @@ add_to_pending_list(dcontext_t *dcontext, fragment_t *f,
     }
     /* add to front of list */
     pend->next = todelete->shared_delete;
+    pend->prev = NULL;
     todelete->shared_delete = pend;
     todelete->shared_delete_count++;
     if (pend->next == NULL) {
         ASSERT(todelete->shared_delete_tail == NULL);
         todelete->shared_delete_tail = pend;
-    }
+    } else
+        pend->next->prev = pend;
 
     if (DYNAMO_OPTION(reset_every_nth_pending) > 0 &&
         DYNAMO_OPTION(reset_every_nth_pending) == todelete->shared_delete_count) {
@@ -9458,6 +9462,8 @@ vm_area_unlink_incoming(dcontext_t *dcontext, app_pc pc)
 
 /* Decrements ref counts for thread-shared pending-deletion fragments,
  * and deletes those whose count has reached 0.
+ * With -flush_epoch_reclaim, instead deletes those older than every live
+ * thread's flushtime.
  * If dcontext==GLOBAL_DCONTEXT, does NOT check the ref counts and assumes it's
  * safe to free EVERYTHING.
  * Returns false iff was_I_flushed has been flushed (not necessarily
@@ -9476,6 +9482,7 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
     int num = 0;
     DEBUG_DECLARE(int i = 0;)
     bool not_flushed = true;
+    uint oldest_flushtime = 0;
     ASSERT(DYNAMO_OPTION(shared_deletion) || dynamo_exited);
     /* must pass in real dcontext, unless exiting or resetting */
     ASSERT(dcontext != GLOBAL_DCONTEXT || dynamo_exited || dynamo_resetting);
@@ -9512,8 +9519,46 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
         last_exit_deleted(dcontext);
     }
 
+    if (DYNAMO_OPTION(flush_epoch_reclaim) && dcontext != GLOBAL_DCONTEXT) {
+        /* We're at a synch point, so we're done with everything flushed so far.
+         * Moving up first lets us free whatever we were the last to hold back.
+         */
+        set_flushtime_last_update(dcontext, flushtime_global);
+        oldest_flushtime = flush_epoch_oldest();
+    }
+
     mutex_lock(&shared_delete_lock);
-    for (pend = todelete->shared_delete; pend != NULL; pend = pend_nxt) {
+    if (DYNAMO_OPTION(flush_epoch_reclaim) && dcontext != GLOBAL_DCONTEXT &&
+        !INTERNAL_OPTION(detect_dangling_fcache)) {
+        /* No ref counts: the list is in decreasing flushtime order, so the
+         * entries no thread can still reach form its tail, and we pop them off
+         * oldest first without looking at the rest.
+         */
+        pending_delete_t *tofree_tail = NULL;
+        while (todelete->shared_delete_tail != NULL &&
+               todelete->shared_delete_tail->flushtime_deleted <= oldest_flushtime) {
+            pend = todelete->shared_delete_tail;
+            LOG(THREAD, LOG_FRAGMENT|LOG_VMAREAS, 2,
+                "  Freeing #%d: "PFX".."PFX" flushtime %d (oldest thread %d)\n",
+                i, pend->start, pend->end, pend->flushtime_deleted, oldest_flushtime);
+            todelete->shared_delete_tail = pend->prev;
+            if (pend->prev == NULL)
+                todelete->shared_delete = NULL;
+            else
+                pend->prev->next = NULL;
+            pend->next = NULL;
+            if (tofree_tail == NULL)
+                tofree = pend;
+            else
+                tofree_tail->next = pend;
+            tofree_tail = pend;
+            STATS_INC(num_shared_flush_epochzero);
+            DODEBUG({ i++; });
+        }
+        pend = NULL; /* skip the walk */
+    } else
+        pend = todelete->shared_delete;
+    for (; pend != NULL; pend = pend_nxt) {
         bool delete_area = false;
         pend_nxt = pend->next;
         LOG(THREAD, LOG_FRAGMENT|LOG_VMAREAS, 2,
@@ -9526,14 +9571,25 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
                 STATS_INC(num_shared_flush_atexit);
             else
                 STATS_INC(num_shared_flush_atreset);
-        } else if (get_flushtime_last_update(dcontext) < pend->flushtime_deleted) {
-            ASSERT(pend->ref_count > 0);
-            pend->ref_count--;
-            STATS_INC(num_shared_flush_refdec);
-            LOG(THREAD, LOG_FRAGMENT|LOG_VMAREAS, 2,
-                "\tdec => ref_count is now %d, flushtime diff is %d\n",
-                pend->ref_count, flushtime_global - pend->flushtime_deleted);
-            delete_area = (pend->ref_count == 0);
+        } else if (DYNAMO_OPTION(flush_epoch_reclaim) ||
+                   get_flushtime_last_update(dcontext) < pend->flushtime_deleted) {
+            if (DYNAMO_OPTION(flush_epoch_reclaim)) {
+                /* No ref counts: the list is in decreasing flushtime order, so
+                 * the entries no thread can still reach form its tail.
+                 */
+                delete_area = (pend->flushtime_deleted <= oldest_flushtime);
+                LOG(THREAD, LOG_FRAGMENT|LOG_VMAREAS, 2,
+                    "\toldest thread flushtime is %d => %s\n", oldest_flushtime,
+                    delete_area ? "free" : "keep");
+            } else {
+                ASSERT(pend->ref_count > 0);
+                pend->ref_count--;
+                STATS_INC(num_shared_flush_refdec);
+                LOG(THREAD, LOG_FRAGMENT|LOG_VMAREAS, 2,
+                    "\tdec => ref_count is now %d, flushtime diff is %d\n",
+                    pend->ref_count, flushtime_global - pend->flushtime_deleted);
+                delete_area = (pend->ref_count == 0);
+            }
             DODEBUG({
                 if (INTERNAL_OPTION(detect_dangling_fcache) && delete_area) {
                     /* don't actually free fragments until exit so we can catch any
@@ -9560,7 +9616,9 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
                 }
             });
             DOSTATS({
-                if (delete_area)
+                if (delete_area && DYNAMO_OPTION(flush_epoch_reclaim))
+                    STATS_INC(num_shared_flush_epochzero);
+                else if (delete_area)
                     STATS_INC(num_shared_flush_refzero);
             });
         } else {
@@ -9584,7 +9642,8 @@ vm_area_check_shared_pending(dcontext_t *dcontext, fragment_t *was_I_flushed)
             if (pend == todelete->shared_delete_tail) {
                 ASSERT(pend->next == NULL);
                 todelete->shared_delete_tail = pend_prev;
-            }
+            } else
+                pend->next->prev = pend_prev;
             pend->next = tofree;
             tofree = pend;
         } else
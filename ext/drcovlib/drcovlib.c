@@ -53,12 +53,14 @@
 #include "dr_api.h"
 #include "drmgr.h"
 #include "drx.h"
+#include "drreg.h"
 #include "drcovlib.h"
 #include "hashtable.h"
 #include "drtable.h"
 #include "modules.h"
 #include "drcovlib_private.h"
 #include <limits.h>
+#include <stddef.h> /* offsetof */
 #include <string.h>
 
 #define UNKNOWN_MODULE_ID USHRT_MAX
@@ -91,6 +93,17 @@ static volatile bool go_native;
 static int tls_idx = -1;
 static int drcovlib_init_count;
 
+/* For DRCOVLIB_DEDUP_BITMAP */
+static bool use_bitmap;
+/* Serializes hit slot assignment: per-module updates use module_entry_t.lock */
+static void *bitmap_lock;
+/* For DRCOVLIB_HIT_COUNTS: the counters and, at the same index, their bbs */
+static drx_counter_array_t *hit_counts;
+static void *hit_table;
+#define DEFAULT_MAX_HIT_COUNTS 16384
+/* The user_data passed to the insertion event is the counter index + 1 */
+#define NO_HIT_SLOT 0
+
 /****************************************************************************
  * Utility Functions
  */
@@ -180,6 +193,185 @@ bb_table_entry_add(void *drcontext, per_thread_t *data, app_pc start, uint size)
     }
 }
 
+/****************************************************************************
+ * Coverage Bitmap Functions
+ */
+
+#define BITMAP_BYTES(size)   (((size) + 7) / 8)
+#define BITMAP_TEST(bm, offs) TEST(1 << ((offs) % 8), (bm)[(offs) / 8])
+#define BITMAP_SET(bm, offs)  ((bm)[(offs) / 8] |= (byte)(1 << ((offs) % 8)))
+
+static bool
+bitmap_range_is_set(byte *bm, uint start, uint size)
+{
+    uint i;
+    for (i = start; i < start + size; i++) {
+        if (!BITMAP_TEST(bm, i))
+            return false;
+    }
+    return true;
+}
+
+/* Records the bb in its module's bitmap unless record is false, and returns its
+ * hit counter index + 1, or NO_HIT_SLOT if its executions are not counted.
+ * Code outside of any known module is not recorded, as post-processing
+ * ignores it anyway.
+ */
+static ptr_uint_t
+bb_bitmap_add(per_thread_t *data, app_pc start, uint size, bool record)
+{
+    module_entry_t *mod_entry = module_table_lookup(data->cache,
+                                                    NUM_THREAD_MODULE_CACHE,
+                                                    module_table, start);
+    size_t mod_size;
+    uint offs;
+    ptr_uint_t slot = NO_HIT_SLOT;
+    if (mod_entry == NULL || mod_entry->data == NULL)
+        return NO_HIT_SLOT;
+    mod_size = mod_entry->data->end - mod_entry->data->start;
+    offs = (uint)(start - mod_entry->data->start);
+    if (offs + size > mod_size)
+        size = (uint)(mod_size - offs);
+    /* Bits are never cleared, slots are never removed, and neither the bitmap
+     * nor the slot table is freed while the module table exists, so the common
+     * case of a repeated bb needs no lock beyond the slot table's own.
+     */
+    if (!record || (mod_entry->bitmap != NULL &&
+                    bitmap_range_is_set(mod_entry->bitmap, offs, size))) {
+        if (hit_counts == NULL || mod_entry->hit_slots == NULL)
+            return NO_HIT_SLOT;
+        slot = (ptr_uint_t)
+            hashtable_lookup(mod_entry->hit_slots, (void *)(ptr_uint_t)offs);
+        if (slot != NO_HIT_SLOT || !record)
+            return slot;
+    }
+    dr_mutex_lock(mod_entry->lock);
+    if (record) {
+        uint i;
+        if (mod_entry->bitmap == NULL) {
+            byte *bm = dr_global_alloc(BITMAP_BYTES(mod_size));
+            memset(bm, 0, BITMAP_BYTES(mod_size));
+            mod_entry->bitmap_size = BITMAP_BYTES(mod_size);
+            mod_entry->bitmap = bm;
+        }
+        for (i = offs; i < offs + size; i++)
+            BITMAP_SET(mod_entry->bitmap, i);
+    }
+    if (hit_counts != NULL) {
+        if (mod_entry->hit_slots == NULL && record) {
+            mod_entry->hit_slots = dr_global_alloc(sizeof(*mod_entry->hit_slots));
+            hashtable_init(mod_entry->hit_slots, 8, HASH_INTPTR, false/*!strdup*/);
+        }
+        if (mod_entry->hit_slots != NULL) {
+            slot = (ptr_uint_t)
+                hashtable_lookup(mod_entry->hit_slots, (void *)(ptr_uint_t)offs);
+            if (slot == NO_HIT_SLOT && record &&
+                /* racy pre-check so a full table costs no global lock */
+                drtable_num_entries(hit_table) < options.max_hit_counts) {
+                /* Only the first build of each bb takes the global lock. */
+                dr_mutex_lock(bitmap_lock);
+                if (drtable_num_entries(hit_table) < options.max_hit_counts) {
+                    ptr_uint_t idx;
+                    bb_entry_t *bb_entry = drtable_alloc(hit_table, 1, &idx);
+                    ASSERT(size < USHRT_MAX, "size overflow");
+                    bb_entry->start = offs;
+                    bb_entry->size = (ushort)size;
+                    bb_entry->mod_id = (ushort)mod_entry->id;
+                    slot = idx + 1;
+                }
+                dr_mutex_unlock(bitmap_lock);
+                if (slot != NO_HIT_SLOT) {
+                    hashtable_add(mod_entry->hit_slots, (void *)(ptr_uint_t)offs,
+                                  (void *)slot);
+                }
+            }
+        }
+    }
+    dr_mutex_unlock(mod_entry->lock);
+    return slot;
+}
+
+static void
+bb_bitmap_print_ranges(file_t log, module_entry_t *entry)
+{
+    uint offs, start = 0;
+    bool in_range = false;
+    uint size = (uint)(entry->data->end - entry->data->start);
+    for (offs = 0; offs <= size; offs++) {
+        bool set = offs < size && BITMAP_TEST(entry->bitmap, offs);
+        if (set && !in_range) {
+            start = offs;
+            in_range = true;
+        } else if (!set && in_range) {
+            dr_fprintf(log, "module[%3u]: "PFX", %3u\n", entry->id, start, offs - start);
+            in_range = false;
+        }
+    }
+}
+
+#define HIT_ENTRY_BUFFER_SIZE 256
+
+static void
+bb_bitmap_print(per_thread_t *data)
+{
+    uint i, num_mods = 0;
+    module_entry_t *entry;
+    bool as_text = TEST(DRCOVLIB_DUMP_AS_TEXT, options.flags);
+    if (data->log == INVALID_FILE) {
+        ASSERT(false, "invalid log file");
+        return;
+    }
+    drvector_lock(&module_table->vector);
+    for (i = 0; i < module_table->vector.entries; i++) {
+        entry = drvector_get_entry(&module_table->vector, i);
+        if (entry->bitmap != NULL)
+            num_mods++;
+    }
+    dr_fprintf(data->log, "BB Bitmap: %u modules\n", num_mods);
+    if (as_text)
+        dr_fprintf(data->log, "module id, start, size:\n");
+    for (i = 0; i < module_table->vector.entries; i++) {
+        entry = drvector_get_entry(&module_table->vector, i);
+        if (entry->bitmap == NULL)
+            continue;
+        if (as_text)
+            bb_bitmap_print_ranges(data->log, entry);
+        else {
+            bb_bitmap_header_t header;
+            header.mod_id = entry->id;
+            header.size = (uint)entry->bitmap_size;
+            dr_write_file(data->log, &header, sizeof(header));
+            dr_write_file(data->log, entry->bitmap, entry->bitmap_size);
+        }
+    }
+    drvector_unlock(&module_table->vector);
+
+    if (hit_counts != NULL) {
+        bb_hit_entry_t buf[HIT_ENTRY_BUFFER_SIZE];
+        uint num_bbs, num_buf = 0;
+        dr_mutex_lock(bitmap_lock);
+        num_bbs = (uint)drtable_num_entries(hit_table);
+        dr_fprintf(data->log, "BB Hit Counts: %u bbs\n", num_bbs);
+        if (as_text)
+            dr_fprintf(data->log, "module id, start, size, count:\n");
+        for (i = 0; i < num_bbs; i++) {
+            bb_hit_entry_t *hit = &buf[num_buf];
+            hit->bb = *(bb_entry_t *)drtable_get_entry(hit_table, i);
+            hit->count = drx_counter_array_get_value(hit_counts, i);
+            if (as_text) {
+                dr_fprintf(data->log, "module[%3u]: "PFX", %3u, %llu\n",
+                           hit->bb.mod_id, hit->bb.start, hit->bb.size, hit->count);
+            } else if (++num_buf == HIT_ENTRY_BUFFER_SIZE) {
+                dr_write_file(data->log, buf, num_buf * sizeof(buf[0]));
+                num_buf = 0;
+            }
+        }
+        if (num_buf > 0)
+            dr_write_file(data->log, buf, num_buf * sizeof(buf[0]));
+        dr_mutex_unlock(bitmap_lock);
+    }
+}
+
 #define INIT_BB_TABLE_ENTRIES 4096
 static void *
 bb_table_create(bool synch)
@@ -214,7 +406,10 @@ dump_drcov_data(void *drcontext, per_thread_t *data)
 {
     version_print(data->log);
     module_table_print(module_table, data->log, false);
-    bb_table_print(drcontext, data);
+    if (use_bitmap)
+        bb_bitmap_print(data);
+    else
+        bb_table_print(drcontext, data);
 }
 
 /****************************************************************************
@@ -329,11 +524,16 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb,
     instr_t *instr;
     app_pc start_pc, end_pc;
 
-    /* do nothing for translation */
-    if (translating)
+    data = (per_thread_t *)drmgr_get_tls_field(drcontext, tls_idx);
+    /* do nothing for translation, except recovering the same counter index */
+    if (translating) {
+        if (hit_counts != NULL) {
+            *user_data = (void *)
+                bb_bitmap_add(data, dr_fragment_app_pc(tag), 0, false/*!record*/);
+        }
         return DR_EMIT_DEFAULT;
+    }
 
-    data = (per_thread_t *)drmgr_get_tls_field(drcontext, tls_idx);
     /* Collect the number of instructions and the basic block size,
      * assuming the basic block does not have any elision on control
      * transfer instructions, which is true for default options passed
@@ -359,8 +559,13 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb,
      *    repeated bb building, etc.
      * 4. The duplication can be easily handled in a post-processing step,
      *    which is required anyway.
+     * DRCOVLIB_DEDUP_BITMAP is provided for when the log size matters more.
      */
-    bb_table_entry_add(drcontext, data, start_pc, (uint)(end_pc - start_pc));
+    if (use_bitmap) {
+        *user_data = (void *)
+            bb_bitmap_add(data, start_pc, (uint)(end_pc - start_pc), true/*record*/);
+    } else
+        bb_table_entry_add(drcontext, data, start_pc, (uint)(end_pc - start_pc));
 
     if (go_native)
         return DR_EMIT_GO_NATIVE;
@@ -368,6 +573,19 @@ event_basic_block_analysis(void *drcontext, void *tag, instrlist_t *bb,
         return DR_EMIT_DEFAULT;
 }
 
+static dr_emit_flags_t
+event_bb_insert_hit_count(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                          bool for_trace, bool translating, void *user_data)
+{
+    ptr_uint_t slot = (ptr_uint_t)user_data;
+    if (slot == NO_HIT_SLOT || !drmgr_is_first_instr(drcontext, inst))
+        return DR_EMIT_DEFAULT;
+    if (!drx_counter_array_insert_update(drcontext, hit_counts, bb, inst,
+                                         (uint)(slot - 1), 1))
+        ASSERT(false, "failed to insert hit count update");
+    return DR_EMIT_DEFAULT;
+}
+
 static void
 event_module_unload(void *drcontext, const module_data_t *info)
 {
@@ -509,6 +727,14 @@ drcovlib_exit(void)
         dump_drcov_data(NULL, global_data);
         global_data_destroy(global_data);
     }
+    if (hit_counts != NULL) {
+        drx_counter_array_free(hit_counts);
+        hit_counts = NULL;
+        drtable_destroy(hit_table, NULL);
+        drreg_exit();
+    }
+    if (bitmap_lock != NULL)
+        dr_mutex_destroy(bitmap_lock);
     /* destroy module table */
     module_table_destroy(module_table);
 
@@ -531,6 +757,19 @@ event_init(void)
         max_elide_jmp != 0 || max_elide_call != 0)
         return DRCOVLIB_ERROR_INVALID_SETUP;
 
+    if (use_bitmap)
+        bitmap_lock = dr_mutex_create();
+    if (TEST(DRCOVLIB_HIT_COUNTS, options.flags)) {
+        drreg_options_t ops = {sizeof(ops), 1 /*max slots needed*/, false};
+        if (drreg_init(&ops) != DRREG_SUCCESS)
+            return DRCOVLIB_ERROR;
+        hit_counts = drx_counter_array_create(DRX_COUNTER_ARRAY_PER_THREAD,
+                                              options.max_hit_counts, 0);
+        if (hit_counts == NULL)
+            return DRCOVLIB_ERROR;
+        hit_table = drtable_create(INIT_BB_TABLE_ENTRIES, sizeof(bb_entry_t),
+                                   0 /* flags */, false /* using bitmap_lock */, NULL);
+    }
     /* create module table */
     module_table = module_table_create();
     /* create process data if whole process bb coverage. */
@@ -546,16 +785,28 @@ drcovlib_init(drcovlib_options_t *ops)
     if (count > 1)
         return DRCOVLIB_SUCCESS;
 
-    if (ops->struct_size != sizeof(options))
+    /* We accept the size prior to the addition of max_hit_counts */
+    if (ops->struct_size != sizeof(options) &&
+        ops->struct_size != offsetof(drcovlib_options_t, max_hit_counts))
         return DRCOVLIB_ERROR_INVALID_PARAMETER;
-    if ((ops->flags & (~(DRCOVLIB_DUMP_AS_TEXT|DRCOVLIB_THREAD_PRIVATE))) != 0)
+    if ((ops->flags & (~(DRCOVLIB_DUMP_AS_TEXT|DRCOVLIB_THREAD_PRIVATE|
+                         DRCOVLIB_DEDUP_BITMAP|DRCOVLIB_HIT_COUNTS))) != 0)
         return DRCOVLIB_ERROR_INVALID_PARAMETER;
+    if (TESTANY(DRCOVLIB_DEDUP_BITMAP|DRCOVLIB_HIT_COUNTS, ops->flags)) {
+        if (TEST(DRCOVLIB_THREAD_PRIVATE, ops->flags))
+            return DRCOVLIB_ERROR_INVALID_PARAMETER;
+        use_bitmap = true;
+    }
     if (TEST(DRCOVLIB_THREAD_PRIVATE, ops->flags)) {
         if (!dr_using_all_private_caches())
             return DRCOVLIB_ERROR_INVALID_SETUP;
         drcov_per_thread = true;
     }
-    options = *ops;
+    memset(&options, 0, sizeof(options));
+    memcpy(&options, ops, ops->struct_size);
+    options.struct_size = sizeof(options);
+    if (options.max_hit_counts == 0)
+        options.max_hit_counts = DEFAULT_MAX_HIT_COUNTS;
     if (options.logdir != NULL)
         dr_snprintf(logdir, BUFFER_SIZE_ELEMENTS(logdir), "%s", ops->logdir);
     else /* default */
@@ -578,7 +829,9 @@ drcovlib_init(drcovlib_options_t *ops)
 
     drmgr_register_thread_init_event(event_thread_init);
     drmgr_register_thread_exit_event(event_thread_exit);
-    drmgr_register_bb_instrumentation_event(event_basic_block_analysis, NULL, NULL);
+    drmgr_register_bb_instrumentation_event(event_basic_block_analysis,
+                                            TEST(DRCOVLIB_HIT_COUNTS, options.flags) ?
+                                            event_bb_insert_hit_count : NULL, NULL);
     drmgr_register_module_load_event(event_module_load);
     drmgr_register_module_unload_event(event_module_unload);
     dr_register_filter_syscall_event(event_filter_syscall);
@@ -76,6 +76,24 @@ typedef enum {
      * drcovlib's own thread exit events rather than in drcovlib_exit().
      */
     DRCOVLIB_THREAD_PRIVATE  = 0x0002,
+    /**
+     * By default, every basic block built by DynamoRIO is appended to the log,
+     * including repeated builds of the same code after cache flushes or module
+     * reloads.  When this flag is enabled, drcovlib instead keeps one bitmap per
+     * module recording which of its bytes have been covered, and writes each
+     * bitmap as a compact binary section, keeping the log size bounded by the
+     * size of the code executed.  This flag cannot be combined with
+     * #DRCOVLIB_THREAD_PRIVATE.
+     */
+    DRCOVLIB_DEDUP_BITMAP    = 0x0004,
+    /**
+     * Implies #DRCOVLIB_DEDUP_BITMAP.  Additionally counts how many times each
+     * distinct basic block executes, using inline increments of per-thread
+     * counter arrays (see drx_counter_array_create()), and writes the totals
+     * in a separate section.  This uses the drreg extension, which drcovlib
+     * initializes for one spill slot.
+     */
+    DRCOVLIB_HIT_COUNTS      = 0x0008,
 } drcovlib_flags_t;
 
 /** Specifies the options when initializing drcovlib. */
@@ -95,6 +113,13 @@ typedef struct _drcovlib_options_t {
      * option, is created.  This option only works under Windows.
      */
     int native_until_thread;
+    /**
+     * With #DRCOVLIB_HIT_COUNTS, the maximum number of distinct basic blocks
+     * whose executions are counted.  Blocks beyond this limit are recorded in
+     * the coverage bitmap but not counted.  Each thread holds this many 64-bit
+     * counters.  If 0, a default of 16384 is used.
+     */
+    uint max_hit_counts;
 } drcovlib_options_t;
 
 /***************************************************************************
@@ -135,6 +160,24 @@ typedef struct _bb_entry_t {
     ushort mod_id;
 } bb_entry_t;
 
+/* With DRCOVLIB_DEDUP_BITMAP, the bb table is replaced by a "BB Bitmap: %u modules"
+ * line followed by, for each module with coverage, this header and then
+ * header.size bytes of bitmap.  Bit (offs % 8) of byte (offs / 8) is set if
+ * the byte at offset offs from the module base was part of an executed bb.
+ */
+typedef struct _bb_bitmap_header_t {
+    uint mod_id;
+    uint size;
+} bb_bitmap_header_t;
+
+/* With DRCOVLIB_HIT_COUNTS, the bitmaps are followed by a
+ * "BB Hit Counts: %u bbs" line and an array of these entries.
+ */
+typedef struct _bb_hit_entry_t {
+    bb_entry_t bb;
+    uint64 count;
+} bb_hit_entry_t;
+
 /***************************************************************************
  * Exported functions
  */
@@ -69,7 +69,15 @@ thread_module_cache_add(module_entry_t **cache, uint cache_size,
 static void
 module_table_entry_free(void *entry)
 {
-    dr_free_module_data(((module_entry_t *)entry)->data);
+    module_entry_t *mod_entry = (module_entry_t *)entry;
+    if (mod_entry->bitmap != NULL)
+        dr_global_free(mod_entry->bitmap, mod_entry->bitmap_size);
+    if (mod_entry->hit_slots != NULL) {
+        hashtable_delete(mod_entry->hit_slots);
+        dr_global_free(mod_entry->hit_slots, sizeof(*mod_entry->hit_slots));
+    }
+    dr_mutex_destroy(mod_entry->lock);
+    dr_free_module_data(mod_entry->data);
     dr_global_free(entry, sizeof(module_entry_t));
 }
 
@@ -118,6 +126,10 @@ module_table_load(module_table_t *table, const module_data_t *data)
         entry->id = table->vector.entries;
         entry->unload = false;
         entry->data = dr_copy_module_data(data);
+        entry->lock = dr_mutex_create();
+        entry->bitmap = NULL;
+        entry->bitmap_size = 0;
+        entry->hit_slots = NULL;
         drvector_append(&table->vector, entry);
     }
     drvector_unlock(&table->vector);
@@ -37,6 +37,7 @@
 
 #include "dr_api.h"
 #include "drvector.h"
+#include "hashtable.h"
 
 #define NUM_GLOBAL_MODULE_CACHE 8
 
@@ -44,6 +45,13 @@ typedef struct _module_entry_t {
     int  id;
     bool unload; /* if the module is unloaded */
     module_data_t *data;
+    /* For DRCOVLIB_DEDUP_BITMAP: serializes updates of bitmap and hit_slots */
+    void *lock;
+    /* For DRCOVLIB_DEDUP_BITMAP: covered bytes, allocated on first use */
+    byte *bitmap;
+    size_t bitmap_size;
+    /* For DRCOVLIB_HIT_COUNTS: maps a bb's module offset to its counter + 1 */
+    hashtable_t *hit_slots;
 } module_entry_t;
 
 typedef struct _module_table_t {
@@ -128,6 +128,7 @@ typedef struct _generic_event_entry_t {
         bool (*exception_cb)(void *, dr_exception_t *);
 #endif
         void (*fault_cb)(void *, void *, dr_mcontext_t *, bool, bool);
+        dr_emit_flags_t (*trace_cb)(void *, void *, instrlist_t *, bool);
         bool (*fault_ex_cb)(void *, bool, dr_restore_state_info_t *);
     } cb;
 } generic_event_entry_t;
@@ -256,6 +257,10 @@ static cb_list_t cblist_fault;
 static void *fault_event_lock;
 static bool registered_fault; /* for lazy registration */
 
+static cb_list_t cblist_trace;
+static void *trace_event_lock;
+static bool registered_trace; /* for lazy registration */
+
 #ifdef WINDOWS
 static byte *addr_KiCallback;
 static int sysnum_NtCallbackReturn;
@@ -307,6 +312,9 @@ static bool
 drmgr_restore_state_event(void *drcontext, bool restore_memory,
                           dr_restore_state_info_t *info);
 
+static dr_emit_flags_t
+drmgr_trace_event(void *drcontext, void *tag, instrlist_t *trace, bool translating);
+
 static bool
 drmgr_cls_presys_event(void *drcontext, int sysnum);
 
@@ -353,6 +361,7 @@ drmgr_init(void)
     exception_event_lock = dr_rwlock_create();
 #endif
     fault_event_lock = dr_rwlock_create();
+    trace_event_lock = dr_rwlock_create();
 
     dr_register_thread_init_event(drmgr_thread_init_event);
     dr_register_thread_exit_event(drmgr_thread_exit_event);
@@ -411,11 +420,14 @@ drmgr_exit(void)
         dr_unregister_bb_event(drmgr_bb_event);
     if (registered_fault)
         dr_unregister_restore_state_ex_event(drmgr_restore_state_event);
+    if (registered_trace)
+        dr_unregister_trace_event(drmgr_trace_event);
 #ifdef WINDOWS
     drmgr_cls_exit();
 #endif
 
     dr_rwlock_destroy(fault_event_lock);
+    dr_rwlock_destroy(trace_event_lock);
 #ifdef UNIX
     dr_rwlock_destroy(signal_event_lock);
 #endif
@@ -533,6 +545,315 @@ cblist_delete_local(void *drcontext, cb_list_t *l, size_t local_num)
     } /* else nothing to do */
 }
 
+/***************************************************************************
+ * INSTRUMENTATION CACHE
+ */
+
+/* The application content of a block: for each instr its pc, length, and raw
+ * bytes, preceded by the isa mode.  The hash only selects candidates; a replay
+ * requires the full key to match.
+ */
+typedef struct _icache_key_t {
+    uint hash;
+    byte *bytes; /* dr_global_alloc-ed */
+    size_t size;
+    /* Bounds of the app bytes, for invalidation */
+    app_pc start;
+    app_pc end;
+} icache_key_t;
+
+/* Final instrumented ilists that survive flushes, keyed by tag plus the
+ * block's application bytes.  Each ilist is allocated with GLOBAL_DCONTEXT
+ * and its instrs are made persistent so it does not reference app memory.
+ */
+typedef struct _icache_entry_t {
+    app_pc tag;
+    icache_key_t key;
+    instrlist_t *ilist;
+    dr_emit_flags_t flags;
+    struct _icache_entry_t *next_in_bucket;
+    /* Insertion order, for evicting the oldest entry */
+    struct _icache_entry_t *prev;
+    struct _icache_entry_t *next;
+} icache_entry_t;
+
+#define ICACHE_HASH_BITS 12
+#define ICACHE_NUM_BUCKETS (1 << ICACHE_HASH_BITS)
+#define ICACHE_BUCKET(tag) \
+    ((((ptr_uint_t)(tag)) ^ (((ptr_uint_t)(tag)) >> ICACHE_HASH_BITS)) & \
+     (ICACHE_NUM_BUCKETS - 1))
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+static void *icache_lock;
+/* The rest are protected by icache_lock, except that icache_max_entries is read
+ * racily in the bb event as a fast check and then re-checked under the lock.
+ */
+static icache_entry_t **icache_table;
+static icache_entry_t *icache_oldest;
+static icache_entry_t *icache_newest;
+static uint icache_num_entries;
+static uint icache_max_entries;
+static uint64 icache_hits;
+static uint64 icache_misses;
+
+static uint
+icache_hash_bytes(uint hash, const byte *bytes, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* Must be called before any pass has modified bb.  Returns false if bb contains
+ * anything we cannot record, in which case it is not cached.  On success the
+ * caller must free key->bytes with icache_key_free() unless icache_store()
+ * takes it over.
+ */
+static bool
+icache_compute_key(void *drcontext, void *tag, instrlist_t *bb, OUT icache_key_t *key)
+{
+    instr_t *inst;
+    dr_isa_mode_t mode = dr_get_isa_mode(drcontext);
+    size_t size = sizeof(mode);
+    byte *pos;
+    app_pc lo = (app_pc) tag, hi = (app_pc) tag;
+    for (inst = instrlist_first(bb); inst != NULL; inst = instr_get_next(inst)) {
+        app_pc pc = instr_get_app_pc(inst);
+        int len;
+        if (!instr_is_app(inst) || pc == NULL || !instr_raw_bits_valid(inst))
+            return false;
+        len = instr_length(drcontext, inst);
+        size += sizeof(pc) + sizeof(len) + len;
+        if (pc < lo)
+            lo = pc;
+        if (pc + len > hi)
+            hi = pc + len;
+    }
+    key->bytes = dr_global_alloc(size);
+    key->size = size;
+    pos = key->bytes;
+    memcpy(pos, &mode, sizeof(mode));
+    pos += sizeof(mode);
+    for (inst = instrlist_first(bb); inst != NULL; inst = instr_get_next(inst)) {
+        app_pc pc = instr_get_app_pc(inst);
+        int len = instr_length(drcontext, inst);
+        memcpy(pos, &pc, sizeof(pc));
+        pos += sizeof(pc);
+        memcpy(pos, &len, sizeof(len));
+        pos += sizeof(len);
+        memcpy(pos, instr_get_raw_bits(inst), len);
+        pos += len;
+    }
+    ASSERT(pos == key->bytes + size, "icache key size mismatch");
+    key->hash = icache_hash_bytes(icache_hash_bytes(FNV_OFFSET_BASIS, (byte *)&tag,
+                                                    sizeof(tag)),
+                                  key->bytes, size);
+    key->start = lo;
+    key->end = hi;
+    return true;
+}
+
+static void
+icache_key_free(icache_key_t *key)
+{
+    dr_global_free(key->bytes, key->size);
+    key->bytes = NULL;
+}
+
+static bool
+icache_key_equal(const icache_key_t *a, const icache_key_t *b)
+{
+    return a->hash == b->hash && a->size == b->size &&
+        memcmp(a->bytes, b->bytes, a->size) == 0;
+}
+
+/* Caller must hold icache_lock */
+static void
+icache_remove(icache_entry_t *e)
+{
+    icache_entry_t **link = &icache_table[ICACHE_BUCKET(e->tag)];
+    while (*link != e) {
+        ASSERT(*link != NULL, "icache entry not in its bucket");
+        link = &(*link)->next_in_bucket;
+    }
+    *link = e->next_in_bucket;
+    if (e->prev == NULL)
+        icache_oldest = e->next;
+    else
+        e->prev->next = e->next;
+    if (e->next == NULL)
+        icache_newest = e->prev;
+    else
+        e->next->prev = e->prev;
+    icache_num_entries--;
+    icache_key_free(&e->key);
+    instrlist_clear_and_destroy(GLOBAL_DCONTEXT, e->ilist);
+    dr_global_free(e, sizeof(*e));
+}
+
+/* Caller must hold icache_lock */
+static void
+icache_evict_to(uint max_entries)
+{
+    while (icache_num_entries > max_entries)
+        icache_remove(icache_oldest);
+}
+
+/* Replaces the contents of bb with the cached instrumentation for (tag, key),
+ * if present.
+ */
+static bool
+icache_replay(void *drcontext, void *tag, instrlist_t *bb, const icache_key_t *key,
+              OUT dr_emit_flags_t *flags)
+{
+    icache_entry_t *e = NULL;
+    dr_mutex_lock(icache_lock);
+    if (icache_table != NULL) {
+        for (e = icache_table[ICACHE_BUCKET(tag)]; e != NULL; e = e->next_in_bucket) {
+            if (e->tag == (app_pc) tag && icache_key_equal(&e->key, key))
+                break;
+        }
+    }
+    if (e != NULL) {
+        instrlist_t *copy = instrlist_clone(drcontext, e->ilist);
+        instr_t *inst;
+        instrlist_clear(drcontext, bb);
+        while ((inst = instrlist_first(copy)) != NULL) {
+            instrlist_remove(copy, inst);
+            instrlist_append(bb, inst);
+        }
+        instrlist_destroy(drcontext, copy);
+        *flags = e->flags;
+        icache_hits++;
+    } else
+        icache_misses++;
+    dr_mutex_unlock(icache_lock);
+    return e != NULL;
+}
+
+/* Takes over key->bytes */
+static void
+icache_store(void *tag, instrlist_t *bb, icache_key_t *key, dr_emit_flags_t flags)
+{
+    icache_entry_t *e, **link;
+    instr_t *inst;
+    instrlist_t *ilist = instrlist_clone(GLOBAL_DCONTEXT, bb);
+    for (inst = instrlist_first(ilist); inst != NULL; inst = instr_get_next(inst))
+        instr_make_persistent(GLOBAL_DCONTEXT, inst);
+
+    dr_mutex_lock(icache_lock);
+    if (icache_table == NULL || icache_max_entries == 0) {
+        /* disabled while we were building */
+        dr_mutex_unlock(icache_lock);
+        instrlist_clear_and_destroy(GLOBAL_DCONTEXT, ilist);
+        icache_key_free(key);
+        return;
+    }
+    /* A stale entry for this tag (different content) is replaced */
+    for (link = &icache_table[ICACHE_BUCKET(tag)]; *link != NULL;
+         link = &(*link)->next_in_bucket) {
+        if ((*link)->tag == (app_pc) tag) {
+            icache_remove(*link);
+            break;
+        }
+    }
+    icache_evict_to(icache_max_entries - 1);
+
+    e = dr_global_alloc(sizeof(*e));
+    e->tag = (app_pc) tag;
+    e->key = *key;
+    e->ilist = ilist;
+    e->flags = flags;
+    e->next_in_bucket = icache_table[ICACHE_BUCKET(tag)];
+    icache_table[ICACHE_BUCKET(tag)] = e;
+    e->prev = icache_newest;
+    e->next = NULL;
+    if (icache_newest == NULL)
+        icache_oldest = e;
+    else
+        icache_newest->next = e;
+    icache_newest = e;
+    icache_num_entries++;
+    dr_mutex_unlock(icache_lock);
+}
+
+DR_EXPORT
+bool
+drmgr_enable_instrumentation_cache(uint max_entries)
+{
+    if (max_entries > 0 && dr_using_all_private_caches())
+        return false;
+    dr_mutex_lock(icache_lock);
+    if (icache_table == NULL && max_entries > 0) {
+        icache_table = dr_global_alloc(ICACHE_NUM_BUCKETS * sizeof(*icache_table));
+        memset(icache_table, 0, ICACHE_NUM_BUCKETS * sizeof(*icache_table));
+    }
+    if (icache_table != NULL)
+        icache_evict_to(max_entries);
+    icache_max_entries = max_entries;
+    dr_mutex_unlock(icache_lock);
+    return true;
+}
+
+DR_EXPORT
+void
+drmgr_invalidate_instrumentation_cache(app_pc start, size_t size)
+{
+    icache_entry_t *e, *next;
+    /* Racy fast check: extensions call this on every instrumentation change */
+    if (icache_table == NULL)
+        return;
+    dr_mutex_lock(icache_lock);
+    if (icache_table != NULL) {
+        for (e = icache_oldest; e != NULL; e = next) {
+            next = e->next;
+            if (e->key.start < start + size && e->key.end > start)
+                icache_remove(e);
+        }
+    }
+    dr_mutex_unlock(icache_lock);
+}
+
+DR_EXPORT
+bool
+drmgr_get_instrumentation_cache_stats(OUT uint64 *hits, OUT uint64 *misses)
+{
+    bool res;
+    dr_mutex_lock(icache_lock);
+    res = (icache_table != NULL);
+    if (hits != NULL)
+        *hits = icache_hits;
+    if (misses != NULL)
+        *misses = icache_misses;
+    dr_mutex_unlock(icache_lock);
+    return res;
+}
+
+static void
+icache_init(void)
+{
+    icache_lock = dr_mutex_create();
+}
+
+static void
+icache_exit(void)
+{
+    if (icache_table != NULL) {
+        icache_evict_to(0);
+        dr_global_free(icache_table, ICACHE_NUM_BUCKETS * sizeof(*icache_table));
+        icache_table = NULL;
+    }
+    icache_max_entries = 0;
+    icache_hits = 0;
+    icache_misses = 0;
+    dr_mutex_destroy(icache_lock);
+}
+
 /***************************************************************************
  * BB EVENTS
  */
@@ -583,6 +904,19 @@ drmgr_bb_event(void *drcontext, void *tag, instrlist_t *bb,
     cb_list_t iter_insert;
     cb_list_t iter_instru;
     per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, our_tls_idx);
+    bool icache_keyed = false;
+    icache_key_t icache_key;
+
+    /* The key must be computed from the unmodified app instrs.  On a hit we
+     * skip all passes.
+     */
+    if (icache_max_entries > 0 && !for_trace) {
+        icache_keyed = icache_compute_key(drcontext, tag, bb, &icache_key);
+        if (icache_keyed && icache_replay(drcontext, tag, bb, &icache_key, &res)) {
+            icache_key_free(&icache_key);
+            return res;
+        }
+    }
 
     dr_rwlock_read_lock(bb_cb_lock);
     /* We use arrays to more easily support unregistering while in an event (i#1356).
@@ -715,6 +1049,13 @@ drmgr_bb_event(void *drcontext, void *tag, instrlist_t *bb,
     cblist_delete_local(drcontext, &iter_insert, BUFFER_SIZE_ELEMENTS(local_insert));
     cblist_delete_local(drcontext, &iter_instru, BUFFER_SIZE_ELEMENTS(local_instru));
 
+    if (icache_keyed) {
+        if (!translating && !TEST(DR_EMIT_GO_NATIVE, res))
+            icache_store(tag, bb, &icache_key, res);
+        else
+            icache_key_free(&icache_key);
+    }
+
     return res;
 }
 
@@ -1003,6 +1344,7 @@ drmgr_bb_init(void)
     cblist_init(&cblist_app2app, sizeof(cb_entry_t));
     cblist_init(&cblist_instrumentation, sizeof(cb_entry_t));
     cblist_init(&cblist_instru2instru, sizeof(cb_entry_t));
+    icache_init();
 }
 
 static void
@@ -1015,6 +1357,7 @@ drmgr_bb_exit(void)
     cblist_delete(&cblist_app2app);
     cblist_delete(&cblist_instrumentation);
     cblist_delete(&cblist_instru2instru);
+    icache_exit();
 }
 
 DR_EXPORT
@@ -1215,6 +1558,7 @@ drmgr_event_init(void)
     cblist_init(&cblist_exception, sizeof(generic_event_entry_t));
 #endif
     cblist_init(&cblist_fault, sizeof(generic_event_entry_t));
+    cblist_init(&cblist_trace, sizeof(generic_event_entry_t));
 }
 
 static void
@@ -1239,6 +1583,7 @@ drmgr_event_exit(void)
     cblist_delete(&cblist_exception);
 #endif
     cblist_delete(&cblist_fault);
+    cblist_delete(&cblist_trace);
 }
 
 DR_EXPORT
@@ -1692,6 +2037,61 @@ drmgr_restore_state_event(void *drcontext, bool restore_memory,
     return res;
 }
 
+/***************************************************************************
+ * WRAPPED TRACE EVENT
+ */
+
+DR_EXPORT
+bool
+drmgr_register_trace_event(dr_emit_flags_t (*func)
+                           (void *drcontext, void *tag, instrlist_t *trace,
+                            bool translating),
+                           drmgr_priority_t *priority)
+{
+    if (!registered_trace) {
+        dr_rwlock_write_lock(trace_event_lock);
+        /* we lazily register so DR only calls out on traces when asked to */
+        if (!registered_trace) {
+            dr_register_trace_event(drmgr_trace_event);
+            registered_trace = true;
+        }
+        dr_rwlock_write_unlock(trace_event_lock);
+    }
+    return drmgr_generic_event_add(&cblist_trace, trace_event_lock,
+                                   (void (*)(void)) func, priority);
+}
+
+DR_EXPORT
+bool
+drmgr_unregister_trace_event(dr_emit_flags_t (*func)
+                             (void *drcontext, void *tag, instrlist_t *trace,
+                              bool translating))
+{
+    return drmgr_generic_event_remove(&cblist_trace, trace_event_lock,
+                                      (void (*)(void)) func);
+}
+
+static dr_emit_flags_t
+drmgr_trace_event(void *drcontext, void *tag, instrlist_t *trace, bool translating)
+{
+    dr_emit_flags_t res = DR_EMIT_DEFAULT;
+    generic_event_entry_t local[EVENTS_STACK_SZ];
+    cb_list_t iter;
+    uint i;
+    dr_rwlock_read_lock(trace_event_lock);
+    cblist_create_local(drcontext, &cblist_trace, &iter, (byte *)local,
+                        BUFFER_SIZE_ELEMENTS(local));
+    dr_rwlock_read_unlock(trace_event_lock);
+
+    for (i = 0; i < iter.num; i++) {
+        if (!iter.cbs.generic[i].pri.valid)
+            continue;
+        res |= (*iter.cbs.generic[i].cb.trace_cb)(drcontext, tag, trace, translating);
+    }
+    cblist_delete_local(drcontext, &iter, BUFFER_SIZE_ELEMENTS(local));
+    return res;
+}
+
 /***************************************************************************
  * TLS
  */
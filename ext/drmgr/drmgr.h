@@ -468,6 +468,63 @@ DR_EXPORT
 bool
 drmgr_is_last_instr(void *drcontext, instr_t *instr);
 
+DR_EXPORT
+/**
+ * Enables a cache of final instrumented basic blocks that survives code cache
+ * flushes.  Blocks are keyed by their tag and their application bytes.  When a
+ * block is rebuilt after a flush (e.g., dr_flush_region(), a module being
+ * unloaded and reloaded at the same address, or a cache reset) and its bytes
+ * are unchanged, drmgr hands back a copy of the previously instrumented
+ * instruction list and skips every app2app, analysis, insertion, and
+ * instru2instru pass.  Blocks built for traces are never cached.  At most
+ * \p max_entries blocks are retained, with the oldest evicted first.
+ *
+ * Enabling the cache asserts that all registered bb passes are
+ * deterministic: for the same tag and application bytes they must
+ * produce the same instruction list and emit flags on every build and in
+ * every thread, and they must not rely on being called for each rebuild
+ * (e.g., to count how often a block is built).  Passes that embed
+ * thread-specific values in the code they insert are not compatible with
+ * the cache; for this reason the cache cannot be enabled when
+ * dr_using_all_private_caches() is true.  Only the instruction list and the
+ * emit flags are cached: settings such as instrlist_set_fall_through_target()
+ * are not replayed.
+ *
+ * A client that flushes a region in order to change its instrumentation
+ * must call drmgr_invalidate_instrumentation_cache() on that region first.
+ * The same applies to any change in what a pass would insert for code that
+ * is not currently in the code cache, as its cached copy would otherwise be
+ * replayed.  The drmgr-based extensions shipped with DynamoRIO, such as
+ * drwrap when wrapping, unwrapping, or replacing a function or when adding a
+ * post-call site, invalidate the affected code themselves.
+ *
+ * May be called more than once to change \p max_entries.  A \p max_entries
+ * of 0 disables the cache and frees all entries.
+ * \return whether successful.
+ */
+bool
+drmgr_enable_instrumentation_cache(uint max_entries);
+
+DR_EXPORT
+/**
+ * Removes all blocks overlapping [\p start, \p start + \p size) from the cache
+ * enabled by drmgr_enable_instrumentation_cache(), so that their next build
+ * runs the full set of bb passes again.
+ */
+void
+drmgr_invalidate_instrumentation_cache(app_pc start, size_t size);
+
+DR_EXPORT
+/**
+ * Returns the number of block builds satisfied from the cache enabled by
+ * drmgr_enable_instrumentation_cache() in \p hits and the number that ran
+ * the full set of bb passes while the cache was enabled in \p misses.
+ * Either parameter may be NULL.
+ * \return false if the cache has never been enabled.
+ */
+bool
+drmgr_get_instrumentation_cache_stats(OUT uint64 *hits, OUT uint64 *misses);
+
 /***************************************************************************
  * TLS
  */
@@ -1089,6 +1146,31 @@ bool
 drmgr_unregister_restore_state_ex_event(bool (*func)(void *drcontext, bool restore_memory,
                                                      dr_restore_state_info_t *info));
 
+DR_EXPORT
+/**
+ * Registers a callback function for the trace event, which behaves
+ * just like DR's trace event dr_register_trace_event(), except that
+ * callbacks are ordered according to \p priority (0 if NULL) and the
+ * emit flags they return are combined.
+ * \return whether successful.
+ */
+bool
+drmgr_register_trace_event(dr_emit_flags_t (*func)
+                           (void *drcontext, void *tag, instrlist_t *trace,
+                            bool translating),
+                           drmgr_priority_t *priority);
+
+DR_EXPORT
+/**
+ * Unregister a callback function for the trace event.
+ * \return true if unregistration is successful and false if it is not
+ * (e.g., \p func was not registered).
+ */
+bool
+drmgr_unregister_trace_event(dr_emit_flags_t (*func)
+                             (void *drcontext, void *tag, instrlist_t *trace,
+                              bool translating));
+
 /*@}*/ /* end doxygen group */
 
 #ifdef __cplusplus
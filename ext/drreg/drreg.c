@@ -70,6 +70,15 @@
 
 #define AFLAGS_SLOT 0 /* always */
 
+/* Notes we place on spills and restores that drreg_event_trace() may remove */
+enum {
+    DRREG_NOTE_RESERVE_SPILL,
+    DRREG_NOTE_BLOCK_END_RESTORE,
+    DRREG_NOTE_COUNT,
+};
+static ptr_uint_t note_base;
+#define NOTE_VAL(enum_val) ((void *)(ptr_int_t)(note_base + (enum_val)))
+
 /* We support using GPR registers only: [DR_REG_START_GPR..DR_REG_STOP_GPR] */
 
 #define REG_DEAD ((void*)(ptr_uint_t)0)
@@ -105,6 +114,17 @@ typedef struct _reg_info_t {
 
 #define GPR_IDX(reg) ((reg) - DR_REG_START_GPR)
 
+#ifdef X86
+/* We only hand out SIMD registers that have a dr_mcontext_t slot, so that
+ * drreg_event_restore_state() can always put back the app value.
+ */
+# define NUM_SIMD_REGS NUM_XMM_SLOTS
+# define SIMD_IDX(reg) ((reg) - DR_REG_START_XMM)
+/* Each slot holds a whole ymm register, even if we only use the xmm part */
+# define SIMD_SLOT_SIZE sizeof(dr_ymm_t)
+# define MAX_SIMD_SPILLS (2*NUM_SIMD_REGS)
+#endif
+
 typedef struct _per_thread_t {
     instr_t *cur_instr;
     int live_idx;
@@ -117,6 +137,17 @@ typedef struct _per_thread_t {
     /* bb-local values */
     drreg_bb_properties_t bb_props;
     bool bb_has_internal_flow;
+    bool bb_for_trace;
+#ifdef X86
+    reg_info_t simd[NUM_SIMD_REGS];
+    reg_id_t simd_slot_use[MAX_SIMD_SPILLS];
+    int simd_pending_unreserved;
+    /* SIMD spill slots: the address of simd_spill_area is in our TLS slot */
+    byte *simd_spill_area;
+    byte *simd_spill_alloc;
+    /* A later drreg_init() may raise the slot count: this thread keeps its own */
+    uint simd_spill_slots;
+#endif
 } per_thread_t;
 
 static drreg_options_t ops;
@@ -125,6 +156,12 @@ static int tls_idx = -1;
 static uint tls_slot_offs;
 static reg_id_t tls_seg;
 
+#ifdef X86
+static uint simd_tls_offs;
+static reg_id_t simd_tls_seg;
+static bool simd_use_ymm;
+#endif
+
 #ifdef DEBUG
 static uint stats_max_slot;
 #endif
@@ -141,6 +178,22 @@ static drreg_status_t
 drreg_spill_aflags(void *drcontext, instrlist_t *ilist, instr_t *where,
                    per_thread_t *pt);
 
+static void
+note_inserted_spill(per_thread_t *pt, instr_t *where, uint slot, ptr_uint_t note);
+
+#ifdef X86
+static void
+drreg_simd_liveness(void *drcontext, per_thread_t *pt, instr_t *inst, bool xfer,
+                    uint index);
+
+static void
+drreg_simd_forward_liveness(per_thread_t *pt, instr_t *inst);
+
+static void
+drreg_simd_insert_late(void *drcontext, per_thread_t *pt, instrlist_t *bb,
+                       instr_t *inst);
+#endif
+
 static void
 drreg_report_error(drreg_status_t res, const char *msg)
 {
@@ -213,6 +266,21 @@ restore_reg(void *drcontext, per_thread_t *pt, reg_id_t reg, uint slot,
     }
 }
 
+/* For -span_trace_blocks-style trace post-processing we tag the raw TLS
+ * spill or restore just inserted prior to where.  Spills to DR's slots
+ * may take several instrs and are never removed.
+ */
+static void
+note_inserted_spill(per_thread_t *pt, instr_t *where, uint slot, ptr_uint_t note)
+{
+    instr_t *inserted;
+    if (!ops.span_trace_blocks || !pt->bb_for_trace || slot >= ops.num_spill_slots)
+        return;
+    inserted = instr_get_prev(where);
+    ASSERT(inserted != NULL && !instr_is_app(inserted), "spill not found");
+    instr_set_note(inserted, NOTE_VAL(note));
+}
+
 static reg_t
 get_spilled_value(void *drcontext, uint slot)
 {
@@ -277,11 +345,19 @@ drreg_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
     ptr_uint_t aflags_new, aflags_cur = 0;
     uint index = 0;
     reg_id_t reg;
+#ifdef X86
+    uint i;
+#endif
 
     for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++)
         pt->reg[GPR_IDX(reg)].app_uses = 0;
+#ifdef X86
+    for (i = 0; i < NUM_SIMD_REGS; i++)
+        pt->simd[i].app_uses = 0;
+#endif
     /* pt->bb_props is set to 0 at thread init and after each bb */
     pt->bb_has_internal_flow = false;
+    pt->bb_for_trace = for_trace;
 
     /* Reverse scan is more efficient.  This means our indices are also reversed. */
     for (inst = instrlist_last(bb); inst != NULL; inst = instr_get_prev(inst)) {
@@ -347,6 +423,11 @@ drreg_event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
         LOG(drcontext, LOG_ALL, 3, " flags=%d\n", aflags_cur);
         drvector_set_entry(&pt->aflags.live, index, (void *)(ptr_uint_t)aflags_cur);
 
+#ifdef X86
+        if (pt->simd_spill_slots > 0)
+            drreg_simd_liveness(drcontext, pt, inst, xfer, index);
+#endif
+
         if (instr_is_app(inst)) {
             int i;
             for (i = 0; i < instr_num_dsts(inst); i++)
@@ -407,6 +488,14 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
         }
     }
 
+#ifdef X86
+    /* This must precede the GPR handling below, which lazily restores the
+     * scratch registers used to address the SIMD spill slots.
+     */
+    if (pt->simd_spill_slots > 0)
+        drreg_simd_insert_late(drcontext, pt, bb, inst);
+#endif
+
     /* Before each app read, or at end of bb, restore spilled registers to app values: */
     for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++) {
         restored_for_read[GPR_IDX(reg)] = false;
@@ -427,12 +516,18 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
                    !TEST(DRREG_IGNORE_CONTROL_FLOW, pt->bb_props)) ||
                   TEST(DRREG_CONTAINS_SPANNING_CONTROL_FLOW, pt->bb_props)))) {
                 if (!pt->reg[GPR_IDX(reg)].in_use) {
+                    bool spilled = pt->reg[GPR_IDX(reg)].ever_spilled;
+                    uint slot = pt->reg[GPR_IDX(reg)].slot;
                     LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": lazily restoring %s\n",
                         __FUNCTION__, pt->live_idx, instr_get_app_pc(inst),
                         get_register_name(reg));
                     res = drreg_restore_reg_now(drcontext, bb, inst, pt, reg);
                     if (res != DRREG_SUCCESS)
                         drreg_report_error(res, "lazy restore failed");
+                    if (spilled && drmgr_is_last_instr(drcontext, inst)) {
+                        note_inserted_spill(pt, inst, slot,
+                                            DRREG_NOTE_BLOCK_END_RESTORE);
+                    }
                     ASSERT(pt->pending_unreserved > 0, "should not go negative");
                     pt->pending_unreserved--;
                 } else {
@@ -561,6 +656,12 @@ drreg_event_bb_insert_late(void *drcontext, void *tag, instrlist_t *bb, instr_t
         for (i = 0; i < MAX_SPILLS; i++) {
             ASSERT(pt->slot_use[i] == DR_REG_NULL, "user failed to unreserve a register");
         }
+# ifdef X86
+        for (i = 0; i < NUM_SIMD_REGS; i++) {
+            ASSERT(!pt->simd[i].in_use && pt->simd[i].native,
+                   "user failed to unreserve a SIMD register");
+        }
+# endif
     }
 #endif
 
@@ -593,6 +694,16 @@ drreg_forward_analysis(void *drcontext, instr_t *start)
         drvector_set_entry(&pt->reg[GPR_IDX(reg)].live, 0, REG_UNKNOWN);
         pt->reg[GPR_IDX(reg)].ever_spilled = false;
     }
+#ifdef X86
+    if (pt->simd_spill_slots > 0) {
+        uint i;
+        for (i = 0; i < NUM_SIMD_REGS; i++) {
+            pt->simd[i].app_uses = 0;
+            drvector_set_entry(&pt->simd[i].live, 0, REG_UNKNOWN);
+            pt->simd[i].ever_spilled = false;
+        }
+    }
+#endif
 
     /* We have to consider meta instrs as well */
     for (inst = start; inst != NULL; inst = instr_get_next(inst)) {
@@ -625,6 +736,11 @@ drreg_forward_analysis(void *drcontext, instr_t *start)
         aflags_new &= (~(EFLAGS_WRITE_TO_READ(aflags_cur)));
         aflags_cur |= aflags_new;
 
+#ifdef X86
+        if (pt->simd_spill_slots > 0)
+            drreg_simd_forward_liveness(pt, inst);
+#endif
+
         if (instr_is_app(inst)) {
             int i;
             for (i = 0; i < instr_num_dsts(inst); i++)
@@ -640,6 +756,15 @@ drreg_forward_analysis(void *drcontext, instr_t *start)
         if (drvector_get_entry(&pt->reg[GPR_IDX(reg)].live, 0) == REG_UNKNOWN)
             drvector_set_entry(&pt->reg[GPR_IDX(reg)].live, 0, REG_LIVE);
     }
+#ifdef X86
+    if (pt->simd_spill_slots > 0) {
+        uint i;
+        for (i = 0; i < NUM_SIMD_REGS; i++) {
+            if (drvector_get_entry(&pt->simd[i].live, 0) == REG_UNKNOWN)
+                drvector_set_entry(&pt->simd[i].live, 0, REG_LIVE);
+        }
+    }
+#endif
     drvector_set_entry(&pt->aflags.live, 0, (void *)(ptr_uint_t)
                        /* set read bit if not written */
                        (EFLAGS_READ_ARITH & (~(EFLAGS_WRITE_TO_READ(aflags_cur)))));
@@ -665,10 +790,13 @@ drreg_init_and_fill_vector(drvector_t *vec, bool allowed)
 drreg_status_t
 drreg_set_vector_entry(drvector_t *vec, reg_id_t reg, bool allowed)
 {
-    if (vec == NULL || reg < DR_REG_START_GPR || reg > DR_REG_STOP_GPR)
+    uint idx;
+    if (vec == NULL)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    if (reg < DR_REG_START_GPR || reg > DR_REG_STOP_GPR)
         return DRREG_ERROR_INVALID_PARAMETER;
-    drvector_set_entry(vec, reg - DR_REG_START_GPR,
-                       allowed ? (void *)(ptr_uint_t)1 : NULL);
+    idx = GPR_IDX(reg);
+    drvector_set_entry(vec, idx, allowed ? (void *)(ptr_uint_t)1 : NULL);
     return DRREG_SUCCESS;
 }
 
@@ -762,6 +890,8 @@ drreg_reserve_reg_internal(void *drcontext, instrlist_t *ilist, instr_t *where,
                 get_register_name(reg), slot);
             spill_reg(drcontext, pt, reg, slot, ilist, where);
             pt->reg[GPR_IDX(reg)].ever_spilled = true;
+            if (drmgr_current_bb_phase(drcontext) == DRMGR_PHASE_INSERTION)
+                note_inserted_spill(pt, where, slot, DRREG_NOTE_RESERVE_SPILL);
         } else {
             LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": no need to spill %s to slot %d\n",
                 __FUNCTION__, pt->live_idx, instr_get_app_pc(where),
@@ -1167,6 +1297,627 @@ drreg_are_aflags_dead(void *drcontext, instr_t *inst, bool *dead)
     return DRREG_SUCCESS;
 }
 
+/***************************************************************************
+ * SIMD REGISTERS
+ */
+
+#ifdef X86
+static reg_id_t
+simd_full_reg(reg_id_t xmm)
+{
+    return simd_use_ymm ? DR_REG_START_YMM + SIMD_IDX(xmm) : xmm;
+}
+
+static bool
+instr_uses_simd_reg(instr_t *inst, reg_id_t xmm)
+{
+    return (instr_uses_reg(inst, xmm) ||
+            instr_uses_reg(inst, DR_REG_START_YMM + SIMD_IDX(xmm)));
+}
+
+static bool
+instr_reads_simd_reg(instr_t *inst, reg_id_t xmm, dr_opnd_query_flags_t flags)
+{
+    return (instr_reads_from_reg(inst, xmm, flags) ||
+            instr_reads_from_reg(inst, DR_REG_START_YMM + SIMD_IDX(xmm), flags));
+}
+
+static bool
+instr_writes_simd_reg(instr_t *inst, reg_id_t xmm, dr_opnd_query_flags_t flags)
+{
+    return (instr_writes_to_reg(inst, xmm, flags) ||
+            instr_writes_to_reg(inst, DR_REG_START_YMM + SIMD_IDX(xmm), flags));
+}
+
+/* Whether inst overwrites every part of xmm that we preserve.  A legacy
+ * SSE write to an xmm register leaves the top of the ymm register intact.
+ */
+static bool
+instr_kills_simd_reg(instr_t *inst, reg_id_t xmm)
+{
+    return (instr_writes_to_exact_reg(inst, DR_REG_START_YMM + SIMD_IDX(xmm),
+                                      DR_QUERY_INCLUDE_COND_SRCS) ||
+            (!simd_use_ymm &&
+             instr_writes_to_exact_reg(inst, xmm, DR_QUERY_INCLUDE_COND_SRCS)));
+}
+
+static void
+drreg_simd_liveness(void *drcontext, per_thread_t *pt, instr_t *inst, bool xfer,
+                    uint index)
+{
+    uint i;
+    for (i = 0; i < NUM_SIMD_REGS; i++) {
+        reg_id_t reg = DR_REG_START_XMM + i;
+        void *value = REG_LIVE;
+        if (instr_reads_simd_reg(inst, reg, DR_QUERY_INCLUDE_COND_SRCS))
+            value = REG_LIVE;
+        else if (instr_kills_simd_reg(inst, reg))
+            value = REG_DEAD;
+        else if (xfer)
+            value = REG_LIVE;
+        else if (index > 0)
+            value = drvector_get_entry(&pt->simd[i].live, index-1);
+        drvector_set_entry(&pt->simd[i].live, index, value);
+        if (instr_is_app(inst) && instr_uses_simd_reg(inst, reg))
+            pt->simd[i].app_uses++;
+    }
+}
+
+static void
+drreg_simd_forward_liveness(per_thread_t *pt, instr_t *inst)
+{
+    uint i;
+    for (i = 0; i < NUM_SIMD_REGS; i++) {
+        reg_id_t reg = DR_REG_START_XMM + i;
+        void *value = REG_UNKNOWN;
+        if (drvector_get_entry(&pt->simd[i].live, 0) != REG_UNKNOWN)
+            continue;
+        if (instr_reads_simd_reg(inst, reg, DR_QUERY_INCLUDE_COND_SRCS))
+            value = REG_LIVE;
+        else if (instr_kills_simd_reg(inst, reg))
+            value = REG_DEAD;
+        if (value != REG_UNKNOWN)
+            drvector_set_entry(&pt->simd[i].live, 0, value);
+        if (instr_is_app(inst) && instr_uses_simd_reg(inst, reg))
+            pt->simd[i].app_uses++;
+    }
+}
+
+static uint
+find_free_simd_slot(per_thread_t *pt)
+{
+    uint i;
+    for (i = 0; i < pt->simd_spill_slots; i++) {
+        if (pt->simd_slot_use[i] == DR_REG_NULL)
+            return i;
+    }
+    return MAX_SIMD_SPILLS;
+}
+
+/* Copies reg to (spill) or from (!spill) SIMD slot slot, using a GPR scratch
+ * register to hold the address of the per-thread spill area.  If avoid is
+ * non-NULL, the code is being inserted after avoid and so the scratch
+ * register must not be one that avoid uses.
+ */
+static drreg_status_t
+simd_move(void *drcontext, reg_id_t reg, uint slot, bool spill,
+          instrlist_t *ilist, instr_t *where, instr_t *avoid)
+{
+    drvector_t allowed;
+    drreg_status_t res;
+    reg_id_t scratch;
+    opnd_t mem, full;
+    drreg_init_and_fill_vector(&allowed, true);
+    if (avoid != NULL) {
+        for (scratch = DR_REG_START_GPR; scratch <= DR_REG_STOP_GPR; scratch++) {
+            if (instr_uses_reg(avoid, scratch))
+                drreg_set_vector_entry(&allowed, scratch, false);
+        }
+    }
+    res = drreg_reserve_reg_internal(drcontext, ilist, where, &allowed, false, &scratch);
+    drvector_delete(&allowed);
+    if (res != DRREG_SUCCESS)
+        return res;
+    dr_insert_read_raw_tls(drcontext, ilist, where, simd_tls_seg, simd_tls_offs, scratch);
+    mem = opnd_create_base_disp(scratch, DR_REG_NULL, 0, slot*SIMD_SLOT_SIZE,
+                                simd_use_ymm ? OPSZ_32 : OPSZ_16);
+    full = opnd_create_reg(simd_full_reg(reg));
+    /* XXX: drreg_event_restore_state() relies on these opcodes */
+    if (simd_use_ymm) {
+        PRE(ilist, where, spill ? INSTR_CREATE_vmovdqu(drcontext, mem, full) :
+            INSTR_CREATE_vmovdqu(drcontext, full, mem));
+    } else {
+        PRE(ilist, where, spill ? INSTR_CREATE_movdqu(drcontext, mem, full) :
+            INSTR_CREATE_movdqu(drcontext, full, mem));
+    }
+    return drreg_unreserve_register(drcontext, ilist, where, scratch);
+}
+
+/* Up to caller to update pt->simd.  This routine updates pt->simd_slot_use. */
+static drreg_status_t
+spill_simd_reg(void *drcontext, per_thread_t *pt, reg_id_t reg, uint slot,
+               instrlist_t *ilist, instr_t *where, instr_t *avoid)
+{
+    ASSERT(pt->simd_slot_use[slot] == DR_REG_NULL ||
+           pt->simd_slot_use[slot] == reg, "internal tracking error");
+    pt->simd_slot_use[slot] = reg;
+    return simd_move(drcontext, reg, slot, true, ilist, where, avoid);
+}
+
+/* Up to caller to update pt->simd.  This routine updates pt->simd_slot_use
+ * if release==true.
+ */
+static drreg_status_t
+restore_simd_reg(void *drcontext, per_thread_t *pt, reg_id_t reg, uint slot,
+                 instrlist_t *ilist, instr_t *where, instr_t *avoid, bool release)
+{
+    ASSERT(pt->simd_slot_use[slot] == reg, "internal tracking error");
+    if (release)
+        pt->simd_slot_use[slot] = DR_REG_NULL;
+    return simd_move(drcontext, reg, slot, false, ilist, where, avoid);
+}
+
+static drreg_status_t
+drreg_restore_simd_now(void *drcontext, instrlist_t *ilist, instr_t *inst,
+                       per_thread_t *pt, reg_id_t reg)
+{
+    reg_info_t *info = &pt->simd[SIMD_IDX(reg)];
+    if (info->ever_spilled) {
+        drreg_status_t res;
+        LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": restoring %s\n",
+            __FUNCTION__, pt->live_idx, instr_get_app_pc(inst), get_register_name(reg));
+        res = restore_simd_reg(drcontext, pt, reg, info->slot, ilist, inst, NULL, true);
+        if (res != DRREG_SUCCESS)
+            return res;
+    } else /* still need to release slot */
+        pt->simd_slot_use[info->slot] = DR_REG_NULL;
+    info->native = true;
+    return DRREG_SUCCESS;
+}
+
+/* The SIMD counterpart of the GPR handling in drreg_event_bb_insert_late() */
+static void
+drreg_simd_insert_late(void *drcontext, per_thread_t *pt, instrlist_t *bb,
+                       instr_t *inst)
+{
+    instr_t *next = instr_get_next(inst);
+    bool last = drmgr_is_last_instr(drcontext, inst);
+    drreg_status_t res;
+    uint i;
+    for (i = 0; i < NUM_SIMD_REGS; i++) {
+        reg_id_t reg = DR_REG_START_XMM + i;
+        reg_info_t *info = &pt->simd[i];
+        if (info->native)
+            continue;
+        if (!info->in_use) {
+            /* We do not bother to distinguish a full app write, which would
+             * let us just drop the slot.
+             */
+            if (last || instr_uses_simd_reg(inst, reg) ||
+                (pt->bb_has_internal_flow &&
+                 !TEST(DRREG_IGNORE_CONTROL_FLOW, pt->bb_props)) ||
+                TEST(DRREG_CONTAINS_SPANNING_CONTROL_FLOW, pt->bb_props)) {
+                LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": lazily restoring %s\n",
+                    __FUNCTION__, pt->live_idx, instr_get_app_pc(inst),
+                    get_register_name(reg));
+                res = drreg_restore_simd_now(drcontext, bb, inst, pt, reg);
+                if (res != DRREG_SUCCESS)
+                    drreg_report_error(res, "lazy SIMD restore failed");
+                ASSERT(pt->simd_pending_unreserved > 0, "should not go negative");
+                pt->simd_pending_unreserved--;
+            }
+        } else if (!last && instr_uses_simd_reg(inst, reg)) {
+            /* The same approach as for GPRs, with the read and write cases
+             * combined:
+             *   + spill reg (tool val) to new slot
+             *   + restore to reg (app val) from app slot
+             *   + <app instr>
+             *   + spill reg (app val) to app slot, if written and live
+             *   + restore to reg (tool val) from new slot
+             * XXX: if we change this, we need to update
+             * drreg_event_restore_state().
+             */
+            uint tmp_slot = find_free_simd_slot(pt);
+            if (tmp_slot == MAX_SIMD_SPILLS) {
+                drreg_report_error(DRREG_ERROR_OUT_OF_SLOTS,
+                                   "failed to preserve tool SIMD val around app instr");
+                continue;
+            }
+            LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": preserving %s around app instr\n",
+                __FUNCTION__, pt->live_idx, instr_get_app_pc(inst),
+                get_register_name(reg));
+            res = spill_simd_reg(drcontext, pt, reg, tmp_slot, bb, inst, NULL);
+            if (res == DRREG_SUCCESS && info->ever_spilled) {
+                res = restore_simd_reg(drcontext, pt, reg, info->slot, bb, inst, NULL,
+                                       false/*keep slot*/);
+            }
+            if (res == DRREG_SUCCESS &&
+                instr_writes_simd_reg(inst, reg, DR_QUERY_INCLUDE_ALL) &&
+                (ops.conservative || pt->live_idx == 0 ||
+                 drvector_get_entry(&info->live, pt->live_idx-1) == REG_LIVE)) {
+                res = spill_simd_reg(drcontext, pt, reg, info->slot, bb, next, inst);
+                info->ever_spilled = true;
+            }
+            if (res == DRREG_SUCCESS)
+                res = restore_simd_reg(drcontext, pt, reg, tmp_slot, bb, next, inst, true);
+            if (res != DRREG_SUCCESS)
+                drreg_report_error(res, "failed to preserve tool SIMD val");
+        }
+    }
+}
+#endif
+
+drreg_status_t
+drreg_init_and_fill_simd_vector(drvector_t *vec, bool allowed)
+{
+#ifdef X86
+    uint i;
+    if (vec == NULL)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    drvector_init(vec, NUM_SIMD_REGS, false/*!synch*/, NULL);
+    for (i = 0; i < NUM_SIMD_REGS; i++)
+        drvector_set_entry(vec, i, allowed ? (void *)(ptr_uint_t)1 : NULL);
+    return DRREG_SUCCESS;
+#else
+    /* FIXME i#1551: add SIMD reservation support for ARM and AArch64 */
+    return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+}
+
+drreg_status_t
+drreg_set_simd_vector_entry(drvector_t *vec, reg_id_t reg, bool allowed)
+{
+#ifdef X86
+    if (vec == NULL || reg < DR_REG_START_XMM || SIMD_IDX(reg) >= NUM_SIMD_REGS)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    drvector_set_entry(vec, SIMD_IDX(reg), allowed ? (void *)(ptr_uint_t)1 : NULL);
+    return DRREG_SUCCESS;
+#else
+    /* FIXME i#1551: add SIMD reservation support for ARM and AArch64 */
+    return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+}
+
+drreg_status_t
+drreg_reserve_simd_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            drvector_t *reg_allowed, OUT reg_id_t *reg_out)
+{
+#ifdef X86
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    uint slot = MAX_SIMD_SPILLS;
+    uint min_uses = UINT_MAX;
+    uint i, best = NUM_SIMD_REGS;
+    bool already_spilled = false;
+    reg_info_t *info;
+    if (reg_out == NULL)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    if (pt->simd_spill_slots == 0)
+        return DRREG_ERROR_OUT_OF_SLOTS;
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
+        drreg_status_t res = drreg_forward_analysis(drcontext, where);
+        if (res != DRREG_SUCCESS)
+            return res;
+    }
+
+    /* As for GPRs, prefer a previously unreserved but not yet restored reg */
+    if (pt->simd_pending_unreserved > 0) {
+        for (i = 0; i < NUM_SIMD_REGS; i++) {
+            if (!pt->simd[i].native && !pt->simd[i].in_use &&
+                (reg_allowed == NULL || drvector_get_entry(reg_allowed, i) != NULL)) {
+                slot = pt->simd[i].slot;
+                pt->simd_pending_unreserved--;
+                already_spilled = pt->simd[i].ever_spilled;
+                break;
+            }
+        }
+    }
+    if (slot == MAX_SIMD_SPILLS) {
+        /* Look for a dead register, or the least-used register */
+        for (i = 0; i < NUM_SIMD_REGS; i++) {
+            if (pt->simd[i].in_use || !pt->simd[i].native)
+                continue;
+            if (reg_allowed != NULL && drvector_get_entry(reg_allowed, i) == NULL)
+                continue;
+            if (drvector_get_entry(&pt->simd[i].live, pt->live_idx) == REG_DEAD)
+                break;
+            if (pt->simd[i].app_uses < min_uses) {
+                best = i;
+                min_uses = pt->simd[i].app_uses;
+            }
+        }
+        if (i == NUM_SIMD_REGS) {
+            if (best == NUM_SIMD_REGS)
+                return DRREG_ERROR_REG_CONFLICT;
+            i = best;
+        }
+        slot = find_free_simd_slot(pt);
+        if (slot == MAX_SIMD_SPILLS)
+            return DRREG_ERROR_OUT_OF_SLOTS;
+    }
+
+    info = &pt->simd[i];
+    ASSERT(!info->in_use, "overlapping uses");
+    if (!already_spilled) {
+        if (ops.conservative ||
+            drvector_get_entry(&info->live, pt->live_idx) == REG_LIVE) {
+            drreg_status_t res;
+            LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX": spilling %s to SIMD slot %d\n",
+                __FUNCTION__, pt->live_idx, instr_get_app_pc(where),
+                get_register_name(DR_REG_START_XMM + i), slot);
+            res = spill_simd_reg(drcontext, pt, DR_REG_START_XMM + i, slot, ilist,
+                                 where, NULL);
+            if (res != DRREG_SUCCESS)
+                return res;
+            info->ever_spilled = true;
+        } else {
+            pt->simd_slot_use[slot] = DR_REG_START_XMM + i;
+            info->ever_spilled = false;
+        }
+    }
+    info->in_use = true;
+    info->native = false;
+    info->xchg = DR_REG_NULL;
+    info->slot = slot;
+    *reg_out = DR_REG_START_XMM + i;
+    return DRREG_SUCCESS;
+#else
+    /* FIXME i#1551: add SIMD reservation support for ARM and AArch64 */
+    return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+}
+
+drreg_status_t
+drreg_unreserve_simd_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                              reg_id_t reg)
+{
+#ifdef X86
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (reg < DR_REG_START_XMM || SIMD_IDX(reg) >= NUM_SIMD_REGS ||
+        !pt->simd[SIMD_IDX(reg)].in_use)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    LOG(drcontext, LOG_ALL, 3, "%s @%d."PFX" %s\n", __FUNCTION__,
+        pt->live_idx, instr_get_app_pc(where), get_register_name(reg));
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
+        drreg_status_t res = drreg_restore_simd_now(drcontext, ilist, where, pt, reg);
+        if (res != DRREG_SUCCESS)
+            return res;
+    } else {
+        /* We lazily restore in drreg_simd_insert_late() */
+        pt->simd_pending_unreserved++;
+    }
+    pt->simd[SIMD_IDX(reg)].in_use = false;
+    return DRREG_SUCCESS;
+#else
+    return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+}
+
+drreg_status_t
+drreg_is_simd_register_dead(void *drcontext, reg_id_t reg, instr_t *inst, bool *dead)
+{
+#ifdef X86
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    if (dead == NULL || pt->simd_spill_slots == 0 ||
+        reg < DR_REG_START_XMM || SIMD_IDX(reg) >= NUM_SIMD_REGS)
+        return DRREG_ERROR_INVALID_PARAMETER;
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
+        drreg_status_t res = drreg_forward_analysis(drcontext, inst);
+        if (res != DRREG_SUCCESS)
+            return res;
+        ASSERT(pt->live_idx == 0, "non-drmgr-insert always uses 0 index");
+    }
+    *dead = drvector_get_entry(&pt->simd[SIMD_IDX(reg)].live, pt->live_idx) == REG_DEAD;
+    return DRREG_SUCCESS;
+#else
+    return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+}
+
+/***************************************************************************
+ * TRACES
+ */
+
+/* Returns the spill slot accessed by our raw TLS spill or restore in, or
+ * MAX_SPILLS if in is not one of those.
+ */
+static uint
+raw_tls_slot_accessed(void *drcontext, instr_t *in, bool *spill OUT, reg_id_t *reg OUT)
+{
+    bool tls;
+    uint offs;
+    if (!instr_is_reg_spill_or_restore(drcontext, in, &tls, spill, reg, &offs) ||
+        !tls || offs < tls_slot_offs ||
+        offs >= tls_slot_offs + ops.num_spill_slots*sizeof(reg_t))
+        return MAX_SPILLS;
+    return (offs - tls_slot_offs) / sizeof(reg_t);
+}
+
+static bool
+instr_touches_reg(instr_t *in, reg_id_t reg)
+{
+    return (instr_reads_from_reg(in, reg, DR_QUERY_INCLUDE_ALL) ||
+            instr_writes_to_reg(in, reg, DR_QUERY_INCLUDE_ALL));
+}
+
+#ifdef X86
+/* Returns the long form of the inverse of the jcc exit, or OP_INVALID if we
+ * cannot build a restore stub around exit.
+ */
+static int
+exit_stub_skip_opcode(void *drcontext, instr_t *exit)
+{
+    int opc;
+    instr_t *inv;
+    if (!instr_is_cbr(exit) || !opnd_is_pc(instr_get_target(exit)))
+        return OP_INVALID;
+    opc = instr_get_opcode(exit);
+    /* No jecxz or loop: they cannot simply be inverted. */
+    if (!((opc >= OP_jo && opc <= OP_jnle) ||
+          (opc >= OP_jo_short && opc <= OP_jnle_short)))
+        return OP_INVALID;
+    inv = instr_clone(drcontext, exit);
+    instr_invert_cbr(inv);
+    opc = instr_get_opcode(inv);
+    instr_destroy(drcontext, inv);
+    if (opc >= OP_jo_short && opc <= OP_jnle_short)
+        opc = opc - OP_jo_short + OP_jo;
+    return opc;
+}
+#endif
+
+/* Examines the block-end restores starting at first, which end one
+ * constituent block of a trace, and pairs each with a same-slot
+ * reservation spill at the start of the following block.  For each pair,
+ * the register holds only a dead tool value between the two and the slot
+ * already holds the app value, so both can go on the path that stays in
+ * the trace.  When the boundary is a trace exit, the restore moves into a
+ * stub skipped by an inverted meta branch:
+ *
+ *      <restores that must stay>
+ *      j!cc cont             # meta
+ *      <restores for the exit path only>
+ *      jcc exit_tag          # app
+ *   cont:
+ *
+ * drreg_event_restore_state() recognizes and skips such stubs.
+ * Returns the instr at which to resume the scan.
+ */
+static instr_t *
+drreg_span_block_boundary(void *drcontext, instrlist_t *trace, instr_t *first)
+{
+    instr_t *restores[DR_NUM_GPR_REGS], *spills[DR_NUM_GPR_REGS];
+    uint num_restores = 0, num_pairs = 0, i;
+    instr_t *in, *boundary, *cont, *skip_to;
+    int skip_opc = OP_INVALID;
+
+    /* Gather the run of our restores preceding the block's last app instr. */
+    for (in = first; in != NULL && !instr_is_app(in); in = instr_get_next(in)) {
+        if (instr_get_note(in) == NOTE_VAL(DRREG_NOTE_BLOCK_END_RESTORE) &&
+            num_restores < DR_NUM_GPR_REGS)
+            restores[num_restores++] = in;
+    }
+    boundary = in;
+    if (boundary == NULL)
+        return NULL;
+    cont = instr_get_next(boundary);
+    if (cont == NULL)
+        return NULL; /* end of the trace */
+    if (instr_is_syscall(boundary) || instr_is_interrupt(boundary))
+        return cont;
+    if (instr_is_cti(boundary) && !instr_is_call_direct(boundary)) {
+#ifdef X86
+        skip_opc = exit_stub_skip_opcode(drcontext, boundary);
+#endif
+        /* XXX: add stubs for ARM's predicated branches. */
+        if (skip_opc == OP_INVALID)
+            return cont;
+    }
+
+    for (i = 0; i < num_restores; i++) {
+        bool spill;
+        reg_id_t reg, spill_reg_id;
+        uint slot = raw_tls_slot_accessed(drcontext, restores[i], &spill, &reg);
+        if (slot == MAX_SPILLS || spill)
+            continue;
+        /* Nothing between the restore and the boundary may rely on the
+         * restored app value, as it will no longer be there on the
+         * in-trace path.
+         */
+        for (in = instr_get_next(restores[i]); in != cont; in = instr_get_next(in)) {
+            if (instr_touches_reg(in, reg))
+                break;
+        }
+        if (in != cont)
+            continue;
+        /* Look for the next block's spill of the same reg to the same slot
+         * before anything else touches the reg.
+         */
+        for (in = cont; in != NULL; in = instr_get_next(in)) {
+            if (instr_get_note(in) == NOTE_VAL(DRREG_NOTE_RESERVE_SPILL) &&
+                raw_tls_slot_accessed(drcontext, in, &spill, &spill_reg_id) == slot &&
+                spill && spill_reg_id == reg)
+                break;
+            if (instr_is_cti(in) || instr_is_syscall(in) || instr_is_interrupt(in) ||
+                instr_touches_reg(in, reg)) {
+                in = NULL;
+                break;
+            }
+        }
+        if (in == NULL)
+            continue;
+        restores[num_pairs] = restores[i];
+        spills[num_pairs] = in;
+        num_pairs++;
+    }
+    if (num_pairs == 0)
+        return cont;
+
+    skip_to = NULL;
+    if (skip_opc != OP_INVALID) {
+        skip_to = INSTR_CREATE_label(drcontext);
+        instrlist_meta_postinsert(trace, boundary, skip_to);
+    }
+    for (i = 0; i < num_pairs; i++) {
+        instrlist_remove(trace, spills[i]);
+        instr_destroy(drcontext, spills[i]);
+        instrlist_remove(trace, restores[i]);
+        if (skip_to == NULL)
+            instr_destroy(drcontext, restores[i]);
+        else
+            instrlist_meta_preinsert(trace, boundary, restores[i]);
+    }
+#ifdef X86
+    if (skip_to != NULL) {
+        instrlist_meta_preinsert(trace, restores[0], INSTR_CREATE_jcc
+                                 (drcontext, skip_opc, opnd_create_instr(skip_to)));
+    }
+#endif
+    LOG(drcontext, LOG_ALL, 3, "%s @"PFX": spanned %d regs across %s\n",
+        __FUNCTION__, instr_get_app_pc(boundary), num_pairs,
+        skip_to == NULL ? "fall-through" : "exit");
+    return cont;
+}
+
+static dr_emit_flags_t
+drreg_event_trace(void *drcontext, void *tag, instrlist_t *trace, bool translating)
+{
+    instr_t *inst, *next;
+    for (inst = instrlist_first(trace); inst != NULL; inst = next) {
+        next = instr_get_next(inst);
+        if (instr_get_note(inst) == NOTE_VAL(DRREG_NOTE_BLOCK_END_RESTORE))
+            next = drreg_span_block_boundary(drcontext, trace, inst);
+    }
+    return DR_EMIT_DEFAULT;
+}
+
+/* Returns whether [start, end) is a restore stub created by
+ * drreg_span_block_boundary(): our restores followed by the exit cti.
+ */
+static bool
+is_exit_restore_stub(void *drcontext, byte *start, byte *end)
+{
+    instr_t inst;
+    byte *pc = start;
+    bool found_exit = false;
+    instr_init(drcontext, &inst);
+    while (pc != NULL && pc < end && !found_exit) {
+        bool spill;
+        reg_id_t reg;
+        instr_reset(drcontext, &inst);
+        pc = decode(drcontext, pc, &inst);
+        if (pc == NULL)
+            break;
+        if (instr_is_cti(&inst))
+            found_exit = true;
+        else if (!instr_is_nop(&inst) &&
+                 (raw_tls_slot_accessed(drcontext, &inst, &spill, &reg) ==
+                  MAX_SPILLS || spill))
+            break;
+    }
+    instr_free(drcontext, &inst);
+    return found_exit && pc == end;
+}
+
 /***************************************************************************
  * RESTORE STATE
  */
@@ -1190,10 +1941,22 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
     byte *prev_pc, *pc = info->fragment_info.cache_start_pc;
     uint offs;
     bool spill, tls;
+#ifdef X86
+    /* SIMD spills are a load of our spill area pointer into a GPR followed by
+     * a movdqu or vmovdqu to or from a slot at that base.
+     */
+    uint simd_spilled_to[NUM_SIMD_REGS];
+    reg_id_t simd_base = DR_REG_NULL;
+    uint i;
+#endif
     if (pc == NULL)
         return true; /* fault not in cache */
     for (reg = DR_REG_START_GPR; reg <= DR_REG_STOP_GPR; reg++)
         spilled_to[GPR_IDX(reg)] = MAX_SPILLS;
+#ifdef X86
+    for (i = 0; i < NUM_SIMD_REGS; i++)
+        simd_spilled_to[i] = MAX_SIMD_SPILLS;
+#endif
     LOG(drcontext, LOG_ALL, 3, "%s: processing fault @"PFX": decoding from "PFX"\n",
         __FUNCTION__, info->raw_mcontext->pc, pc);
     instr_init(drcontext, &inst);
@@ -1202,6 +1965,66 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
         prev_pc = pc;
         pc = decode(drcontext, pc, &inst);
 
+        /* A restore stub for a trace exit only runs if the exit is taken, which
+         * it was not if we got past it.
+         */
+        if (ops.span_trace_blocks && instr_is_cbr(&inst) &&
+            opnd_is_pc(instr_get_target(&inst))) {
+            byte *target = opnd_get_pc(instr_get_target(&inst));
+            if (target > pc && target <= info->raw_mcontext->pc &&
+                is_exit_restore_stub(drcontext, pc, target)) {
+                LOG(drcontext, LOG_ALL, 3, "%s @"PFX": skipping exit restore stub\n",
+                    __FUNCTION__, prev_pc);
+                pc = target;
+                continue;
+            }
+        }
+
+#ifdef X86
+        if (ops.num_simd_spill_slots > 0) {
+            if (instr_is_reg_spill_or_restore(drcontext, &inst, &tls, &spill, &reg,
+                                              &offs) &&
+                tls && !spill && offs == simd_tls_offs) {
+                simd_base = reg;
+                continue;
+            }
+            if (simd_base != DR_REG_NULL &&
+                (instr_get_opcode(&inst) == OP_movdqu ||
+                 instr_get_opcode(&inst) == OP_vmovdqu)) {
+                opnd_t mem = instr_get_dst(&inst, 0);
+                opnd_t val = instr_get_src(&inst, 0);
+                spill = opnd_is_base_disp(mem);
+                if (!spill) {
+                    mem = instr_get_src(&inst, 0);
+                    val = instr_get_dst(&inst, 0);
+                }
+                if (opnd_is_base_disp(mem) && opnd_get_base(mem) == simd_base &&
+                    opnd_get_index(mem) == DR_REG_NULL && opnd_is_reg(val) &&
+                    opnd_get_disp(mem) >= 0 &&
+                    opnd_get_disp(mem) < (int)(ops.num_simd_spill_slots*SIMD_SLOT_SIZE)) {
+                    uint slot = opnd_get_disp(mem) / SIMD_SLOT_SIZE;
+                    reg = opnd_get_reg(val);
+                    i = (reg >= DR_REG_START_YMM && reg <= DR_REG_STOP_YMM) ?
+                        reg - DR_REG_START_YMM : SIMD_IDX(reg);
+                    ASSERT(i < NUM_SIMD_REGS, "invalid SIMD spill");
+                    LOG(drcontext, LOG_ALL, 3, "%s @"PFX" found SIMD %s of %s slot %d\n",
+                        __FUNCTION__, prev_pc, spill ? "spill" : "restore",
+                        get_register_name(reg), slot);
+                    if (spill) {
+                        /* As for GPRs, a 2nd spill is of the tool's value */
+                        if (simd_spilled_to[i] == MAX_SIMD_SPILLS)
+                            simd_spilled_to[i] = slot;
+                    } else if (simd_spilled_to[i] == slot)
+                        simd_spilled_to[i] = MAX_SIMD_SPILLS;
+                    continue;
+                }
+            }
+            if (simd_base != DR_REG_NULL &&
+                instr_writes_to_reg(&inst, simd_base, DR_QUERY_INCLUDE_ALL))
+                simd_base = DR_REG_NULL;
+        }
+#endif
+
         /* XXX i#511: if we add xchg to our arsenal we'll have to detect it here */
         if (instr_is_reg_spill_or_restore(drcontext, &inst, &tls, &spill, &reg, &offs)) {
             uint slot;
@@ -1278,6 +2101,24 @@ drreg_event_restore_state(void *drcontext, bool restore_memory,
             reg_set_value(reg, info->mcontext, val);
         }
     }
+#ifdef X86
+    for (i = 0; i < NUM_SIMD_REGS; i++) {
+        if (simd_spilled_to[i] < MAX_SIMD_SPILLS) {
+            per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+            if (!TEST(DR_MC_MULTIMEDIA, info->mcontext->flags)) {
+                /* XXX: we have no way to ask for the multimedia fields */
+                LOG(drcontext, LOG_ALL, 1, "%s: unable to restore SIMD reg %d\n",
+                    __FUNCTION__, i);
+                continue;
+            }
+            LOG(drcontext, LOG_ALL, 3, "%s: restoring SIMD reg %d from slot %d\n",
+                __FUNCTION__, i, simd_spilled_to[i]);
+            memcpy(&info->mcontext->ymm[i],
+                   pt->simd_spill_area + simd_spilled_to[i]*SIMD_SLOT_SIZE,
+                   simd_use_ymm ? sizeof(dr_ymm_t) : sizeof(dr_xmm_t));
+        }
+    }
+#endif
 
     return true;
 }
@@ -1304,6 +2145,23 @@ drreg_thread_init(void *drcontext)
     }
     drvector_init(&pt->aflags.live, 20, false/*!synch*/, NULL);
     pt->tls_seg_base = dr_get_dr_segment_base(tls_seg);
+#ifdef X86
+    pt->simd_spill_slots = ops.num_simd_spill_slots;
+    if (pt->simd_spill_slots > 0) {
+        uint i;
+        for (i = 0; i < NUM_SIMD_REGS; i++) {
+            drvector_init(&pt->simd[i].live, 20, false/*!synch*/, NULL);
+            pt->simd[i].native = true;
+        }
+        /* Over-allocate so we can align the slots */
+        pt->simd_spill_alloc = (byte *)
+            dr_thread_alloc(drcontext, (pt->simd_spill_slots + 1)*SIMD_SLOT_SIZE);
+        pt->simd_spill_area = (byte *)
+            ALIGN_FORWARD(pt->simd_spill_alloc, SIMD_SLOT_SIZE);
+        *(byte **)(dr_get_dr_segment_base(simd_tls_seg) + simd_tls_offs) =
+            pt->simd_spill_area;
+    }
+#endif
 }
 
 static void
@@ -1315,9 +2173,77 @@ drreg_thread_exit(void *drcontext)
         drvector_delete(&pt->reg[GPR_IDX(reg)].live);
     }
     drvector_delete(&pt->aflags.live);
+#ifdef X86
+    if (pt->simd_spill_slots > 0) {
+        uint i;
+        for (i = 0; i < NUM_SIMD_REGS; i++)
+            drvector_delete(&pt->simd[i].live);
+        dr_thread_free(drcontext, pt->simd_spill_alloc,
+                       (pt->simd_spill_slots + 1)*SIMD_SLOT_SIZE);
+    }
+#endif
     dr_thread_free(drcontext, pt, sizeof(*pt));
 }
 
+static drreg_status_t
+drreg_init_span_trace_blocks(void)
+{
+    drmgr_priority_t trace_priority = {
+        sizeof(trace_priority), DRMGR_PRIORITY_NAME_DRREG_TRACE, NULL, NULL,
+        DRMGR_PRIORITY_TRACE_DRREG
+    };
+    note_base = drmgr_reserve_note_range(DRREG_NOTE_COUNT);
+    if (note_base == DRMGR_NOTE_NONE)
+        return DRREG_ERROR;
+    if (!drmgr_register_trace_event(drreg_event_trace, &trace_priority))
+        return DRREG_ERROR;
+    return DRREG_SUCCESS;
+}
+
+static drreg_status_t
+drreg_init_simd_slots(void)
+{
+#ifdef X86
+    if (!dr_raw_tls_calloc(&simd_tls_seg, &simd_tls_offs, 1, 0))
+        return DRREG_ERROR_OUT_OF_SLOTS;
+    simd_use_ymm = proc_avx_enabled();
+    return DRREG_SUCCESS;
+#else
+    /* FIXME i#1551: add SIMD reservation support for ARM and AArch64 */
+    return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
+}
+
+/* Folds a later drreg_init() caller's requests into ops.  Fields that
+ * size per-thread state only take effect for threads initialized afterward.
+ */
+static drreg_status_t
+drreg_merge_options(drreg_options_t *ops_in)
+{
+    drreg_status_t res;
+    if (ops_in->struct_size > offsetof(drreg_options_t, span_trace_blocks) &&
+        ops_in->span_trace_blocks && !ops.span_trace_blocks) {
+        res = drreg_init_span_trace_blocks();
+        if (res != DRREG_SUCCESS)
+            return res;
+        ops.span_trace_blocks = true;
+    }
+    if (ops_in->struct_size > offsetof(drreg_options_t, num_simd_spill_slots) &&
+        ops_in->num_simd_spill_slots > 0) {
+#ifdef X86
+        if (ops.num_simd_spill_slots + ops_in->num_simd_spill_slots > MAX_SIMD_SPILLS)
+            return DRREG_ERROR_INVALID_PARAMETER;
+#endif
+        if (ops.num_simd_spill_slots == 0) {
+            res = drreg_init_simd_slots();
+            if (res != DRREG_SUCCESS)
+                return res;
+        }
+        ops.num_simd_spill_slots += ops_in->num_simd_spill_slots;
+    }
+    return DRREG_SUCCESS;
+}
+
 drreg_status_t
 drreg_init(drreg_options_t *ops_in)
 {
@@ -1341,15 +2267,25 @@ drreg_init(drreg_options_t *ops_in)
      * drreg_thread_init() and thus consider all callers' requests?  For
      * the num_ fields we can easily sum them: but what about if we
      * later add bool or other fields that are harder to combine?
+     * The newer bool and SIMD fields are combined by drreg_merge_options().
      */
     if (count > 1)
-        return DRREG_SUCCESS;
+        return drreg_merge_options(ops_in);
 
     if (ops_in->struct_size < offsetof(drreg_options_t, error_callback))
         return DRREG_ERROR_INVALID_PARAMETER;
-    else if (ops_in->struct_size < sizeof(ops))
-        ops.error_callback = NULL;
-    ops = *ops_in;
+    /* Fields beyond the caller's struct_size keep their zero defaults */
+    memset(&ops, 0, sizeof(ops));
+    memcpy(&ops, ops_in, ops_in->struct_size < sizeof(ops) ?
+           ops_in->struct_size : sizeof(ops));
+#ifdef X86
+    if (ops.num_simd_spill_slots > MAX_SIMD_SPILLS)
+        return DRREG_ERROR_INVALID_PARAMETER;
+#else
+    /* FIXME i#1551: add SIMD reservation support for ARM and AArch64 */
+    if (ops.num_simd_spill_slots > 0)
+        return DRREG_ERROR_FEATURE_NOT_AVAILABLE;
+#endif
 
     drmgr_init();
 
@@ -1370,6 +2306,17 @@ drreg_init(drreg_options_t *ops_in)
 
     if (!dr_raw_tls_calloc(&tls_seg, &tls_slot_offs, ops.num_spill_slots, 0))
         return DRREG_ERROR_OUT_OF_SLOTS;
+    if (ops.num_simd_spill_slots > 0) {
+        drreg_status_t res = drreg_init_simd_slots();
+        if (res != DRREG_SUCCESS)
+            return res;
+    }
+
+    if (ops.span_trace_blocks) {
+        drreg_status_t res = drreg_init_span_trace_blocks();
+        if (res != DRREG_SUCCESS)
+            return res;
+    }
 
     return DRREG_SUCCESS;
 }
@@ -1386,6 +2333,8 @@ drreg_exit(void)
         return DRREG_ERROR;
 
     drmgr_unregister_tls_field(tls_idx);
+    if (ops.span_trace_blocks && !drmgr_unregister_trace_event(drreg_event_trace))
+        return DRREG_ERROR;
     if (!drmgr_unregister_bb_insertion_event(drreg_event_bb_insert_early) ||
         !drmgr_unregister_bb_instrumentation_event(drreg_event_bb_analysis) ||
         !drmgr_unregister_restore_state_ex_event(drreg_event_restore_state))
@@ -1395,6 +2344,10 @@ drreg_exit(void)
 
     if (!dr_raw_tls_cfree(tls_slot_offs, ops.num_spill_slots))
         return DRREG_ERROR;
+#ifdef X86
+    if (ops.num_simd_spill_slots > 0 && !dr_raw_tls_cfree(simd_tls_offs, 1))
+        return DRREG_ERROR;
+#endif
 
     return DRREG_SUCCESS;
 }
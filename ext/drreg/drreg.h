@@ -89,6 +89,8 @@ enum {
     DRMGR_PRIORITY_INSERT_DRREG_LOW  =   7500,
     /** Priority of drreg fault handling event */
     DRMGR_PRIORITY_FAULT_DRREG       =  -7500,
+    /** Priority of drreg trace post-processing event */
+    DRMGR_PRIORITY_TRACE_DRREG       =   7500,
 };
 
 /**
@@ -108,6 +110,12 @@ enum {
  */
 #define DRMGR_PRIORITY_NAME_DRREG_FAULT "drreg_fault"
 
+/**
+ * Name of drreg trace post-processing event, which is meant to take place
+ * after any tool changes to the trace.
+ */
+#define DRMGR_PRIORITY_NAME_DRREG_TRACE "drreg_trace"
+
 /** Specifies the options when initializing drreg. */
 typedef struct _drreg_options_t {
     /** Set this to the size of this structure. */
@@ -140,6 +148,32 @@ typedef struct _drreg_options_t {
      * If this callback is NULL, or if it returns false, drreg will call dr_abort().
      */
     bool (*error_callback)(drreg_status_t status);
+    /**
+     * By default, drreg restores every register it spilled at the end of
+     * each basic block, including each constituent block of a trace.  When
+     * this flag is set, drreg post-processes each trace (see
+     * drmgr_register_trace_event()) and removes the restore at the end of one
+     * constituent block and the matching spill at the start of the next
+     * one when they use the same spill slot.  Where the removed restore
+     * guarded a trace exit, it is moved into a small restore stub that is
+     * only executed when that exit is taken.  The register's application
+     * value thus stays in its slot across the inlined block boundary.
+     * Restore stubs are currently only created on x86; elsewhere only
+     * boundaries that do not exit the trace are optimized.
+     */
+    bool span_trace_blocks;
+    /**
+     * The number of SIMD spill slots to use for drreg_reserve_simd_register().
+     * Each slot holds a full multimedia register (a ymm register when
+     * proc_avx_enabled() returns true, else an xmm register) and lives in a
+     * per-thread buffer whose address is kept in one additional slot
+     * requested via dr_raw_tls_calloc().  As for \p num_spill_slots, an
+     * additional slot should be requested for each SIMD register held
+     * across application instructions that access it.  If zero, SIMD
+     * registers cannot be reserved.  SIMD reservations are currently only
+     * supported on x86.
+     */
+    uint num_simd_spill_slots;
 } drreg_options_t;
 
 DR_EXPORT
@@ -331,7 +365,9 @@ DR_EXPORT
  * Sets the entry in \p vec at index \p reg minus #DR_REG_START_GPR to
  * NULL if \p allowed is false or a non-NULL value if \p allowed is
  * true.  This is intendend as a convenience routine for setting up
- * the \p reg_allowed parameter to drreg_reserve_register().
+ * the \p reg_allowed parameter to drreg_reserve_register().  Returns
+ * #DRREG_ERROR_INVALID_PARAMETER if \p reg is not a general-purpose
+ * register: use drreg_set_simd_vector_entry() for SIMD vectors.
  *
  * @return whether successful or an error code on failure.
  */
@@ -412,6 +448,94 @@ DR_EXPORT
 drreg_status_t
 drreg_is_register_dead(void *drcontext, reg_id_t reg, instr_t *inst, bool *dead);
 
+DR_EXPORT
+/**
+ * Reserves a SIMD register for exclusive use by the caller.  Uses
+ * multimedia register liveness information to pick a dead register
+ * where possible, in which case no spill is needed.  Otherwise, the
+ * application value is spilled at \p where in \p ilist to one of the
+ * drreg_options_t.num_simd_spill_slots slots.  Spilling and restoring
+ * a SIMD register uses a general-purpose scratch register obtained
+ * internally from drreg_reserve_register(), so at least one
+ * general-purpose register must be available.  As with general-purpose
+ * registers, the application value is restored lazily and is
+ * automatically restored and re-spilled around application
+ * instructions that access the register while it is reserved.  If
+ * called during drmgr's insertion phase, \p where must be the current
+ * application instruction.
+ *
+ * The returned register is an xmm register.  When proc_avx_enabled()
+ * returns true, the whole corresponding ymm register (at the same
+ * offset from #DR_REG_START_YMM) is reserved and preserved.  Only
+ * registers that have a slot in dr_mcontext_t (#NUM_XMM_SLOTS of them)
+ * are considered, so that faults can be translated.
+ *
+ * If \p reg_allowed is non-NULL, only registers from the specified set
+ * will be considered, where \p reg_allowed must be a vector set up by
+ * drreg_init_and_fill_simd_vector() and drreg_set_simd_vector_entry().
+ *
+ * Currently only supported on x86.
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_reserve_simd_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                            drvector_t *reg_allowed, OUT reg_id_t *reg);
+
+DR_EXPORT
+/**
+ * Terminates exclusive use of the SIMD register \p reg, which must have
+ * been returned by drreg_reserve_simd_register().  Restores the
+ * application value at \p where in \p ilist, if necessary.  If called
+ * during drmgr's insertion phase, \p where must be the current
+ * application instruction.
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_unreserve_simd_register(void *drcontext, instrlist_t *ilist, instr_t *where,
+                              reg_id_t reg);
+
+DR_EXPORT
+/**
+ * Initializes \p vec to hold one entry per SIMD register that can be
+ * passed to drreg_reserve_simd_register(), starting at #DR_REG_START_XMM,
+ * each either set to NULL if \p allowed is false or a non-NULL value if
+ * \p allowed is true.  Entries are changed with
+ * drreg_set_simd_vector_entry().
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_init_and_fill_simd_vector(drvector_t *vec, bool allowed);
+
+DR_EXPORT
+/**
+ * Sets the entry in \p vec at index \p reg minus #DR_REG_START_XMM to
+ * NULL if \p allowed is false or a non-NULL value if \p allowed is
+ * true, where \p vec was set up by drreg_init_and_fill_simd_vector().
+ * Returns #DRREG_ERROR_INVALID_PARAMETER if \p reg is not an xmm
+ * register that drreg_reserve_simd_register() can return.
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_set_simd_vector_entry(drvector_t *vec, reg_id_t reg, bool allowed);
+
+DR_EXPORT
+/**
+ * Returns in \p dead whether the SIMD register \p reg, an xmm register,
+ * is dead at the point of \p inst.  When proc_avx_enabled() returns
+ * true, the register is only considered dead if the whole ymm register
+ * is.  If called during drmgr's insertion phase, \p inst must be the
+ * current application instruction.
+ *
+ * @return whether successful or an error code on failure.
+ */
+drreg_status_t
+drreg_is_simd_register_dead(void *drcontext, reg_id_t reg, instr_t *inst,
+                            bool *dead);
+
 DR_EXPORT
 /**
  * May only be called during drmgr's app2app, analysis, or insertion phase.
@@ -240,6 +240,43 @@ drsym_error_t
 drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *info /*INOUT*/,
                      uint flags);
 
+/** An address to be symbolized by drsym_lookup_address_batch(). */
+typedef struct _drsym_batch_entry_t {
+    /** Input: the full path to the module to be queried. */
+    const char *modpath;
+    /** Input: the offset from the base of the module to be queried. */
+    size_t modoffs;
+    /**
+     * Input/output: information about the symbol at the queried address,
+     * set up by the caller just as for drsym_lookup_address().
+     */
+    drsym_info_t *info;
+    /** Output: the result drsym_lookup_address() would have returned. */
+    drsym_error_t result;
+} drsym_batch_entry_t;
+
+DR_EXPORT
+/**
+ * Retrieves symbol information for each of an array of module offsets,
+ * with the same results as calling drsym_lookup_address() on each entry.
+ * The entries are processed in module and offset order internally, with
+ * each module looked up once and the symbol lock acquired only once for
+ * the whole batch, which is considerably faster than separate queries
+ * when symbolizing many addresses offline.  The entries themselves are not
+ * reordered.
+ *
+ * Returns DRSYM_ERROR_INVALID_PARAMETER if \p entries is NULL while \p
+ * count is non-zero, and otherwise returns DRSYM_SUCCESS with each entry's
+ * own status stored in its \p result field.
+ *
+ * @param[in,out] entries The addresses to look up and their results.
+ * @param[in]  count   The number of elements in \p entries.
+ * @param[in]  flags   Options for the operation as a combination of drsym_flags_t
+ *    values, as for drsym_lookup_address().
+ */
+drsym_error_t
+drsym_lookup_address_batch(drsym_batch_entry_t *entries, size_t count, uint flags);
+
 enum {
     DRSYM_TYPE_OTHER,  /**< Unknown type, cannot downcast. */
     DRSYM_TYPE_INT,    /**< Integer, cast to drsym_int_type_t. */
@@ -675,6 +712,25 @@ DR_EXPORT
 drsym_error_t
 drsym_free_resources(const char *modpath);
 
+DR_EXPORT
+/**
+ * Enables a persistent on-disk index of symbol and line information, stored
+ * in the directory \p dir, which is created if it does not exist.  The first
+ * time a module is loaded after this call, drsyms saves its symbol address
+ * ranges, symbol names, and line table to a file in \p dir.  Later loads of
+ * the same module, in this or any other process, map that file and answer
+ * drsym_lookup_address(), drsym_lookup_symbol(), symbol enumeration, and
+ * drsym_enumerate_lines() from it without parsing the symbol table or DWARF.
+ * Index files are named by the module's build id and size and are ignored if
+ * either does not match.  Modules without a build id are not indexed.
+ * Passing NULL disables the index for modules loaded afterward.  The
+ * directory may be shared by concurrent processes.
+ *
+ * \note Currently only supported for ELF modules on Linux.
+ */
+drsym_error_t
+drsym_set_index_cache_dir(const char *dir);
+
 /***************************************************************************
  * Line iteration
  */
@@ -38,6 +38,8 @@
 #include "dr_api.h"
 #include "drsyms.h"
 #include "drsyms_private.h"
+#include <stdlib.h> /* qsort */
+#include <string.h>
 
 void
 pool_init(mempool_t *pool, char *buf, size_t sz)
@@ -62,3 +64,49 @@ pool_alloc(mempool_t *pool, size_t sz)
     }
     return ret;
 }
+
+/* qsort has no context parameter so we sort pointers into the entries */
+static int
+compare_batch_entries(const void *a_in, const void *b_in)
+{
+    const drsym_batch_entry_t *a = *(const drsym_batch_entry_t **) a_in;
+    const drsym_batch_entry_t *b = *(const drsym_batch_entry_t **) b_in;
+    int cmp;
+    if (a->modpath != b->modpath) {
+        if (a->modpath == NULL || b->modpath == NULL)
+            return (a->modpath == NULL) ? -1 : 1;
+        cmp = strcmp(a->modpath, b->modpath);
+        if (cmp != 0)
+            return cmp;
+    }
+    if (a->modoffs != b->modoffs)
+        return (a->modoffs < b->modoffs) ? -1 : 1;
+    /* Keep the order stable */
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+size_t *
+drsym_batch_order(drsym_batch_entry_t *entries, size_t count)
+{
+    drsym_batch_entry_t **sorted;
+    size_t *order;
+    size_t i;
+    if (count == 0)
+        return NULL;
+    sorted = dr_global_alloc(count * sizeof(*sorted));
+    for (i = 0; i < count; i++)
+        sorted[i] = &entries[i];
+    qsort(sorted, count, sizeof(*sorted), compare_batch_entries);
+    order = dr_global_alloc(count * sizeof(*order));
+    for (i = 0; i < count; i++)
+        order[i] = sorted[i] - entries;
+    dr_global_free(sorted, count * sizeof(*sorted));
+    return order;
+}
+
+void
+drsym_batch_order_free(size_t *order, size_t count)
+{
+    if (order != NULL)
+        dr_global_free(order, count * sizeof(*order));
+}
@@ -37,6 +37,7 @@
 #include "dr_api.h"
 #include "drsyms.h"
 #include "drsyms_private.h"
+#include "drsyms_obj.h"
 
 #include "dwarf.h"
 #include "libdwarf.h"
@@ -53,13 +54,42 @@ static bool verbose = false;
     } \
 } while (0)
 
+/* Values of cu_info_t.num_lines other than a count */
+#define CU_LINES_UNREAD -1
+#define CU_LINES_NONE   -2
+
+typedef struct _cu_info_t {
+    Dwarf_Off die_offs;
+    /* Both 0 if the CU has no lowpc+highpc */
+    Dwarf_Addr lo_pc;
+    Dwarf_Addr hi_pc;
+    /* The CU's line table sorted by address, read on first use */
+    Dwarf_Line *lines;
+    Dwarf_Addr *line_addrs;
+    Dwarf_Signed num_lines;
+} cu_info_t;
+
+/* An entry in the table of CU address ranges sorted by lo_pc */
+typedef struct _cu_range_t {
+    Dwarf_Addr lo_pc;
+    /* The maximum hi_pc of this and all prior entries, to bound the search
+     * for CUs containing an address.
+     */
+    Dwarf_Addr max_hi_pc;
+    uint cu;
+} cu_range_t;
+
 typedef struct _dwarf_module_t {
     byte *load_base;
     Dwarf_Debug dbg;
-    /* we cache the last CU we looked up */
-    Dwarf_Die lines_cu;
-    Dwarf_Line *lines;
-    Dwarf_Signed num_lines;
+    /* All CUs in .debug_info order (and thus sorted by die_offs), built on the
+     * first query so we don't walk every CU header on each lookup.
+     */
+    bool cus_built;
+    cu_info_t *cus;
+    uint num_cus;
+    cu_range_t *ranges;
+    uint num_ranges;
     /* Amount to adjust all offsets for __PAGEZERO + PIE (i#1365) */
     ssize_t offs_adjust;
 } dwarf_module_t;
@@ -71,7 +101,7 @@ typedef enum {
 } search_result_t;
 
 static search_result_t
-search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, Dwarf_Die cu_die,
+search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, uint cu,
                        drsym_info_t *sym_info INOUT);
 
 /******************************************************************************
@@ -100,84 +130,180 @@ next_die_matching_tag(Dwarf_Debug dbg, Dwarf_Tag search_tag)
     return die;
 }
 
-/* Iterate over all the CUs in the module to find the CU containing the given
- * PC.
+static int
+compare_cu_ranges(const void *a_in, const void *b_in)
+{
+    const cu_range_t *a = (const cu_range_t *) a_in;
+    const cu_range_t *b = (const cu_range_t *) b_in;
+    if (a->lo_pc != b->lo_pc)
+        return (a->lo_pc < b->lo_pc) ? -1 : 1;
+    if (a->cu != b->cu)
+        return (a->cu < b->cu) ? -1 : 1;
+    return 0;
+}
+
+/* Walks all the CU headers once and records each CU's DIE offset and its
+ * lowpc+highpc range, if any, in a table sorted by lowpc.
  */
-static Dwarf_Die
-find_cu_die_via_iter(Dwarf_Debug dbg, Dwarf_Addr pc)
+static void
+build_cu_table(dwarf_module_t *mod)
 {
-    Dwarf_Die die = NULL;
+    Dwarf_Die die;
     Dwarf_Unsigned cu_offset = 0;
     Dwarf_Error de; /* expensive to init (DrM#1770) */
-    Dwarf_Die cu_die = NULL;
+    uint capacity = 0, i;
+    Dwarf_Addr max_hi_pc = 0;
 
-    while (dwarf_next_cu_header(dbg, NULL, NULL, NULL, NULL,
+    mod->cus_built = true;
+    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
                                 &cu_offset, &de) == DW_DLV_OK) {
+        cu_info_t *cu;
         /* Scan forward in the tag soup for a CU DIE. */
-        die = next_die_matching_tag(dbg, DW_TAG_compile_unit);
-
-        /* We found a CU die, now check if it's the one we wanted. */
-        if (die != NULL) {
-            Dwarf_Addr lo_pc, hi_pc;
-            if (dwarf_lowpc(die, &lo_pc, &de) != DW_DLV_OK ||
-                dwarf_highpc(die, &hi_pc, &de) != DW_DLV_OK) {
-                NOTIFY_DWARF(de);
-                break;
+        die = next_die_matching_tag(mod->dbg, DW_TAG_compile_unit);
+        if (die == NULL)
+            continue;
+        if (mod->num_cus == capacity) {
+            uint new_capacity = (capacity == 0) ? 64 : capacity * 2;
+            cu_info_t *new_cus = dr_global_alloc(new_capacity * sizeof(*new_cus));
+            if (mod->cus != NULL) {
+                memcpy(new_cus, mod->cus, mod->num_cus * sizeof(*new_cus));
+                dr_global_free(mod->cus, capacity * sizeof(*mod->cus));
             }
+            mod->cus = new_cus;
+            capacity = new_capacity;
+        }
+        cu = &mod->cus[mod->num_cus];
+        memset(cu, 0, sizeof(*cu));
+        cu->num_lines = CU_LINES_UNREAD;
+        if (dwarf_dieoffset(die, &cu->die_offs, &de) != DW_DLV_OK) {
+            NOTIFY_DWARF(de);
+            continue;
+        }
+        /* Cygwin and MinGW gcc and clang don't seem to include lowpc+highpc
+         * in their CU's.  We still record the CU for a full search.
+         */
+        if (dwarf_lowpc(die, &cu->lo_pc, &de) != DW_DLV_OK ||
+            dwarf_highpc(die, &cu->hi_pc, &de) != DW_DLV_OK ||
+            cu->hi_pc <= cu->lo_pc) {
+            cu->lo_pc = 0;
+            cu->hi_pc = 0;
+        } else
+            mod->num_ranges++;
+        mod->num_cus++;
+    }
+    /* Shrink to fit so we can free with the right size */
+    if (mod->cus != NULL && mod->num_cus < capacity) {
+        cu_info_t *new_cus = NULL;
+        if (mod->num_cus > 0) {
+            new_cus = dr_global_alloc(mod->num_cus * sizeof(*new_cus));
+            memcpy(new_cus, mod->cus, mod->num_cus * sizeof(*new_cus));
+        }
+        dr_global_free(mod->cus, capacity * sizeof(*mod->cus));
+        mod->cus = new_cus;
+    }
 
-            if (lo_pc <= pc && pc < hi_pc) {
-                cu_die = die;
-                break;
-            }
+    if (mod->num_ranges == 0)
+        return;
+    mod->ranges = dr_global_alloc(mod->num_ranges * sizeof(*mod->ranges));
+    mod->num_ranges = 0;
+    for (i = 0; i < mod->num_cus; i++) {
+        if (mod->cus[i].hi_pc != 0) {
+            mod->ranges[mod->num_ranges].lo_pc = mod->cus[i].lo_pc;
+            mod->ranges[mod->num_ranges].cu = i;
+            mod->num_ranges++;
         }
     }
+    qsort(mod->ranges, mod->num_ranges, sizeof(*mod->ranges), compare_cu_ranges);
+    for (i = 0; i < mod->num_ranges; i++) {
+        Dwarf_Addr hi_pc = mod->cus[mod->ranges[i].cu].hi_pc;
+        if (hi_pc > max_hi_pc)
+            max_hi_pc = hi_pc;
+        mod->ranges[i].max_hi_pc = max_hi_pc;
+    }
+}
 
-    while (dwarf_next_cu_header(dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Reset the internal CU header state. */
+/* Returns the index of the CU with the given DIE offset, or -1 */
+static int
+cu_from_die_offs(dwarf_module_t *mod, Dwarf_Off die_offs)
+{
+    uint lo = 0, hi = mod->num_cus;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (mod->cus[mid].die_offs == die_offs)
+            return (int) mid;
+        if (mod->cus[mid].die_offs < die_offs)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    return -1;
+}
 
-    return cu_die;
+/* Returns the index of the first CU in .debug_info order whose lowpc+highpc
+ * contains pc, or -1.
+ */
+static int
+find_cu_via_ranges(dwarf_module_t *mod, Dwarf_Addr pc)
+{
+    uint lo = 0, hi = mod->num_ranges, i;
+    int best = -1;
+    /* Find the number of ranges starting at or before pc */
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (mod->ranges[mid].lo_pc <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (i = lo; i > 0 && mod->ranges[i - 1].max_hi_pc > pc; i--) {
+        uint cu = mod->ranges[i - 1].cu;
+        if (pc < mod->cus[cu].hi_pc && (best < 0 || cu < (uint) best))
+            best = (int) cu;
+    }
+    return best;
 }
 
-static Dwarf_Die
-find_cu_die(Dwarf_Debug dbg, Dwarf_Addr pc)
+/* Returns the index of the CU containing pc, or -1 */
+static int
+find_cu(dwarf_module_t *mod, Dwarf_Addr pc)
 {
     Dwarf_Error de; /* expensive to init (DrM#1770) */
-    Dwarf_Die cu_die = NULL;
     Dwarf_Arange *arlist;
     Dwarf_Signed arcnt;
     Dwarf_Arange ar;
     Dwarf_Off die_offs;
-    if (dwarf_get_aranges(dbg, &arlist, &arcnt, &de) != DW_DLV_OK ||
+    int cu = -1;
+    if (!mod->cus_built)
+        build_cu_table(mod);
+    if (dwarf_get_aranges(mod->dbg, &arlist, &arcnt, &de) != DW_DLV_OK ||
         dwarf_get_arange(arlist, arcnt, pc, &ar, &de) != DW_DLV_OK ||
         dwarf_get_cu_die_offset(ar, &die_offs, &de) != DW_DLV_OK ||
-        dwarf_offdie(dbg, die_offs, &cu_die, &de) != DW_DLV_OK) {
+        (cu = cu_from_die_offs(mod, die_offs)) < 0) {
         NOTIFY_DWARF(de);
-        /* Try to find it by walking all CU's and looking at their lowpc+highpc
-         * entries, which should work if each has a single contiguous
-         * range.  Note that Cygwin and MinGW gcc don't seen to include
-         * lowpc+highpc in their CU's.
+        /* Try to find it via the CUs' lowpc+highpc entries, which should work
+         * if each has a single contiguous range.
          */
-        cu_die = find_cu_die_via_iter(dbg, pc);
+        cu = find_cu_via_ranges(mod, pc);
     }
-    return cu_die;
+    return cu;
 }
 
+typedef struct _sort_line_t {
+    Dwarf_Addr addr;
+    Dwarf_Line line;
+    Dwarf_Signed idx;
+} sort_line_t;
+
 static int
 compare_lines(const void *a_in, const void *b_in)
 {
-    const Dwarf_Line a = *(const Dwarf_Line *)a_in;
-    const Dwarf_Line b = *(const Dwarf_Line *)b_in;
-    Dwarf_Addr addr_a, addr_b;
-    Dwarf_Error de; /* expensive to init (DrM#1770) */
-    if (dwarf_lineaddr(a, &addr_a, &de) != DW_DLV_OK ||
-        dwarf_lineaddr(b, &addr_b, &de) != DW_DLV_OK)
-        return 0;
-    if (addr_a > addr_b)
-        return 1;
-    if (addr_a < addr_b)
-        return -1;
+    const sort_line_t *a = (const sort_line_t *) a_in;
+    const sort_line_t *b = (const sort_line_t *) b_in;
+    if (a->addr != b->addr)
+        return (a->addr > b->addr) ? 1 : -1;
+    /* Keep the original order for equal addresses */
+    if (a->idx != b->idx)
+        return (a->idx > b->idx) ? 1 : -1;
     return 0;
 }
 
@@ -187,11 +313,10 @@ bool
 drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info INOUT)
 {
     dwarf_module_t *mod = (dwarf_module_t *) mod_in;
-    Dwarf_Error de; /* expensive to init (DrM#1770) */
-    Dwarf_Die cu_die;
-    Dwarf_Unsigned cu_offset = 0;
     bool success = false;
     search_result_t res;
+    int cu;
+    uint i;
 
     pc += mod->offs_adjust;
 
@@ -206,118 +331,150 @@ drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info
     /* First try cutting down the search space by finding the CU (i.e., the .c
      * file) that this function belongs to.
      */
-    cu_die = find_cu_die(mod->dbg, pc);
-    if (cu_die == NULL) {
+    cu = find_cu(mod, pc);
+    if (cu < 0) {
         NOTIFY("%s: failed to find CU die for "PFX", searching all CUs\n",
                __FUNCTION__, (ptr_uint_t)pc);
     } else {
-        return (search_addr2line_in_cu(mod, pc, cu_die, sym_info) != SEARCH_NOT_FOUND);
+        return (search_addr2line_in_cu(mod, pc, (uint) cu, sym_info) !=
+                SEARCH_NOT_FOUND);
     }
 
     /* We failed to find a CU containing this PC.  Some compilers (clang) don't
      * put lo_pc hi_pc attributes on compilation units.  In this case, we
-     * iterate all the CUs and dig into the dwarf tag soup for all of them.
+     * search the line tables of all the CUs, which are cached after the
+     * first such search.
      */
-    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Scan forward in the tag soup for a CU DIE. */
-        cu_die = next_die_matching_tag(mod->dbg, DW_TAG_compile_unit);
-
-        /* We found a CU die, now check if it's the one we wanted. */
-        if (cu_die != NULL) {
-            res = search_addr2line_in_cu(mod, pc, cu_die, sym_info);
-            if (res == SEARCH_FOUND) {
-                success = true;
-                break;
-            } else if (res == SEARCH_MAYBE) {
-                success = true;
-                /* try to find a better fit: continue searching */
-            }
+    for (i = 0; i < mod->num_cus; i++) {
+        res = search_addr2line_in_cu(mod, pc, i, sym_info);
+        if (res == SEARCH_FOUND) {
+            success = true;
+            break;
+        } else if (res == SEARCH_MAYBE) {
+            success = true;
+            /* try to find a better fit: continue searching */
         }
     }
 
-    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Reset the internal CU header state. */
-    }
-
     return success;
 }
 
+static Dwarf_Die
+get_cu_die(dwarf_module_t *mod, uint cu)
+{
+    Dwarf_Die cu_die;
+    Dwarf_Error de; /* expensive to init (DrM#1770) */
+    if (dwarf_offdie(mod->dbg, mod->cus[cu].die_offs, &cu_die, &de) != DW_DLV_OK) {
+        NOTIFY_DWARF(de);
+        return NULL;
+    }
+    return cu_die;
+}
+
+/* Returns the CU's lines sorted by address, reading and sorting them on the
+ * first call for each CU.
+ */
 static Dwarf_Signed
-get_lines_from_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
-                  Dwarf_Line **lines_out OUT)
+get_lines_from_cu(dwarf_module_t *mod, uint cu,
+                  Dwarf_Line **lines_out OUT, Dwarf_Addr **addrs_out OUT)
 {
-    if (mod->lines_cu != cu_die) {
+    cu_info_t *info = &mod->cus[cu];
+    if (info->num_lines == CU_LINES_UNREAD) {
         Dwarf_Line *lines;
-        Dwarf_Signed num_lines;
+        Dwarf_Signed num_lines, i;
         Dwarf_Error de; /* expensive to init (DrM#1770) */
-        if (dwarf_srclines(cu_die, &lines, &num_lines, &de) != DW_DLV_OK) {
+        Dwarf_Die cu_die = get_cu_die(mod, cu);
+        sort_line_t *sorted;
+        info->num_lines = CU_LINES_NONE;
+        if (cu_die == NULL ||
+            dwarf_srclines(cu_die, &lines, &num_lines, &de) != DW_DLV_OK) {
             NOTIFY_DWARF(de);
             return -1;
         }
         /* XXX: we should fix libelftc to sort as it builds the table but for now
-         * it's easier to sort and store here
+         * it's easier to sort and store here.  We extract the addresses once
+         * so that sorting and searching do not call into libdwarf.
          */
-        qsort(lines, (size_t)num_lines, sizeof(*lines), compare_lines);
-        /* Save for next query */
-        dwarf_srclines_dealloc(mod->dbg, mod->lines, mod->num_lines);
-        mod->lines_cu = cu_die;
-        mod->lines = lines;
-        mod->num_lines = num_lines;
+        info->line_addrs = NULL;
+        if (num_lines > 0) {
+            sorted = dr_global_alloc((size_t)num_lines * sizeof(*sorted));
+            for (i = 0; i < num_lines; i++) {
+                sorted[i].line = lines[i];
+                sorted[i].idx = i;
+                if (dwarf_lineaddr(lines[i], &sorted[i].addr, &de) != DW_DLV_OK) {
+                    NOTIFY_DWARF(de);
+                    sorted[i].addr = 0;
+                }
+            }
+            qsort(sorted, (size_t)num_lines, sizeof(*sorted), compare_lines);
+            info->line_addrs = dr_global_alloc((size_t)num_lines *
+                                               sizeof(*info->line_addrs));
+            for (i = 0; i < num_lines; i++) {
+                lines[i] = sorted[i].line;
+                info->line_addrs[i] = sorted[i].addr;
+            }
+            dr_global_free(sorted, (size_t)num_lines * sizeof(*sorted));
+        }
+        info->lines = lines;
+        info->num_lines = num_lines;
     }
-    *lines_out = mod->lines;
-    return mod->num_lines;
+    if (info->num_lines < 0)
+        return -1;
+    *lines_out = info->lines;
+    if (addrs_out != NULL)
+        *addrs_out = info->line_addrs;
+    return info->num_lines;
 }
 
 static search_result_t
-search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, Dwarf_Die cu_die,
+search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, uint cu,
                        drsym_info_t *sym_info INOUT)
 {
     Dwarf_Line *lines;
-    Dwarf_Signed num_lines;
-    int i;
-    Dwarf_Addr lineaddr, next_lineaddr = 0;
+    Dwarf_Addr *addrs;
+    Dwarf_Signed num_lines, lo, hi;
+    Dwarf_Addr lineaddr;
     Dwarf_Line dw_line;
     Dwarf_Error de; /* expensive to init (DrM#1770) */
     search_result_t res = SEARCH_NOT_FOUND;
 
-    num_lines = get_lines_from_cu(mod, cu_die, &lines);
-    if (num_lines < 0)
+    num_lines = get_lines_from_cu(mod, cu, &lines, &addrs);
+    if (num_lines <= 0)
         return SEARCH_NOT_FOUND;
 
     if (verbose) {
         char *name;
-        if (dwarf_diename(cu_die, &name, &de) == DW_DLV_OK) {
+        Dwarf_Die cu_die = get_cu_die(mod, cu);
+        if (cu_die != NULL && dwarf_diename(cu_die, &name, &de) == DW_DLV_OK) {
             NOTIFY("%s: searching cu %s for pc 0"PFX"\n",
                    __FUNCTION__, name, (ptr_uint_t)pc);
         }
     }
 
-    /* We could binary search this, but we assume dwarf_srclines is the
-     * bottleneck.
-     */
-    dw_line = NULL;
-    for (i = 0; i < num_lines - 1; i++) {
-        if (dwarf_lineaddr(lines[i], &lineaddr, &de) != DW_DLV_OK ||
-            dwarf_lineaddr(lines[i + 1], &next_lineaddr, &de) != DW_DLV_OK) {
-            NOTIFY_DWARF(de);
-            break;
-        }
-        NOTIFY("%s: pc "PFX" vs line "PFX"-"PFX"\n", __FUNCTION__, (ptr_uint_t)pc,
-               (ptr_uint_t)lineaddr, (ptr_uint_t)next_lineaddr);
-        if (lineaddr <= pc && pc < next_lineaddr) {
-            dw_line = lines[i];
-            res = SEARCH_FOUND;
-            break;
-        }
+    /* Find the last line starting at or before pc. */
+    lo = 0;
+    hi = num_lines;
+    while (lo < hi) {
+        Dwarf_Signed mid = lo + (hi - lo) / 2;
+        if (addrs[mid] <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    /* Handle the case when the PC is from the last line of the CU. */
-    if (i == num_lines - 1 && dw_line == NULL && next_lineaddr <= pc) {
+    dw_line = NULL;
+    if (num_lines == 1 || lo == num_lines) {
+        /* Handle the case when the PC is from the last line of the CU.
+         * We have no end address so this is only a possible match.
+         */
         NOTIFY("%s: pc "PFX" vs last line "PFX"\n",
-               __FUNCTION__, (ptr_uint_t)pc, (ptr_uint_t)next_lineaddr);
+               __FUNCTION__, (ptr_uint_t)pc, (ptr_uint_t)addrs[num_lines - 1]);
         dw_line = lines[num_lines - 1];
         res = SEARCH_MAYBE;
+    } else if (lo > 0) {
+        NOTIFY("%s: pc "PFX" vs line "PFX"-"PFX"\n", __FUNCTION__, (ptr_uint_t)pc,
+               (ptr_uint_t)addrs[lo - 1], (ptr_uint_t)addrs[lo]);
+        dw_line = lines[lo - 1];
+        res = SEARCH_FOUND;
     }
 
     /* If we found dw_line, use it to fill out sym_info. */
@@ -351,28 +508,30 @@ search_addr2line_in_cu(dwarf_module_t *mod, Dwarf_Addr pc, Dwarf_Die cu_die,
  * -1 means error.
  */
 static int
-enumerate_lines_in_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
-                      drsym_enumerate_lines_cb callback, void *data)
+enumerate_lines_in_cu(dwarf_module_t *mod, uint cu,
+                      drsym_enumerate_lines_ex_cb callback, void *data)
 {
     Dwarf_Line *lines;
     Dwarf_Signed num_lines;
     int i;
     Dwarf_Error de; /* expensive to init (DrM#1770) */
     drsym_line_info_t info;
+    Dwarf_Die cu_die = get_cu_die(mod, cu);
 
-    if (dwarf_diename(cu_die, (char **) &info.cu_name, &de) != DW_DLV_OK) {
+    if (cu_die == NULL ||
+        dwarf_diename(cu_die, (char **) &info.cu_name, &de) != DW_DLV_OK) {
         /* i#1477: it is possible that a DIE entrie has a NULL name */
         info.cu_name = NULL;
         NOTIFY_DWARF(de);
     }
 
-    num_lines = get_lines_from_cu(mod, cu_die, &lines);
+    num_lines = get_lines_from_cu(mod, cu, &lines, NULL);
     if (num_lines < 0) {
         /* This cu has no line info.  Don't bail: keep going. */
         info.file = NULL;
         info.line = 0;
         info.line_addr = 0;
-        if (!(*callback)(&info, data))
+        if (!(*callback)(&info, false, data))
             return 0;
         return 1;
     }
@@ -380,6 +539,7 @@ enumerate_lines_in_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
     for (i = 0; i < num_lines; i++) {
         Dwarf_Unsigned lineno;
         Dwarf_Addr lineaddr;
+        Dwarf_Bool end_sequence;
 
         /* We do not want to bail on failure of any of these: we want to
          * provide as much information as possible.
@@ -402,7 +562,11 @@ enumerate_lines_in_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
             info.line_addr = (size_t)
                 (lineaddr - (Dwarf_Addr)(ptr_uint_t)mod->load_base - mod->offs_adjust);
         }
-        if (!(*callback)(&info, data))
+        if (dwarf_lineendsequence(lines[i], &end_sequence, &de) != DW_DLV_OK) {
+            NOTIFY_DWARF(de);
+            end_sequence = false;
+        }
+        if (!(*callback)(&info, end_sequence != 0, data))
             return 0;
     }
 
@@ -410,36 +574,46 @@ enumerate_lines_in_cu(dwarf_module_t *mod, Dwarf_Die cu_die,
 }
 
 drsym_error_t
-drsym_dwarf_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data)
+drsym_dwarf_enumerate_lines_ex(void *mod_in, drsym_enumerate_lines_ex_cb callback,
+                               void *data)
 {
     drsym_error_t success = DRSYM_SUCCESS;
     dwarf_module_t *mod = (dwarf_module_t *) mod_in;
-    Dwarf_Error de; /* expensive to init (DrM#1770) */
-    Dwarf_Die cu_die;
-    Dwarf_Unsigned cu_offset = 0;
+    uint i;
 
+    if (!mod->cus_built)
+        build_cu_table(mod);
     /* Enumerate all CU's */
-    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Scan forward in the tag soup for a CU DIE. */
-        cu_die = next_die_matching_tag(mod->dbg, DW_TAG_compile_unit);
-        if (cu_die != NULL) {
-            int res = enumerate_lines_in_cu(mod, cu_die, callback, data);
-            if (res < 0)
-                success = DRSYM_ERROR_LINE_NOT_AVAILABLE;
-            if (res <= 0)
-                break;
-        }
-    }
-
-    while (dwarf_next_cu_header(mod->dbg, NULL, NULL, NULL, NULL,
-                                &cu_offset, &de) == DW_DLV_OK) {
-        /* Reset the internal CU header state. */
+    for (i = 0; i < mod->num_cus; i++) {
+        int res = enumerate_lines_in_cu(mod, i, callback, data);
+        if (res < 0)
+            success = DRSYM_ERROR_LINE_NOT_AVAILABLE;
+        if (res <= 0)
+            break;
     }
 
     return success;
 }
 
+typedef struct _enum_lines_data_t {
+    drsym_enumerate_lines_cb callback;
+    void *data;
+} enum_lines_data_t;
+
+static bool
+enumerate_lines_cb(drsym_line_info_t *info, bool end_sequence, void *data)
+{
+    enum_lines_data_t *enum_data = (enum_lines_data_t *) data;
+    return (*enum_data->callback)(info, enum_data->data);
+}
+
+drsym_error_t
+drsym_dwarf_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data)
+{
+    enum_lines_data_t enum_data = {callback, data};
+    return drsym_dwarf_enumerate_lines_ex(mod_in, enumerate_lines_cb, &enum_data);
+}
+
 void *
 drsym_dwarf_init(Dwarf_Debug dbg)
 {
@@ -453,8 +627,21 @@ void
 drsym_dwarf_exit(void *mod_in)
 {
     dwarf_module_t *mod = (dwarf_module_t *) mod_in;
-    if (mod->lines != NULL)
-        dwarf_srclines_dealloc(mod->dbg, mod->lines, mod->num_lines);
+    uint i;
+    for (i = 0; i < mod->num_cus; i++) {
+        cu_info_t *cu = &mod->cus[i];
+        if (cu->num_lines >= 0) {
+            dwarf_srclines_dealloc(mod->dbg, cu->lines, cu->num_lines);
+            if (cu->line_addrs != NULL) {
+                dr_global_free(cu->line_addrs,
+                               (size_t)cu->num_lines * sizeof(*cu->line_addrs));
+            }
+        }
+    }
+    if (mod->cus != NULL)
+        dr_global_free(mod->cus, mod->num_cus * sizeof(*mod->cus));
+    if (mod->ranges != NULL)
+        dr_global_free(mod->ranges, mod->num_ranges * sizeof(*mod->ranges));
     dwarf_finish(mod->dbg, NULL);
     dr_global_free(mod, sizeof(*mod));
 }
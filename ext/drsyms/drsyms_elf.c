@@ -327,6 +327,38 @@ drsym_obj_debuglink_section(void *mod_in, const char *modpath)
     return ((char*) mod->map_base) + section_header->sh_offset;
 }
 
+const byte *
+drsym_obj_build_id(void *mod_in, uint *len OUT)
+{
+    elf_info_t *mod = (elf_info_t *) mod_in;
+    Elf_Shdr *section_header;
+    Elf_Scn *scn = find_elf_section_by_name(mod->elf, ".note.gnu.build-id");
+    /* The note is a header of three 4-byte fields (namesz, descsz, type)
+     * followed by the name "GNU" and then the build id itself, each
+     * padded to 4-byte alignment.
+     */
+    const uint *note;
+    uint namesz, descsz;
+    if (scn == NULL)
+        return NULL;
+    section_header = elf_getshdr(scn);
+    if (section_header == NULL) {
+        NOTIFY_ELF("elf_getshdr .note.gnu.build-id");
+        return NULL;
+    }
+    if (section_header->sh_size < 3 * sizeof(uint))
+        return NULL;
+    note = (const uint *) (mod->map_base + section_header->sh_offset);
+    namesz = note[0];
+    descsz = note[1];
+    if (note[2] != NT_GNU_BUILD_ID || descsz == 0 ||
+        3 * sizeof(uint) + ALIGN_FORWARD(namesz, 4) + descsz >
+        section_header->sh_size)
+        return NULL;
+    *len = descsz;
+    return (const byte *) (note + 3) + ALIGN_FORWARD(namesz, 4);
+}
+
 uint
 drsym_obj_num_symbols(void *mod_in)
 {
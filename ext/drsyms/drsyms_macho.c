@@ -494,6 +494,16 @@ drsym_obj_debuglink_section(void *mod_in, const char *modpath)
     return NULL;
 }
 
+const byte *
+drsym_obj_build_id(void *mod_in, uint *len OUT)
+{
+    /* XXX: we could return the LC_UUID, but the persistent index's
+     * address search follows ELF symbol semantics rather than our
+     * sorted-symbol search here.
+     */
+    return NULL;
+}
+
 uint
 drsym_obj_num_symbols(void *mod_in)
 {
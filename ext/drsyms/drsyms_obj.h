@@ -78,6 +78,13 @@ drsym_obj_load_base(void *mod_in);
 const char *
 drsym_obj_debuglink_section(void *mod_in, const char *modpath);
 
+/* Returns the unique build identifier of the object, if it has one, and its
+ * length in *len.  The returned bytes live as long as the mapping passed to
+ * drsym_obj_mod_init_pre().
+ */
+const byte *
+drsym_obj_build_id(void *mod_in, uint *len OUT);
+
 uint
 drsym_obj_num_symbols(void *mod_in);
 
@@ -123,4 +130,14 @@ drsym_dwarf_search_addr2line(void *mod_in, Dwarf_Addr pc, drsym_info_t *sym_info
 drsym_error_t
 drsym_dwarf_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data);
 
+/* Like drsym_enumerate_lines_cb, plus whether the line ends a sequence: its
+ * address is then the first one past the code the sequence covers.
+ */
+typedef bool (*drsym_enumerate_lines_ex_cb)(drsym_line_info_t *info, bool end_sequence,
+                                            void *data);
+
+drsym_error_t
+drsym_dwarf_enumerate_lines_ex(void *mod_in, drsym_enumerate_lines_ex_cb callback,
+                               void *data);
+
 #endif /* DRSYMS_ARCH_H */
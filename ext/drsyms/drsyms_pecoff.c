@@ -312,6 +312,13 @@ drsym_obj_debuglink_section(void *mod_in, const char *modpath)
     return (const char *) mod->debuglink;
 }
 
+const byte *
+drsym_obj_build_id(void *mod_in, uint *len OUT)
+{
+    /* XXX: we could use the CodeView GUID+age, but MinGW does not emit it */
+    return NULL;
+}
+
 /* caller holds lock */
 static const char *
 drsym_pecoff_symbol_name(pecoff_data_t *mod, IMAGE_SYMBOL *sym)
@@ -79,6 +79,13 @@ void *pool_alloc(mempool_t *pool, size_t sz);
 #define POOL_ALLOC_SIZE(pool, type, size) \
     ((type*)pool_alloc(pool, (size)))
 
+/* Returns an array of indices into entries ordered by module path and then
+ * by offset, which the caller must free with drsym_batch_order_free().
+ */
+size_t *drsym_batch_order(drsym_batch_entry_t *entries, size_t count);
+
+void drsym_batch_order_free(size_t *order, size_t count);
+
 /***************************************************************************
  * Cygwin interface from Unix to Windows
  * For all of these, the caller is responsible for synchronization
@@ -132,4 +139,7 @@ drsym_unix_get_module_debug_kind(void *moddata, drsym_debug_kind_t *kind OUT);
 drsym_error_t
 drsym_unix_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data);
 
+drsym_error_t
+drsym_unix_set_index_dir(const char *dir);
+
 #endif /* DRSYMS_PRIVATE_H */
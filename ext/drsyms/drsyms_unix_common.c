@@ -45,9 +45,11 @@
 #include <string.h> /* strlen */
 #include <errno.h>
 #include <stddef.h> /* offsetof */
+#include <stdlib.h> /* qsort */
 
 #include "demangle.h"
 #include "libelftc.h"
+#include "hashtable.h"
 
 #ifdef WINDOWS
 # define IF_WINDOWS(x) x
@@ -71,6 +73,13 @@ typedef struct _dbg_module_t {
      * while the primary mod has symtab+strtab.
      */
     struct _dbg_module_t *mod_with_dwarf;
+    /* If non-NULL, symbol and address queries are answered from this persistent
+     * index and the fields above other than debug_kind are unused.  Queries the
+     * index does not cover load the full debug info into unindexed on demand.
+     */
+    struct _drsym_index_t *index;
+    char *modpath;
+    struct _dbg_module_t *unindexed;
 } dbg_module_t;
 
 /******************************************************************************
@@ -78,6 +87,7 @@ typedef struct _dbg_module_t {
  */
 
 static void unload_module(dbg_module_t *mod);
+static void index_unload(struct _drsym_index_t *index);
 static bool follow_debuglink(const char * modpath, dbg_module_t *mod,
                              const char *debuglink, char debug_modpath[MAXIMUM_PATH]);
 
@@ -298,9 +308,753 @@ unload_module(dbg_module_t *mod)
         dr_close_file(mod->fd);
     if (mod->mod_with_dwarf != NULL)
         unload_module(mod->mod_with_dwarf);
+    if (mod->index != NULL)
+        index_unload(mod->index);
+    if (mod->modpath != NULL)
+        dr_global_free(mod->modpath, strlen(mod->modpath) + 1);
+    if (mod->unindexed != NULL)
+        unload_module(mod->unindexed);
     dr_global_free(mod, sizeof(*mod));
 }
 
+/******************************************************************************
+ * Persistent index
+ *
+ * To avoid re-parsing the symbol table and DWARF in every process, we can
+ * save the sorted symbol ranges, symbol names, and line table of a module
+ * into a file in a cache directory and map that file in later runs.  The
+ * file is named by the module's build id and size and is only used if
+ * both match.  It is in the native layout, so it is only valid for the
+ * architecture that wrote it.
+ */
+
+#define INDEX_MAGIC 0x49535244 /* "DRSI" */
+#define INDEX_VERSION 3
+#define INDEX_MAX_BUILD_ID 64
+#define INDEX_ALIGN 8
+
+/* Symbol is an import with no offset */
+#define INDEX_SYM_IMPORT 0x1
+
+/* Compilation unit without line info, reported as such by enumeration */
+#define INDEX_CU_NO_LINES 0x1
+
+/* Line ends a sequence: its address is the first one past the sequence's code */
+#define INDEX_LINE_END_SEQUENCE 0x1
+
+/* String offset standing for a NULL name */
+#define INDEX_NO_NAME ((uint)-1)
+
+typedef struct _index_key_t {
+    /* Struct layouts differ between 32-bit and 64-bit builds */
+    uint pointer_size;
+    uint64 file_size;
+    uint build_id_len;
+    byte build_id[INDEX_MAX_BUILD_ID];
+} index_key_t;
+
+typedef struct _index_header_t {
+    uint magic;
+    uint version;
+    index_key_t key;
+    uint debug_kind;
+    uint num_syms;
+    uint num_sorted;
+    uint num_lines;
+    uint num_files;
+    uint num_cus;
+    uint64 total_size;
+    /* Offsets from the start of the file of each table */
+    uint64 syms_offs;    /* index_sym_t[num_syms], in symbol table order */
+    uint64 sorted_offs;  /* index_sorted_t[num_sorted], non-imports by start */
+    uint64 lines_offs;   /* index_line_t[num_lines], sorted by addr */
+    uint64 files_offs;   /* uint[num_files] offsets into strings */
+    uint64 cus_offs;     /* index_cu_t[num_cus] */
+    uint64 strings_offs;
+    uint64 strings_size;
+} index_header_t;
+
+typedef struct _index_sym_t {
+    uint64 start;
+    uint64 end;
+    uint name; /* offset into strings */
+    uint flags;
+} index_sym_t;
+
+typedef struct _index_sorted_t {
+    uint64 start;
+    /* The maximum end of this and all prior entries, to bound the search
+     * for symbols containing an address.
+     */
+    uint64 max_end;
+    uint sym;
+    uint padding;
+} index_sorted_t;
+
+typedef struct _index_line_t {
+    uint64 addr;
+    uint line;
+    uint file; /* index into files */
+    uint cu;   /* index into cus */
+    uint flags;
+} index_line_t;
+
+typedef struct _index_cu_t {
+    uint name; /* offset into strings, or INDEX_NO_NAME */
+    uint flags;
+} index_cu_t;
+
+typedef struct _drsym_index_t {
+    file_t fd;
+    byte *map_base;
+    size_t map_size;
+    index_header_t *header;
+    index_sym_t *syms;
+    index_sorted_t *sorted;
+    index_line_t *lines;
+    uint *files;
+    index_cu_t *cus;
+    const char *strings;
+} drsym_index_t;
+
+/* Growable buffer used while building an index */
+typedef struct _index_buf_t {
+    byte *data;
+    size_t size;
+    size_t capacity;
+} index_buf_t;
+
+/* Empty if the index is disabled.  Protected by the caller's lock. */
+static char index_dir[MAXIMUM_PATH];
+
+static bool
+index_buf_append(index_buf_t *buf, const void *data, size_t size)
+{
+    if (buf->size + size > buf->capacity) {
+        size_t new_cap = (buf->capacity == 0) ? 4096 : buf->capacity * 2;
+        byte *new_data;
+        while (new_cap < buf->size + size)
+            new_cap *= 2;
+        new_data = dr_global_alloc(new_cap);
+        if (new_data == NULL)
+            return false;
+        if (buf->data != NULL) {
+            memcpy(new_data, buf->data, buf->size);
+            dr_global_free(buf->data, buf->capacity);
+        }
+        buf->data = new_data;
+        buf->capacity = new_cap;
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+    return true;
+}
+
+static void
+index_buf_free(index_buf_t *buf)
+{
+    if (buf->data != NULL)
+        dr_global_free(buf->data, buf->capacity);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/* Computes the cache file path for modpath.  Returns false if the module has
+ * no build id, in which case it cannot be indexed.
+ */
+static bool
+index_path_for_module(const char *modpath, index_key_t *key OUT,
+                      char index_path[MAXIMUM_PATH])
+{
+    file_t fd;
+    uint64 file_size;
+    size_t map_size;
+    byte *map_base;
+    void *obj_info;
+    const byte *build_id;
+    uint build_id_len = 0, i;
+    char *s;
+    bool res = false;
+
+    fd = dr_open_file(modpath, DR_FILE_READ);
+    if (fd == INVALID_FILE)
+        return false;
+    if (!dr_file_size(fd, &file_size)) {
+        dr_close_file(fd);
+        return false;
+    }
+    map_size = (size_t) file_size;
+    map_base = dr_map_file(fd, &map_size, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+    if (map_base == NULL || map_size < file_size) {
+        if (map_base != NULL)
+            dr_unmap_file(map_base, map_size);
+        dr_close_file(fd);
+        return false;
+    }
+    obj_info = drsym_obj_mod_init_pre(map_base, (size_t) file_size);
+    if (obj_info != NULL) {
+        build_id = drsym_obj_build_id(obj_info, &build_id_len);
+        if (build_id != NULL && build_id_len <= INDEX_MAX_BUILD_ID) {
+            memset(key, 0, sizeof(*key));
+            key->pointer_size = sizeof(void *);
+            key->file_size = file_size;
+            key->build_id_len = build_id_len;
+            memcpy(key->build_id, build_id, build_id_len);
+            s = index_path;
+            s += dr_snprintf(s, MAXIMUM_PATH, "%s/", index_dir);
+            for (i = 0; i < build_id_len && s + 3 < index_path + MAXIMUM_PATH; i++)
+                s += dr_snprintf(s, 3, "%02x", build_id[i]);
+            dr_snprintf(s, index_path + MAXIMUM_PATH - s, "-%llx.drsyms",
+                        (long long) file_size);
+            index_path[MAXIMUM_PATH-1] = '\0';
+            res = true;
+        }
+        drsym_obj_mod_exit(obj_info);
+    }
+    dr_unmap_file(map_base, map_size);
+    dr_close_file(fd);
+    return res;
+}
+
+static bool
+index_table_in_bounds(index_header_t *header, uint64 offs, uint64 count,
+                      size_t entry_size)
+{
+    return (offs <= header->total_size &&
+            count <= (header->total_size - offs) / entry_size);
+}
+
+static void
+index_unload(drsym_index_t *index)
+{
+    if (index->map_base != NULL)
+        dr_unmap_file(index->map_base, index->map_size);
+    if (index->fd != INVALID_FILE)
+        dr_close_file(index->fd);
+    dr_global_free(index, sizeof(*index));
+}
+
+static drsym_index_t *
+index_load(const char *index_path, index_key_t *key)
+{
+    drsym_index_t *index;
+    index_header_t *header;
+    uint64 file_size;
+
+    index = dr_global_alloc(sizeof(*index));
+    memset(index, 0, sizeof(*index));
+    index->fd = dr_open_file(index_path, DR_FILE_READ);
+    if (index->fd == INVALID_FILE)
+        goto error;
+    if (!dr_file_size(index->fd, &file_size) || file_size < sizeof(*header))
+        goto error;
+    index->map_size = (size_t) file_size;
+    index->map_base = dr_map_file(index->fd, &index->map_size, 0, NULL,
+                                  DR_MEMPROT_READ, DR_MAP_PRIVATE);
+    if (index->map_base == NULL || index->map_size < file_size)
+        goto error;
+    header = (index_header_t *) index->map_base;
+    if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION ||
+        memcmp(&header->key, key, sizeof(*key)) != 0 ||
+        header->total_size != file_size ||
+        !index_table_in_bounds(header, header->syms_offs, header->num_syms,
+                               sizeof(index_sym_t)) ||
+        !index_table_in_bounds(header, header->sorted_offs, header->num_sorted,
+                               sizeof(index_sorted_t)) ||
+        !index_table_in_bounds(header, header->lines_offs, header->num_lines,
+                               sizeof(index_line_t)) ||
+        !index_table_in_bounds(header, header->files_offs, header->num_files,
+                               sizeof(uint)) ||
+        !index_table_in_bounds(header, header->cus_offs, header->num_cus,
+                               sizeof(index_cu_t)) ||
+        !index_table_in_bounds(header, header->strings_offs, header->strings_size, 1) ||
+        header->strings_size == 0 ||
+        index->map_base[header->strings_offs + header->strings_size - 1] != '\0') {
+        NOTIFY("%s: stale or corrupt index %s\n", __FUNCTION__, index_path);
+        goto error;
+    }
+    index->header = header;
+    index->syms = (index_sym_t *) (index->map_base + header->syms_offs);
+    index->sorted = (index_sorted_t *) (index->map_base + header->sorted_offs);
+    index->lines = (index_line_t *) (index->map_base + header->lines_offs);
+    index->files = (uint *) (index->map_base + header->files_offs);
+    index->cus = (index_cu_t *) (index->map_base + header->cus_offs);
+    index->strings = (const char *) (index->map_base + header->strings_offs);
+    return index;
+
+ error:
+    index_unload(index);
+    return NULL;
+}
+
+static const char *
+index_string(drsym_index_t *index, uint offs)
+{
+    if (offs >= index->header->strings_size)
+        return NULL;
+    return index->strings + offs;
+}
+
+/* Follows the semantics of drsym_obj_addrsearch_symtab() for ELF: the first
+ * symbol in table order that contains modoffs, or else the closest preceding
+ * symbol if it has no size and a name (i#1337).
+ */
+static drsym_error_t
+index_addrsearch(drsym_index_t *index, size_t modoffs, uint *idx OUT)
+{
+    uint lo = 0, hi = index->header->num_sorted, i;
+    int best = -1;
+    /* Find the number of entries starting at or before modoffs */
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (index->sorted[mid].start <= modoffs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (i = lo; i > 0 && index->sorted[i - 1].max_end > modoffs; i--) {
+        index_sorted_t *entry = &index->sorted[i - 1];
+        if (modoffs < index->syms[entry->sym].end &&
+            (best < 0 || entry->sym < (uint) best))
+            best = entry->sym;
+    }
+    if (best < 0 && lo > 0) {
+        uint64 start = index->sorted[lo - 1].start;
+        const char *name;
+        for (i = lo; i > 0 && index->sorted[i - 1].start == start; i--) {
+            if (best < 0 || index->sorted[i - 1].sym < (uint) best)
+                best = index->sorted[i - 1].sym;
+        }
+        name = index_string(index, index->syms[best].name);
+        if (index->syms[best].end != start || name == NULL || name[0] == '\0')
+            best = -1;
+    }
+    if (best < 0)
+        return DRSYM_ERROR_SYMBOL_NOT_FOUND;
+    *idx = (uint) best;
+    return DRSYM_SUCCESS;
+}
+
+/* Follows the semantics of drsym_dwarf_search_addr2line(): the last line
+ * starting at or before modoffs.  An address in no sequence (padding, data, or
+ * past the last sequence) has no line.
+ */
+static bool
+index_addr2line(drsym_index_t *index, size_t modoffs, drsym_info_t *sym_info INOUT)
+{
+    uint lo = 0, hi = index->header->num_lines, i;
+    index_line_t *line;
+    const char *file = NULL;
+
+    sym_info->file_available_size = 0;
+    if (sym_info->file != NULL)
+        sym_info->file[0] = '\0';
+    sym_info->line = 0;
+    sym_info->line_offs = 0;
+
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (index->lines[mid].addr <= modoffs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return false;
+    /* A sequence can start where another ends, so we take the last line at
+     * this address that does not end a sequence.
+     */
+    line = NULL;
+    for (i = lo; i > 0 && index->lines[i - 1].addr == index->lines[lo - 1].addr; i--) {
+        if (!TEST(INDEX_LINE_END_SEQUENCE, index->lines[i - 1].flags)) {
+            line = &index->lines[i - 1];
+            break;
+        }
+    }
+    if (line == NULL)
+        return false;
+    if (line->file < index->header->num_files)
+        file = index_string(index, index->files[line->file]);
+    if (file == NULL)
+        return false;
+    sym_info->file_available_size = strlen(file);
+    if (sym_info->file != NULL) {
+        strncpy(sym_info->file, file, sym_info->file_size);
+        sym_info->file[sym_info->file_size - 1] = '\0';
+    }
+    sym_info->line = line->line;
+    sym_info->line_offs = (size_t) (modoffs - line->addr);
+    return true;
+}
+
+static int
+compare_index_sorted(const void *a_in, const void *b_in)
+{
+    const index_sorted_t *a = (const index_sorted_t *) a_in;
+    const index_sorted_t *b = (const index_sorted_t *) b_in;
+    if (a->start != b->start)
+        return (a->start < b->start) ? -1 : 1;
+    if (a->sym != b->sym)
+        return (a->sym < b->sym) ? -1 : 1;
+    return 0;
+}
+
+/* Lines at the same address keep their enumeration order, which matches the
+ * order drsym_dwarf_search_addr2line() sees them in.
+ */
+typedef struct _index_build_line_t {
+    index_line_t line;
+    uint seq;
+} index_build_line_t;
+
+static int
+compare_index_lines(const void *a_in, const void *b_in)
+{
+    const index_build_line_t *a = (const index_build_line_t *) a_in;
+    const index_build_line_t *b = (const index_build_line_t *) b_in;
+    if (a->line.addr != b->line.addr)
+        return (a->line.addr < b->line.addr) ? -1 : 1;
+    if (a->seq != b->seq)
+        return (a->seq < b->seq) ? -1 : 1;
+    return 0;
+}
+
+typedef struct _index_build_t {
+    index_buf_t lines;
+    index_buf_t files;
+    index_buf_t cus;
+    index_buf_t strings;
+    /* Maps file name to 1 + its index in files */
+    hashtable_t file_table;
+    /* Maps compilation unit name to 1 + its index in cus */
+    hashtable_t cu_table;
+    uint num_files;
+    uint num_cus;
+    uint num_lines;
+    bool ok;
+} index_build_t;
+
+static bool
+index_add_string(index_build_t *build, const char *str, uint *offs OUT)
+{
+    *offs = (uint) build->strings.size;
+    return index_buf_append(&build->strings, str, strlen(str) + 1);
+}
+
+/* Returns the index in cus of info's compilation unit, adding it if needed.
+ * Units without line info get an entry each, as enumeration reports each.
+ */
+static bool
+index_add_cu(index_build_t *build, drsym_line_info_t *info, uint *cu OUT)
+{
+    index_cu_t entry;
+    ptr_uint_t cu_idx = 0;
+    bool no_lines = (info->file == NULL);
+    if (info->cu_name != NULL && !no_lines)
+        cu_idx = (ptr_uint_t) hashtable_lookup(&build->cu_table, (void *)info->cu_name);
+    if (cu_idx != 0) {
+        *cu = (uint) (cu_idx - 1);
+        return true;
+    }
+    entry.name = INDEX_NO_NAME;
+    entry.flags = no_lines ? INDEX_CU_NO_LINES : 0;
+    if (info->cu_name != NULL && !index_add_string(build, info->cu_name, &entry.name))
+        return false;
+    if (!index_buf_append(&build->cus, &entry, sizeof(entry)))
+        return false;
+    *cu = build->num_cus++;
+    if (info->cu_name != NULL && !no_lines) {
+        hashtable_add(&build->cu_table, (void *)info->cu_name,
+                      (void *)(ptr_uint_t)build->num_cus);
+    }
+    return true;
+}
+
+static bool
+index_line_cb(drsym_line_info_t *info, bool end_sequence, void *data)
+{
+    index_build_t *build = (index_build_t *) data;
+    index_build_line_t line;
+    ptr_uint_t file_idx;
+    memset(&line, 0, sizeof(line));
+    if (!index_add_cu(build, info, &line.line.cu)) {
+        build->ok = false;
+        return false;
+    }
+    if (info->file == NULL)
+        return true; /* no line info for this CU */
+    file_idx = (ptr_uint_t) hashtable_lookup(&build->file_table, (void *)info->file);
+    if (file_idx == 0) {
+        uint offs;
+        if (!index_add_string(build, info->file, &offs) ||
+            !index_buf_append(&build->files, &offs, sizeof(offs))) {
+            build->ok = false;
+            return false;
+        }
+        file_idx = ++build->num_files;
+        hashtable_add(&build->file_table, (void *)info->file, (void *)file_idx);
+    }
+    line.line.addr = info->line_addr;
+    line.line.line = (uint) info->line;
+    line.line.file = (uint) (file_idx - 1);
+    if (end_sequence)
+        line.line.flags |= INDEX_LINE_END_SEQUENCE;
+    line.seq = build->num_lines++;
+    if (!index_buf_append(&build->lines, &line, sizeof(line))) {
+        build->ok = false;
+        return false;
+    }
+    return true;
+}
+
+static bool
+index_write_table(file_t f, const void *data, size_t size, uint64 *offs INOUT)
+{
+    static const byte zeroes[INDEX_ALIGN];
+    size_t pad = ALIGN_FORWARD(size, INDEX_ALIGN) - size;
+    if (size > 0 && dr_write_file(f, data, size) != (ssize_t) size)
+        return false;
+    if (pad > 0 && dr_write_file(f, zeroes, pad) != (ssize_t) pad)
+        return false;
+    *offs += size + pad;
+    return true;
+}
+
+/* Writes an index for the fully-loaded mod.  Failure is not fatal: the
+ * module simply remains unindexed.
+ */
+static void
+index_save(dbg_module_t *mod, index_key_t *key, const char *index_path)
+{
+    index_build_t build;
+    index_header_t header;
+    index_buf_t syms = {0,}, sorted = {0,};
+    dbg_module_t *mod4line = (mod->mod_with_dwarf != NULL) ? mod->mod_with_dwarf : mod;
+    char tmp_path[MAXIMUM_PATH];
+    uint num_syms = drsym_obj_num_symbols(mod->obj_info), i;
+    uint64 max_end = 0, offs;
+    file_t f;
+
+    memset(&build, 0, sizeof(build));
+    build.ok = true;
+    hashtable_init_ex(&build.file_table, 12, HASH_STRING, true/*strdup*/,
+                      false/*!synch*/, NULL, NULL, NULL);
+    hashtable_init_ex(&build.cu_table, 10, HASH_STRING, true/*strdup*/,
+                      false/*!synch*/, NULL, NULL, NULL);
+
+    for (i = 0; build.ok && i < num_syms; i++) {
+        index_sym_t sym;
+        index_sorted_t entry;
+        size_t start, end;
+        const char *name = drsym_obj_symbol_name(mod->obj_info, i);
+        drsym_error_t res = drsym_obj_symbol_offs(mod->obj_info, i, &start, &end);
+        memset(&sym, 0, sizeof(sym));
+        if (name == NULL ||
+            (res != DRSYM_SUCCESS && res != DRSYM_ERROR_SYMBOL_NOT_FOUND) ||
+            !index_add_string(&build, name, &sym.name)) {
+            build.ok = false;
+            break;
+        }
+        if (res == DRSYM_ERROR_SYMBOL_NOT_FOUND)
+            sym.flags = INDEX_SYM_IMPORT;
+        else {
+            sym.start = start;
+            sym.end = end;
+            memset(&entry, 0, sizeof(entry));
+            entry.start = start;
+            entry.sym = i;
+            if (!index_buf_append(&sorted, &entry, sizeof(entry)))
+                build.ok = false;
+        }
+        if (!index_buf_append(&syms, &sym, sizeof(sym)))
+            build.ok = false;
+    }
+    if (build.ok && mod4line->dwarf_info != NULL) {
+        drsym_dwarf_enumerate_lines_ex(mod4line->dwarf_info, index_line_cb, &build);
+    }
+    if (!build.ok)
+        goto done;
+
+    qsort(sorted.data, sorted.size / sizeof(index_sorted_t), sizeof(index_sorted_t),
+          compare_index_sorted);
+    for (i = 0; i < sorted.size / sizeof(index_sorted_t); i++) {
+        index_sorted_t *entry = &((index_sorted_t *)sorted.data)[i];
+        uint64 end = ((index_sym_t *)syms.data)[entry->sym].end;
+        if (end > max_end)
+            max_end = end;
+        entry->max_end = max_end;
+    }
+    qsort(build.lines.data, build.num_lines, sizeof(index_build_line_t),
+          compare_index_lines);
+    /* Compact in place to the on-disk entry size */
+    for (i = 0; i < build.num_lines; i++) {
+        memmove(&((index_line_t *)build.lines.data)[i],
+                &((index_build_line_t *)build.lines.data)[i].line,
+                sizeof(index_line_t));
+    }
+    build.lines.size = build.num_lines * sizeof(index_line_t);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.key = *key;
+    header.debug_kind = mod->debug_kind;
+    header.num_syms = (uint) (syms.size / sizeof(index_sym_t));
+    header.num_sorted = (uint) (sorted.size / sizeof(index_sorted_t));
+    header.num_lines = build.num_lines;
+    header.num_files = build.num_files;
+    header.num_cus = build.num_cus;
+    header.strings_size = build.strings.size;
+    offs = ALIGN_FORWARD(sizeof(header), INDEX_ALIGN);
+    header.syms_offs = offs;
+    offs += ALIGN_FORWARD(syms.size, INDEX_ALIGN);
+    header.sorted_offs = offs;
+    offs += ALIGN_FORWARD(sorted.size, INDEX_ALIGN);
+    header.lines_offs = offs;
+    offs += ALIGN_FORWARD(build.lines.size, INDEX_ALIGN);
+    header.files_offs = offs;
+    offs += ALIGN_FORWARD(build.files.size, INDEX_ALIGN);
+    header.cus_offs = offs;
+    offs += ALIGN_FORWARD(build.cus.size, INDEX_ALIGN);
+    header.strings_offs = offs;
+    offs += ALIGN_FORWARD(build.strings.size, INDEX_ALIGN);
+    header.total_size = offs;
+
+    /* Write to a private file and rename it so concurrent processes never
+     * see a partial index.
+     */
+    dr_snprintf(tmp_path, BUFFER_SIZE_ELEMENTS(tmp_path), "%s.%d.tmp",
+                index_path, dr_get_process_id());
+    NULL_TERMINATE_BUFFER(tmp_path);
+    f = dr_open_file(tmp_path, DR_FILE_WRITE_OVERWRITE);
+    if (f == INVALID_FILE) {
+        NOTIFY("%s: unable to create %s\n", __FUNCTION__, tmp_path);
+        goto done;
+    }
+    offs = 0;
+    if (index_write_table(f, &header, sizeof(header), &offs) &&
+        index_write_table(f, syms.data, syms.size, &offs) &&
+        index_write_table(f, sorted.data, sorted.size, &offs) &&
+        index_write_table(f, build.lines.data, build.lines.size, &offs) &&
+        index_write_table(f, build.files.data, build.files.size, &offs) &&
+        index_write_table(f, build.cus.data, build.cus.size, &offs) &&
+        index_write_table(f, build.strings.data, build.strings.size, &offs)) {
+        dr_close_file(f);
+        if (!dr_rename_file(tmp_path, index_path, true/*replace*/))
+            dr_delete_file(tmp_path);
+    } else {
+        dr_close_file(f);
+        dr_delete_file(tmp_path);
+    }
+
+ done:
+    hashtable_delete(&build.file_table);
+    hashtable_delete(&build.cu_table);
+    index_buf_free(&build.lines);
+    index_buf_free(&build.files);
+    index_buf_free(&build.cus);
+    index_buf_free(&build.strings);
+    index_buf_free(&syms);
+    index_buf_free(&sorted);
+}
+
+static dbg_module_t *
+load_module_with_index(const char *modpath)
+{
+    dbg_module_t *mod;
+    index_key_t key;
+    char index_path[MAXIMUM_PATH];
+    drsym_index_t *index;
+
+    if (!index_path_for_module(modpath, &key, index_path))
+        return load_module(modpath);
+    index = index_load(index_path, &key);
+    if (index == NULL) {
+        mod = load_module(modpath);
+        if (mod != NULL && mod->obj_info != NULL)
+            index_save(mod, &key, index_path);
+        return mod;
+    }
+    NOTIFY("%s: using index %s for %s\n", __FUNCTION__, index_path, modpath);
+    mod = dr_global_alloc(sizeof(*mod));
+    memset(mod, 0, sizeof(*mod));
+    mod->fd = INVALID_FILE;
+    mod->index = index;
+    mod->debug_kind = index->header->debug_kind;
+    mod->modpath = dr_global_alloc(strlen(modpath) + 1);
+    strncpy(mod->modpath, modpath, strlen(modpath) + 1);
+    return mod;
+}
+
+/* Returns the module with full debug info for queries the index cannot answer */
+static dbg_module_t *
+unindexed_module(dbg_module_t *mod)
+{
+    if (mod->index == NULL)
+        return mod;
+    if (mod->unindexed == NULL)
+        mod->unindexed = load_module(mod->modpath);
+    return mod->unindexed;
+}
+
+/* If the module has line info but we could not enumerate any of it (e.g., our
+ * libdwarf could not parse its CU headers), the index has no lines and line
+ * queries must go to the full debug info, which may still find them via
+ * .debug_aranges.
+ */
+static bool
+index_has_lines(dbg_module_t *mod)
+{
+    return (mod->index->header->num_lines > 0 ||
+            !TEST(DRSYM_LINE_NUMS, mod->debug_kind));
+}
+
+/* These dispatch symbol table queries to either the index or the object file */
+
+static uint
+mod_num_symbols(dbg_module_t *mod)
+{
+    if (mod->index != NULL)
+        return mod->index->header->num_syms;
+    return drsym_obj_num_symbols(mod->obj_info);
+}
+
+static const char *
+mod_symbol_name(dbg_module_t *mod, uint idx)
+{
+    if (mod->index != NULL) {
+        if (idx >= mod->index->header->num_syms)
+            return NULL;
+        return index_string(mod->index, mod->index->syms[idx].name);
+    }
+    return drsym_obj_symbol_name(mod->obj_info, idx);
+}
+
+static drsym_error_t
+mod_symbol_offs(dbg_module_t *mod, uint idx, size_t *offs_start OUT,
+                size_t *offs_end OUT)
+{
+    if (mod->index != NULL) {
+        index_sym_t *sym;
+        if (offs_start == NULL || idx >= mod->index->header->num_syms)
+            return DRSYM_ERROR_INVALID_PARAMETER;
+        sym = &mod->index->syms[idx];
+        *offs_start = (size_t) sym->start;
+        if (offs_end != NULL)
+            *offs_end = (size_t) sym->end;
+        return TEST(INDEX_SYM_IMPORT, sym->flags) ?
+            DRSYM_ERROR_SYMBOL_NOT_FOUND : DRSYM_SUCCESS;
+    }
+    return drsym_obj_symbol_offs(mod->obj_info, idx, offs_start, offs_end);
+}
+
+static drsym_error_t
+mod_addrsearch_symtab(dbg_module_t *mod, size_t modoffs, uint *idx OUT)
+{
+    if (mod->index != NULL)
+        return index_addrsearch(mod->index, modoffs, idx);
+    return drsym_obj_addrsearch_symtab(mod->obj_info, modoffs, idx);
+}
+
 /******************************************************************************
  * Symbol table parsing
  */
@@ -317,7 +1071,7 @@ symsearch_symtab(dbg_module_t *mod, drsym_enumerate_cb callback,
     drsym_error_t res = DRSYM_SUCCESS;
     drsym_info_t *out;
 
-    num_syms = drsym_obj_num_symbols(mod->obj_info);
+    num_syms = mod_num_symbols(mod);
     if (num_syms == 0)
         return DRSYM_ERROR;
 
@@ -337,7 +1091,7 @@ symsearch_symtab(dbg_module_t *mod, drsym_enumerate_cb callback,
     }
 
     for (i = 0; keep_searching && i < num_syms; i++) {
-        const char *mangled = drsym_obj_symbol_name(mod->obj_info, i);
+        const char *mangled = mod_symbol_name(mod, i);
         const char *unmangled = mangled;  /* Points at mangled or symbol_buf. */
         size_t modoffs = 0;
         if (mangled == NULL) {
@@ -346,10 +1100,9 @@ symsearch_symtab(dbg_module_t *mod, drsym_enumerate_cb callback,
         }
 
         if (callback_ex != NULL) {
-            res = drsym_obj_symbol_offs(mod->obj_info, i, &out->start_offs,
-                                        &out->end_offs);
+            res = mod_symbol_offs(mod, i, &out->start_offs, &out->end_offs);
         } else
-            res = drsym_obj_symbol_offs(mod->obj_info, i, &modoffs, NULL);
+            res = mod_symbol_offs(mod, i, &modoffs, NULL);
         if (res == DRSYM_ERROR_SYMBOL_NOT_FOUND) { /* an import, so skip */
             res = DRSYM_SUCCESS; /* if go off end of loop */
             continue;
@@ -400,12 +1153,12 @@ addrsearch_symtab(dbg_module_t *mod, size_t modoffs, drsym_info_t *info INOUT,
     const char *symbol;
     size_t name_len = 0;
     uint idx;
-    drsym_error_t res = drsym_obj_addrsearch_symtab(mod->obj_info, modoffs, &idx);
+    drsym_error_t res = mod_addrsearch_symtab(mod, modoffs, &idx);
 
     if (res != DRSYM_SUCCESS)
         return res;
 
-    symbol = drsym_obj_symbol_name(mod->obj_info, idx);
+    symbol = mod_symbol_name(mod, idx);
     if (symbol == NULL)
         return DRSYM_ERROR;
 
@@ -423,7 +1176,7 @@ addrsearch_symtab(dbg_module_t *mod, size_t modoffs, drsym_info_t *info INOUT,
 
     info->name_available_size = name_len;
 
-    return drsym_obj_symbol_offs(mod->obj_info, idx, &info->start_offs, &info->end_offs);
+    return mod_symbol_offs(mod, idx, &info->start_offs, &info->end_offs);
 }
 
 /******************************************************************************
@@ -445,9 +1198,27 @@ drsym_unix_exit(void)
 void *
 drsym_unix_load(const char *modpath)
 {
+    if (index_dir[0] != '\0')
+        return load_module_with_index(modpath);
     return load_module(modpath);
 }
 
+drsym_error_t
+drsym_unix_set_index_dir(const char *dir)
+{
+    if (dir == NULL) {
+        index_dir[0] = '\0';
+        return DRSYM_SUCCESS;
+    }
+    if (strlen(dir) >= BUFFER_SIZE_ELEMENTS(index_dir))
+        return DRSYM_ERROR_INVALID_PARAMETER;
+    if (!dr_directory_exists(dir) && !dr_create_dir(dir))
+        return DRSYM_ERROR;
+    strncpy(index_dir, dir, BUFFER_SIZE_ELEMENTS(index_dir));
+    NULL_TERMINATE_BUFFER(index_dir);
+    return DRSYM_SUCCESS;
+}
+
 void
 drsym_unix_unload(void *mod_in)
 {
@@ -570,10 +1341,19 @@ drsym_unix_lookup_address(void *mod_in, size_t modoffs,
         dbg_module_t *mod4line = mod;
         if (mod->mod_with_dwarf != NULL)
             mod4line = mod->mod_with_dwarf;
-        if (mod4line->dwarf_info == NULL ||
-            !drsym_dwarf_search_addr2line
-            (mod4line->dwarf_info, (Dwarf_Addr)(ptr_uint_t)
-             (drsym_obj_load_base(mod->obj_info) + modoffs), out)) {
+        if (mod->index != NULL && index_has_lines(mod)) {
+            if (!index_addr2line(mod->index, modoffs, out))
+                r = DRSYM_ERROR_LINE_NOT_AVAILABLE;
+        } else if (mod->index != NULL) {
+            dbg_module_t *full = unindexed_module(mod);
+            if (full == NULL)
+                r = DRSYM_ERROR_LINE_NOT_AVAILABLE;
+            else
+                return drsym_unix_lookup_address(full, modoffs, out, flags);
+        } else if (mod4line->dwarf_info == NULL ||
+                   !drsym_dwarf_search_addr2line
+                   (mod4line->dwarf_info, (Dwarf_Addr)(ptr_uint_t)
+                    (drsym_obj_load_base(mod->obj_info) + modoffs), out)) {
             r = DRSYM_ERROR_LINE_NOT_AVAILABLE;
         }
     }
@@ -587,11 +1367,52 @@ drsym_unix_lookup_address(void *mod_in, size_t modoffs,
     return r;
 }
 
+/* Reports the index's lines in address order, followed by the compilation
+ * units without line info.
+ */
+static drsym_error_t
+index_enumerate_lines(drsym_index_t *index, drsym_enumerate_lines_cb callback,
+                      void *data)
+{
+    drsym_line_info_t info;
+    uint i;
+    for (i = 0; i < index->header->num_lines; i++) {
+        index_line_t *line = &index->lines[i];
+        info.cu_name = NULL;
+        if (line->cu < index->header->num_cus)
+            info.cu_name = index_string(index, index->cus[line->cu].name);
+        info.file = NULL;
+        if (line->file < index->header->num_files)
+            info.file = index_string(index, index->files[line->file]);
+        info.line = line->line;
+        info.line_addr = (size_t) line->addr;
+        if (!(*callback)(&info, data))
+            return DRSYM_SUCCESS;
+    }
+    for (i = 0; i < index->header->num_cus; i++) {
+        if (!TEST(INDEX_CU_NO_LINES, index->cus[i].flags))
+            continue;
+        info.cu_name = index_string(index, index->cus[i].name);
+        info.file = NULL;
+        info.line = 0;
+        info.line_addr = 0;
+        if (!(*callback)(&info, data))
+            break;
+    }
+    return DRSYM_SUCCESS;
+}
+
 drsym_error_t
 drsym_unix_enumerate_lines(void *mod_in, drsym_enumerate_lines_cb callback, void *data)
 {
     dbg_module_t *mod = (dbg_module_t *) mod_in;
-    dbg_module_t *mod4line = mod;
+    dbg_module_t *mod4line;
+    if (mod->index != NULL && mod->index->header->num_lines > 0)
+        return index_enumerate_lines(mod->index, callback, data);
+    mod = unindexed_module(mod);
+    mod4line = mod;
+    if (mod == NULL)
+        return DRSYM_ERROR_LOAD_FAILED;
     if (mod->mod_with_dwarf != NULL)
         mod4line = mod->mod_with_dwarf;
     if (mod4line->dwarf_info != NULL)
@@ -46,6 +46,7 @@
 #include "drsyms.h"
 #include "drsyms_private.h"
 #include "hashtable.h"
+#include <string.h>
 
 /* Guards our internal state and libdwarf's modifications of mod->dbg.
  * We use a recursive lock to allow queries to be called from enumerate callbacks.
@@ -156,6 +157,48 @@ drsym_lookup_address_local(const char *modpath, size_t modoffs,
     return r;
 }
 
+static drsym_error_t
+drsym_lookup_address_batch_local(drsym_batch_entry_t *entries, size_t count,
+                                 uint flags)
+{
+    size_t *order;
+    size_t i;
+    const char *cur_path = NULL;
+    void *mod = NULL;
+
+    if (entries == NULL && count > 0)
+        return DRSYM_ERROR_INVALID_PARAMETER;
+    order = drsym_batch_order(entries, count);
+
+    dr_recurlock_lock(symbol_lock);
+    for (i = 0; i < count; i++) {
+        drsym_batch_entry_t *entry = &entries[order[i]];
+        if (entry->modpath == NULL || entry->info == NULL) {
+            entry->result = DRSYM_ERROR_INVALID_PARAMETER;
+            continue;
+        }
+        if (entry->info->struct_size != sizeof(*entry->info)) {
+            entry->result = DRSYM_ERROR_INVALID_SIZE;
+            continue;
+        }
+        /* The entries are sorted by path so we load each module once */
+        if (cur_path == NULL || strcmp(cur_path, entry->modpath) != 0) {
+            cur_path = entry->modpath;
+            mod = lookup_or_load(cur_path);
+        }
+        if (mod == NULL)
+            entry->result = DRSYM_ERROR_LOAD_FAILED;
+        else {
+            entry->result = drsym_unix_lookup_address(mod, entry->modoffs,
+                                                      entry->info, flags);
+        }
+    }
+    dr_recurlock_unlock(symbol_lock);
+
+    drsym_batch_order_free(order, count);
+    return DRSYM_SUCCESS;
+}
+
 static drsym_error_t
 drsym_enumerate_lines_local(const char *modpath, drsym_enumerate_lines_cb callback,
                             void *data)
@@ -246,6 +289,17 @@ drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *out INOU
     }
 }
 
+DR_EXPORT
+drsym_error_t
+drsym_lookup_address_batch(drsym_batch_entry_t *entries, size_t count, uint flags)
+{
+    if (IS_SIDELINE) {
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    } else {
+        return drsym_lookup_address_batch_local(entries, count, flags);
+    }
+}
+
 DR_EXPORT
 drsym_error_t
 drsym_lookup_symbol(const char *modpath, const char *symbol, size_t *modoffs OUT,
@@ -374,6 +428,19 @@ drsym_free_resources(const char *modpath)
     }
 }
 
+DR_EXPORT
+drsym_error_t
+drsym_set_index_cache_dir(const char *dir)
+{
+    drsym_error_t res;
+    if (IS_SIDELINE)
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    dr_recurlock_lock(symbol_lock);
+    res = drsym_unix_set_index_dir(dir);
+    dr_recurlock_unlock(symbol_lock);
+    return res;
+}
+
 DR_EXPORT
 drsym_error_t
 drsym_enumerate_lines(const char *modpath, drsym_enumerate_lines_cb callback, void *data)
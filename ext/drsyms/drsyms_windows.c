@@ -1494,6 +1494,32 @@ drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *out INOU
     }
 }
 
+DR_EXPORT
+drsym_error_t
+drsym_lookup_address_batch(drsym_batch_entry_t *entries, size_t count, uint flags)
+{
+    size_t *order;
+    size_t i;
+    if (IS_SIDELINE)
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+    if (entries == NULL && count > 0)
+        return DRSYM_ERROR_INVALID_PARAMETER;
+    order = drsym_batch_order(entries, count);
+    /* Holding the recursive lock across the batch avoids contending for it
+     * on each query.  XXX: dbghelp has its own per-query overhead which we
+     * do not avoid here.
+     */
+    dr_recurlock_lock(symbol_lock);
+    for (i = 0; i < count; i++) {
+        drsym_batch_entry_t *entry = &entries[order[i]];
+        entry->result = drsym_lookup_address_local(entry->modpath, entry->modoffs,
+                                                   entry->info, flags);
+    }
+    dr_recurlock_unlock(symbol_lock);
+    drsym_batch_order_free(order, count);
+    return DRSYM_SUCCESS;
+}
+
 DR_EXPORT
 drsym_error_t
 drsym_lookup_symbol(const char *modpath, const char *symbol, size_t *modoffs OUT,
@@ -1915,3 +1941,13 @@ drsym_enumerate_lines(const char *modpath, drsym_enumerate_lines_cb callback, vo
         return drsym_enumerate_lines_local(modpath, callback, data);
     }
 }
+
+DR_EXPORT
+drsym_error_t
+drsym_set_index_cache_dir(const char *dir)
+{
+    /* XXX: PDB lookups go through dbghelp, which has its own symbol cache,
+     * and our PECOFF modules have no build id to key an index on.
+     */
+    return DRSYM_ERROR_NOT_IMPLEMENTED;
+}
@@ -25,6 +25,7 @@
 
 #include "dr_api.h"
 #include "drmgr.h"
+#include "drutil.h"
 #include "../ext_utils.h"
 
 /* currently using asserts on internal logic sanity checks (never on
@@ -395,6 +396,166 @@ drutil_opnd_mem_size_in_bytes(opnd_t memref, instr_t *inst)
         return opnd_size_in_bytes(opnd_get_size(memref));
 }
 
+/* Whether memref's address can be derived from that of another reference
+ * with the same registers.
+ */
+static bool
+memref_is_cse_candidate(opnd_t memref)
+{
+    reg_id_t base, index;
+    if (!opnd_is_base_disp(memref))
+        return false;
+    base = opnd_get_base(memref);
+    index = opnd_get_index(memref);
+#ifdef X86
+    /* xlat needs special handling in drutil_insert_get_mem_addr() */
+    if (index == DR_REG_AL)
+        return false;
+    /* 32-bit addressing wraps at 4GB, which a displacement delta would not */
+    if ((base != DR_REG_NULL && !reg_is_pointer_sized(base)) ||
+        (index != DR_REG_NULL && !reg_is_pointer_sized(index)))
+        return false;
+#elif defined(ARM)
+    /* The pc value differs for each instruction */
+    if (base == DR_REG_PC)
+        return false;
+#endif
+    return true;
+}
+
+/* Whether a and b are the same address expression modulo the displacement */
+static bool
+memref_same_shape(opnd_t a, opnd_t b)
+{
+    opnd_set_disp(&a, 0);
+    opnd_set_disp(&b, 0);
+    return opnd_same_address(a, b);
+}
+
+/* Whether the registers used by memref keep their values from just before
+ * start up to just before end, with straight-line code in between.
+ */
+static bool
+memref_regs_unchanged(opnd_t memref, instr_t *start, instr_t *end)
+{
+    instr_t *in;
+    int i;
+    for (in = start; in != end; in = instr_get_next(in)) {
+        if (in == NULL)
+            return false;
+        if (instr_is_cti(in) || instr_is_syscall(in) || instr_is_interrupt(in))
+            return false;
+        for (i = 0; i < opnd_num_regs_used(memref); i++) {
+            if (instr_writes_to_reg(in, opnd_get_reg_used(memref, i),
+                                    DR_QUERY_INCLUDE_ALL))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void
+memref_cse_add(drutil_memref_cse_t *refs, uint num, instr_t *inst, opnd_t memref,
+               bool is_write)
+{
+    drutil_memref_cse_t *ref = &refs[num];
+    int j;
+    ref->instr = inst;
+    ref->memref = memref;
+    ref->is_write = is_write;
+    ref->leader = -1;
+    ref->delta = 0;
+    if (!memref_is_cse_candidate(memref))
+        return;
+    /* Search back for the nearest leader with the same registers */
+    for (j = (int)num - 1; j >= 0; j--) {
+        int64 delta;
+        if (refs[j].leader != -1 || !memref_is_cse_candidate(refs[j].memref) ||
+            !memref_same_shape(refs[j].memref, memref))
+            continue;
+        if (!memref_regs_unchanged(memref, refs[j].instr, inst))
+            break;
+        delta = (int64)opnd_get_disp(memref) - (int64)opnd_get_disp(refs[j].memref);
+        if (delta != (int)delta)
+            continue;
+        ref->leader = j;
+        ref->delta = (int)delta;
+        return;
+    }
+}
+
+DR_EXPORT
+bool
+drutil_memref_cse_analyze(void *drcontext, instrlist_t *bb, drutil_memref_cse_t *refs,
+                          uint max_refs, OUT uint *num_refs)
+{
+    instr_t *inst;
+    uint num = 0;
+    int i;
+    if (bb == NULL || refs == NULL || num_refs == NULL)
+        return false;
+    for (inst = instrlist_first_app(bb); inst != NULL; inst = instr_get_next_app(inst)) {
+        /* Reads first, then writes, matching the order of the accesses.
+         * Address-only operands such as lea's are not references.
+         */
+        for (i = 0; instr_reads_memory(inst) && i < instr_num_srcs(inst); i++) {
+            if (opnd_is_memory_reference(instr_get_src(inst, i))) {
+                if (num >= max_refs)
+                    return false;
+                memref_cse_add(refs, num++, inst, instr_get_src(inst, i), false);
+            }
+        }
+        for (i = 0; instr_writes_memory(inst) && i < instr_num_dsts(inst); i++) {
+            if (opnd_is_memory_reference(instr_get_dst(inst, i))) {
+                if (num >= max_refs)
+                    return false;
+                memref_cse_add(refs, num++, inst, instr_get_dst(inst, i), true);
+            }
+        }
+    }
+    *num_refs = num;
+    return true;
+}
+
+DR_EXPORT
+bool
+drutil_insert_get_mem_addr_cse(void *drcontext, instrlist_t *bb, instr_t *where,
+                               drutil_memref_cse_t *refs, uint index,
+                               reg_id_t leader_reg, reg_id_t dst, reg_id_t scratch)
+{
+    drutil_memref_cse_t *ref;
+    if (refs == NULL)
+        return false;
+    ref = &refs[index];
+    if (ref->leader == -1) {
+        return drutil_insert_get_mem_addr(drcontext, bb, where, ref->memref,
+                                          dst, scratch);
+    }
+    if (ref->delta == 0) {
+        if (dst != leader_reg) {
+            PRE(bb, where, XINST_CREATE_move(drcontext, opnd_create_reg(dst),
+                                             opnd_create_reg(leader_reg)));
+        }
+        return true;
+    }
+#ifdef X86
+    PRE(bb, where,
+        INSTR_CREATE_lea(drcontext, opnd_create_reg(dst),
+                         opnd_create_base_disp(leader_reg, DR_REG_NULL, 0, ref->delta,
+                                               OPSZ_lea)));
+#elif defined(AARCHXX)
+    /* XXX: use an immediate add when the delta is encodable */
+    if (scratch == leader_reg)
+        return false;
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)ref->delta,
+                                     opnd_create_reg(scratch), bb, where, NULL, NULL);
+    PRE(bb, where, XINST_CREATE_add_2src(drcontext, opnd_create_reg(dst),
+                                         opnd_create_reg(leader_reg),
+                                         opnd_create_reg(scratch)));
+#endif
+    return true;
+}
+
 #ifdef X86
 static bool
 opc_is_stringop_loop(uint opc)
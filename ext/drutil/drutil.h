@@ -91,6 +91,75 @@ bool
 drutil_insert_get_mem_addr(void *drcontext, instrlist_t *bb, instr_t *where,
                            opnd_t memref, reg_id_t dst, reg_id_t scratch);
 
+/**
+ * Describes one memory reference in a basic block, as filled in by
+ * drutil_memref_cse_analyze().
+ */
+typedef struct _drutil_memref_cse_t {
+    /** The application instruction containing the reference. */
+    instr_t *instr;
+    /** The memory reference operand. */
+    opnd_t memref;
+    /** Whether \p memref is a destination of \p instr. */
+    bool is_write;
+    /**
+     * The index of an earlier entry whose address, computed prior to that
+     * entry's instruction, plus \p delta is also the address of this
+     * reference; or -1 if this address must be computed from scratch.
+     * A leader is always itself an entry with \p leader of -1.
+     */
+    int leader;
+    /** The displacement of this reference from its leader's address. */
+    int delta;
+} drutil_memref_cse_t;
+
+DR_EXPORT
+/**
+ * Records in \p refs every memory reference of the application
+ * instructions in \p bb, in instruction order with each instruction's
+ * sources ahead of its destinations, and sets \p num_refs to the number
+ * of entries.  Operands of instructions that do not access memory, such
+ * as lea and multi-byte nops, are skipped (see instr_reads_memory()).
+ * For each reference, looks for an earlier one that uses the same
+ * registers with the same scale and segment, and whose registers are not
+ * written from its instruction up to this one with no control transfer
+ * in between.  If one is found, this reference's
+ * address is that reference's address plus a constant displacement,
+ * which is recorded in drutil_memref_cse_t.delta.
+ *
+ * A client that keeps each leader's address in a register (e.g., one
+ * reserved through \p drreg across application instructions) can then
+ * use drutil_insert_get_mem_addr_cse() to materialize the other
+ * addresses with a single add or none at all, or can fold the delta
+ * into its own instrumentation directly.  The client is responsible for
+ * keeping the leader's register intact up to each reference.
+ *
+ * Should be called from the analysis or insertion stage, after any
+ * application changes such as drutil_expand_rep_string().
+ *
+ * \return false if \p bb has more than \p max_refs references.
+ */
+bool
+drutil_memref_cse_analyze(void *drcontext, instrlist_t *bb, drutil_memref_cse_t *refs,
+                          uint max_refs, OUT uint *num_refs);
+
+DR_EXPORT
+/**
+ * Inserts instructions prior to \p where in \p bb that store the address
+ * of \p refs[\p index] into \p dst.  If the entry has no leader, this is
+ * identical to drutil_insert_get_mem_addr().  Otherwise, \p leader_reg
+ * must hold the address of the leader entry, computed at or prior to the
+ * leader's instruction, and at most one instruction (or, on ARM and
+ * AArch64, an immediate load into \p scratch plus an add) is inserted.
+ * \p dst may equal \p leader_reg.
+ *
+ * \return whether successful.
+ */
+bool
+drutil_insert_get_mem_addr_cse(void *drcontext, instrlist_t *bb, instr_t *where,
+                               drutil_memref_cse_t *refs, uint index,
+                               reg_id_t leader_reg, reg_id_t dst, reg_id_t scratch);
+
 DR_EXPORT
 /**
  * Returns the size of the memory reference \p memref in bytes.
@@ -318,6 +318,8 @@ post_call_entry_add(app_pc postcall, bool external)
         memset(e->prior, 0, sizeof(e->prior));
     }
     hashtable_add(&post_call_table, (void*)postcall, (void*)e);
+    /* a cached copy of the block at postcall would lack the post-call instru */
+    drmgr_invalidate_instrumentation_cache(postcall, 1);
     if (!external && post_call_notify_list != NULL) {
         post_call_notify_t *cb = post_call_notify_list;
         while (cb != NULL) {
@@ -1176,6 +1178,8 @@ drwrap_replace_common(hashtable_t *table,
     /* XXX: we're assuming void* tag == pc
      * XXX: we're assuming the replace target is not in the middle of a trace
      */
+    if (res)
+        drmgr_invalidate_instrumentation_cache(original, 1);
     if (flush || dr_fragment_exists_at(dr_get_current_drcontext(), original)) {
         /* we do not guarantee faster than a lazy flush.
          * we can't use dr_unlink_flush_region() unless we require that
@@ -1619,6 +1623,7 @@ drwrap_flush_func(app_pc func)
      * we do not guarantee faster than a lazy flush.
      */
     ASSERT(!dr_recurlock_self_owns(wrap_lock), "cannot hold lock while flushing");
+    drmgr_invalidate_instrumentation_cache(func, 1);
     if (!dr_unlink_flush_region(func, 1))
         ASSERT(false, "wrap update flush failed");
 }
@@ -2299,6 +2304,8 @@ drwrap_wrap_ex(app_pc func,
     } else {
         wrap_new->next = NULL;
         hashtable_add(&wrap_table, (void *)func, (void *)wrap_new);
+        /* Even with no fragment present, drmgr may hold an unwrapped copy */
+        drmgr_invalidate_instrumentation_cache(func, 1);
         /* XXX: we're assuming void* tag == pc */
         if (dr_fragment_exists_at(dr_get_current_drcontext(), func)) {
             /* we do not guarantee faster than a lazy flush */
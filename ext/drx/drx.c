@@ -91,6 +91,10 @@ static uint verbose = 0;
 bool drx_buf_init_library(void);
 void drx_buf_exit_library(void);
 
+/* defined in drx_counter.c */
+bool drx_counter_init_library(void);
+void drx_counter_exit_library(void);
+
 /***************************************************************************
  * INIT
  */
@@ -109,7 +113,7 @@ drx_init(void)
     note_base = drmgr_reserve_note_range(DRX_NOTE_COUNT);
     ASSERT(note_base != DRMGR_NOTE_NONE, "failed to reserve note range");
 
-    return drx_buf_init_library();
+    return drx_buf_init_library() && drx_counter_init_library();
 }
 
 DR_EXPORT
@@ -123,6 +127,7 @@ drx_exit()
     if (soft_kills_enabled)
         soft_kills_exit();
 
+    drx_counter_exit_library();
     drx_buf_exit_library();
     drmgr_exit();
 }
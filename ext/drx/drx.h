@@ -162,6 +162,122 @@ drx_insert_counter_update(void *drcontext, instrlist_t *ilist, instr_t *where,
                           dr_spill_slot_t slot, IF_NOT_X86_(dr_spill_slot_t slot2)
                           void *addr, int value, uint flags);
 
+/***************************************************************************
+ * SHARDED COUNTERS
+ */
+
+struct _drx_counter_array_t;
+
+/**
+ * Opaque handle which represents an array of counters created by
+ * drx_counter_array_create().
+ */
+typedef struct _drx_counter_array_t drx_counter_array_t;
+
+/** Layouts available for drx_counter_array_create(). */
+typedef enum {
+    /**
+     * Each thread increments its own private copy of the array, located
+     * through a raw TLS slot, using non-atomic instructions.  The copies are
+     * summed by drx_counter_array_get_value() and folded into a process-wide
+     * total when a thread exits.  Counters are 64-bit.
+     */
+    DRX_COUNTER_ARRAY_PER_THREAD,
+    /**
+     * A single process-wide array where each counter is placed in its own
+     * cache line.  The update is performed by drx_insert_counter_update()
+     * using the \p flags passed to drx_counter_array_create().
+     */
+    DRX_COUNTER_ARRAY_GLOBAL_PADDED,
+} drx_counter_array_type_t;
+
+/**
+ * Priorities of drmgr thread events used by the drx sharded counters.
+ * Per-thread arrays are set up before and folded in after most client
+ * thread events, so a client's own thread exit event can still query them.
+ */
+enum {
+    /** Priority of drx sharded counter thread init event */
+    DRMGR_PRIORITY_THREAD_INIT_DRX_COUNTER   =  -7500,
+    /** Priority of drx sharded counter thread exit event */
+    DRMGR_PRIORITY_THREAD_EXIT_DRX_COUNTER   =   7500,
+};
+
+/** Name of drx sharded counter thread init priority. */
+#define DRMGR_PRIORITY_NAME_DRX_COUNTER_INIT "drx_counter.init"
+
+/** Name of drx sharded counter thread exit priority. */
+#define DRMGR_PRIORITY_NAME_DRX_COUNTER_EXIT "drx_counter.exit"
+
+DR_EXPORT
+/**
+ * Creates an array of \p num_counters counters laid out according to \p type.
+ * For #DRX_COUNTER_ARRAY_GLOBAL_PADDED, \p flags takes the same
+ * DRX_COUNTER_* values as drx_insert_counter_update(); it is ignored for
+ * #DRX_COUNTER_ARRAY_PER_THREAD.
+ *
+ * A #DRX_COUNTER_ARRAY_PER_THREAD array uses one raw TLS slot and must be
+ * created during process initialization (i.e., in dr_init()), as threads that
+ * already exist when it is created do not receive a private copy and code
+ * they execute that updates the array will crash.
+ *
+ * \return NULL if unsuccessful, a valid opaque struct pointer if successful.
+ */
+drx_counter_array_t *
+drx_counter_array_create(drx_counter_array_type_t type, uint num_counters,
+                         uint flags);
+
+DR_EXPORT
+/**
+ * Cleans up the counters associated with \p array.
+ *
+ * Instrumented code holds direct references to the counters, so this must
+ * only be called at process exit or after all code containing updates to
+ * \p array has been flushed.
+ *
+ * \return whether successful.
+ */
+bool
+drx_counter_array_free(drx_counter_array_t *array);
+
+DR_EXPORT
+/**
+ * Inserts into \p ilist prior to \p where meta-instruction(s) to add the
+ * constant \p value to counter \p index of \p array.
+ *
+ * This routine uses the drreg extension to obtain a scratch register and
+ * to preserve the arithmetic flags, and must be called from drmgr's
+ * insertion phase.
+ *
+ * \return whether successful.
+ *
+ * \note #DRX_COUNTER_ARRAY_PER_THREAD is not yet supported on 32-bit ARM.
+ */
+bool
+drx_counter_array_insert_update(void *drcontext, drx_counter_array_t *array,
+                                instrlist_t *ilist, instr_t *where,
+                                uint index, int value);
+
+DR_EXPORT
+/**
+ * Returns the process-wide value of counter \p index of \p array.
+ * For #DRX_COUNTER_ARRAY_PER_THREAD this is the sum of the totals of exited
+ * threads and a snapshot of each live thread's copy; live threads may
+ * continue to increment their copies concurrently.
+ */
+uint64
+drx_counter_array_get_value(drx_counter_array_t *array, uint index);
+
+DR_EXPORT
+/**
+ * Returns the value of counter \p index of \p array as seen by the thread
+ * \p drcontext.  For #DRX_COUNTER_ARRAY_PER_THREAD this is the thread's own
+ * copy; for #DRX_COUNTER_ARRAY_GLOBAL_PADDED it is the process-wide value.
+ */
+uint64
+drx_counter_array_get_thread_value(void *drcontext, drx_counter_array_t *array,
+                                   uint index);
+
 /***************************************************************************
  * SOFT KILLS
  */
@@ -0,0 +1,457 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* DynamoRio eXtension Sharded Counter API */
+
+#include "dr_api.h"
+#include "drx.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include "drvector.h"
+#include "../ext_utils.h"
+#include <string.h> /* memset */
+
+#ifdef DEBUG
+# define ASSERT(x, msg) DR_ASSERT_MSG(x, msg)
+#else
+# define ASSERT(x, msg) /* nothing */
+#endif
+
+#define TLS_SLOT(tls_base, offs) (void **)((byte *)(tls_base)+(offs))
+#define COUNTS_PTR(tls_base, offs) *(uint64 **) TLS_SLOT(tls_base, offs)
+
+#define MINSERT instrlist_meta_preinsert
+
+/* One thread's shard of a per-thread counter array.  We keep all live
+ * shards on a list so that drx_counter_array_get_value() can sum them
+ * without waiting for the threads to exit.
+ */
+typedef struct _per_thread_t {
+    byte   *seg_base;
+    uint64 *counts;
+    struct _per_thread_t *next;
+    struct _per_thread_t *prev;
+} per_thread_t;
+
+struct _drx_counter_array_t {
+    drx_counter_array_type_t type;
+    uint   num_counters;
+    uint   flags;
+    uint   vec_idx; /* index into the arrays vector */
+    /* DRX_COUNTER_ARRAY_GLOBAL_PADDED: one counter per stride bytes */
+    byte  *global_base;
+    size_t global_size;
+    size_t stride;
+    /* DRX_COUNTER_ARRAY_PER_THREAD: raw TLS slot holds the shard pointer */
+    int      tls_idx;
+    uint     tls_offs;
+    reg_id_t tls_seg;
+    /* Live shards plus the folded-in totals of exited threads, both
+     * protected by lock.
+     */
+    void   *lock;
+    per_thread_t *threads;
+    uint64 *exited_totals;
+};
+
+/* drx_counter globals */
+static drvector_t arrays;
+
+/* called by drx_init() */
+bool drx_counter_init_library(void);
+void drx_counter_exit_library(void);
+
+static void event_thread_init(void *drcontext);
+static void event_thread_exit(void *drcontext);
+
+bool
+drx_counter_init_library(void)
+{
+    drmgr_priority_t exit_priority = {
+        sizeof(exit_priority), DRMGR_PRIORITY_NAME_DRX_COUNTER_EXIT, NULL, NULL,
+        DRMGR_PRIORITY_THREAD_EXIT_DRX_COUNTER};
+    drmgr_priority_t init_priority = {
+        sizeof(init_priority), DRMGR_PRIORITY_NAME_DRX_COUNTER_INIT, NULL, NULL,
+        DRMGR_PRIORITY_THREAD_INIT_DRX_COUNTER};
+
+    /* As with drx_buf we sync the vector manually. */
+    if (!drvector_init(&arrays, 1, false/*!synch*/, NULL) ||
+        !drmgr_register_thread_init_event_ex(event_thread_init, &init_priority) ||
+        !drmgr_register_thread_exit_event_ex(event_thread_exit, &exit_priority))
+        return false;
+    return true;
+}
+
+void
+drx_counter_exit_library(void)
+{
+    drmgr_unregister_thread_init_event(event_thread_init);
+    drmgr_unregister_thread_exit_event(event_thread_exit);
+    drvector_delete(&arrays);
+}
+
+DR_EXPORT
+drx_counter_array_t *
+drx_counter_array_create(drx_counter_array_type_t type, uint num_counters,
+                         uint flags)
+{
+    drx_counter_array_t *array;
+
+    if (num_counters == 0)
+        return NULL;
+    if (type == DRX_COUNTER_ARRAY_GLOBAL_PADDED) {
+        if (TEST(DRX_COUNTER_LOCK, flags) &&
+            IF_X64_ELSE(false, TEST(DRX_COUNTER_64BIT, flags)))
+            return NULL; /* same restriction as drx_insert_counter_update() */
+    } else if (type != DRX_COUNTER_ARRAY_PER_THREAD)
+        return NULL;
+
+    array = dr_global_alloc(sizeof(*array));
+    memset(array, 0, sizeof(*array));
+    array->type = type;
+    array->num_counters = num_counters;
+    array->flags = flags;
+    array->tls_idx = -1;
+
+    if (type == DRX_COUNTER_ARRAY_GLOBAL_PADDED) {
+        /* Give each counter its own cache line so that threads updating
+         * different counters never share a line.  We over-allocate by one
+         * line to align the base.
+         */
+        array->stride = proc_get_cache_line_size();
+        array->global_size = (num_counters + 1) * array->stride;
+        array->global_base = dr_global_alloc(array->global_size);
+        memset(array->global_base, 0, array->global_size);
+    } else {
+        /* allocate raw TLS so we can access the shard from the code cache */
+        if (!dr_raw_tls_calloc(&array->tls_seg, &array->tls_offs, 1, 0)) {
+            dr_global_free(array, sizeof(*array));
+            return NULL;
+        }
+        array->tls_idx = drmgr_register_tls_field();
+        if (array->tls_idx == -1) {
+            dr_raw_tls_cfree(array->tls_offs, 1);
+            dr_global_free(array, sizeof(*array));
+            return NULL;
+        }
+        array->exited_totals = dr_global_alloc(num_counters * sizeof(uint64));
+        memset(array->exited_totals, 0, num_counters * sizeof(uint64));
+        array->lock = dr_mutex_create();
+    }
+
+    drvector_lock(&arrays);
+    /* We don't attempt to re-use NULL entries, for simplicity. */
+    array->vec_idx = arrays.entries;
+    drvector_append(&arrays, array);
+    drvector_unlock(&arrays);
+    /* Threads that already exist will not receive a thread init event
+     * for this array, so a per-thread array must be created at
+     * process init time, like drx_buf buffers.
+     */
+    return array;
+}
+
+DR_EXPORT
+bool
+drx_counter_array_free(drx_counter_array_t *array)
+{
+    drvector_lock(&arrays);
+    if (!(array != NULL && drvector_get_entry(&arrays, array->vec_idx) == array)) {
+        drvector_unlock(&arrays);
+        return false;
+    }
+    /* NULL out the entry in the vector */
+    ((drx_counter_array_t **)arrays.array)[array->vec_idx] = NULL;
+    drvector_unlock(&arrays);
+
+    if (array->type == DRX_COUNTER_ARRAY_GLOBAL_PADDED) {
+        dr_global_free(array->global_base, array->global_size);
+    } else {
+        per_thread_t *data, *next;
+        /* Any shards still live belong to threads that will no longer find
+         * this array in the vector at exit, so we free them here.  We clear
+         * each thread's slot first so that instrumented code the caller failed
+         * to flush faults rather than silently writing into freed memory.
+         */
+        for (data = array->threads; data != NULL; data = next) {
+            next = data->next;
+            COUNTS_PTR(data->seg_base, array->tls_offs) = NULL;
+            dr_global_free(data->counts, array->num_counters * sizeof(uint64));
+            dr_global_free(data, sizeof(*data));
+        }
+        dr_global_free(array->exited_totals, array->num_counters * sizeof(uint64));
+        dr_mutex_destroy(array->lock);
+        if (!drmgr_unregister_tls_field(array->tls_idx) ||
+            !dr_raw_tls_cfree(array->tls_offs, 1)) {
+            dr_global_free(array, sizeof(*array));
+            return false;
+        }
+    }
+    dr_global_free(array, sizeof(*array));
+    return true;
+}
+
+static void *
+global_counter_addr(drx_counter_array_t *array, uint index)
+{
+    return (void *)(ALIGN_FORWARD(array->global_base, array->stride) +
+                    index * array->stride);
+}
+
+static uint64
+global_counter_value(drx_counter_array_t *array, uint index)
+{
+    void *addr = global_counter_addr(array, index);
+    if (TEST(DRX_COUNTER_64BIT, array->flags))
+        return *(uint64 *)addr;
+    return *(uint *)addr;
+}
+
+static void
+event_thread_init(void *drcontext)
+{
+    uint i;
+    drvector_lock(&arrays);
+    for (i = 0; i < arrays.entries; ++i) {
+        drx_counter_array_t *array = drvector_get_entry(&arrays, i);
+        per_thread_t *data;
+        if (array == NULL || array->type != DRX_COUNTER_ARRAY_PER_THREAD)
+            continue;
+        /* The shards are read by other threads when aggregating, so we use
+         * global rather than thread-private memory.
+         */
+        data = dr_global_alloc(sizeof(*data));
+        data->seg_base = dr_get_dr_segment_base(array->tls_seg);
+        data->counts = dr_global_alloc(array->num_counters * sizeof(uint64));
+        memset(data->counts, 0, array->num_counters * sizeof(uint64));
+        COUNTS_PTR(data->seg_base, array->tls_offs) = data->counts;
+        drmgr_set_tls_field(drcontext, array->tls_idx, data);
+        dr_mutex_lock(array->lock);
+        data->prev = NULL;
+        data->next = array->threads;
+        if (array->threads != NULL)
+            array->threads->prev = data;
+        array->threads = data;
+        dr_mutex_unlock(array->lock);
+    }
+    drvector_unlock(&arrays);
+}
+
+static void
+event_thread_exit(void *drcontext)
+{
+    uint i, j;
+    drvector_lock(&arrays);
+    for (i = 0; i < arrays.entries; ++i) {
+        drx_counter_array_t *array = drvector_get_entry(&arrays, i);
+        per_thread_t *data;
+        if (array == NULL || array->type != DRX_COUNTER_ARRAY_PER_THREAD)
+            continue;
+        data = drmgr_get_tls_field(drcontext, array->tls_idx);
+        if (data == NULL)
+            continue;
+        dr_mutex_lock(array->lock);
+        /* Fold this thread's shard into the totals so the counts survive. */
+        for (j = 0; j < array->num_counters; j++)
+            array->exited_totals[j] += data->counts[j];
+        if (data->prev == NULL)
+            array->threads = data->next;
+        else
+            data->prev->next = data->next;
+        if (data->next != NULL)
+            data->next->prev = data->prev;
+        dr_mutex_unlock(array->lock);
+        drmgr_set_tls_field(drcontext, array->tls_idx, NULL);
+        dr_global_free(data->counts, array->num_counters * sizeof(uint64));
+        dr_global_free(data, sizeof(*data));
+    }
+    drvector_unlock(&arrays);
+}
+
+DR_EXPORT
+uint64
+drx_counter_array_get_value(drx_counter_array_t *array, uint index)
+{
+    uint64 sum;
+    per_thread_t *data;
+    if (array == NULL || index >= array->num_counters)
+        return 0;
+    if (array->type == DRX_COUNTER_ARRAY_GLOBAL_PADDED)
+        return global_counter_value(array, index);
+    dr_mutex_lock(array->lock);
+    sum = array->exited_totals[index];
+    /* The owning threads keep incrementing without synchronization, so this
+     * is a snapshot: each shard is read once.
+     */
+    for (data = array->threads; data != NULL; data = data->next)
+        sum += *(volatile uint64 *)&data->counts[index];
+    dr_mutex_unlock(array->lock);
+    return sum;
+}
+
+DR_EXPORT
+uint64
+drx_counter_array_get_thread_value(void *drcontext, drx_counter_array_t *array,
+                                   uint index)
+{
+    per_thread_t *data;
+    if (array == NULL || index >= array->num_counters)
+        return 0;
+    if (array->type == DRX_COUNTER_ARRAY_GLOBAL_PADDED)
+        return global_counter_value(array, index);
+    data = drmgr_get_tls_field(drcontext, array->tls_idx);
+    if (data == NULL)
+        return 0;
+    return data->counts[index];
+}
+
+static bool
+insert_per_thread_update(void *drcontext, drx_counter_array_t *array,
+                         instrlist_t *ilist, instr_t *where, uint index, int value)
+{
+    reg_id_t reg_ptr;
+    int disp = (int)(index * sizeof(uint64));
+#ifdef AARCHXX
+    reg_id_t reg_val;
+#endif
+
+    if (drreg_reserve_register(drcontext, ilist, where, NULL, &reg_ptr) !=
+        DRREG_SUCCESS)
+        return false;
+    dr_insert_read_raw_tls(drcontext, ilist, where, array->tls_seg,
+                           array->tls_offs, reg_ptr);
+#ifdef X86
+    /* The shard is private to this thread so no lock prefix is needed. */
+    if (drreg_reserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS) {
+        drreg_unreserve_register(drcontext, ilist, where, reg_ptr);
+        return false;
+    }
+    MINSERT(ilist, where, INSTR_CREATE_add
+            (drcontext, opnd_create_base_disp(reg_ptr, DR_REG_NULL, 0, disp,
+                                              IF_X64_ELSE(OPSZ_8, OPSZ_4)),
+             OPND_CREATE_INT32(value)));
+# ifndef X64
+    MINSERT(ilist, where, INSTR_CREATE_adc
+            (drcontext, opnd_create_base_disp(reg_ptr, DR_REG_NULL, 0, disp + 4,
+                                              OPSZ_4),
+             OPND_CREATE_INT32(value < 0 ? -1 : 0)));
+# endif
+    if (drreg_unreserve_aflags(drcontext, ilist, where) != DRREG_SUCCESS) {
+        drreg_unreserve_register(drcontext, ilist, where, reg_ptr);
+        return false;
+    }
+#elif defined(AARCH64)
+    if (drreg_reserve_register(drcontext, ilist, where, NULL, &reg_val) !=
+        DRREG_SUCCESS) {
+        drreg_unreserve_register(drcontext, ilist, where, reg_ptr);
+        return false;
+    }
+    if (disp > 32760) {
+        /* Beyond the reach of the scaled immediate offset. */
+        instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)disp,
+                                         opnd_create_reg(reg_val),
+                                         ilist, where, NULL, NULL);
+        MINSERT(ilist, where, XINST_CREATE_add
+                (drcontext, opnd_create_reg(reg_ptr), opnd_create_reg(reg_val)));
+        disp = 0;
+    }
+    MINSERT(ilist, where, XINST_CREATE_load
+            (drcontext, opnd_create_reg(reg_val),
+             OPND_CREATE_MEMPTR(reg_ptr, disp)));
+    /* add/sub only encode an unsigned 12-bit immediate */
+    if (value >= 0 && value <= 0xfff) {
+        MINSERT(ilist, where, XINST_CREATE_add
+                (drcontext, opnd_create_reg(reg_val), OPND_CREATE_INT(value)));
+    } else if (value < 0 && value >= -0xfff) {
+        MINSERT(ilist, where, XINST_CREATE_sub
+                (drcontext, opnd_create_reg(reg_val), OPND_CREATE_INT(-value)));
+    } else {
+        reg_id_t reg_imm;
+        if (drreg_reserve_register(drcontext, ilist, where, NULL, &reg_imm) !=
+            DRREG_SUCCESS) {
+            drreg_unreserve_register(drcontext, ilist, where, reg_val);
+            drreg_unreserve_register(drcontext, ilist, where, reg_ptr);
+            return false;
+        }
+        instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)value,
+                                         opnd_create_reg(reg_imm),
+                                         ilist, where, NULL, NULL);
+        MINSERT(ilist, where, XINST_CREATE_add
+                (drcontext, opnd_create_reg(reg_val), opnd_create_reg(reg_imm)));
+        if (drreg_unreserve_register(drcontext, ilist, where, reg_imm) !=
+            DRREG_SUCCESS) {
+            drreg_unreserve_register(drcontext, ilist, where, reg_val);
+            drreg_unreserve_register(drcontext, ilist, where, reg_ptr);
+            return false;
+        }
+    }
+    MINSERT(ilist, where, XINST_CREATE_store
+            (drcontext, OPND_CREATE_MEMPTR(reg_ptr, disp),
+             opnd_create_reg(reg_val)));
+    if (drreg_unreserve_register(drcontext, ilist, where, reg_val) != DRREG_SUCCESS) {
+        drreg_unreserve_register(drcontext, ilist, where, reg_ptr);
+        return false;
+    }
+#else
+    /* FIXME i#1551: implement 64-bit counter support for 32-bit ARM */
+    ASSERT(false, "per-thread counters are not implemented for ARM");
+    reg_val = DR_REG_NULL;
+    drreg_unreserve_register(drcontext, ilist, where, reg_ptr);
+    return false;
+#endif
+    if (drreg_unreserve_register(drcontext, ilist, where, reg_ptr) != DRREG_SUCCESS)
+        return false;
+    return true;
+}
+
+DR_EXPORT
+bool
+drx_counter_array_insert_update(void *drcontext, drx_counter_array_t *array,
+                                instrlist_t *ilist, instr_t *where,
+                                uint index, int value)
+{
+    if (drcontext == NULL || array == NULL || index >= array->num_counters) {
+        ASSERT(false, "invalid parameter");
+        return false;
+    }
+    if (drmgr_current_bb_phase(drcontext) != DRMGR_PHASE_INSERTION) {
+        ASSERT(false, "must be called from drmgr's insertion phase");
+        return false;
+    }
+    if (array->type == DRX_COUNTER_ARRAY_GLOBAL_PADDED) {
+        return drx_insert_counter_update(drcontext, ilist, where, SPILL_SLOT_MAX+1,
+                                         IF_NOT_X86_(SPILL_SLOT_MAX+1)
+                                         global_counter_addr(array, index), value,
+                                         array->flags);
+    }
+    return insert_per_thread_update(drcontext, array, ilist, where, index, value);
+}
@@ -0,0 +1,112 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests drmgr_enable_instrumentation_cache(): blocks in the app are flushed
+ * periodically, and their rebuilds should be served from the cache while
+ * the instrumentation keeps executing.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "client_tools.h"
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "CHECK failed %s:%d: %s\n", __FILE__, __LINE__, msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+#define FLUSH_FREQUENCY 500
+#define INVALIDATE_AT (FLUSH_FREQUENCY * 10)
+
+static app_pc app_start, app_end;
+static uint num_calls;
+
+static void
+at_bb(app_pc tag)
+{
+    /* We only insert this call into app blocks, and the cache must preserve it */
+    CHECK(tag >= app_start && tag < app_end, "clean call in wrong block");
+    num_calls++;
+    if (num_calls % FLUSH_FREQUENCY == 0)
+        dr_delay_flush_region(tag, 1, 0, NULL);
+    if (num_calls == INVALIDATE_AT)
+        drmgr_invalidate_instrumentation_cache(app_start, app_end - app_start);
+}
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb,
+                      instr_t *instr, bool for_trace,
+                      bool translating, void *user_data)
+{
+    if (!drmgr_is_first_instr(drcontext, instr) ||
+        (app_pc)tag < app_start || (app_pc)tag >= app_end)
+        return DR_EMIT_DEFAULT;
+    dr_insert_clean_call(drcontext, bb, instr, (void *)at_bb, false, 1,
+                         OPND_CREATE_INTPTR(tag));
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+event_exit(void)
+{
+    uint64 hits, misses;
+    CHECK(drmgr_get_instrumentation_cache_stats(&hits, &misses),
+          "cache stats unavailable");
+    CHECK(hits > 0, "no rebuilds were served from the cache");
+    CHECK(misses > 0, "nothing was instrumented");
+    CHECK(num_calls > INVALIDATE_AT, "instrumentation stopped executing");
+    CHECK(drmgr_enable_instrumentation_cache(0), "failed to disable cache");
+    drmgr_exit();
+    dr_fprintf(STDERR, "event_exit\n");
+}
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    module_data_t *exe = dr_get_main_module();
+    CHECK(exe != NULL, "failed to find app module");
+    app_start = exe->start;
+    app_end = exe->end;
+    dr_free_module_data(exe);
+
+    if (!drmgr_init())
+        CHECK(false, "drmgr_init failed");
+    CHECK(!drmgr_get_instrumentation_cache_stats(NULL, NULL),
+          "cache should start disabled");
+    if (!drmgr_enable_instrumentation_cache(1024))
+        CHECK(false, "failed to enable cache");
+    if (!drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL))
+        CHECK(false, "drmgr register bb failed");
+    dr_register_exit_event(event_exit);
+}
@@ -0,0 +1,121 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests reserving SIMD registers across app instrs with the drreg
+ * extension.  The tool value is clobbered on every reservation, so a
+ * missed restore shows up as a different result in the app.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include "client_tools.h"
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "CHECK failed %s:%d: %s\n", __FILE__, __LINE__, msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+/* This test assumes that DR has a global lock around bb creation,
+ * allowing us to use a global var here.
+ */
+static reg_id_t reg = DR_REG_NULL;
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb,
+                      instr_t *instr, bool for_trace,
+                      bool translating, void *user_data)
+{
+    drvector_t allowed;
+    reg_id_t gpr;
+    if (reg != DR_REG_NULL) {
+        if (drreg_unreserve_simd_register(drcontext, bb, instr, reg) != DRREG_SUCCESS)
+            CHECK(false, "failed to unreserve");
+        reg = DR_REG_NULL;
+    }
+    if (!instr_is_app(instr) || drmgr_is_last_instr(drcontext, instr))
+        return DR_EMIT_DEFAULT;
+
+    /* Limit the registers so that live ones are picked and the app's
+     * accesses to them must be handled.
+     */
+    drreg_init_and_fill_simd_vector(&allowed, false);
+    drreg_set_simd_vector_entry(&allowed, DR_REG_XMM0, true);
+    drreg_set_simd_vector_entry(&allowed, DR_REG_XMM1, true);
+    if (drreg_reserve_simd_register(drcontext, bb, instr, &allowed, &reg) !=
+        DRREG_SUCCESS)
+        CHECK(false, "failed to reserve");
+    drvector_delete(&allowed);
+
+    /* An xmm entry must not leak into a GPR vector: XMM0 shares its index
+     * with xax, which must remain the only allowed GPR.
+     */
+    drreg_init_and_fill_vector(&allowed, false);
+    drreg_set_vector_entry(&allowed, DR_REG_XAX, true);
+    CHECK(drreg_set_vector_entry(&allowed, DR_REG_XMM0, false) ==
+          DRREG_ERROR_INVALID_PARAMETER, "xmm accepted in GPR vector");
+    if (drreg_reserve_register(drcontext, bb, instr, &allowed, &gpr) != DRREG_SUCCESS)
+        CHECK(false, "failed to reserve GPR");
+    CHECK(gpr == DR_REG_XAX, "GPR vector changed by xmm entry");
+    if (drreg_unreserve_register(drcontext, bb, instr, gpr) != DRREG_SUCCESS)
+        CHECK(false, "failed to unreserve GPR");
+    drvector_delete(&allowed);
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_pxor
+                             (drcontext, opnd_create_reg(reg), opnd_create_reg(reg)));
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+event_exit(void)
+{
+    if (!drmgr_unregister_bb_insertion_event(event_app_instruction) ||
+        drreg_exit() != DRREG_SUCCESS)
+        CHECK(false, "exit failed");
+    drmgr_exit();
+}
+
+DR_EXPORT void
+dr_client_main(client_id_t id, int argc, const char *argv[])
+{
+    /* We need GPR slots for the scratch register used to reach the SIMD slots */
+    drreg_options_t ops = {sizeof(ops), 4 /*max slots needed*/, false};
+    ops.num_simd_spill_slots = 2;
+    if (!drmgr_init())
+        CHECK(false, "drmgr init failed");
+    if (drreg_init(&ops) != DRREG_SUCCESS)
+        CHECK(false, "drreg_init failed");
+    dr_register_exit_event(event_exit);
+    if (!drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL))
+        CHECK(false, "bb reg failed");
+}
@@ -0,0 +1,71 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Runs hot loops with conditional exits so that traces are built whose
+ * constituent blocks all reserve the same scratch register, for
+ * drreg-trace.dll.c.
+ */
+
+#include "tools.h"
+
+#define NUM_ITER 100000
+
+static volatile int sink;
+
+static int
+classify(int i)
+{
+    if (i % 7 == 0)
+        return i / 7;
+    else if (i % 5 == 0)
+        return i - 5;
+    else
+        return i ^ 0x55;
+}
+
+int
+main(void)
+{
+    int i, j;
+    unsigned int sum = 0;
+    print("Starting drreg trace test\n");
+    for (i = 0; i < NUM_ITER; i++) {
+        sum += classify(i);
+        if (sum & 0x10)
+            sink = i;
+        for (j = 0; j < (i & 3); j++)
+            sum = (sum << 1) | (sum >> 31);
+    }
+    print("sum = %u\n", sum);
+    print("Ending drreg trace test\n");
+    return 0;
+}
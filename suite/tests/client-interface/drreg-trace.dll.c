@@ -0,0 +1,100 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests drreg_options_t.span_trace_blocks: every block clobbers the same
+ * scratch register, so in traces the app value is only restored at the
+ * end of the trace or on an exit.  A wrong elision shows up as a different
+ * result in the app.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include "client_tools.h"
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "CHECK failed %s:%d: %s\n", __FILE__, __LINE__, msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+static bool saw_trace;
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb,
+                      instr_t *instr, bool for_trace,
+                      bool translating, void *user_data)
+{
+    drvector_t allowed;
+    reg_id_t reg;
+    if (!drmgr_is_first_instr(drcontext, instr))
+        return DR_EMIT_DEFAULT;
+    if (for_trace)
+        saw_trace = true;
+    /* Allow only one register so each block reserves the same one. */
+    drreg_init_and_fill_vector(&allowed, false);
+    drreg_set_vector_entry(&allowed, IF_X86_ELSE(DR_REG_XSI, DR_REG_R4), true);
+    if (drreg_reserve_register(drcontext, bb, instr, &allowed, &reg) != DRREG_SUCCESS)
+        CHECK(false, "failed to reserve");
+    drvector_delete(&allowed);
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t)tag, opnd_create_reg(reg),
+                                     bb, instr, NULL, NULL);
+    if (drreg_unreserve_register(drcontext, bb, instr, reg) != DRREG_SUCCESS)
+        CHECK(false, "failed to unreserve");
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+event_exit(void)
+{
+    CHECK(saw_trace, "no traces were built");
+    if (!drmgr_unregister_bb_insertion_event(event_app_instruction) ||
+        drreg_exit() != DRREG_SUCCESS)
+        CHECK(false, "exit failed");
+    drmgr_exit();
+    dr_fprintf(STDERR, "event_exit\n");
+}
+
+DR_EXPORT void
+dr_client_main(client_id_t id, int argc, const char *argv[])
+{
+    drreg_options_t ops = {sizeof(ops), 1 /*max slots needed*/, false};
+    ops.span_trace_blocks = true;
+    if (!drmgr_init())
+        CHECK(false, "drmgr init failed");
+    if (drreg_init(&ops) != DRREG_SUCCESS)
+        CHECK(false, "drreg_init failed");
+    dr_register_exit_event(event_exit);
+    if (!drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL))
+        CHECK(false, "bb reg failed");
+}
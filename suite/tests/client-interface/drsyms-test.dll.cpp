@@ -69,11 +69,24 @@ static dr_os_version_info_t os_version = {sizeof(os_version),};
 
 static bool found_tools_h, found_appdll;
 
+#ifdef UNIX
+/* A non-empty client option names a drsyms index cache dir to test */
+static char index_dir[MAXIMUM_PATH];
+#endif
+
 extern "C" DR_EXPORT void
 dr_init(client_id_t id)
 {
     drsym_error_t r = drsym_init(0);
     ASSERT(r == DRSYM_SUCCESS);
+#ifdef UNIX
+    dr_snprintf(index_dir, BUFFER_SIZE_ELEMENTS(index_dir), "%s", dr_get_options(id));
+    NULL_TERMINATE_BUFFER(index_dir);
+    if (index_dir[0] != '\0') {
+        r = drsym_set_index_cache_dir(index_dir);
+        ASSERT(r == DRSYM_SUCCESS);
+    }
+#endif
     drwrap_init();
     dr_register_exit_event(event_exit);
 
@@ -556,6 +569,147 @@ test_line_iteration(const module_data_t *dll_data)
         dr_fprintf(STDERR, "found tools.h\n");
 }
 
+/* Ensure a batch lookup matches individual lookups regardless of entry order. */
+static void
+test_batch_lookup(const char *dll_path, size_t offs1, size_t offs2)
+{
+    const int num_entries = 4;
+    drsym_batch_entry_t entries[num_entries];
+    drsym_info_t infos[num_entries];
+    char names[num_entries][256];
+    drsym_info_t info;
+    char name[256];
+    drsym_error_t r;
+    int i;
+
+    for (i = 0; i < num_entries; i++) {
+        memset(&infos[i], 0, sizeof(infos[i]));
+        infos[i].struct_size = sizeof(infos[i]);
+        infos[i].name = names[i];
+        infos[i].name_size = BUFFER_SIZE_ELEMENTS(names[i]);
+        entries[i].modpath = dll_path;
+        entries[i].info = &infos[i];
+    }
+    entries[0].modoffs = offs2;
+    entries[1].modoffs = offs1;
+    entries[2].modoffs = offs2;
+    /* An invalid entry should not affect the others. */
+    entries[3].modpath = NULL;
+    r = drsym_lookup_address_batch(entries, num_entries, DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == DRSYM_SUCCESS);
+    ASSERT(entries[3].result == DRSYM_ERROR_INVALID_PARAMETER);
+    for (i = 0; i < num_entries - 1; i++) {
+        memset(&info, 0, sizeof(info));
+        info.struct_size = sizeof(info);
+        info.name = name;
+        info.name_size = BUFFER_SIZE_ELEMENTS(name);
+        r = drsym_lookup_address(dll_path, entries[i].modoffs, &info,
+                                 DRSYM_DEFAULT_FLAGS);
+        ASSERT(r == entries[i].result);
+        ASSERT(strcmp(name, names[i]) == 0);
+        ASSERT(info.start_offs == infos[i].start_offs);
+    }
+
+    r = drsym_lookup_address_batch(NULL, 1, DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == DRSYM_ERROR_INVALID_PARAMETER);
+}
+
+#ifdef UNIX
+#define NUM_INDEX_ADDRS 4
+
+/* Query results that must not change when served from the on-disk index */
+typedef struct _index_answers_t {
+    drsym_error_t result[NUM_INDEX_ADDRS];
+    char name[NUM_INDEX_ADDRS][256];
+    char file[NUM_INDEX_ADDRS][MAXIMUM_PATH];
+    uint64 line[NUM_INDEX_ADDRS];
+    size_t line_offs[NUM_INDEX_ADDRS];
+    size_t start_offs[NUM_INDEX_ADDRS];
+    size_t symbol_offs;
+    uint num_lines;
+    /* The order of enumeration is not specified, so we sum the lines */
+    uint64 lines_sum;
+} index_answers_t;
+
+static bool
+sum_line_cb(drsym_line_info_t *info, void *data)
+{
+    index_answers_t *answers = (index_answers_t *) data;
+    answers->num_lines++;
+    answers->lines_sum += info->line_addr * 31 + info->line;
+    return true;
+}
+
+static void
+get_index_answers(const char *dll_path, const char *symbol, size_t offs[NUM_INDEX_ADDRS],
+                  index_answers_t *answers)
+{
+    drsym_error_t r;
+    int i;
+    memset(answers, 0, sizeof(*answers));
+    for (i = 0; i < NUM_INDEX_ADDRS; i++) {
+        drsym_info_t info;
+        memset(&info, 0, sizeof(info));
+        info.struct_size = sizeof(info);
+        info.name = answers->name[i];
+        info.name_size = BUFFER_SIZE_ELEMENTS(answers->name[i]);
+        info.file = answers->file[i];
+        info.file_size = BUFFER_SIZE_ELEMENTS(answers->file[i]);
+        answers->result[i] = drsym_lookup_address(dll_path, offs[i], &info,
+                                                  DRSYM_DEFAULT_FLAGS);
+        answers->line[i] = info.line;
+        answers->line_offs[i] = info.line_offs;
+        answers->start_offs[i] = info.start_offs;
+    }
+    r = drsym_lookup_symbol(dll_path, symbol, &answers->symbol_offs,
+                            DRSYM_DEFAULT_FLAGS);
+    ASSERT(r == DRSYM_SUCCESS);
+    r = drsym_enumerate_lines(dll_path, sum_line_cb, answers);
+    ASSERT(r == DRSYM_SUCCESS);
+    r = drsym_free_resources(dll_path);
+    ASSERT(r == DRSYM_SUCCESS);
+}
+
+static void
+check_index_answers(index_answers_t *expect, index_answers_t *got)
+{
+    int i;
+    for (i = 0; i < NUM_INDEX_ADDRS; i++) {
+        ASSERT(got->result[i] == expect->result[i]);
+        ASSERT(strcmp(got->name[i], expect->name[i]) == 0);
+        ASSERT(strcmp(got->file[i], expect->file[i]) == 0);
+        ASSERT(got->line[i] == expect->line[i]);
+        ASSERT(got->line_offs[i] == expect->line_offs[i]);
+        ASSERT(got->start_offs[i] == expect->start_offs[i]);
+    }
+    ASSERT(got->symbol_offs == expect->symbol_offs);
+    ASSERT(got->num_lines == expect->num_lines);
+    ASSERT(got->lines_sum == expect->lines_sum);
+}
+
+/* The queries made so far with index_dir set wrote an index for the module, if
+ * absent: we check that a reload of it gives the same answers as the debug info.
+ */
+static void
+test_index(const char *dll_path, const char *symbol, size_t offs1, size_t offs2)
+{
+    size_t offs[NUM_INDEX_ADDRS] = {offs1, offs1 + 1, offs2, offs2 + 1};
+    index_answers_t expect, got;
+    drsym_error_t r;
+
+    drsym_free_resources(dll_path);
+    r = drsym_set_index_cache_dir(NULL);
+    ASSERT(r == DRSYM_SUCCESS);
+    get_index_answers(dll_path, symbol, offs, &expect);
+    ASSERT(expect.num_lines > 0);
+
+    r = drsym_set_index_cache_dir(index_dir);
+    ASSERT(r == DRSYM_SUCCESS);
+    get_index_answers(dll_path, symbol, offs, &got);
+    check_index_answers(&expect, &got);
+}
+#endif
+
 /* Lookup symbols in the appdll and wrap them. */
 static void
 lookup_dll_syms(void *dc, const module_data_t *dll_data, bool loaded)
@@ -624,10 +778,17 @@ lookup_dll_syms(void *dc, const module_data_t *dll_data, bool loaded)
     ok = drwrap_wrap(dll_base + stack_trace_offs, pre_stack_trace, post_func);
     ASSERT(ok);
 
+    test_batch_lookup(dll_path, dll_export_offs, stack_trace_offs);
+
     check_enumerate_dll_syms(dll_path);
 
     test_line_iteration(dll_data);
 
+#ifdef UNIX
+    if (index_dir[0] != '\0')
+        test_index(dll_path, base_name, dll_export_offs, stack_trace_offs);
+#endif
+
     drsym_free_resources(dll_path);
 }
 
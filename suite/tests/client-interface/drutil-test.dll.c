@@ -47,6 +47,7 @@
 static bool verbose;
 
 static int repstr_seen;
+static int cse_checked_same, cse_checked_delta;
 
 #define MAGIC_NOTE 0x9a9b9c9d
 dr_instr_label_data_t magic_vals = {
@@ -91,6 +92,8 @@ event_exit(void)
     if (verbose) {
         /* I see 62 for win x64, and 16 for linux x86 */
         dr_fprintf(STDERR, "saw %d rep str instrs\n", repstr_seen);
+        dr_fprintf(STDERR, "checked %d same-address and %d delta CSE refs\n",
+                   cse_checked_same, cse_checked_delta);
     }
 }
 
@@ -126,10 +129,59 @@ event_bb_app2app(void *drcontext, void *tag, instrlist_t *bb,
     return DR_EMIT_DEFAULT;
 }
 
+#define MAX_MEMREFS 256
+
+/* Analysis results handed to the insertion stage of the same block via the
+ * drmgr user_data, as bbs can be built concurrently.
+ */
+typedef struct _cse_data_t {
+    drutil_memref_cse_t refs[MAX_MEMREFS];
+    uint num;
+} cse_data_t;
+
+static void
+check_memref_cse(void *drcontext, instrlist_t *bb, cse_data_t *cse)
+{
+    drutil_memref_cse_t *refs = cse->refs;
+    uint num, i;
+    instr_t *inst;
+    cse->num = 0;
+    if (!drutil_memref_cse_analyze(drcontext, bb, refs, MAX_MEMREFS, &num))
+        return; /* too many refs */
+    cse->num = num;
+    for (inst = instrlist_first_app(bb); inst != NULL; inst = instr_get_next_app(inst)) {
+        /* lea and multi-byte nops must not be counted as references */
+        if (!instr_reads_memory(inst) && !instr_writes_memory(inst)) {
+            for (i = 0; i < num; i++)
+                CHECK(refs[i].instr != inst, "non-memory instr recorded");
+        }
+    }
+    for (i = 0; i < num; i++) {
+        opnd_t leader, ref;
+        CHECK(opnd_is_memory_reference(refs[i].memref), "not a memref");
+        if (refs[i].leader == -1)
+            continue;
+        CHECK(refs[i].leader >= 0 && (uint)refs[i].leader < i, "bad leader index");
+        CHECK(refs[refs[i].leader].leader == -1, "leader is not a leader");
+        leader = refs[refs[i].leader].memref;
+        ref = refs[i].memref;
+        CHECK(opnd_get_base(leader) == opnd_get_base(ref) &&
+              opnd_get_index(leader) == opnd_get_index(ref) &&
+              opnd_get_scale(leader) == opnd_get_scale(ref),
+              "leader uses different registers");
+        CHECK(opnd_get_disp(leader) + refs[i].delta == opnd_get_disp(ref),
+              "wrong delta");
+    }
+}
+
 static dr_emit_flags_t
 event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
                   bool for_trace, bool translating, OUT void **user_data)
 {
+    cse_data_t *cse = dr_thread_alloc(drcontext, sizeof(*cse));
+    check_memref_cse(drcontext, bb, cse);
+    *user_data = (void *) cse;
+
     /* test label data (i#675) */
     instr_t *first = instrlist_first(bb);
     if (first != NULL) {
@@ -143,6 +195,58 @@ event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
     return DR_EMIT_DEFAULT;
 }
 
+static void
+check_cse_addr(app_pc computed, app_pc actual, int delta)
+{
+    CHECK(computed == actual, "CSE address differs from full computation");
+    if (delta == 0)
+        dr_atomic_add32_return_sum(&cse_checked_same, 1);
+    else
+        dr_atomic_add32_return_sum(&cse_checked_delta, 1);
+}
+
+/* For each reference at instr with a leader, computes the address both from
+ * scratch and from the leader's address via drutil_insert_get_mem_addr_cse()
+ * and compares them at runtime.  The analysis guarantees the leader's
+ * registers are unchanged up to instr, so the leader's address can be
+ * computed here rather than held in a register from its own instruction.
+ */
+static void
+insert_cse_checks(void *drcontext, instrlist_t *bb, instr_t *instr,
+                  cse_data_t *cse, reg_id_t reg1, reg_id_t reg2, reg_id_t reg3)
+{
+    drutil_memref_cse_t *cse_refs = cse->refs;
+    uint i;
+    for (i = 0; i < cse->num; i++) {
+        bool ok;
+        if (cse_refs[i].instr != instr || cse_refs[i].leader == -1)
+            continue;
+        dr_save_reg(drcontext, bb, instr, reg1, SPILL_SLOT_1);
+        dr_save_reg(drcontext, bb, instr, reg2, SPILL_SLOT_2);
+        dr_save_reg(drcontext, bb, instr, reg3, SPILL_SLOT_3);
+        ok = drutil_insert_get_mem_addr(drcontext, bb, instr, cse_refs[i].memref,
+                                        reg1, reg2);
+        CHECK(ok, "drutil_insert_get_mem_addr failed");
+        dr_save_reg(drcontext, bb, instr, reg1, SPILL_SLOT_4);
+        dr_restore_reg(drcontext, bb, instr, reg2, SPILL_SLOT_2);
+        dr_restore_reg(drcontext, bb, instr, reg1, SPILL_SLOT_1);
+        ok = drutil_insert_get_mem_addr(drcontext, bb, instr,
+                                        cse_refs[cse_refs[i].leader].memref,
+                                        reg1, reg2);
+        CHECK(ok, "drutil_insert_get_mem_addr failed");
+        ok = drutil_insert_get_mem_addr_cse(drcontext, bb, instr, cse_refs, i,
+                                            reg1, reg2, reg3);
+        CHECK(ok, "drutil_insert_get_mem_addr_cse failed");
+        dr_restore_reg(drcontext, bb, instr, reg1, SPILL_SLOT_4);
+        dr_insert_clean_call(drcontext, bb, instr, (void *)check_cse_addr, false, 3,
+                             opnd_create_reg(reg2), opnd_create_reg(reg1),
+                             OPND_CREATE_INT32(cse_refs[i].delta));
+        dr_restore_reg(drcontext, bb, instr, reg3, SPILL_SLOT_3);
+        dr_restore_reg(drcontext, bb, instr, reg2, SPILL_SLOT_2);
+        dr_restore_reg(drcontext, bb, instr, reg1, SPILL_SLOT_1);
+    }
+}
+
 static void
 check_label_data(instrlist_t *bb)
 {
@@ -165,7 +269,11 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
     int i;
     reg_id_t reg1 = IF_X86_ELSE(REG_XAX, DR_REG_R0);
     reg_id_t reg2 = IF_X86_ELSE(REG_XDX, DR_REG_R1);
+    reg_id_t reg3 = IF_X86_ELSE(REG_XCX, DR_REG_R2);
     CHECK(!instr_is_stringop_loop(instr), "rep str conversion missed one");
+    if (instr_is_app(instr))
+        insert_cse_checks(drcontext, bb, instr, (cse_data_t *) user_data,
+                          reg1, reg2, reg3);
     if (instr_writes_memory(instr)) {
         for (i = 0; i < instr_num_dsts(instr); i++) {
             if (opnd_is_memory_reference(instr_get_dst(instr, i))) {
@@ -183,6 +291,8 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr,
         }
     }
     check_label_data(bb);
+    if (drmgr_is_last_instr(drcontext, instr))
+        dr_thread_free(drcontext, user_data, sizeof(cse_data_t));
     return DR_EMIT_DEFAULT;
 }
 
@@ -0,0 +1,106 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Runs the same code on several threads so that the sharded counters in
+ * drx_counter-test.dll.c see concurrent updates.
+ */
+
+#include "tools.h"
+
+#define NUM_THREADS 4
+#define NUM_ITER 10000
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        fprintf(stderr, "CHECK failed %s:%d: %s\n", __FILE__, __LINE__, msg); \
+        abort();                         \
+    }                                    \
+} while (0);
+
+static volatile int sum;
+
+static int
+do_work(int i)
+{
+    if (i % 3 == 0)
+        return i / 3;
+    else
+        return i * 2;
+}
+
+#ifdef UNIX
+# include <pthread.h>
+static void *
+thread_func(void *unused)
+#else
+# include <windows.h>
+static DWORD WINAPI
+thread_func(LPVOID unused)
+#endif
+{
+    int i;
+    for (i = 0; i < NUM_ITER; i++)
+        sum += do_work(i);
+    return 0;
+}
+
+int
+main(void)
+{
+    int i;
+#ifdef UNIX
+    pthread_t thread[NUM_THREADS];
+#else
+    HANDLE thread[NUM_THREADS];
+    DWORD tid;
+#endif
+    print("Starting drx_counter threaded test\n");
+    for (i = 0; i < NUM_THREADS; i++) {
+#ifdef UNIX
+        CHECK(!pthread_create(&thread[i], NULL, thread_func, NULL), "create failed");
+#else
+        thread[i] = CreateThread(NULL, 0, thread_func, NULL, 0, &tid);
+        CHECK(thread[i] != NULL, "CreateThread failed");
+#endif
+    }
+    (void)thread_func(NULL);
+    for (i = 0; i < NUM_THREADS; i++) {
+#ifdef UNIX
+        CHECK(!pthread_join(thread[i], NULL), "join failed");
+#else
+        WaitForSingleObject(thread[i], INFINITE);
+        CloseHandle(thread[i]);
+#endif
+    }
+    print("Ending drx_counter threaded test\n");
+    return 0;
+}
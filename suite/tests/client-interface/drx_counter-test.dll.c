@@ -0,0 +1,158 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests the drx sharded counter API by comparing a per-thread array and a
+ * padded global array against a plain locked counter.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drreg.h"
+#include "drx.h"
+
+#define CHECK(x, msg) do {               \
+    if (!(x)) {                          \
+        dr_fprintf(STDERR, "CHECK failed %s:%d: %s\n", __FILE__, __LINE__, msg); \
+        dr_abort();                      \
+    }                                    \
+} while (0);
+
+enum {
+    COUNTER_BBS,
+    COUNTER_INSTRS,
+    COUNTER_NUM,
+};
+
+static drx_counter_array_t *per_thread;
+static drx_counter_array_t *padded;
+static uint locked_bbs;
+static uint locked_instrs;
+
+static void
+event_thread_exit(void *drcontext)
+{
+    /* The thread's copy is still live at our default priority. */
+    CHECK(drx_counter_array_get_thread_value(drcontext, per_thread, COUNTER_BBS) <=
+          drx_counter_array_get_value(per_thread, COUNTER_BBS),
+          "thread value exceeds process value");
+}
+
+static void
+event_exit(void)
+{
+    CHECK(drx_counter_array_get_value(per_thread, COUNTER_BBS) == locked_bbs,
+          "per-thread bb count mismatch");
+    CHECK(drx_counter_array_get_value(per_thread, COUNTER_INSTRS) == locked_instrs,
+          "per-thread instr count mismatch");
+    CHECK(drx_counter_array_get_value(padded, COUNTER_BBS) == locked_bbs,
+          "padded bb count mismatch");
+    CHECK(drx_counter_array_get_value(padded, COUNTER_INSTRS) == locked_instrs,
+          "padded instr count mismatch");
+    CHECK(drx_counter_array_free(per_thread), "free failed");
+    CHECK(drx_counter_array_free(padded), "free failed");
+    CHECK(!drx_counter_array_free(padded), "double free should fail");
+    drmgr_unregister_thread_exit_event(event_thread_exit);
+    drx_exit();
+    drreg_exit();
+    drmgr_exit();
+    dr_fprintf(STDERR, "event_exit\n");
+}
+
+static dr_emit_flags_t
+event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
+                  bool for_trace, bool translating, void **user_data)
+{
+    instr_t *instr;
+    uint num_instrs = 0;
+    for (instr = instrlist_first_app(bb); instr != NULL;
+         instr = instr_get_next_app(instr))
+        num_instrs++;
+    *user_data = (void *)(ptr_uint_t)num_instrs;
+    return DR_EMIT_DEFAULT;
+}
+
+static dr_emit_flags_t
+event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
+                      bool for_trace, bool translating, void *user_data)
+{
+    uint num_instrs = (uint)(ptr_uint_t)user_data;
+    bool ok;
+    if (!drmgr_is_first_instr(drcontext, inst))
+        return DR_EMIT_DEFAULT;
+    ok = drx_counter_array_insert_update(drcontext, per_thread, bb, inst,
+                                         COUNTER_BBS, 1);
+    CHECK(ok, "per-thread update failed");
+    ok = drx_counter_array_insert_update(drcontext, per_thread, bb, inst,
+                                         COUNTER_INSTRS, num_instrs);
+    CHECK(ok, "per-thread update failed");
+    ok = drx_counter_array_insert_update(drcontext, padded, bb, inst,
+                                         COUNTER_BBS, 1);
+    CHECK(ok, "padded update failed");
+    ok = drx_counter_array_insert_update(drcontext, padded, bb, inst,
+                                         COUNTER_INSTRS, num_instrs);
+    CHECK(ok, "padded update failed");
+    ok = drx_insert_counter_update(drcontext, bb, inst, SPILL_SLOT_MAX+1,
+                                   IF_NOT_X86_(SPILL_SLOT_MAX+1) &locked_bbs, 1,
+                                   DRX_COUNTER_LOCK);
+    CHECK(ok, "locked update failed");
+    ok = drx_insert_counter_update(drcontext, bb, inst, SPILL_SLOT_MAX+1,
+                                   IF_NOT_X86_(SPILL_SLOT_MAX+1) &locked_instrs,
+                                   num_instrs, DRX_COUNTER_LOCK);
+    CHECK(ok, "locked update failed");
+    return DR_EMIT_DEFAULT;
+}
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    drreg_options_t ops = {sizeof(ops), 2 /*max slots needed*/, false};
+    drreg_status_t res;
+    bool ok = drmgr_init();
+    CHECK(ok, "drmgr_init failed");
+    ok = drx_init();
+    CHECK(ok, "drx_init failed");
+    res = drreg_init(&ops);
+    CHECK(res == DRREG_SUCCESS, "drreg_init failed");
+
+    per_thread = drx_counter_array_create(DRX_COUNTER_ARRAY_PER_THREAD,
+                                          COUNTER_NUM, 0);
+    CHECK(per_thread != NULL, "per-thread create failed");
+    padded = drx_counter_array_create(DRX_COUNTER_ARRAY_GLOBAL_PADDED,
+                                      COUNTER_NUM, DRX_COUNTER_LOCK);
+    CHECK(padded != NULL, "padded create failed");
+
+    dr_register_exit_event(event_exit);
+    ok = drmgr_register_thread_exit_event(event_thread_exit) &&
+        drmgr_register_bb_instrumentation_event(event_bb_analysis,
+                                                event_app_instruction, NULL);
+    CHECK(ok, "drmgr register failed");
+}
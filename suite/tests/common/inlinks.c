@@ -0,0 +1,110 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Many direct calls to one generated routine, with the callers and then the
+ * routine itself rewritten, so that the routine's incoming link list is long
+ * enough for -incoming_index_threshold to index and is then cut down by
+ * unlinking and flushing.  Run with -max_elide_call 0 so that each call ends
+ * its block in a link.
+ */
+
+#include "tools.h"
+
+#define NUM_CALLERS 64
+#define MOV_IMM32_LEN 5
+#define CALL_REL32_LEN 5
+
+typedef int (*callers_func_t)(void);
+
+static byte *target;
+static byte *callers;
+
+/* add eax, addend; ret */
+static void
+write_target(char addend)
+{
+    protect_mem(target, PAGE_SIZE, ALLOW_READ|ALLOW_WRITE);
+    target[0] = 0x83;
+    target[1] = 0xc0;
+    target[2] = (byte) addend;
+    target[3] = 0xc3;
+    protect_mem(target, PAGE_SIZE, ALLOW_READ|ALLOW_EXEC);
+}
+
+/* mov eax, start; NUM_CALLERS x call target; ret */
+static void
+write_callers(int start)
+{
+    byte *pc = callers;
+    int i;
+    protect_mem(callers, PAGE_SIZE, ALLOW_READ|ALLOW_WRITE);
+    *pc = 0xb8;
+    *(int *)(pc + 1) = start;
+    pc += MOV_IMM32_LEN;
+    for (i = 0; i < NUM_CALLERS; i++) {
+        *pc = 0xe8;
+        *(int *)(pc + 1) = (int)(target - (pc + CALL_REL32_LEN));
+        pc += CALL_REL32_LEN;
+    }
+    *pc = 0xc3;
+    protect_mem(callers, PAGE_SIZE, ALLOW_READ|ALLOW_EXEC);
+}
+
+static void
+run(const char *what)
+{
+    int i, res = 0;
+    /* a few runs build the links without making a trace */
+    for (i = 0; i < 3; i++)
+        res = ((callers_func_t)callers)();
+    print("%s: %d\n", what, res);
+}
+
+int
+main(void)
+{
+    byte *buf = (byte *) allocate_mem(2*PAGE_SIZE, ALLOW_READ|ALLOW_WRITE);
+    target = buf;
+    callers = buf + PAGE_SIZE;
+    write_target(1);
+    write_callers(0);
+    run("initial");
+    /* flushes every source of the target's links while it stays */
+    write_callers(100);
+    run("new callers");
+    /* flushes the target under its relinked sources */
+    write_target(2);
+    run("new target");
+    write_callers(0);
+    run("both new");
+    return 0;
+}
@@ -0,0 +1,132 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+/* A fault right after the trace's inlined return check, whose restores of
+ * xcx (and of xax on x64) -opt_trace_level 1 removes because the app writes
+ * both registers before reading them.  The fault must still see the app's
+ * values, which translation recovers from the spill slots.
+ */
+
+#ifndef ASM_CODE_ONLY /* C code */
+# include "tools.h"
+# include <setjmp.h>
+
+# define XCX_VAL 0xf1f1
+# define XAX_VAL 0xf2f2
+
+/* asm routine: loops until it loads through NULL after count iterations */
+void fault_after_return(ptr_int_t *ptr, ptr_int_t count);
+
+static SIGJMP_BUF mark;
+
+static void
+check_regs(ptr_int_t xcx, ptr_int_t xax)
+{
+    if (xcx != XCX_VAL)
+        print("ERROR: xcx at fault is "PFX"\n", xcx);
+    if (xax != XAX_VAL)
+        print("ERROR: xax at fault is "PFX"\n", xax);
+    print("fault after return\n");
+}
+
+# if defined(UNIX)
+#  include <signal.h>
+static void
+handle_signal(int signal, siginfo_t *siginfo, ucontext_t *ucxt)
+{
+    sigcontext_t *sc = SIGCXT_FROM_UCXT(ucxt);
+    check_regs(sc->SC_XCX, sc->SC_XAX);
+    SIGLONGJMP(mark, 1);
+}
+# elif defined(WINDOWS)
+#  include <windows.h>
+static LONG WINAPI
+handle_exception(struct _EXCEPTION_POINTERS *ep)
+{
+    check_regs(ep->ContextRecord->CXT_XCX, ep->ContextRecord->CXT_XAX);
+    SIGLONGJMP(mark, 1);
+}
+# endif
+
+int
+main(void)
+{
+    ptr_int_t val = 0;
+# if defined(UNIX)
+    intercept_signal(SIGSEGV, (handler_3_t)&handle_signal, false);
+# elif defined(WINDOWS)
+    SetUnhandledExceptionFilter(&handle_exception);
+# endif
+    /* enough iterations to build and run the trace */
+    if (SIGSETJMP(mark) == 0)
+        fault_after_return(&val, 1000);
+    print("all done\n");
+    return 0;
+}
+
+#else /* asm code *************************************************************/
+# include "asm_defines.asm"
+START_FILE
+
+# define FUNCNAME fault_after_return
+        DECLARE_FUNC_SEH(FUNCNAME)
+GLOBAL_LABEL(FUNCNAME:)
+        mov      REG_XAX, ARG2
+        mov      REG_XDX, ARG1
+        PUSH_SEH(REG_XBX)
+        END_PROLOG
+        mov      REG_XBX, REG_XAX
+     loop_top:
+        mov      REG_XCX, HEX(f1f1)
+        call     set_xax
+        /* The trace restores xcx and xax here, after checking the return
+         * target.  The load faults once xdx is NULL, and both registers are
+         * written before being read.  The sub writes all the flags, so the
+         * trace does not restore them here.
+         */
+        mov      REG_XAX, PTRSZ [REG_XDX]
+        mov      REG_XCX, REG_XAX
+        sub      REG_XBX, 1
+        cmovz    REG_XDX, REG_XBX
+        jmp      loop_top
+        /* not reached: the fault handler longjmps out */
+        pop      REG_XBX
+        ret
+     set_xax:
+        mov      REG_XAX, HEX(f2f2)
+        ret
+        END_FUNC(FUNCNAME)
+# undef FUNCNAME
+
+END_FILE
+#endif
@@ -0,0 +1,95 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests loading a persisted cache at a different base (case 9581): the
+ * library's pcache is written when it is unloaded, and we then block part of
+ * its old range so the second load, which uses that pcache, lands elsewhere.
+ */
+
+#include "tools.h"
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+#define NUM_ITERS 1000
+
+typedef int (*work_func_t)(int);
+
+static work_func_t
+load_library(const char *path, void **lib)
+{
+    work_func_t work;
+    *lib = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+    if (*lib == NULL) {
+        print("error loading library %s: %s\n", path, dlerror());
+        return NULL;
+    }
+    work = (work_func_t) dlsym(*lib, "persist_rebase_work");
+    if (work == NULL)
+        print("error finding persist_rebase_work\n");
+    return work;
+}
+
+int
+main(int argc, char **argv)
+{
+    void *lib;
+    work_func_t work, new_work;
+    void *old_page, *block;
+
+    /* We don't have "." on LD_LIBRARY_PATH path so we take in abs path */
+    if (argc < 2) {
+        print("need to pass in lib path\n");
+        return 1;
+    }
+    work = load_library(argv[1], &lib);
+    if (work == NULL)
+        return 1;
+    print("first load: %d\n", work(NUM_ITERS));
+    /* DR persists the library's code here */
+    dlclose(lib);
+
+    /* Occupying a page of the old range keeps the loader from reusing it */
+    old_page = (void *)((ptr_uint_t)work & ~((ptr_uint_t)PAGE_SIZE - 1));
+    block = mmap(old_page, PAGE_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (block != old_page)
+        print("unable to reserve the old range\n");
+
+    new_work = load_library(argv[1], &lib);
+    if (new_work == NULL)
+        return 1;
+    if (new_work == work)
+        print("library was not rebased\n");
+    print("second load: %d\n", new_work(NUM_ITERS));
+    dlclose(lib);
+    munmap(block, PAGE_SIZE);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* **********************************************************
+ * Copyright (c) 2016 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Indirect calls and returns from several threads, with dominant targets that
+ * shift halfway through, while the main thread keeps signalling them.  Run
+ * with -ib_inline_targets (and -ret_shadow_stack) plus options that suspend
+ * and translate threads in the cache or flush the rebuilt sites.
+ */
+
+#include "tools.h"
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#define NUM_THREADS 4
+#define NUM_ITERS 400000
+#define NUM_SIGNALS 50
+
+static volatile int signals_received;
+static volatile int threads_done;
+
+static NOINLINE uint f0(uint x) { return x + 1; }
+static NOINLINE uint f1(uint x) { return x ^ 0x35; }
+static NOINLINE uint f2(uint x) { return x * 3; }
+static NOINLINE uint f3(uint x) { return x - 7; }
+static NOINLINE uint f4(uint x) { return (x >> 1) | 1; }
+
+static uint (* volatile table[])(uint) = { f0, f1, f2, f3, f4 };
+
+static void
+signal_handler(int sig, siginfo_t *siginfo, ucontext_t *ucxt)
+{
+    if (sig == SIGUSR1)
+        signals_received++;
+}
+
+static void *
+process(void *arg)
+{
+    uint *result = (uint *) arg;
+    uint sum = 0;
+    int i;
+    for (i = 0; i < NUM_ITERS; i++) {
+        /* two targets dominate the first half and three others the second */
+        if (i < NUM_ITERS / 2)
+            sum += table[i & 1](i);
+        else
+            sum += table[2 + i % 3](i);
+    }
+    *result = sum;
+    __sync_fetch_and_add(&threads_done, 1);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    pthread_t thread[NUM_THREADS];
+    uint result[NUM_THREADS];
+    struct timespec sleeptime;
+    int i, j;
+
+    intercept_signal(SIGUSR1, signal_handler, false);
+    for (i = 0; i < NUM_THREADS; i++) {
+        if (pthread_create(&thread[i], NULL, process, &result[i]) != 0) {
+            print("failed to create thread\n");
+            return 1;
+        }
+    }
+    sleeptime.tv_sec = 0;
+    sleeptime.tv_nsec = 1000*1000; /* 1ms */
+    for (j = 0; j < NUM_SIGNALS && threads_done < NUM_THREADS; j++) {
+        for (i = 0; i < NUM_THREADS; i++)
+            pthread_kill(thread[i], SIGUSR1);
+        nanosleep(&sleeptime, NULL);
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        if (pthread_join(thread[i], NULL) != 0) {
+            print("failed to join thread\n");
+            return 1;
+        }
+    }
+    for (i = 0; i < NUM_THREADS; i++)
+        print("thread %d: 0x%08x\n", i, result[i]);
+    return 0;
+}